@@ -7,6 +7,7 @@
 </node>
 <node CREATED="1251906380840" ID="ID_655458925" MODIFIED="1251906394670" TEXT="enabling disabled controls? is it possible? if yes implement it"/>
 <node CREATED="1252395164923" ID="ID_357039860" MODIFIED="1252395442071" TEXT="!Signalling-/Callback-Mechanismus statt polling f&#xfc;r das Abgreifen von Bildern!">
+<icon BUILTIN="button_ok"/>
 <node CREATED="1252395197555" ID="ID_1326979582" MODIFIED="1252395217286" TEXT="bedenke, dass der thread sich evtl. &#xe4;ndert f&#xfc;r die auszuf&#xfc;hrende funktion"/>
 </node>
 </node>
@@ -0,0 +1,187 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* a producer publishes 1080p frames from the synthetic source into a ring, a history keeps them in a
+   budget of 128 MiB - as they are, or as differences. After some seconds the history is written to a
+   directory (default: the current one) while the producer goes on. Prints how long the budget lasts, the
+   compression, the frames the history dropped and the frames the producer had to drop - which should stay 0. */
+
+#include "framearena.hpp"
+#include "framecontainer.hpp"
+#include "framehistory.hpp"
+#include "framenotifier.hpp"
+#include "framering.hpp"
+#include "syntheticsource.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+/** @returns false, if the producer had no buffer */
+static bool produce(SyntheticSource *source, FrameRing *ring, FrameNotifier *notifier, pollfd *descriptor)
+{
+    if (poll(descriptor, 1, 100) <= 0) return true;
+
+    FrameRing::Buffer *buffer = ring->lockForWriting();
+    timespec time;
+    unsigned int sequence;
+    size_t length = source->readFrame(buffer != 0 ? buffer->buffer : 0, buffer != 0 ? buffer->length : 0, &time,
+            &sequence);
+
+    if (buffer == 0) return length == 0;
+    if (length == 0) {
+        ring->discard(buffer);
+        return true;
+    }
+
+    buffer->time = time;
+    buffer->sequence = sequence;
+    buffer->bytesUsed = (unsigned int) length;
+    ring->publish(buffer);
+    notifier->notify(buffer->serial);
+    return true;
+}
+
+
+int main(int argc, char **args)
+{
+    string directory = argc > 1 ? args[1] : ".";
+    double seconds = argc > 2 ? atof(args[2]) : 4.0;
+    const size_t budget = 128 * 1024 * 1024;
+
+    struct Scene
+    {
+        const char *name;
+        SyntheticSource::Pattern pattern;
+        unsigned int speed;
+    };
+    Scene scenes[] = {
+        {"static bars", SyntheticSource::PatternBars, 0},
+        {"moving bars", SyntheticSource::PatternBars, 4},
+        {"checkerboard", SyntheticSource::PatternCheckerboard, 4}};
+    FrameHistory::Codec codecs[] = {FrameHistory::CodecNone, FrameHistory::CodecDelta};
+
+    cout << "1920x1080 YUYV, 60 fps, " << budget / (1024 * 1024) << " MiB" << endl
+            << "       scene   codec   held [s]   ratio   s/GiB   dropped   producer dropped   written   write [s]"
+            << endl;
+
+    for (unsigned int s = 0; s < sizeof(scenes) / sizeof(Scene); ++s) {
+        for (unsigned int c = 0; c < sizeof(codecs) / sizeof(codecs[0]); ++c) {
+            SyntheticSource source;
+            source.setFramesPerSecond(60.0);
+            source.setPattern(scenes[s].pattern);
+            source.setSpeed(scenes[s].speed);
+
+            unsigned int width = 1920;
+            unsigned int height = 1080;
+            __u32 pixelFormat = V4L2_PIX_FMT_YUYV;
+            unsigned int bytesPerLine = 0;
+
+            size_t frameSize = source.open(&width, &height, &pixelFormat, &bytesPerLine);
+            if (frameSize == 0) return 1;
+
+            /* the producer's buffers and the one being copied */
+            FrameRing ring;
+            ring.resize(3);
+            FrameArena arena;
+            if (arena.allocate(ring.size(), frameSize) == false) return 1;
+            for (unsigned int a = 0; a < ring.size(); ++a) {
+                ring.buffer(a).buffer = arena.frame(a);
+                ring.buffer(a).length = frameSize;
+            }
+
+            FrameNotifier notifier;
+            FrameHistory history;
+            history.setRing(&ring, &notifier, pixelFormat, width, height, bytesPerLine);
+            history.setBudget(budget);
+            history.setCodec(codecs[c]);
+            if (history.start() == false) return 1;
+
+            pollfd descriptor;
+            descriptor.fd = source.fileDescriptor();
+            descriptor.events = POLLIN;
+
+            unsigned long long producerDropped = 0;
+
+            source.start();
+            double start = now();
+            while (now() - start < seconds) {
+                if (produce(&source, &ring, &notifier, &descriptor) == false) ++producerDropped;
+            }
+
+            FrameHistory::Statistics held = history.statistics();
+
+            /* written while capturing goes on */
+            string fileName = directory + "/benchmark-framehistory.raw";
+            double writeStart = now();
+            if (history.trigger(fileName) == false) return 1;
+            while (history.isFlushing() == true) {
+                if (produce(&source, &ring, &notifier, &descriptor) == false) ++producerDropped;
+            }
+            double writeDuration = now() - writeStart;
+
+            source.stop();
+            history.stop();
+            source.close();
+
+            FrameHistory::Statistics statistics = history.statistics();
+
+            FrameContainer container;
+            bool readable = container.open(fileName) == true && container.frameCount() == statistics.flushedFrames;
+            container.close();
+            remove(fileName.c_str());
+
+            double ratio = held.storedBytes > 0 ? (double) held.rawBytes / held.storedBytes : 0.0;
+            double perGibibyte = held.storedBytes > 0 ? held.seconds * 1024 * 1024 * 1024 / held.storedBytes : 0.0;
+
+            cout << setw(12) << scenes[s].name
+                    << setw(8) << FrameHistory::codecString(codecs[c])
+                    << setw(11) << fixed << setprecision(1) << held.seconds
+                    << setw(8) << ratio
+                    << setw(8) << perGibibyte
+                    << setw(10) << statistics.droppedFrames
+                    << setw(19) << producerDropped
+                    << setw(10) << statistics.flushedFrames
+                    << setw(12) << setprecision(2) << writeDuration << endl;
+
+            if (statistics.flushFailed == true || readable == false) {
+                cerr << "cannot write or read back \"" << fileName << "\"" << endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* a producer publishes frames from the synthetic source into a ring at a fixed rate, the recorder writes
+   them to a directory (default: the current one). Prints the recorded rate and bandwidth, the frames dropped
+   because the disk could not keep up, and the frames the producer had to drop - which should stay 0.
+   Then the same for the frames of an MJPEG file (concatenated JPEGs), recorded compressed as an MJPG camera's
+   are, next to the bandwidth their decoded RGB24 frames would need. */
+
+#include "framearena.hpp"
+#include "framenotifier.hpp"
+#include "framerecorder.hpp"
+#include "framering.hpp"
+#include "syntheticsource.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+/** splits the file at the start of image markers */
+static vector<string> readFrames(const string &fileName)
+{
+    vector<string> ret;
+
+    ifstream file(fileName.c_str(), ios::binary);
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    /* 0xff is byte stuffed in the entropy coded data, so the markers are unique */
+    string::size_type start = data.find("\xff\xd8");
+    while (start != string::npos) {
+        string::size_type end = data.find("\xff\xd8", start + 2);
+        ret.push_back(data.substr(start, end == string::npos ? string::npos : end - start));
+        start = end;
+    }
+
+    return ret;
+}
+
+
+static bool imageSize(const string &frame, unsigned int *width, unsigned int *height)
+{
+    struct jpeg_decompress_struct decompress;
+    struct jpeg_error_mgr errorManager;
+    decompress.err = jpeg_std_error(&errorManager);
+    jpeg_create_decompress(&decompress);
+
+    jpeg_mem_src(&decompress, (unsigned char*) frame.data(), frame.size());
+    bool ret = jpeg_read_header(&decompress, TRUE) == JPEG_HEADER_OK;
+    *width = decompress.image_width;
+    *height = decompress.image_height;
+
+    jpeg_destroy_decompress(&decompress);
+    return ret;
+}
+
+
+int main(int argc, char **args)
+{
+    string directory = argc > 1 ? args[1] : ".";
+    double seconds = argc > 2 ? atof(args[2]) : 3.0;
+    string mjpegFileName = argc > 3 ? args[3] : "src/benchmarks/data/sample-1280x720.mjpeg";
+
+    unsigned int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+    double rates[] = {30.0, 120.0, 1000.0};
+
+    cout << " resolution    fps   recorded/sec   MiB/sec   dropped   producer dropped   slowest write [ms]   i/o"
+            << endl;
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (unsigned int r = 0; r < sizeof(rates) / sizeof(double); ++r) {
+            SyntheticSource source;
+            source.setFramesPerSecond(rates[r]);
+
+            unsigned int width = sizes[s][0];
+            unsigned int height = sizes[s][1];
+            __u32 pixelFormat = V4L2_PIX_FMT_YUYV;
+            unsigned int bytesPerLine = 0;
+
+            size_t frameSize = source.open(&width, &height, &pixelFormat, &bytesPerLine);
+            if (frameSize == 0) return 1;
+
+            FrameRecorder recorder;
+
+            /* the producer's buffers, the recorder's queue and one being written */
+            FrameRing ring;
+            ring.resize(2 + recorder.queueLength() + 1);
+            FrameArena arena;
+            if (arena.allocate(ring.size(), frameSize) == false) return 1;
+            for (unsigned int a = 0; a < ring.size(); ++a) {
+                ring.buffer(a).buffer = arena.frame(a);
+                ring.buffer(a).length = frameSize;
+            }
+
+            FrameNotifier notifier;
+            string fileName = directory + "/benchmark-framerecorder.raw";
+            recorder.addRing(&ring, &notifier, pixelFormat, width, height, bytesPerLine, fileName);
+            if (recorder.start() == false) {
+                cerr << "Cannot record to \"" << fileName << "\"" << endl;
+                return 1;
+            }
+
+            pollfd descriptor;
+            descriptor.fd = source.fileDescriptor();
+            descriptor.events = POLLIN;
+
+            unsigned long long producerDropped = 0;
+
+            source.start();
+            double start = now();
+
+            while (now() - start < seconds) {
+                if (poll(&descriptor, 1, 100) <= 0) continue;
+
+                /* without a buffer the frame is skipped - the recorder holds too many */
+                FrameRing::Buffer *buffer = ring.lockForWriting();
+                timespec time;
+                unsigned int sequence;
+                size_t length = source.readFrame(buffer != 0 ? buffer->buffer : 0, buffer != 0 ? buffer->length : 0,
+                        &time, &sequence);
+
+                if (buffer == 0) {
+                    if (length > 0) ++producerDropped;
+                    continue;
+                }
+                if (length == 0) {
+                    ring.discard(buffer);
+                    continue;
+                }
+
+                buffer->time = time;
+                buffer->sequence = sequence;
+                buffer->bytesUsed = (unsigned int) length;
+                ring.publish(buffer);
+                notifier.notify(buffer->serial);
+            }
+
+            double duration = now() - start;
+            source.stop();
+            recorder.stop();
+            source.close();
+
+            FrameRecorder::Statistics statistics = recorder.statistics()[0];
+            remove(fileName.c_str());
+
+            ostringstream resolution;
+            resolution << width << "x" << height;
+
+            cout << setw(11) << resolution.str()
+                    << setw(7) << (int) rates[r]
+                    << setw(15) << fixed << setprecision(1) << statistics.recordedFrames / duration
+                    << setw(10) << statistics.bytesWritten / duration / (1024 * 1024)
+                    << setw(10) << statistics.droppedFrames
+                    << setw(19) << producerDropped
+                    << setw(21) << statistics.maximumWriteLatency * 1000.0
+                    << "   " << (statistics.directIo == true ? "direct" : "buffered") << endl;
+
+            if (statistics.failed == true) return 1;
+        }
+    }
+
+    vector<string> frames = readFrames(mjpegFileName);
+    unsigned int jpegWidth, jpegHeight;
+    if (frames.empty() == true || imageSize(frames[0], &jpegWidth, &jpegHeight) == false) {
+        cerr << "Cannot read \"" << mjpegFileName << "\"" << endl;
+        return 1;
+    }
+
+    size_t maxFrameSize = 0;
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        if (it->size() > maxFrameSize) maxFrameSize = it->size();
+    }
+
+    /* a chunk of the decoded frame: header block and data, padded to blocks */
+    double decodedChunkLength = (jpegWidth * jpegHeight * 3 + 4095) / 4096 * 4096 + 4096;
+
+    cout << endl << mjpegFileName << ": " << jpegWidth << "x" << jpegHeight << " MJPEG, recorded compressed" << endl
+            << "    fps   recorded/sec   MiB/sec   decoded MiB/sec   dropped   producer dropped   slowest write [ms]"
+            << "   i/o" << endl;
+
+    for (unsigned int r = 0; r < sizeof(rates) / sizeof(double); ++r) {
+        /* only the clock */
+        SyntheticSource clock;
+        clock.setFramesPerSecond(rates[r]);
+
+        unsigned int width = jpegWidth;
+        unsigned int height = jpegHeight;
+        __u32 pixelFormat = V4L2_PIX_FMT_GREY;
+        unsigned int bytesPerLine = 0;
+        if (clock.open(&width, &height, &pixelFormat, &bytesPerLine) == 0) return 1;
+
+        FrameRecorder recorder;
+
+        FrameRing ring;
+        ring.resize(2 + recorder.queueLength() + 1);
+        FrameArena arena;
+        if (arena.allocate(ring.size(), maxFrameSize) == false) return 1;
+        for (unsigned int a = 0; a < ring.size(); ++a) {
+            ring.buffer(a).buffer = arena.frame(a);
+            ring.buffer(a).length = maxFrameSize;
+        }
+
+        FrameNotifier notifier;
+        string fileName = directory + "/benchmark-framerecorder.raw";
+        recorder.addRing(&ring, &notifier, V4L2_PIX_FMT_MJPEG, jpegWidth, jpegHeight, 0, fileName);
+        if (recorder.start() == false) {
+            cerr << "Cannot record to \"" << fileName << "\"" << endl;
+            return 1;
+        }
+
+        pollfd descriptor;
+        descriptor.fd = clock.fileDescriptor();
+        descriptor.events = POLLIN;
+
+        unsigned long long producerDropped = 0;
+        unsigned long long produced = 0;
+
+        clock.start();
+        double start = now();
+
+        while (now() - start < seconds) {
+            if (poll(&descriptor, 1, 100) <= 0) continue;
+
+            timespec time;
+            unsigned int sequence;
+            if (clock.readFrame(0, 0, &time, &sequence) == 0) continue;
+
+            FrameRing::Buffer *buffer = ring.lockForWriting();
+            if (buffer == 0) {
+                ++producerDropped;
+                continue;
+            }
+
+            const string &frame = frames[produced++ % frames.size()];
+            memcpy(buffer->buffer, frame.data(), frame.size());
+            buffer->time = time;
+            buffer->sequence = sequence;
+            buffer->bytesUsed = (unsigned int) frame.size();
+            ring.publish(buffer);
+            notifier.notify(buffer->serial);
+        }
+
+        double duration = now() - start;
+        clock.stop();
+        recorder.stop();
+        clock.close();
+
+        FrameRecorder::Statistics statistics = recorder.statistics()[0];
+        remove(fileName.c_str());
+
+        cout << setw(7) << (int) rates[r]
+                << setw(15) << fixed << setprecision(1) << statistics.recordedFrames / duration
+                << setw(10) << statistics.bytesWritten / duration / (1024 * 1024)
+                << setw(18) << statistics.recordedFrames * decodedChunkLength / duration / (1024 * 1024)
+                << setw(10) << statistics.droppedFrames
+                << setw(19) << producerDropped
+                << setw(21) << statistics.maximumWriteLatency * 1000.0
+                << "   " << (statistics.directIo == true ? "direct" : "buffered") << endl;
+
+        if (statistics.failed == true) return 1;
+    }
+
+    return 0;
+}
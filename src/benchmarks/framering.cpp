@@ -0,0 +1,250 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* one producer (the capture thread) publishes frames as fast as it can, N readers lock the
+   newest frame, touch it and unlock it again.
+   Compares the lock-free FrameRing with the former deque + mutex ring. */
+
+#include "framering.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+
+using namespace std;
+
+
+static const unsigned int s_bufferCount = 4;
+static const unsigned int s_bufferSize = 4096;
+
+
+struct Result
+{
+    unsigned long long published;
+    unsigned long long stalls;
+    unsigned long long reads;
+};
+
+
+/* *** the former implementation, kept here for comparison ***************** */
+struct OldBuffer
+{
+    timespec time;
+    int readerCount;
+    unsigned char *buffer;
+};
+
+struct OldRing
+{
+    list<OldBuffer> buffers;
+    deque<OldBuffer*> timelySortedBuffers;
+    mutex timelySortedBuffersMutex;
+};
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+static void newRingProducer(FrameRing *ring, atomic<bool> *stop, Result *result)
+{
+    while (stop->load(memory_order_relaxed) == false) {
+        FrameRing::Buffer *buffer = ring->lockForWriting();
+        if (buffer == 0) {
+            ++result->stalls;
+            continue;
+        }
+        memset(buffer->buffer, (int) result->published, s_bufferSize);
+        clock_gettime(CLOCK_MONOTONIC, &buffer->time);
+        ring->publish(buffer);
+        ++result->published;
+    }
+}
+
+
+static void newRingReader(FrameRing *ring, atomic<bool> *stop, Result *result)
+{
+    unsigned int sum = 0;
+    while (stop->load(memory_order_relaxed) == false) {
+        const FrameRing::Buffer *buffer = ring->lockNewest();
+        if (buffer != 0) {
+            sum += buffer->buffer[s_bufferSize / 2];
+            FrameRing::unlock(buffer);
+        }
+        ++result->reads;
+    }
+    if (sum == 1) cerr << ""; /* keep the reads */
+}
+
+
+static void oldRingProducer(OldRing *ring, atomic<bool> *stop, Result *result)
+{
+    while (stop->load(memory_order_relaxed) == false) {
+        ring->timelySortedBuffersMutex.lock();
+        if (ring->timelySortedBuffers.back()->readerCount > 0) {
+            ring->timelySortedBuffersMutex.unlock();
+            ++result->stalls;
+            continue;
+        }
+        OldBuffer *buffer = ring->timelySortedBuffers.back();
+        ring->timelySortedBuffers.pop_back();
+        ring->timelySortedBuffersMutex.unlock();
+
+        memset(buffer->buffer, (int) result->published, s_bufferSize);
+        clock_gettime(CLOCK_MONOTONIC, &buffer->time);
+
+        ring->timelySortedBuffersMutex.lock();
+        ring->timelySortedBuffers.push_front(buffer);
+        ring->timelySortedBuffersMutex.unlock();
+        ++result->published;
+    }
+}
+
+
+static void oldRingReader(OldRing *ring, atomic<bool> *stop, Result *result)
+{
+    unsigned int sum = 0;
+    while (stop->load(memory_order_relaxed) == false) {
+        deque<const OldBuffer*> buffers;
+
+        ring->timelySortedBuffersMutex.lock();
+        buffers.push_back(ring->timelySortedBuffers.front());
+        ++ring->timelySortedBuffers.front()->readerCount;
+        ring->timelySortedBuffersMutex.unlock();
+
+        sum += buffers[0]->buffer[s_bufferSize / 2];
+
+        ring->timelySortedBuffersMutex.lock();
+        for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+            for (auto it2 = ring->timelySortedBuffers.begin(); it2 != ring->timelySortedBuffers.end(); ++it2) {
+                if (*it == *it2) --((*it2)->readerCount);
+            }
+        }
+        ring->timelySortedBuffersMutex.unlock();
+        ++result->reads;
+    }
+    if (sum == 1) cerr << "";
+}
+
+
+static void print(const char *name, unsigned int readerCount, double seconds, const Result &producer,
+        const vector<Result> &readers)
+{
+    unsigned long long reads = 0;
+    for (auto it = readers.begin(); it != readers.end(); ++it) reads += it->reads;
+
+    cout << setw(10) << name << setw(9) << readerCount
+            << setw(16) << (unsigned long long) (producer.published / seconds)
+            << setw(14) << producer.stalls
+            << setw(16) << (unsigned long long) (reads / seconds)
+            << setw(16) << (readerCount > 0 ? (unsigned long long) (reads / seconds / readerCount) : 0) << endl;
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 2.0;
+    unsigned int readerCounts[] = {0, 1, 2, 4, 8};
+
+    vector<unsigned char> memory(s_bufferCount * s_bufferSize);
+
+    cout << "      ring  readers  publishes/sec  writer stalls     reads/sec  reads/sec/reader" << endl;
+
+    for (unsigned int r = 0; r < sizeof(readerCounts) / sizeof(unsigned int); ++r) {
+        unsigned int readerCount = readerCounts[r];
+
+        /* *** lock-free ring *** */
+        {
+            FrameRing ring;
+            ring.resize(s_bufferCount);
+            for (unsigned int a = 0; a < s_bufferCount; ++a) {
+                ring.buffer(a).buffer = &memory[a * s_bufferSize];
+                ring.buffer(a).length = s_bufferSize;
+            }
+
+            atomic<bool> stop(false);
+            Result producer = {0, 0, 0};
+            vector<Result> readers(readerCount, producer);
+            list<thread*> threads;
+
+            double start = now();
+            threads.push_back(new thread(bind(newRingProducer, &ring, &stop, &producer)));
+            for (unsigned int a = 0; a < readerCount; ++a) {
+                threads.push_back(new thread(bind(newRingReader, &ring, &stop, &readers[a])));
+            }
+
+            timespec sleepLength = { (time_t) seconds, (long) ((seconds - (time_t) seconds) * 1000000000.0) };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &sleepLength, 0);
+            stop = true;
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                (*it)->join();
+                delete *it;
+            }
+
+            print("lock-free", readerCount, now() - start, producer, readers);
+        }
+
+        /* *** former mutex ring *** */
+        {
+            OldRing ring;
+            for (unsigned int a = 0; a < s_bufferCount; ++a) {
+                ring.buffers.push_front(OldBuffer());
+                ring.buffers.front().readerCount = 0;
+                ring.buffers.front().buffer = &memory[a * s_bufferSize];
+                ring.timelySortedBuffers.push_back(&ring.buffers.front());
+            }
+
+            atomic<bool> stop(false);
+            Result producer = {0, 0, 0};
+            vector<Result> readers(readerCount, producer);
+            list<thread*> threads;
+
+            double start = now();
+            threads.push_back(new thread(bind(oldRingProducer, &ring, &stop, &producer)));
+            for (unsigned int a = 0; a < readerCount; ++a) {
+                threads.push_back(new thread(bind(oldRingReader, &ring, &stop, &readers[a])));
+            }
+
+            timespec sleepLength = { (time_t) seconds, (long) ((seconds - (time_t) seconds) * 1000000000.0) };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &sleepLength, 0);
+            stop = true;
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                (*it)->join();
+                delete *it;
+            }
+
+            print("mutex", readerCount, now() - start, producer, readers);
+        }
+    }
+
+    return 0;
+}
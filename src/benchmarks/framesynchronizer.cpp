@@ -0,0 +1,160 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* simulates rigs of 2, 4, 8 and 16 cameras at 60 fps, whose frames are taken with some jitter and of
+   which 1% get lost, and matches their frames into tuples. Reports the tuple rate, the skew, the drop
+   rate and the cpu time the matching takes per tuple. */
+
+#include "framenotifier.hpp"
+#include "framering.hpp"
+#include "framesynchronizer.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+
+using namespace std;
+
+
+static const long s_periodNanoseconds = 1000000000 / 60;
+/** frames of all cameras are taken within +- this */
+static const long s_jitterNanoseconds = 1000000;
+static const unsigned int s_bufferSize = 64;
+
+
+struct Camera
+{
+    FrameRing ring;
+    FrameNotifier notifier;
+    vector<unsigned char> memory;
+};
+
+
+static void addNanoseconds(timespec *time, long nanoseconds)
+{
+    time->tv_nsec += nanoseconds;
+    while (time->tv_nsec >= 1000000000) {
+        time->tv_nsec -= 1000000000;
+        ++time->tv_sec;
+    }
+}
+
+
+static void producer(Camera *camera, timespec start, atomic<bool> *stop, unsigned int seed)
+{
+    timespec next = start;
+
+    while (stop->load() == false) {
+        addNanoseconds(&next, s_periodNanoseconds);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+
+        /* the camera lost a frame */
+        if (rand_r(&seed) % 100 == 0) continue;
+
+        FrameRing::Buffer *buffer = camera->ring.lockForWriting();
+        if (buffer == 0) continue;
+
+        buffer->time = next;
+        addNanoseconds(&buffer->time, s_jitterNanoseconds + rand_r(&seed) % (2 * s_jitterNanoseconds) -
+                s_jitterNanoseconds);
+        camera->ring.publish(buffer);
+        camera->notifier.notify(buffer->serial);
+    }
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 3.0;
+
+    cout << "cameras   tuples/sec   mean skew [ms]   max skew [ms]   drop rate [%]   cpu per tuple [us]" << endl;
+
+    unsigned int cameraCounts[] = {2, 4, 8, 16};
+
+    for (unsigned int c = 0; c < sizeof(cameraCounts) / sizeof(unsigned int); ++c) {
+        unsigned int cameraCount = cameraCounts[c];
+
+        vector<Camera*> cameras;
+        FrameSynchronizer *synchronizer = new FrameSynchronizer();
+        synchronizer->setTolerance(2.0 * s_jitterNanoseconds / 1000000000.0);
+
+        for (unsigned int a = 0; a < cameraCount; ++a) {
+            Camera *camera = new Camera();
+            camera->ring.resize(4);
+            camera->memory.resize(camera->ring.size() * s_bufferSize);
+            for (unsigned int b = 0; b < camera->ring.size(); ++b) {
+                camera->ring.buffer(b).buffer = &camera->memory[b * s_bufferSize];
+                camera->ring.buffer(b).length = s_bufferSize;
+            }
+            cameras.push_back(camera);
+            synchronizer->addRing(&camera->ring, &camera->notifier, 0, s_bufferSize, 1, s_bufferSize);
+        }
+
+        atomic<bool> stop(false);
+        timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        vector<thread*> producers;
+        for (unsigned int a = 0; a < cameraCount; ++a) {
+            producers.push_back(new thread(bind(producer, cameras[a], start, &stop, a + 1)));
+        }
+
+        FrameSynchronizer::FrameTuple tuple;
+        timespec cpuStart, cpuEnd;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+
+        timespec now = start;
+        while ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1000000000.0 < seconds) {
+            synchronizer->waitForTuple(&tuple, 100);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+        tuple.frames.clear();
+
+        FrameSynchronizer::Statistics statistics = synchronizer->statistics();
+        delete synchronizer;
+
+        stop = true;
+        for (unsigned int a = 0; a < cameraCount; ++a) {
+            producers[a]->join();
+            delete producers[a];
+            delete cameras[a];
+        }
+
+        unsigned long long dropped = 0;
+        for (unsigned int a = 0; a < cameraCount; ++a) dropped += statistics.droppedFrames[a];
+        double dropRate = 100.0 * dropped / (dropped + statistics.tupleCount * cameraCount);
+        double cpu = (cpuEnd.tv_sec - cpuStart.tv_sec) + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1000000000.0;
+
+        cout << setw(7) << cameraCount
+                << setw(13) << fixed << setprecision(1) << statistics.tupleCount / seconds
+                << setw(17) << setprecision(3) << statistics.meanSkew * 1000.0
+                << setw(16) << statistics.maximumSkew * 1000.0
+                << setw(16) << setprecision(1) << dropRate
+                << setw(21) << cpu * 1000000.0 / statistics.tupleCount << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* feeds the frames of an MJPEG file (concatenated JPEGs, e.g. data/sample-1280x720.mjpeg) through
+   the decoder pool as fast as it takes them, the same way a capture device does, for 1, 2, 4 ...
+   threads. A reader checks that the decoded frames are published in order. */
+
+#include "framenotifier.hpp"
+#include "framering.hpp"
+#include "mjpegdecoder.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jpeglib.h>
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+/** splits the file at the start of image markers */
+static vector<string> readFrames(const string &fileName)
+{
+    vector<string> ret;
+
+    ifstream file(fileName.c_str(), ios::binary);
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    /* 0xff is byte stuffed in the entropy coded data, so the markers are unique */
+    string::size_type start = data.find("\xff\xd8");
+    while (start != string::npos) {
+        string::size_type end = data.find("\xff\xd8", start + 2);
+        ret.push_back(data.substr(start, end == string::npos ? string::npos : end - start));
+        start = end;
+    }
+
+    return ret;
+}
+
+
+static bool imageSize(const string &frame, unsigned int *width, unsigned int *height)
+{
+    struct jpeg_decompress_struct decompress;
+    struct jpeg_error_mgr errorManager;
+    decompress.err = jpeg_std_error(&errorManager);
+    jpeg_create_decompress(&decompress);
+
+    jpeg_mem_src(&decompress, (unsigned char*) frame.data(), frame.size());
+    bool ret = jpeg_read_header(&decompress, TRUE) == JPEG_HEADER_OK;
+    *width = decompress.image_width;
+    *height = decompress.image_height;
+
+    jpeg_destroy_decompress(&decompress);
+    return ret;
+}
+
+
+/** verifies the order of the published frames */
+static void orderChecker(FrameRing *ring, FrameNotifier *notifier, atomic<bool> *stop,
+        unsigned long long *outOfOrder)
+{
+    unsigned long long serial = 0;
+    long long lastSequence = -1;
+
+    while (stop->load() == false) {
+        serial = notifier->wait(serial, 10000000);
+
+        const FrameRing::Buffer *buffer = ring->lockNewest();
+        if (buffer == 0) continue;
+
+        if ((long long) buffer->sequence < lastSequence) ++(*outOfOrder);
+        lastSequence = buffer->sequence;
+        FrameRing::unlock(buffer);
+    }
+}
+
+
+int main(int argc, char **args)
+{
+    string fileName = argc > 1 ? args[1] : "src/benchmarks/data/sample-1280x720.mjpeg";
+    double seconds = argc > 2 ? atof(args[2]) : 2.0;
+
+    vector<string> frames = readFrames(fileName);
+    unsigned int width, height;
+    if (frames.empty() == true || imageSize(frames[0], &width, &height) == false) {
+        cerr << "Cannot read \"" << fileName << "\"" << endl;
+        return 1;
+    }
+
+    unsigned int maxFrameSize = 0;
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        if (it->size() > maxFrameSize) maxFrameSize = it->size();
+    }
+
+    cout << fileName << ": " << frames.size() << " frames " << width << "x" << height
+            << ", cores: " << thread::hardware_concurrency() << endl
+            << "threads   frames/sec   dropped   out of order" << endl;
+
+    unsigned int threadCounts[] = {1, 2, 4, 8};
+
+    for (unsigned int t = 0; t < sizeof(threadCounts) / sizeof(unsigned int); ++t) {
+        unsigned int threadCount = threadCounts[t];
+
+        /* compressed frames as the driver would deliver them */
+        FrameRing compressedRing;
+        compressedRing.resize(3 * threadCount + 2);
+        vector<unsigned char> compressedMemory(compressedRing.size() * maxFrameSize);
+        for (unsigned int a = 0; a < compressedRing.size(); ++a) {
+            compressedRing.buffer(a).buffer = &compressedMemory[a * maxFrameSize];
+            compressedRing.buffer(a).length = maxFrameSize;
+        }
+
+        /* one buffer for the reader, one for the newest frame and one per pending frame - a thread, which
+           finished early, keeps its frame until the older ones are published and continues with the next */
+        FrameRing decodedRing;
+        decodedRing.resize(2 * threadCount + 2);
+        vector<unsigned char> decodedMemory(decodedRing.size() * width * height * 3);
+        for (unsigned int a = 0; a < decodedRing.size(); ++a) {
+            decodedRing.buffer(a).buffer = &decodedMemory[a * width * height * 3];
+            decodedRing.buffer(a).length = width * height * 3;
+        }
+
+        FrameNotifier notifier;
+        MjpegDecoder decoder(threadCount);
+        MjpegDecoder::Stream stream;
+        stream.setOutput(&decodedRing, width, height, width * 3);
+        stream.setNotifier(&notifier);
+
+        decoder.start();
+        decoder.attach(&stream);
+
+        atomic<bool> stop(false);
+        unsigned long long outOfOrder = 0;
+        thread checker(bind(orderChecker, &decodedRing, &notifier, &stop, &outOfOrder));
+
+        double start = now();
+        unsigned long long submitted = 0;
+
+        while (now() - start < seconds) {
+            /* do not overrun the decoder - a camera would, the decoder would drop */
+            if (stream.pendingFrameCount() >= 2 * threadCount) {
+                notifier.wait(decodedRing.latestSerial(), 1000000);
+                continue;
+            }
+
+            FrameRing::Buffer *buffer = compressedRing.lockForWriting();
+            if (buffer == 0) {
+                this_thread::yield();
+                continue;
+            }
+
+            const string &frame = frames[submitted % frames.size()];
+            memcpy(buffer->buffer, frame.data(), frame.size());
+            buffer->bytesUsed = frame.size();
+            buffer->sequence = (unsigned int) submitted;
+            clock_gettime(CLOCK_MONOTONIC, &buffer->time);
+            compressedRing.publish(buffer);
+            ++submitted;
+
+            FrameRing::tryLockForReading(buffer);
+            decoder.decode(&stream, buffer);
+        }
+
+        decoder.detach(&stream);
+        double duration = now() - start;
+        decoder.stop();
+
+        stop = true;
+        checker.join();
+
+        cout << setw(7) << threadCount
+                << setw(13) << fixed << setprecision(1) << stream.decodedFrameCount() / duration
+                << setw(10) << stream.droppedFrameCount()
+                << setw(15) << outOfOrder << endl;
+
+        if (stream.decodedFrameCount() + stream.droppedFrameCount() != submitted) {
+            cerr << "frames got lost: " << submitted << " submitted, "
+                    << stream.decodedFrameCount() + stream.droppedFrameCount() << " decoded or dropped" << endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* a worker passes a checkpoint once per simulated frame, the main thread pauses and resumes it over and over.
+   Prints what a checkpoint costs while running and how long the worker takes to run again after resume(). */
+
+#include "pausegate.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+static void worker(PauseGate *gate, atomic<bool> *stop, long frameNanoseconds, atomic<unsigned long long> *frames)
+{
+    while (stop->load() == false) {
+        gate->checkpoint();
+
+        if (frameNanoseconds > 0) {
+            timespec frameLength = { 0, frameNanoseconds };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &frameLength, 0);
+        }
+        frames->fetch_add(1, memory_order_relaxed);
+    }
+}
+
+
+int main(int argc, char **args)
+{
+    unsigned int cycles = argc > 1 ? atoi(args[1]) : 1000;
+
+    /* the fast path - one atomic load per frame */
+    {
+        PauseGate gate;
+        atomic<bool> stop(false);
+        atomic<unsigned long long> frames(0);
+
+        thread t(bind(worker, &gate, &stop, 0L, &frames));
+        double start = now();
+        timespec length = { 0, 200000000 };
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &length, 0);
+        stop = true;
+        t.join();
+
+        cout << "checkpoint while running: " << fixed << setprecision(1)
+                << (now() - start) * 1000000000.0 / frames.load() << " ns per frame, including the loop" << endl;
+    }
+
+    cout << "frame interval [ms]   resumes   mean latency [us]   max latency [us]" << endl;
+
+    long frameIntervals[] = { 1000000, 16666666, 33333333 };
+
+    for (unsigned int i = 0; i < sizeof(frameIntervals) / sizeof(long); ++i) {
+        PauseGate gate;
+        atomic<bool> stop(false);
+        atomic<unsigned long long> frames(0);
+
+        thread t(bind(worker, &gate, &stop, frameIntervals[i], &frames));
+
+        for (unsigned int a = 0; a < cycles; ++a) {
+            gate.pause();
+            if (gate.waitUntilParked(1000000000L) == false) {
+                cerr << "worker did not park" << endl;
+                return 1;
+            }
+
+            timespec pauseLength = { 0, 200000 };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &pauseLength, 0);
+
+            gate.resume();
+        }
+
+        stop = true;
+        t.join();
+
+        PauseGate::Statistics statistics = gate.statistics();
+        cout << setw(19) << fixed << setprecision(1) << frameIntervals[i] / 1000000.0
+                << setw(10) << statistics.resumeCount
+                << setw(20) << statistics.meanResumeLatency * 1000000.0
+                << setw(19) << statistics.maximumResumeLatency * 1000000.0 << endl;
+
+        if (statistics.resumeCount != cycles) {
+            cerr << "resumes got lost: " << cycles << " cycles, " << statistics.resumeCount << " resumes" << endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* converts random frames from the native formats into RGB888 (and extracts luma, and downscales them
+   by 4 into RGB888 as for the preview) with the scalar and the runtime selected SIMD implementation.
+   Both have to yield identical results. */
+
+#include "pixelconversion.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+static string fourcc(__u32 pixelFormat)
+{
+    return string((const char*) &pixelFormat, 4);
+}
+
+
+/** @returns frames per second */
+static double measure(__u32 pixelFormat, bool luma, const vector<unsigned char> &source,
+        unsigned int sourceBytesPerLine, unsigned int width, unsigned int height,
+        vector<unsigned char> &destination, double seconds)
+{
+    unsigned int destinationBytesPerLine = luma ? width : width * 3;
+    unsigned long long frames = 0;
+    double start = now(), end;
+
+    do {
+        if (luma == true) {
+            PixelConversion::extractLuma(pixelFormat, &source[0], sourceBytesPerLine, width, height,
+                    &destination[0], destinationBytesPerLine);
+        } else {
+            PixelConversion::convertToRgb888(pixelFormat, &source[0], sourceBytesPerLine, width, height,
+                    &destination[0], destinationBytesPerLine);
+        }
+        ++frames;
+        end = now();
+    } while (end - start < seconds);
+
+    return frames / (end - start);
+}
+
+
+/** @returns frames per second */
+static double measureDownscale(__u32 pixelFormat, const vector<unsigned char> &source,
+        unsigned int sourceBytesPerLine, unsigned int width, unsigned int height, unsigned int factor,
+        vector<unsigned char> &destination, double seconds)
+{
+    unsigned long long frames = 0;
+    double start = now(), end;
+
+    do {
+        PixelConversion::downscaleToRgb888(pixelFormat, &source[0], sourceBytesPerLine, width, height, factor,
+                &destination[0], width / factor * 3);
+        ++frames;
+        end = now();
+    } while (end - start < seconds);
+
+    return frames / (end - start);
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 1.0;
+
+    __u32 pixelFormats[] = {V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_GREY};
+    unsigned int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+    bool failed = false;
+
+    cout << "simd implementation: " << PixelConversion::implementation() << endl
+            << "format  operation   resolution    scalar fps      simd fps   speedup" << endl;
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        unsigned int width = sizes[s][0];
+        unsigned int height = sizes[s][1];
+
+        for (unsigned int f = 0; f < sizeof(pixelFormats) / sizeof(__u32); ++f) {
+            __u32 pixelFormat = pixelFormats[f];
+            unsigned int sourceBytesPerLine =
+                    (pixelFormat == V4L2_PIX_FMT_YUYV || pixelFormat == V4L2_PIX_FMT_UYVY) ? width * 2 : width;
+
+            vector<unsigned char> source(sourceBytesPerLine * height * 2);
+            for (auto it = source.begin(); it != source.end(); ++it) *it = (unsigned char) rand();
+
+            for (int luma = 0; luma < 2; ++luma) {
+                if (luma == 1 && PixelConversion::lumaPlane(pixelFormat, &source[0]) != 0) continue;
+
+                vector<unsigned char> scalarResult(width * height * 3), simdResult(width * height * 3);
+
+                PixelConversion::setForceScalar(true);
+                double scalarFps = measure(pixelFormat, luma, source, sourceBytesPerLine, width, height,
+                        scalarResult, seconds);
+                PixelConversion::setForceScalar(false);
+                double simdFps = measure(pixelFormat, luma, source, sourceBytesPerLine, width, height,
+                        simdResult, seconds);
+
+                if (scalarResult != simdResult) {
+                    cerr << "results differ: " << fourcc(pixelFormat) << endl;
+                    failed = true;
+                }
+
+                cout << setw(6) << fourcc(pixelFormat)
+                        << setw(11) << (luma ? "luma" : "rgb888")
+                        << setw(8) << width << "x" << setw(4) << height
+                        << setw(14) << fixed << setprecision(1) << scalarFps
+                        << setw(14) << simdFps
+                        << setw(10) << setprecision(2) << simdFps / scalarFps << endl;
+            }
+        }
+    }
+
+    /* the preview's reduction, RGB3 included */
+    __u32 downscaleFormats[] = {V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12,
+            V4L2_PIX_FMT_GREY};
+    unsigned int width = 1920, height = 1080, factor = 4;
+
+    for (unsigned int f = 0; f < sizeof(downscaleFormats) / sizeof(__u32); ++f) {
+        __u32 pixelFormat = downscaleFormats[f];
+        unsigned int sourceBytesPerLine = pixelFormat == V4L2_PIX_FMT_RGB24 ? width * 3 :
+                ((pixelFormat == V4L2_PIX_FMT_YUYV || pixelFormat == V4L2_PIX_FMT_UYVY) ? width * 2 : width);
+
+        vector<unsigned char> source(sourceBytesPerLine * height * 2);
+        for (auto it = source.begin(); it != source.end(); ++it) *it = (unsigned char) rand();
+
+        vector<unsigned char> scalarResult(width / factor * height / factor * 3);
+        vector<unsigned char> simdResult(scalarResult.size());
+
+        PixelConversion::setForceScalar(true);
+        double scalarFps = measureDownscale(pixelFormat, source, sourceBytesPerLine, width, height, factor,
+                scalarResult, seconds);
+        PixelConversion::setForceScalar(false);
+        double simdFps = measureDownscale(pixelFormat, source, sourceBytesPerLine, width, height, factor,
+                simdResult, seconds);
+
+        if (scalarResult != simdResult) {
+            cerr << "results differ: " << fourcc(pixelFormat) << " downscaled" << endl;
+            failed = true;
+        }
+
+        cout << setw(6) << fourcc(pixelFormat)
+                << setw(11) << "1/4 rgb888"
+                << setw(8) << width << "x" << setw(4) << height
+                << setw(14) << fixed << setprecision(1) << scalarFps
+                << setw(14) << simdFps
+                << setw(10) << setprecision(2) << simdFps / scalarFps << endl;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* a synthetic 1080p YUYV camera feeds a processing reader, which touches every byte of each frame, with and
+   without a preview stream - all on one cpu, so they compete for it. Prints the frames the processing got
+   and the preview's frames and downscaling time. The preview must not cost the processing frames, with the
+   cpu saturated it gets next to none itself. */
+
+#include "framenotifier.hpp"
+#include "framering.hpp"
+#include "previewstream.hpp"
+#include "syntheticsource.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+/** sums every byte of each new frame, some passes per frame */
+static void processingThread(FrameRing *ring, FrameNotifier *notifier, unsigned int passes, atomic<bool> *stop,
+        unsigned long long *frames)
+{
+    unsigned long long lastSerial = 0;
+    volatile unsigned int sink = 0;
+
+    while (stop->load() == false) {
+        notifier->wait(lastSerial, 10000000);
+
+        const FrameRing::Buffer *buffer = ring->lockNewest();
+        if (buffer == 0) continue;
+
+        if (buffer->serial > lastSerial) {
+            unsigned int sum = 0;
+            for (unsigned int p = 0; p < passes; ++p) {
+                for (unsigned int a = 0; a < buffer->bytesUsed; a += 4) sum += buffer->buffer[a];
+            }
+            sink = sum;
+            lastSerial = buffer->serial;
+            ++(*frames);
+        }
+        FrameRing::unlock(buffer);
+    }
+    (void) sink;
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 2.0;
+
+    /* one cpu for everything - the threads inherit it */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    sched_setaffinity(0, sizeof(cpu_set_t), &cpus);
+
+    /* 0: as fast as the frames are taken - the cpu is saturated */
+    double rates[] = {30.0, 60.0, 0.0};
+    unsigned int passes[] = {1, 8};
+
+    cout << "camera fps   processing passes   preview   captured   processed   preview frames   downscale [ms]"
+            << endl;
+
+    for (unsigned int r = 0; r < sizeof(rates) / sizeof(double); ++r) {
+        for (unsigned int p = 0; p < sizeof(passes) / sizeof(unsigned int); ++p) {
+            for (int withPreview = 0; withPreview < 2; ++withPreview) {
+                SyntheticSource source;
+                source.setFramesPerSecond(rates[r]);
+
+                unsigned int width = 1920, height = 1080, bytesPerLine = 0;
+                __u32 pixelFormat = V4L2_PIX_FMT_YUYV;
+                size_t frameSize = source.open(&width, &height, &pixelFormat, &bytesPerLine);
+                if (frameSize == 0) {
+                    cerr << "Cannot open " << source.name() << endl;
+                    return 1;
+                }
+
+                /* one buffer more for the preview */
+                FrameRing ring;
+                ring.resize(5);
+                vector<unsigned char> memory(ring.size() * frameSize);
+                for (unsigned int a = 0; a < ring.size(); ++a) {
+                    ring.buffer(a).buffer = &memory[a * frameSize];
+                    ring.buffer(a).length = frameSize;
+                }
+                FrameNotifier notifier;
+
+                PreviewStream preview;
+                if (withPreview == 1) {
+                    preview.setFramesPerSecond(30.0);
+                    preview.setRing(&ring, &notifier, pixelFormat, width, height, bytesPerLine);
+                    preview.start();
+                }
+
+                atomic<bool> stop(false);
+                unsigned long long processed = 0;
+                thread processing(bind(processingThread, &ring, &notifier, passes[p], &stop, &processed));
+
+                pollfd descriptor;
+                descriptor.fd = source.fileDescriptor();
+                descriptor.events = POLLIN;
+                unsigned long long captured = 0;
+
+                source.start();
+                double start = now();
+
+                while (now() - start < seconds) {
+                    if (poll(&descriptor, 1, 100) <= 0) continue;
+
+                    FrameRing::Buffer *buffer = ring.lockForWriting();
+                    if (buffer == 0) continue;
+
+                    size_t length = source.readFrame(buffer->buffer, buffer->length, &buffer->time,
+                            &buffer->sequence);
+                    if (length == 0) {
+                        ring.discard(buffer);
+                        continue;
+                    }
+                    buffer->bytesUsed = (unsigned int) length;
+                    ring.publish(buffer);
+                    notifier.notify(buffer->serial);
+                    ++captured;
+                }
+
+                stop = true;
+                processing.join();
+                preview.stop();
+                source.stop();
+                source.close();
+
+                PreviewStream::Statistics statistics = preview.statistics();
+
+                ostringstream rate;
+                if (rates[r] == 0.0) rate << "max"; else rate << rates[r];
+
+                cout << setw(10) << rate.str()
+                        << setw(20) << passes[p]
+                        << setw(10) << (withPreview == 1 ? "yes" : "no")
+                        << setw(11) << captured
+                        << setw(12) << processed
+                        << setw(17) << statistics.frames
+                        << setw(17) << fixed << setprecision(2) << statistics.meanMilliseconds << endl;
+            }
+        }
+    }
+
+    return 0;
+}
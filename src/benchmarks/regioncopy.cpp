@@ -0,0 +1,135 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* copies the centered half of random 1080p frames out of them, as the capture thread does for a region of
+   interest, plain and binned or decimated by 2 and 4, in each native format. Uniform frames have to yield
+   uniform regions. */
+
+#include "pixelconversion.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+static string fourcc(__u32 pixelFormat)
+{
+    return string((const char*) &pixelFormat, 4);
+}
+
+
+static unsigned int bytesPerPixel(__u32 pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24: return 3;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY: return 2;
+    default: return 1;
+    }
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 1.0;
+
+    __u32 pixelFormats[] = {V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12,
+            V4L2_PIX_FMT_GREY};
+    unsigned int width = 1920, height = 1080;
+    bool failed = false;
+
+    cout << "region " << width / 2 << "x" << height / 2 << " of " << width << "x" << height << endl
+            << "format  factor        mode           fps   source MiB/s" << endl;
+
+    for (unsigned int f = 0; f < sizeof(pixelFormats) / sizeof(__u32); ++f) {
+        __u32 pixelFormat = pixelFormats[f];
+        unsigned int sourceBytesPerLine = width * bytesPerPixel(pixelFormat);
+        unsigned int destinationBytesPerLine = sourceBytesPerLine / 2;
+
+        /* twice the rows cover the chroma plane of NV12 */
+        vector<unsigned char> source(sourceBytesPerLine * height * 2);
+        vector<unsigned char> destination(destinationBytesPerLine * height);
+
+        for (unsigned int factor = 1; factor <= 4; factor *= 2) {
+            for (int average = 1; average >= (factor == 1 ? 1 : 0); --average) {
+                unsigned int horizontal, vertical;
+                PixelConversion::regionGranularity(pixelFormat, factor, &horizontal, &vertical);
+                unsigned int left = (width / 4) - (width / 4) % horizontal;
+                unsigned int top = (height / 4) - (height / 4) % vertical;
+                unsigned int regionWidth = (width / 2) - (width / 2) % horizontal;
+                unsigned int regionHeight = (height / 2) - (height / 2) % vertical;
+                unsigned int rows = regionHeight / factor;
+                unsigned int rowLength = regionWidth / factor * bytesPerPixel(pixelFormat);
+
+                memset(&source[0], 77, source.size());
+                memset(&destination[0], 0, destination.size());
+                PixelConversion::copyRegion(pixelFormat, &source[0], sourceBytesPerLine, height, left, top,
+                        regionWidth, regionHeight, factor, average, &destination[0], destinationBytesPerLine);
+                for (unsigned int y = 0; y < (pixelFormat == V4L2_PIX_FMT_NV12 ? rows * 3 / 2 : rows); ++y) {
+                    for (unsigned int x = 0; x < rowLength; ++x) {
+                        if (destination[y * destinationBytesPerLine + x] != 77) {
+                            cerr << "wrong region: " << fourcc(pixelFormat) << " factor " << factor
+                                    << " at " << x << "," << y << endl;
+                            failed = true;
+                            y = rows * 2;
+                            break;
+                        }
+                    }
+                }
+
+                for (auto it = source.begin(); it != source.end(); ++it) *it = (unsigned char) rand();
+
+                unsigned long long frames = 0;
+                double start = now(), end;
+                do {
+                    PixelConversion::copyRegion(pixelFormat, &source[0], sourceBytesPerLine, height, left, top,
+                            regionWidth, regionHeight, factor, average, &destination[0], destinationBytesPerLine);
+                    ++frames;
+                    end = now();
+                } while (end - start < seconds);
+
+                double fps = frames / (end - start);
+                double regionBytes = (double) regionWidth * regionHeight * bytesPerPixel(pixelFormat) *
+                        (pixelFormat == V4L2_PIX_FMT_NV12 ? 1.5 : 1.0);
+
+                cout << setw(6) << fourcc(pixelFormat)
+                        << setw(8) << factor
+                        << setw(12) << (factor == 1 ? "copy" : (average == 1 ? "binning" : "decimation"))
+                        << setw(14) << fixed << setprecision(1) << fps
+                        << setw(15) << fps * regionBytes / (1024 * 1024) << endl;
+            }
+        }
+    }
+
+    return failed ? 1 : 0;
+}
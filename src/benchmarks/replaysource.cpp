@@ -0,0 +1,225 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* records 200 fps of the synthetic source for a while and replays the file: as fast as possible, with the original
+   timing and at a fixed rate, then seeks to random frames. Prints the rates, the intervals of the original timing
+   and what a seek costs. The frames are mapped, never copied. */
+
+#include "framearena.hpp"
+#include "framenotifier.hpp"
+#include "framerecorder.hpp"
+#include "framering.hpp"
+#include "replaysource.hpp"
+#include "syntheticsource.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <time.h>
+
+using namespace std;
+
+
+/** the frames are read into this, so the reads are not optimized away */
+static volatile unsigned char s_sink;
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+static bool record(const string &fileName, double seconds)
+{
+    SyntheticSource source;
+    source.setFramesPerSecond(200.0);
+
+    unsigned int width = 1280, height = 720, bytesPerLine = 0;
+    __u32 pixelFormat = V4L2_PIX_FMT_YUYV;
+    size_t frameSize = source.open(&width, &height, &pixelFormat, &bytesPerLine);
+
+    FrameRecorder recorder;
+    FrameRing ring;
+    ring.resize(2 + recorder.queueLength() + 1);
+    FrameArena arena;
+    if (frameSize == 0 || arena.allocate(ring.size(), frameSize) == false) return false;
+    for (unsigned int a = 0; a < ring.size(); ++a) {
+        ring.buffer(a).buffer = arena.frame(a);
+        ring.buffer(a).length = frameSize;
+    }
+
+    FrameNotifier notifier;
+    recorder.addRing(&ring, &notifier, pixelFormat, width, height, bytesPerLine, fileName);
+    if (recorder.start() == false) return false;
+
+    pollfd descriptor;
+    descriptor.fd = source.fileDescriptor();
+    descriptor.events = POLLIN;
+
+    source.start();
+    double start = now();
+    while (now() - start < seconds) {
+        if (poll(&descriptor, 1, 100) <= 0) continue;
+
+        FrameRing::Buffer *buffer = ring.lockForWriting();
+        timespec time;
+        unsigned int sequence;
+        size_t length = source.readFrame(buffer != 0 ? buffer->buffer : 0, buffer != 0 ? buffer->length : 0,
+                &time, &sequence);
+        if (buffer == 0) continue;
+        if (length == 0) {
+            ring.discard(buffer);
+            continue;
+        }
+
+        buffer->time = time;
+        buffer->sequence = sequence;
+        buffer->bytesUsed = (unsigned int) length;
+        ring.publish(buffer);
+        notifier.notify(buffer->serial);
+    }
+    recorder.stop();
+
+    FrameRecorder::Statistics statistics = recorder.statistics()[0];
+    cout << "recorded " << statistics.recordedFrames << " frames " << width << "x" << height << " YUYV at 200 fps, "
+            << statistics.droppedFrames << " dropped" << endl;
+
+    return statistics.failed == false;
+}
+
+
+/** plays for the given time or up to the end
+    @returns frames per second */
+static double play(ReplaySource *source, double seconds, double *meanInterval, double *intervalDeviation)
+{
+    unsigned int width = 0, height = 0, bytesPerLine = 0;
+    __u32 pixelFormat = 0;
+    if (source->open(&width, &height, &pixelFormat, &bytesPerLine) == 0) exit(1);
+
+    pollfd descriptor;
+    descriptor.fd = source->fileDescriptor();
+    descriptor.events = POLLIN;
+
+    unsigned long long frames = 0;
+    double intervalSum = 0.0, intervalSquareSum = 0.0, last = 0.0;
+
+    source->start();
+    double start = now();
+    double end = start;
+
+    while (now() - start < seconds) {
+        if (poll(&descriptor, 1, 100) <= 0) break;
+
+        const unsigned char *data;
+        timespec time;
+        unsigned int sequence;
+        size_t length = source->mapFrame(&data, &time, &sequence);
+        if (length == 0) continue;
+
+        /* touch the frame - the pages are read from the file */
+        s_sink = data[length / 2];
+        end = now();
+
+        double t = time.tv_sec + time.tv_nsec / 1000000000.0;
+        if (frames > 0) {
+            intervalSum += t - last;
+            intervalSquareSum += (t - last) * (t - last);
+        }
+        last = t;
+        ++frames;
+    }
+
+    source->stop();
+    source->close();
+
+    if (meanInterval != 0 && frames > 1) {
+        *meanInterval = intervalSum / (frames - 1);
+        *intervalDeviation = sqrt(max(0.0, intervalSquareSum / (frames - 1) - *meanInterval * *meanInterval));
+    }
+
+    return frames / (end - start);
+}
+
+
+int main(int argc, char **args)
+{
+    string directory = argc > 1 ? args[1] : ".";
+    string fileName = directory + "/benchmark-replaysource.raw";
+
+    if (record(fileName, 1.5) == false) {
+        cerr << "Cannot record to \"" << fileName << "\"" << endl;
+        return 1;
+    }
+
+    {
+        ReplaySource source(fileName);
+        source.setTiming(ReplaySource::TimingFastest);
+        source.setLooping(true);
+        cout << "fastest, looping:      " << fixed << setprecision(1) << play(&source, 1.0, 0, 0) << " frames/sec" << endl;
+    }
+
+    {
+        ReplaySource source(fileName);
+        double meanInterval = 0.0, intervalDeviation = 0.0;
+        double rate = play(&source, 10.0, &meanInterval, &intervalDeviation);
+        cout << "original timing:       " << rate << " frames/sec, interval " << setprecision(3)
+                << meanInterval * 1000.0 << " ms +- " << intervalDeviation * 1000.0 << " ms (recorded: 5 ms)" << endl;
+    }
+
+    {
+        ReplaySource source(fileName);
+        source.setTiming(ReplaySource::TimingFixedRate, 1000.0);
+        source.setLooping(true);
+        cout << "fixed rate 1000 fps:   " << setprecision(1) << play(&source, 1.0, 0, 0) << " frames/sec" << endl;
+    }
+
+    {
+        ReplaySource source(fileName);
+        source.setTiming(ReplaySource::TimingFastest);
+        unsigned int width = 0, height = 0, bytesPerLine = 0;
+        __u32 pixelFormat = 0;
+        if (source.open(&width, &height, &pixelFormat, &bytesPerLine) == 0) return 1;
+        source.start();
+
+        unsigned int seekCount = 1000000;
+        srand(1);
+        double start = now();
+        for (unsigned int a = 0; a < seekCount; ++a) {
+            source.seek(rand() % source.frameCount());
+
+            const unsigned char *data;
+            timespec time;
+            unsigned int sequence;
+            if (source.mapFrame(&data, &time, &sequence) > 0) s_sink = data[0];
+        }
+        double duration = now() - start;
+
+        cout << "seek and take a frame: " << setprecision(0) << duration * 1000000000.0 / seekCount << " ns" << endl;
+    }
+
+    remove(fileName.c_str());
+    return 0;
+}
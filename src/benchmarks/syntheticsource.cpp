@@ -0,0 +1,134 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* runs the synthetic source unthrottled and at 1000 frames per second in every format for a few resolutions,
+   the way a capture device does: wait for the file descriptor, read the frame into a buffer of a ring, publish.
+   Prints the frames per second achieved and the frames lost to a late reader (sequence gaps). */
+
+#include "framering.hpp"
+#include "syntheticsource.hpp"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <time.h>
+
+using namespace std;
+
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+
+int main(int argc, char **args)
+{
+    double seconds = argc > 1 ? atof(args[1]) : 1.0;
+
+    __u32 formats[] = {V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12,
+            V4L2_PIX_FMT_GREY};
+    const char *formatNames[] = {"RGB3", "YUYV", "UYVY", "NV12", "GREY"};
+    unsigned int sizes[][2] = {{320, 240}, {640, 480}, {1280, 720}};
+    double rates[] = {0.0, 1000.0};
+
+    cout << "format   resolution   requested fps   frames/sec   lost" << endl;
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (unsigned int f = 0; f < sizeof(formats) / sizeof(__u32); ++f) {
+            for (unsigned int r = 0; r < sizeof(rates) / sizeof(double); ++r) {
+                SyntheticSource source;
+                source.setFramesPerSecond(rates[r]);
+
+                unsigned int width = sizes[s][0];
+                unsigned int height = sizes[s][1];
+                __u32 pixelFormat = formats[f];
+                unsigned int bytesPerLine = 0;
+
+                size_t frameSize = source.open(&width, &height, &pixelFormat, &bytesPerLine);
+                if (frameSize == 0) {
+                    cerr << "Cannot open " << source.name() << endl;
+                    return 1;
+                }
+
+                FrameRing ring;
+                ring.resize(4);
+                vector<unsigned char> memory(ring.size() * frameSize);
+                for (unsigned int a = 0; a < ring.size(); ++a) {
+                    ring.buffer(a).buffer = &memory[a * frameSize];
+                    ring.buffer(a).length = frameSize;
+                }
+
+                pollfd descriptor;
+                descriptor.fd = source.fileDescriptor();
+                descriptor.events = POLLIN;
+
+                unsigned long long frames = 0;
+                unsigned long long lost = 0;
+                long long lastSequence = -1;
+
+                source.start();
+                double start = now();
+
+                while (now() - start < seconds) {
+                    if (poll(&descriptor, 1, 100) <= 0) continue;
+
+                    FrameRing::Buffer *buffer = ring.lockForWriting();
+                    if (buffer == 0) continue;
+
+                    size_t length = source.readFrame(buffer->buffer, buffer->length, &buffer->time, &buffer->sequence);
+                    if (length == 0) {
+                        ring.discard(buffer);
+                        continue;
+                    }
+                    buffer->bytesUsed = (unsigned int) length;
+
+                    if (lastSequence != -1) lost += buffer->sequence - lastSequence - 1;
+                    lastSequence = buffer->sequence;
+
+                    ring.publish(buffer);
+                    ++frames;
+                }
+
+                double duration = now() - start;
+                source.stop();
+                source.close();
+
+                ostringstream resolution, rate;
+                resolution << width << "x" << height;
+                if (rates[r] == 0.0) rate << "max"; else rate << rates[r];
+
+                cout << setw(6) << formatNames[f]
+                        << setw(13) << resolution.str()
+                        << setw(16) << rate.str()
+                        << setw(13) << fixed << setprecision(1) << frames / duration
+                        << setw(7) << lost << endl;
+            }
+        }
+    }
+
+    return 0;
+}
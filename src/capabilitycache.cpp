@@ -0,0 +1,264 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "capabilitycache.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/** changes whenever the layout below changes */
+static const char s_magic[8] = { 'V', 'C', 'C', 'A', 'P', 'S', '1', '\0' };
+
+/* layout of a file, in host byte order:
+     magic
+     sizes of v4l2_capability, v4l2_fmtdesc, v4l2_queryctrl, v4l2_querymenu - the headers might differ
+     v4l2_capability
+     format count, control count, menu item count
+     the formats, controls and menu items
+     FNV-1a checksum of everything before */
+struct FileHeader
+{
+    char magic[8];
+    __u32 capabilitySize;
+    __u32 formatSize;
+    __u32 controlSize;
+    __u32 menuItemSize;
+    struct v4l2_capability capability;
+    __u32 formatCount;
+    __u32 controlCount;
+    __u32 menuItemCount;
+};
+
+
+static bool isSameDevice(const struct v4l2_capability &a, const struct v4l2_capability &b);
+static unsigned long long checksum(const char *data, size_t length);
+static void append(string *data, const void *value, size_t length);
+static bool extract(const string &data, size_t *offset, void *value, size_t length);
+static bool makeDirectory(const string &path);
+
+
+CapabilityCache::CapabilityCache(const string &directory) :
+        m_directory(directory)
+{
+}
+
+
+const string &CapabilityCache::directory() const
+{
+    return m_directory;
+}
+
+
+bool CapabilityCache::load(const struct v4l2_capability &capability, Entry *entry) const
+{
+    ifstream file(fileName(capability).c_str(), ios::binary);
+    if (file.is_open() == false) return false;
+
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    unsigned long long storedChecksum;
+    if (data.size() < sizeof(FileHeader) + sizeof(storedChecksum)) return false;
+
+    memcpy(&storedChecksum, data.data() + data.size() - sizeof(storedChecksum), sizeof(storedChecksum));
+    data.resize(data.size() - sizeof(storedChecksum));
+    if (checksum(data.data(), data.size()) != storedChecksum) return false;
+
+    FileHeader header;
+    size_t offset = 0;
+    extract(data, &offset, &header, sizeof(FileHeader));
+
+    if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 ||
+            header.capabilitySize != sizeof(v4l2_capability) || header.formatSize != sizeof(v4l2_fmtdesc) ||
+            header.controlSize != sizeof(v4l2_queryctrl) || header.menuItemSize != sizeof(v4l2_querymenu)) {
+        return false;
+    }
+
+    /* other device at the same port, or the driver got updated */
+    if (isSameDevice(header.capability, capability) == false) return false;
+
+    if (data.size() - offset != header.formatCount * sizeof(v4l2_fmtdesc) +
+            header.controlCount * sizeof(v4l2_queryctrl) + header.menuItemCount * sizeof(v4l2_querymenu)) {
+        return false;
+    }
+
+    Entry ret;
+
+    ret.formats.resize(header.formatCount);
+    for (unsigned int a = 0; a < header.formatCount; ++a) {
+        extract(data, &offset, &ret.formats[a], sizeof(v4l2_fmtdesc));
+    }
+    for (unsigned int a = 0; a < header.controlCount; ++a) {
+        struct v4l2_queryctrl control;
+        extract(data, &offset, &control, sizeof(v4l2_queryctrl));
+        ret.controls.first.push_back(control);
+    }
+    for (unsigned int a = 0; a < header.menuItemCount; ++a) {
+        struct v4l2_querymenu menuItem;
+        extract(data, &offset, &menuItem, sizeof(v4l2_querymenu));
+        ret.controls.second.push_back(menuItem);
+    }
+
+    *entry = ret;
+    return true;
+}
+
+
+bool CapabilityCache::store(const struct v4l2_capability &capability, const Entry &entry) const
+{
+    if (makeDirectory(m_directory) == false) return false;
+
+    FileHeader header;
+    memset(&header, 0, sizeof(FileHeader));
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.capabilitySize = sizeof(v4l2_capability);
+    header.formatSize = sizeof(v4l2_fmtdesc);
+    header.controlSize = sizeof(v4l2_queryctrl);
+    header.menuItemSize = sizeof(v4l2_querymenu);
+    header.capability = capability;
+    header.formatCount = entry.formats.size();
+    header.controlCount = entry.controls.first.size();
+    header.menuItemCount = entry.controls.second.size();
+
+    string data;
+    append(&data, &header, sizeof(FileHeader));
+    for (auto it = entry.formats.begin(); it != entry.formats.end(); ++it) {
+        append(&data, &(*it), sizeof(v4l2_fmtdesc));
+    }
+    for (auto it = entry.controls.first.begin(); it != entry.controls.first.end(); ++it) {
+        append(&data, &(*it), sizeof(v4l2_queryctrl));
+    }
+    for (auto it = entry.controls.second.begin(); it != entry.controls.second.end(); ++it) {
+        append(&data, &(*it), sizeof(v4l2_querymenu));
+    }
+    unsigned long long dataChecksum = checksum(data.data(), data.size());
+    append(&data, &dataChecksum, sizeof(dataChecksum));
+
+    /* readers see the old or the new file, never a partial one */
+    string name = fileName(capability);
+    ostringstream temporaryName;
+    temporaryName << name << "." << getpid() << ".tmp";
+
+    ofstream file(temporaryName.str().c_str(), ios::binary | ios::trunc);
+    file.write(data.data(), data.size());
+    file.close();
+
+    if (file.fail() == true || rename(temporaryName.str().c_str(), name.c_str()) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " Cannot write \"" << name << "\" " << errno << " " << strerror(errno) << endl;
+        unlink(temporaryName.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+string CapabilityCache::defaultDirectory()
+{
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome != 0 && cacheHome[0] != '\0') return string(cacheHome) + "/videocapture";
+
+    const char *home = getenv("HOME");
+    if (home != 0 && home[0] != '\0') return string(home) + "/.cache/videocapture";
+
+    return "/tmp/videocapture";
+}
+
+
+string CapabilityCache::fileName(const struct v4l2_capability &capability) const
+{
+    /* card and version are checked on loading - a changed one replaces the file */
+    string ret = m_directory + "/";
+
+    string name = string((const char*) capability.driver, strnlen((const char*) capability.driver,
+            sizeof(capability.driver))) + "-" + string((const char*) capability.bus_info,
+            strnlen((const char*) capability.bus_info, sizeof(capability.bus_info)));
+
+    for (auto it = name.begin(); it != name.end(); ++it) {
+        bool isPlain = (*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9') ||
+                *it == '-' || *it == '.';
+        ret.push_back(isPlain == true ? *it : '_');
+    }
+
+    return ret + ".cache";
+}
+
+
+/* *** local *************************************************************** */
+bool isSameDevice(const struct v4l2_capability &a, const struct v4l2_capability &b)
+{
+    return strncmp((const char*) a.driver, (const char*) b.driver, sizeof(a.driver)) == 0 &&
+            strncmp((const char*) a.card, (const char*) b.card, sizeof(a.card)) == 0 &&
+            strncmp((const char*) a.bus_info, (const char*) b.bus_info, sizeof(a.bus_info)) == 0 &&
+            a.version == b.version;
+}
+
+
+unsigned long long checksum(const char *data, size_t length)
+{
+    unsigned long long ret = 14695981039346656037ULL;
+
+    for (size_t a = 0; a < length; ++a) {
+        ret ^= (unsigned char) data[a];
+        ret *= 1099511628211ULL;
+    }
+
+    return ret;
+}
+
+
+void append(string *data, const void *value, size_t length)
+{
+    data->append((const char*) value, length);
+}
+
+
+bool extract(const string &data, size_t *offset, void *value, size_t length)
+{
+    if (data.size() - *offset < length) return false;
+
+    memcpy(value, data.data() + *offset, length);
+    *offset += length;
+    return true;
+}
+
+
+/** creates the parents, too */
+bool makeDirectory(const string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) return S_ISDIR(st.st_mode);
+
+    string::size_type slash = path.find_last_of('/');
+    if (slash != string::npos && slash > 0 && makeDirectory(path.substr(0, slash)) == false) return false;
+
+    /* EEXIST - another device got here first */
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
@@ -0,0 +1,78 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CAPABILITY_CACHE_HPP
+#define CAPABILITY_CACHE_HPP
+
+#include "prereqs.hpp"
+
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+
+/**
+ * what a device reports about itself, stored on disk between runs
+ *
+ * One file per device, named after driver and bus_info. An entry is used only if driver, card, bus_info
+ * and version equal the ones VIDIOC_QUERYCAP reports now - one ioctl instead of enumerating formats and controls.
+ * Files, which are truncated, corrupt or written by a different build, are ignored and replaced.
+ */
+class CapabilityCache
+{
+public:
+
+    struct Entry
+    {
+        /** as enumerated through libv4l, including its emulated formats */
+        std::vector<struct v4l2_fmtdesc> formats;
+        std::pair<std::list<struct v4l2_queryctrl>, std::list<struct v4l2_querymenu> > controls;
+    };
+
+
+    /** @param directory created on the first store(), if missing */
+    CapabilityCache(const std::string &directory = defaultDirectory());
+    CapabilityCache(const CapabilityCache&) = delete;
+    CapabilityCache(CapabilityCache&&) = delete;
+    CapabilityCache &operator=(const CapabilityCache&) = delete;
+    CapabilityCache &operator=(CapabilityCache&&) = delete;
+
+    const std::string &directory() const;
+
+    /** @returns false, if there is no valid entry for the device */
+    bool load(const struct v4l2_capability &capability, Entry *entry) const;
+    /** replaces the device's entry
+        @returns false, if it could not be written. The cache is optional, so this is no error
+        @note devices may be stored concurrently */
+    bool store(const struct v4l2_capability &capability, const Entry &entry) const;
+
+    /** $XDG_CACHE_HOME/videocapture or ~/.cache/videocapture */
+    static std::string defaultDirectory();
+
+private:
+
+    std::string fileName(const struct v4l2_capability &capability) const;
+
+    std::string m_directory;
+};
+
+
+#endif /* CAPABILITY_CACHE_HPP */
@@ -18,14 +18,23 @@
 
 #include "capturedevice.hpp"
 
+#include "capabilitycache.hpp"
+#include "capturereactor.hpp"
+#include "capturesource.hpp"
+#include "framehistory.hpp"
+#include "framerecorder.hpp"
+#include "framesynchronizer.hpp"
+#include "pixelconversion.hpp"
+
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cerrno>
-#include <cmath>
 #include <cstring>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <thread>
 #include <vector>
 
@@ -33,6 +42,7 @@
 
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -40,15 +50,68 @@
 using namespace std;
 
 
+/** number of buffers, which stay queued in the driver in addition to the ring (streaming i/o) */
+static const unsigned int s_driverQueueLength = 2;
+
+static bool isJpeg(__u32 pixelFormat);
+static bool isWholeFrame(const CaptureDevice::RegionOfInterest &region, unsigned int width, unsigned int height);
+static unsigned int minimumBytesPerLine(__u32 pixelFormat, unsigned int width);
+static enum v4l2_memory memoryType(CaptureDevice::IoMethod ioMethod);
+
+
 CaptureDevice::CaptureDevice() :
         m_captureHeight(0),
         m_captureWidth(0),
         m_bufferCount(2),
+        m_ioMethod(IoMethodMmap),
+        m_pixelFormat(V4L2_PIX_FMT_RGB24),
+        m_backpressurePolicy(BackpressureDrop),
+        m_growLimit(4),
         m_fileDescriptor(-1),
+        m_bufferSize(0),
+        m_bytesPerLine(0),
+        m_queuedBufferCount(0),
+        m_writeBuffer(0),
+        m_discardBuffer(0),
+        m_mjpegDecoder(0),
+        m_previewFramesPerSecond(0.0),
+        m_outputRing(&m_ring),
+        m_croppingInHardware(false),
+        m_deviceWidth(0),
+        m_deviceHeight(0),
+        m_frameWidth(0),
+        m_frameHeight(0),
+        m_frameBytesPerLine(0),
+        m_regionFactor(1),
+        m_regionPosition(0),
+        m_regionAverage(true),
+        m_lastSequence(-1),
+        m_capturedFrameCount(0),
+        m_droppedFrameCount(0),
+        m_discardedFrameCount(0),
+        m_overwrittenFrameCount(0),
+        m_addedBufferCount(0),
+        m_captureReactor(0),
+        m_capturing(false),
         m_captureThread(0),
-        m_capturingPaused(false)
+        m_source(0),
+        m_capabilityCache(0),
+        m_capabilitiesFromCache(false),
+        m_controlsCached(false),
+        m_formatsCached(false),
+        m_controlsQueued(false)
 {
     // cerr << __PRETTY_FUNCTION__ << endl;
+    m_staleBefore.tv_sec = 0;
+    m_staleBefore.tv_nsec = 0;
+
+    m_regionOfInterest.left = 0;
+    m_regionOfInterest.top = 0;
+    m_regionOfInterest.width = 0;
+    m_regionOfInterest.height = 0;
+    m_regionOfInterest.factor = 1;
+    m_regionOfInterest.average = true;
+    memset(&m_cropcap, 0, sizeof(v4l2_cropcap));
 }
 
 
@@ -79,6 +142,59 @@ pair<unsigned int, unsigned int> CaptureDevice::captureSize() const
 }
 
 
+bool CaptureDevice::setRegionOfInterest(const RegionOfInterest &region)
+{
+    assert(region.factor == 1 || region.factor == 2 || region.factor == 4);
+
+    if (m_fileDescriptor == -1) {
+        m_regionOfInterest = region;
+        return true;
+    }
+
+    /* the rings and everything attached to them keep their geometry until the next init() */
+    RegionOfInterest fitted = fittedRegion(region);
+    if (fitted.width != m_regionOfInterest.width || fitted.height != m_regionOfInterest.height ||
+            fitted.factor != m_regionOfInterest.factor) {
+        return false;
+    }
+
+    if (m_croppingInHardware == true) {
+        struct v4l2_crop crop;
+        memset(&crop, 0, sizeof(v4l2_crop));
+        crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        crop.c = cropRectangle(m_cropcap, fitted);
+
+        /* many drivers refuse while streaming */
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_CROP, &crop) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " VIDIOC_S_CROP " << errno << " " << strerror(errno) << endl;
+            return false;
+        }
+    } else {
+        m_regionPosition = ((unsigned long long) fitted.left << 32) | fitted.top;
+    }
+    m_regionAverage = fitted.average;
+
+    m_regionOfInterest = fitted;
+    return true;
+}
+CaptureDevice::RegionOfInterest CaptureDevice::regionOfInterest() const
+{
+    return m_regionOfInterest;
+}
+
+
+bool CaptureDevice::isCroppingInHardware() const
+{
+    return m_croppingInHardware;
+}
+
+
+pair<unsigned int, unsigned int> CaptureDevice::frameSize() const
+{
+    return make_pair(m_frameWidth, m_frameHeight);
+}
+
+
 void CaptureDevice::setFileName(const std::string& name)
 {
     assert(name.empty() == false);
@@ -103,6 +219,145 @@ unsigned int CaptureDevice::bufferCount() const
 }
 
 
+void CaptureDevice::setCaptureReactor(CaptureReactor *reactor)
+{
+    assert(m_capturing == false);
+
+    m_captureReactor = reactor;
+}
+CaptureReactor *CaptureDevice::captureReactor() const
+{
+    return m_captureReactor;
+}
+
+
+void CaptureDevice::setThreadScheduling(const ThreadScheduling &scheduling)
+{
+    m_threadScheduling = scheduling;
+}
+
+
+const ThreadScheduling &CaptureDevice::threadScheduling() const
+{
+    return m_threadScheduling;
+}
+
+
+const ThreadScheduling &CaptureDevice::effectiveThreadScheduling() const
+{
+    return m_effectiveThreadScheduling;
+}
+
+
+int CaptureDevice::fileDescriptor() const
+{
+    return m_fileDescriptor;
+}
+
+
+void CaptureDevice::setPixelFormat(__u32 pixelFormat)
+{
+    assert(m_fileDescriptor == -1);
+    assert(pixelFormat == 0 || PixelConversion::isSupported(pixelFormat) || isJpeg(pixelFormat));
+
+    m_pixelFormat = pixelFormat;
+}
+__u32 CaptureDevice::pixelFormat() const
+{
+    return m_pixelFormat;
+}
+__u32 CaptureDevice::framePixelFormat() const
+{
+    return isJpeg(m_pixelFormat) ? V4L2_PIX_FMT_RGB24 : m_pixelFormat;
+}
+
+
+unsigned int CaptureDevice::bytesPerLine() const
+{
+    return m_frameBytesPerLine;
+}
+
+
+void CaptureDevice::setMjpegDecoder(MjpegDecoder *decoder)
+{
+    assert(m_fileDescriptor == -1);
+
+    m_mjpegDecoder = decoder;
+}
+MjpegDecoder *CaptureDevice::mjpegDecoder() const
+{
+    return m_mjpegDecoder;
+}
+
+
+void CaptureDevice::setCaptureSource(CaptureSource *source)
+{
+    assert(m_fileDescriptor == -1);
+    m_source = source;
+}
+
+
+CaptureSource *CaptureDevice::captureSource() const
+{
+    return m_source;
+}
+
+
+void CaptureDevice::setCapabilityCache(CapabilityCache *cache)
+{
+    assert(m_fileDescriptor == -1);
+    m_capabilityCache = cache;
+}
+
+
+CapabilityCache *CaptureDevice::capabilityCache() const
+{
+    return m_capabilityCache;
+}
+
+
+bool CaptureDevice::capabilitiesFromCache() const
+{
+    return m_capabilitiesFromCache;
+}
+
+
+void CaptureDevice::setIoMethod(IoMethod method)
+{
+    assert(m_fileDescriptor == -1);
+
+    m_ioMethod = method;
+}
+CaptureDevice::IoMethod CaptureDevice::ioMethod() const
+{
+    return m_ioMethod;
+}
+
+
+void CaptureDevice::setBackpressurePolicy(BackpressurePolicy policy)
+{
+    assert(m_fileDescriptor == -1);
+
+    m_backpressurePolicy = policy;
+}
+CaptureDevice::BackpressurePolicy CaptureDevice::backpressurePolicy() const
+{
+    return m_backpressurePolicy;
+}
+
+
+void CaptureDevice::setGrowLimit(unsigned int bufferCount)
+{
+    assert(m_fileDescriptor == -1);
+
+    m_growLimit = bufferCount;
+}
+unsigned int CaptureDevice::growLimit() const
+{
+    return m_growLimit;
+}
+
+
 bool CaptureDevice::init()
 {
     // cerr << __PRETTY_FUNCTION__ << endl;
@@ -113,6 +368,17 @@ bool CaptureDevice::init()
     assert(m_bufferCount > 1);
 
     m_captureThreadCancellationFlag = false;
+    m_capturedFrameCount = 0;
+    m_droppedFrameCount = 0;
+    m_discardedFrameCount = 0;
+    m_overwrittenFrameCount = 0;
+    m_addedBufferCount = 0;
+    m_timing.reset();
+
+    /* the device might be a different one now */
+    m_capabilitiesFromCache = false;
+    m_controlsCached = false;
+    m_formatsCached = false;
 
     /* *** initialize timer *** */
     int clockret = clock_gettime(CLOCK_MONOTONIC, &m_timerStart);
@@ -129,6 +395,8 @@ bool CaptureDevice::init()
         finish(); return false;
     }
 
+    if (m_source != 0) return initSource();
+
 
     /* *** open the device file *** */
     struct stat st;
@@ -171,91 +439,598 @@ bool CaptureDevice::init()
         finish(); return false;
     }
 
-    if (!(cap.capabilities  &V4L2_CAP_READWRITE)) {
+    if (m_ioMethod != IoMethodRead && !(cap.capabilities & V4L2_CAP_STREAMING)) {
+        cerr << "File does not support streaming i/o. Falling back to read i/o." << endl;
+        m_ioMethod = IoMethodRead;
+    }
+
+    if (!(cap.capabilities  &V4L2_CAP_READWRITE) && m_ioMethod == IoMethodRead) {
         cerr << "File does not support read i/o." << endl;
         finish(); return false;
     }
 
 
+    /* *** formats and controls *** */
+    if (m_capabilityCache != 0) {
+        CapabilityCache::Entry entry;
+
+        if (m_capabilityCache->load(cap, &entry) == true) {
+            m_formats.swap(entry.formats);
+            m_controls.swap(entry.controls);
+            m_formatsCached = true;
+            m_controlsCached = true;
+            m_capabilitiesFromCache = true;
+        } else {
+            /* missing, stale or corrupt - enumerate now, the next start will not have to */
+            entry.formats = formats();
+            entry.controls = controls();
+            m_capabilityCache->store(cap, entry);
+        }
+    }
+
+
     struct v4l2_cropcap cropcap;
     struct v4l2_crop crop;
     memset(&cropcap, 0, sizeof(v4l2_cropcap));
 
     cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     xv4l2_ioctl(m_fileDescriptor, VIDIOC_CROPCAP, &cropcap); /* ignore errors */
+    m_cropcap = cropcap;
 
     crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     crop.c = cropcap.defrect;
     xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_CROP, &crop); /* ignore errors */
 
 
+    if (m_pixelFormat == 0) {
+        m_pixelFormat = nativePixelFormat();
+        if (m_pixelFormat == 0) {
+            cerr << "No natively supported pixel format. Falling back to "
+                    << pixelFormatString(V4L2_PIX_FMT_RGB24) << "." << endl;
+            m_pixelFormat = V4L2_PIX_FMT_RGB24;
+        }
+    }
+
+    if (isJpeg(m_pixelFormat) == true && m_mjpegDecoder == 0) {
+        cerr << pixelFormatString(m_pixelFormat) << " needs a decoder." << endl;
+        finish(); return false;
+    }
+
     struct v4l2_format fmt;
     memset(&fmt, 0, sizeof(v4l2_format));
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     fmt.fmt.pix.width = m_captureWidth;
     fmt.fmt.pix.height = m_captureHeight;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+    fmt.fmt.pix.pixelformat = m_pixelFormat;
     fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    /* cache line padded rows, if the driver lets us choose */
+    fmt.fmt.pix.bytesperline = FrameArena::alignedRowLength(minimumBytesPerLine(m_pixelFormat, m_captureWidth));
 
     if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_FMT, &fmt) == -1) {
         cerr << __PRETTY_FUNCTION__ << " VIDIOC_S_FMT " << errno << " " << strerror(errno) << endl;
         finish(); return false;
     }
 
+    /* consumers only understand what PixelConversion understands. libv4l always offers RGB24 */
+    if (PixelConversion::isSupported(fmt.fmt.pix.pixelformat) == false &&
+            (isJpeg(fmt.fmt.pix.pixelformat) == false || m_mjpegDecoder == 0)) {
+        cerr << "Got unsupported pixel format " << pixelFormatString(fmt.fmt.pix.pixelformat)
+                << ". Retrying with " << pixelFormatString(V4L2_PIX_FMT_RGB24) << "." << endl;
+
+        fmt.fmt.pix.width = m_captureWidth;
+        fmt.fmt.pix.height = m_captureHeight;
+        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix.bytesperline = FrameArena::alignedRowLength(minimumBytesPerLine(V4L2_PIX_FMT_RGB24,
+                m_captureWidth));
+
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_FMT, &fmt) == -1 ||
+                PixelConversion::isSupported(fmt.fmt.pix.pixelformat) == false) {
+            cerr << __PRETTY_FUNCTION__ << " VIDIOC_S_FMT " << errno << " " << strerror(errno) << endl;
+            finish(); return false;
+        }
+    }
+
     if (fmt.fmt.pix.width != m_captureWidth || fmt.fmt.pix.height != m_captureHeight ||
-            fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 ||
+            fmt.fmt.pix.pixelformat != m_pixelFormat ||
             fmt.fmt.pix.field != V4L2_FIELD_NONE) {
 
         cerr << "Your parameters were changed: "
                 << m_captureWidth << "x" << m_captureHeight << " in "
-                << pixelFormatString(V4L2_PIX_FMT_RGB24) << ", fieldFormat " << V4L2_FIELD_NONE << " -> ";
+                << pixelFormatString(m_pixelFormat) << ", fieldFormat " << V4L2_FIELD_NONE << " -> ";
 
         m_captureWidth = fmt.fmt.pix.width;
         m_captureHeight = fmt.fmt.pix.height;
+        m_pixelFormat = fmt.fmt.pix.pixelformat;
 
         cerr << m_captureWidth << "x" << m_captureHeight << " in "
                 << pixelFormatString(fmt.fmt.pix.pixelformat) << ", fieldFormat " << fmt.fmt.pix.field<< endl;
     }
 
+    /* *** region of interest - the driver's cropping saves the bus and the copy *** */
+    m_regionOfInterest = fittedRegion(m_regionOfInterest);
+    m_croppingInHardware = false;
+    if (isWholeFrame(m_regionOfInterest, m_captureWidth, m_captureHeight) == false) {
+        m_croppingInHardware = initHardwareCrop(cropcap, &fmt);
+    }
+    m_deviceWidth = fmt.fmt.pix.width;
+    m_deviceHeight = fmt.fmt.pix.height;
+
 
     /* Buggy driver paranoia. */
     unsigned int min;
-    min = fmt.fmt.pix.width * 2;
+    min = minimumBytesPerLine(m_pixelFormat, fmt.fmt.pix.width);
     if (fmt.fmt.pix.bytesperline < min)
         fmt.fmt.pix.bytesperline = min;
     min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
+    if (m_pixelFormat == V4L2_PIX_FMT_NV12)
+        min += fmt.fmt.pix.bytesperline * ((fmt.fmt.pix.height + 1) / 2);
+    if (isJpeg(m_pixelFormat) == true)
+        min = fmt.fmt.pix.width * fmt.fmt.pix.height; /* 8 bit per pixel are plenty */
     if (fmt.fmt.pix.sizeimage < min)
         fmt.fmt.pix.sizeimage = min;
 
+    /* decoded frames are ours to lay out */
+    m_bytesPerLine = isJpeg(m_pixelFormat) ? FrameArena::alignedRowLength(fmt.fmt.pix.width * 3) :
+            fmt.fmt.pix.bytesperline;
     m_bufferSize = fmt.fmt.pix.sizeimage;
 
     /* *** allocate buffers *** */
-    for (unsigned int a=0; a < m_bufferCount; ++a) {
-        m_buffers.push_front(Buffer());
+    if (m_ioMethod == IoMethodUserPtr && initUserPtrBuffers() == false) {
+        cerr << "Cannot stream into user memory. Falling back to mmap i/o." << endl;
+        m_ioMethod = IoMethodMmap;
+    }
+
+    if (m_ioMethod == IoMethodMmap && initMmapBuffers() == false) {
+        if (!(cap.capabilities & V4L2_CAP_READWRITE)) {
+            cerr << "Cannot map driver buffers and file does not support read i/o." << endl;
+            finish(); return false;
+        }
+        cerr << "Cannot map driver buffers. Falling back to read i/o." << endl;
+        m_ioMethod = IoMethodRead;
+    }
+
+    return initRings();
+}
+
+
+bool CaptureDevice::initSource()
+{
+    /* the source writes into our buffers */
+    m_ioMethod = IoMethodRead;
+
+    unsigned int width = m_captureWidth;
+    unsigned int height = m_captureHeight;
+    __u32 pixelFormat = m_pixelFormat;
+    unsigned int bytesPerLine = FrameArena::alignedRowLength(minimumBytesPerLine(m_pixelFormat, m_captureWidth));
+
+    size_t frameSize = m_source->open(&width, &height, &pixelFormat, &bytesPerLine);
+    if (frameSize == 0) {
+        cerr << "Cannot open " << m_source->name() << "." << endl;
+        finish(); return false;
+    }
+    m_fileDescriptor = m_source->fileDescriptor();
+
+    if (isJpeg(pixelFormat) == true && m_mjpegDecoder == 0) {
+        cerr << pixelFormatString(pixelFormat) << " needs a decoder." << endl;
+        finish(); return false;
+    }
 
-        m_buffers.front().time = {numeric_limits<time_t>::min(), 0};
-        m_buffers.front().readerCount = 0;
-        m_buffers.front().buffer = (unsigned char*) malloc(sizeof(unsigned char)*m_bufferSize); 
-        assert(m_buffers.front().buffer != 0);
+    if (width != m_captureWidth || height != m_captureHeight || pixelFormat != m_pixelFormat) {
+        cerr << "Your parameters were changed: " << m_captureWidth << "x" << m_captureHeight << " in "
+                << pixelFormatString(m_pixelFormat) << " -> " << width << "x" << height << " in "
+                << pixelFormatString(pixelFormat) << endl;
 
-        m_timelySortedBuffers.push_back(&(m_buffers.front()));
+        m_captureWidth = width;
+        m_captureHeight = height;
+        m_pixelFormat = pixelFormat;
+    }
+
+    m_bytesPerLine = isJpeg(m_pixelFormat) ? FrameArena::alignedRowLength(m_captureWidth * 3) : bytesPerLine;
+    m_bufferSize = frameSize;
+
+    m_regionOfInterest = fittedRegion(m_regionOfInterest);
+    m_croppingInHardware = false;
+    m_deviceWidth = m_captureWidth;
+    m_deviceHeight = m_captureHeight;
+
+    /* nothing to enumerate */
+    m_formatsCached = true;
+    m_controlsCached = true;
+
+    return initRings();
+}
+
+
+bool CaptureDevice::initRings()
+{
+    if (m_ioMethod == IoMethodRead && initReadBuffers() == false) {
+        finish(); return false;
+    }
+
+    if (isDecoding() == true && initDecodedBuffers() == false) {
+        finish(); return false;
+    }
+    m_outputRing = isDecoding() ? &m_decodedRing : &m_ring;
+
+    if (initRegionBuffers() == false) {
+        finish(); return false;
+    }
+    if (m_regionRing.size() > 0) m_outputRing = &m_regionRing;
+
+    /* from the frames handed out - decoded and cropped */
+    if (m_previewFramesPerSecond > 0.0 && m_preview.setRing(m_outputRing, &m_notifier, framePixelFormat(),
+            m_frameWidth, m_frameHeight, m_frameBytesPerLine) == false) {
+        cerr << "Cannot set up the preview. Going without." << endl;
+    }
+
+    /* park the buffers for BackpressureGrow - a driver might have given us fewer than requested */
+    while (m_reserveBuffers.size() < reserveBufferCount() &&
+            m_ring.size() - m_reserveBuffers.size() > m_bufferCount + 1) {
+        m_reserveBuffers.push_back(m_ring.lockForWriting());
+    }
+
+    return true;
+}
+
+
+bool CaptureDevice::initReadBuffers()
+{
+    /* the decoder holds compressed frames while working on them */
+    m_ring.resize(m_bufferCount + (isDecoding() ? m_mjpegDecoder->threadCount() : 0) + reserveBufferCount());
+
+    /* the buffers are pointed at the source's frames one by one */
+    if (m_source != 0 && m_source->mapsFrames() == true) return true;
+
+    /* plus one frame to read discarded frames into */
+    if (m_arena.allocate(m_ring.size() + 1, m_bufferSize) == false) {
+        return false;
+    }
+    m_discardBuffer = m_arena.frame(m_ring.size());
+
+    for (unsigned int a=0; a < m_ring.size(); ++a) {
+        Buffer &buffer = m_ring.buffer(a);
+
+        buffer.buffer = m_arena.frame(a);
+        buffer.length = m_bufferSize;
     }
 
     return true;
 }
 
 
+bool CaptureDevice::initMmapBuffers()
+{
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(v4l2_requestbuffers));
+
+    req.count = m_bufferCount + s_driverQueueLength + (isDecoding() ? m_mjpegDecoder->threadCount() : 0) +
+            reserveBufferCount();
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_REQBUFS, &req) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " VIDIOC_REQBUFS " << errno << " " << strerror(errno) << endl;
+        return false;
+    }
+
+    /* the ring needs m_bufferCount buffers, the driver at least one to write into */
+    if (req.count < m_bufferCount + 1) {
+        cerr << __PRETTY_FUNCTION__ << " Insufficient buffer memory. Got " << req.count << " buffers" << endl;
+        freeBuffers(); return false;
+    }
+
+    /* the ring's indices equal the driver's */
+    m_ring.resize(req.count);
+
+    for (unsigned int a = 0; a < req.count; ++a) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(v4l2_buffer));
+
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = a;
+
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_QUERYBUF, &buf) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " VIDIOC_QUERYBUF " << errno << " " << strerror(errno) << endl;
+            freeBuffers(); return false;
+        }
+
+        m_fileAccessMutex.lock();
+        void *mapping = v4l2_mmap(0, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fileDescriptor,
+                buf.m.offset);
+        m_fileAccessMutex.unlock();
+
+        if (mapping == MAP_FAILED) {
+            cerr << __PRETTY_FUNCTION__ << " Cannot map buffer. " << errno << " " << strerror(errno) << endl;
+            freeBuffers(); return false;
+        }
+
+        m_ring.buffer(a).buffer = (unsigned char*) mapping;
+        m_ring.buffer(a).length = buf.length;
+    }
+
+    return true;
+}
+
+
+bool CaptureDevice::initUserPtrBuffers()
+{
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(v4l2_requestbuffers));
+
+    req.count = m_bufferCount + s_driverQueueLength + (isDecoding() ? m_mjpegDecoder->threadCount() : 0) +
+            reserveBufferCount();
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_REQBUFS, &req) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " VIDIOC_REQBUFS " << errno << " " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (req.count < m_bufferCount + 1) {
+        cerr << __PRETTY_FUNCTION__ << " Insufficient buffer memory. Got " << req.count << " buffers" << endl;
+        freeBuffers(); return false;
+    }
+
+    /* the ring's indices equal the driver's */
+    m_ring.resize(req.count);
+
+    if (m_arena.allocate(m_ring.size(), m_bufferSize) == false) {
+        freeBuffers(); return false;
+    }
+
+    for (unsigned int a = 0; a < m_ring.size(); ++a) {
+        m_ring.buffer(a).buffer = m_arena.frame(a);
+        m_ring.buffer(a).length = m_bufferSize;
+    }
+
+    return true;
+}
+
+
+bool CaptureDevice::initDecodedBuffers()
+{
+    /* a decoding thread, which finished early, keeps its frame until the older ones are published
+       and continues with the next one meanwhile */
+    m_decodedRing.resize(m_bufferCount + 2 * m_mjpegDecoder->threadCount());
+
+    if (m_decodedArena.allocate(m_decodedRing.size(), m_bytesPerLine * m_deviceHeight) == false) {
+        return false;
+    }
+
+    for (unsigned int a = 0; a < m_decodedRing.size(); ++a) {
+        Buffer &buffer = m_decodedRing.buffer(a);
+
+        buffer.buffer = m_decodedArena.frame(a);
+        buffer.length = m_bytesPerLine * m_deviceHeight;
+    }
+
+    m_decodeStream.setOutput(&m_decodedRing, m_deviceWidth, m_deviceHeight, m_bytesPerLine);
+    m_decodeStream.setNotifier(&m_notifier);
+
+    return true;
+}
+
+
+bool CaptureDevice::initRegionBuffers()
+{
+    RegionOfInterest &region = m_regionOfInterest;
+    unsigned int width = region.width / region.factor;
+    unsigned int height = region.height / region.factor;
+
+    /* left to us: the binning or decimation, if the driver only crops, everything, if it does not crop */
+    m_regionFactor = m_croppingInHardware == true ? m_deviceWidth / width : region.factor;
+    bool copying = m_croppingInHardware == true ? m_regionFactor > 1 :
+            isWholeFrame(region, m_captureWidth, m_captureHeight) == false;
+
+    if (copying == true && isDecoding() == true) {
+        cerr << "Cannot copy the region out of decoded frames. Handing out the frames as the device delivers them."
+                << endl;
+        if (m_croppingInHardware == false) {
+            region.left = 0;
+            region.top = 0;
+            region.width = m_captureWidth;
+            region.height = m_captureHeight;
+        }
+        region.factor = 1;
+        copying = false;
+    }
+
+    if (copying == false) {
+        m_frameWidth = m_deviceWidth;
+        m_frameHeight = m_deviceHeight;
+        m_frameBytesPerLine = m_bytesPerLine;
+        return true;
+    }
+
+    m_frameWidth = width;
+    m_frameHeight = height;
+    m_frameBytesPerLine = FrameArena::alignedRowLength(minimumBytesPerLine(m_pixelFormat, width));
+    size_t frameSize = (size_t) m_frameBytesPerLine * height;
+    if (m_pixelFormat == V4L2_PIX_FMT_NV12) frameSize += (size_t) m_frameBytesPerLine * ((height + 1) / 2);
+
+    /* readers lock these instead of the captured frames, so the reserve for BackpressureGrow is needed here */
+    m_regionRing.resize(m_bufferCount + reserveBufferCount());
+    if (m_regionArena.allocate(m_regionRing.size(), frameSize) == false) {
+        return false;
+    }
+
+    for (unsigned int a = 0; a < m_regionRing.size(); ++a) {
+        Buffer &buffer = m_regionRing.buffer(a);
+
+        buffer.buffer = m_regionArena.frame(a);
+        buffer.length = frameSize;
+    }
+
+    m_regionPosition = m_croppingInHardware == true ? 0 : ((unsigned long long) region.left << 32) | region.top;
+    m_regionAverage = region.average;
+
+    return true;
+}
+
+
+bool CaptureDevice::initHardwareCrop(const struct v4l2_cropcap &cropcap, struct v4l2_format *format)
+{
+    const RegionOfInterest &region = m_regionOfInterest;
+
+    /* no bounds to map the region into */
+    if (cropcap.defrect.width == 0 || cropcap.defrect.height == 0) return false;
+
+    struct v4l2_crop crop;
+    memset(&crop, 0, sizeof(v4l2_crop));
+    crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    crop.c = cropRectangle(cropcap, region);
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_CROP, &crop) == -1) return false;
+
+    /* drivers silently round to what they can do - only the exact rectangle is of use */
+    struct v4l2_crop actual;
+    memset(&actual, 0, sizeof(v4l2_crop));
+    actual.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bool ret = xv4l2_ioctl(m_fileDescriptor, VIDIOC_G_CROP, &actual) != -1 &&
+            memcmp(&actual.c, &crop.c, sizeof(v4l2_rect)) == 0;
+
+    /* drivers, which scale, take the reduced size. The others return the region's, we reduce then */
+    struct v4l2_format cropped = *format;
+    if (ret == true) {
+        cropped.fmt.pix.width = region.width / region.factor;
+        cropped.fmt.pix.height = region.height / region.factor;
+        cropped.fmt.pix.bytesperline = FrameArena::alignedRowLength(minimumBytesPerLine(m_pixelFormat,
+                cropped.fmt.pix.width));
+
+        ret = xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_FMT, &cropped) != -1 &&
+                cropped.fmt.pix.pixelformat == format->fmt.pix.pixelformat &&
+                ((cropped.fmt.pix.width == region.width / region.factor &&
+                        cropped.fmt.pix.height == region.height / region.factor) ||
+                (cropped.fmt.pix.width == region.width && cropped.fmt.pix.height == region.height));
+    }
+
+    if (ret == true) {
+        *format = cropped;
+        return true;
+    }
+
+    /* back to the whole frame */
+    crop.c = cropcap.defrect;
+    xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_CROP, &crop); /* ignore errors */
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_FMT, format) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " VIDIOC_S_FMT " << errno << " " << strerror(errno) << endl;
+    }
+
+    return false;
+}
+
+
+struct v4l2_rect CaptureDevice::cropRectangle(const struct v4l2_cropcap &cropcap,
+        const RegionOfInterest &region) const
+{
+    /* the default rectangle is what the whole frame shows */
+    const struct v4l2_rect &whole = cropcap.defrect;
+
+    struct v4l2_rect ret;
+    ret.left = whole.left + (long long) region.left * whole.width / m_captureWidth;
+    ret.top = whole.top + (long long) region.top * whole.height / m_captureHeight;
+    ret.width = (long long) region.width * whole.width / m_captureWidth;
+    ret.height = (long long) region.height * whole.height / m_captureHeight;
+
+    return ret;
+}
+
+
+CaptureDevice::RegionOfInterest CaptureDevice::fittedRegion(const RegionOfInterest &region) const
+{
+    RegionOfInterest ret = region;
+
+    if (ret.width == 0 || ret.height == 0) {
+        ret.left = 0;
+        ret.top = 0;
+        ret.width = m_captureWidth;
+        ret.height = m_captureHeight;
+    }
+
+    unsigned int horizontal, vertical;
+    PixelConversion::regionGranularity(m_pixelFormat, ret.factor, &horizontal, &vertical);
+
+    ret.width = min(ret.width, m_captureWidth);
+    ret.height = min(ret.height, m_captureHeight);
+    ret.width = max(ret.width - ret.width % horizontal, horizontal);
+    ret.height = max(ret.height - ret.height % vertical, vertical);
+
+    ret.left = min(ret.left, m_captureWidth - ret.width);
+    ret.top = min(ret.top, m_captureHeight - ret.height);
+    ret.left -= ret.left % horizontal;
+    ret.top -= ret.top % vertical;
+
+    return ret;
+}
+
+
+void CaptureDevice::freeBuffers()
+{
+    for (unsigned int a = 0; a < m_ring.size(); ++a) {
+        Buffer &buffer = m_ring.buffer(a);
+        if (buffer.buffer == 0) continue;
+
+        if (m_ioMethod == IoMethodMmap) {
+            m_fileAccessMutex.lock();
+            int ret = v4l2_munmap(buffer.buffer, buffer.length);
+            m_fileAccessMutex.unlock();
+            if (ret == -1) {
+                cerr << __PRETTY_FUNCTION__ << " Cannot unmap buffer. " << errno << " " << strerror(errno) << endl;
+            }
+        }
+        buffer.buffer = 0;
+    }
+    m_ring.resize(0);
+    m_reserveBuffers.clear();
+    m_discardBuffer = 0;
+
+    m_decodedRing.resize(0);
+    m_regionRing.resize(0);
+    m_preview.clearRing();
+    m_outputRing = &m_ring;
+
+    if (m_ioMethod != IoMethodRead && m_fileDescriptor != -1) {
+        /* release the driver's buffers - before the memory of user pointers */
+        struct v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(v4l2_requestbuffers));
+        req.count = 0;
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = memoryType(m_ioMethod);
+        xv4l2_ioctl(m_fileDescriptor, VIDIOC_REQBUFS, &req); /* ignore errors */
+    }
+
+    m_arena.release();
+    m_decodedArena.release();
+    m_regionArena.release();
+}
+
+
 void CaptureDevice::finish()
 {
     /* *** stop capturing *** */
-    if (m_captureThread != 0) {
+    if (isCapturing() == true) {
         stopCapturing();
     }
 
 
+    /* *** free buffers - before closing, because mapped buffers belong to the device *** */
+    freeBuffers();
+    m_bufferSize = 0;
+    m_bytesPerLine = 0;
+    m_frameWidth = 0;
+    m_frameHeight = 0;
+    m_frameBytesPerLine = 0;
+
+
     /* *** close device *** */
-    if (m_fileDescriptor != -1) {
+    if (m_source != 0) {
+        if (m_fileDescriptor != -1) m_source->close();
+        m_fileDescriptor = -1;
+    } else if (m_fileDescriptor != -1) {
         m_fileAccessMutex.lock();
         int ret = v4l2_close(m_fileDescriptor);
         m_fileAccessMutex.unlock();
@@ -264,17 +1039,6 @@ void CaptureDevice::finish()
         }
         m_fileDescriptor = -1;
     }
-
-
-    /* *** free buffers *** */
-    if (m_buffers.empty() == false) {
-        for (auto a = m_buffers.begin(); a != m_buffers.end(); ++a) {
-            assert(a->buffer != 0);
-            free (a->buffer); a->buffer = 0;
-        }
-        m_buffers.clear();
-    }
-    m_bufferSize = 0;
 }
 
 
@@ -283,32 +1047,78 @@ void CaptureDevice::printDeviceInfo()
     // cerr << __PRETTY_FUNCTION__ << endl;
     assert(m_fileDescriptor != -1);
 
-	struct v4l2_capability cap;
-	/* check capabilities */
-	if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_QUERYCAP, &cap) == -1) {
-        if (EINVAL == errno) {
-            cerr << __PRETTY_FUNCTION__ << "Device is no V4L2 device." << endl;
-            abort();
-        } else {
-            cerr << __PRETTY_FUNCTION__ << " VIDIOC_QUERYCAP " << errno << " " << strerror(errno) << endl;
-            return;
+    if (m_source != 0) {
+        cout << "Device info:" << endl
+                << "  source: " << m_source->name() << endl;
+    } else {
+        struct v4l2_capability cap;
+        /* check capabilities */
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_QUERYCAP, &cap) == -1) {
+            if (EINVAL == errno) {
+                cerr << __PRETTY_FUNCTION__ << "Device is no V4L2 device." << endl;
+                abort();
+            } else {
+                cerr << __PRETTY_FUNCTION__ << " VIDIOC_QUERYCAP " << errno << " " << strerror(errno) << endl;
+                return;
+            }
         }
-	}
 
-    cout << "Device info:" << endl
-            << "  driver: " << cap.driver << endl
-            << "  card: " << cap.card << endl
-            << "  bus info: " << cap.bus_info << endl
-            << "  version: " << cap.version << endl;
+        cout << "Device info:" << endl
+                << "  driver: " << cap.driver << endl
+                << "  card: " << cap.card << endl
+                << "  bus info: " << cap.bus_info << endl
+                << "  version: " << cap.version << endl;
+
+        cout << "  supports: ";
+
+        if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+            cout << "capture, ";
+        }
+
+        if (cap.capabilities & V4L2_CAP_STREAMING) {
+            cout << "streaming";
+        }
+        cout << endl;
+    }
+
+    if (m_capabilityCache != 0 && m_source == 0) {
+        cout << "  formats and controls: " << (m_capabilitiesFromCache == true ? "from" : "stored in")
+                << " the cache in " << m_capabilityCache->directory() << endl;
+    }
+
+    cout << "  capturing: " << m_captureWidth << "x" << m_captureHeight << " " << pixelFormatString(m_pixelFormat)
+            << ", " << (m_ioMethod == IoMethodMmap ? "mmap" : (m_ioMethod == IoMethodUserPtr ? "userptr" : "read"))
+            << " i/o"
+            << ", conversion: " << PixelConversion::implementation() << endl;
 
-    cout << "  supports: ";
+    if (isWholeFrame(m_regionOfInterest, m_captureWidth, m_captureHeight) == false) {
+        const RegionOfInterest &region = m_regionOfInterest;
+        cout << "  region: " << region.width << "x" << region.height << " at " << region.left << "," << region.top;
+        if (region.factor > 1) {
+            cout << ", " << (region.average == true ? "binned" : "decimated") << " by " << region.factor;
+        }
+        cout << " -> " << m_frameWidth << "x" << m_frameHeight << ", "
+                << (m_croppingInHardware == false ? "copied" :
+                        (m_regionFactor > 1 ? "cropped by the driver, reduced by copying" : "cropped by the driver"))
+                << endl;
+    }
+
+    if (m_arena.frameCount() > 0 || m_decodedArena.frameCount() > 0) {
+        cout << "  buffer memory: "
+                << FrameArena::pageSizeString(m_arena.frameCount() > 0 ? m_arena.pageSize() : m_decodedArena.pageSize())
+                << endl;
+    }
 
-	if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) {
-        cout << "capture, ";
+    if (m_preview.size().first > 0) {
+        cout << "  preview: " << m_preview.size().first << "x" << m_preview.size().second << " RGB3 (1/"
+                << m_preview.factor() << ") at up to " << m_preview.framesPerSecond() << " fps" << endl;
     }
 
-	if (cap.capabilities & V4L2_CAP_STREAMING) {
-        cout << "streaming";
+    cout << "  buffers: " << m_ring.size() - m_reserveBuffers.size() << ", backpressure: ";
+    switch (m_backpressurePolicy) {
+    case BackpressureGrow: cout << "grow by up to " << m_reserveBuffers.size(); break;
+    case BackpressureOverwrite: cout << "overwrite"; break;
+    default: cout << "drop"; break;
     }
     cout << endl;
 }
@@ -319,7 +1129,7 @@ void CaptureDevice::printControls()
     // cerr << __PRETTY_FUNCTION__ << endl;
     assert(m_fileDescriptor != -1);
 
-    pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > ctlsAndMenus = controls();
+    const pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > &ctlsAndMenus = controls();
 
     const list<struct v4l2_queryctrl> &ctls = ctlsAndMenus.first;
     const list<struct v4l2_querymenu> &menus = ctlsAndMenus.second;
@@ -327,7 +1137,7 @@ void CaptureDevice::printControls()
     cout << "Available Controls:" << endl;
     for (auto it = ctls.begin(); it != ctls.end(); ++it) {
 
-        cout << "  " << it->id - V4L2_CID_BASE << " \"" << it->name << "\""
+        cout << "  0x" << hex << it->id << dec << " \"" << it->name << "\""
                 << ((it->flags & V4L2_CTRL_FLAG_DISABLED) ? " +" : " !") << "disabled,"
                 << ((it->flags & V4L2_CTRL_FLAG_GRABBED) ? " +" : " !") << "grabbed,"
                 << ((it->flags & V4L2_CTRL_FLAG_READ_ONLY) ? " +" : " !") << "readonly,"
@@ -355,7 +1165,8 @@ void CaptureDevice::printControls()
             cout << " control class type";
             break;
         default:
-            assert(0);
+            cout << " type " << it->type;
+            break;
         }
 
         cout << ", min " << it->minimum << ", max " << it->maximum << ", step "
@@ -444,192 +1255,373 @@ void CaptureDevice::printFormats()
     int formatCount = sizeof(pixelFormats) / sizeof(FormatRecord);
     
 
-    cout << "Supported Hardware Formats: " << endl;
+    /* libv4l flags the formats it converts to itself */
+    ostringstream hardwareFormats;
+    ostringstream softwareFormats;
+    const vector<struct v4l2_fmtdesc> &all = formats();
+
+    for (auto it = all.begin(); it != all.end(); ++it) {
+        for (int a = 0; a < formatCount; ++a) {
+            if (it->pixelformat == pixelFormats[a].id) {
+                ostringstream line;
+                line << "  " << it->description
+                        << ((it->flags & V4L2_FMT_FLAG_COMPRESSED) ? " compressed" : " raw")
+                        << " \"" << pixelFormats[a].name << "\"" << endl;
+
+                if ((it->flags & V4L2_FMT_FLAG_EMULATED) == 0) hardwareFormats << line.str();
+                softwareFormats << line.str();
+                break;
+            }
+        }
+    }
 
-	/* ask for a pixel format enumeration */
-	int ioctlError = 0;
-	int formatIndex = 0;
+    cout << "Supported Hardware Formats: " << endl << hardwareFormats.str();
+    cout << "Supported Software Formats: " << endl << softwareFormats.str();
+}
 
-	while (ioctlError == 0) {
 
-        struct v4l2_fmtdesc format;
-        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		format.index = formatIndex;
+FrameRef CaptureDevice::lockNewestFrame()
+{
+    const Buffer *buffer = m_outputRing->lockNewest();
+    if (buffer == 0) return FrameRef();
 
-		m_fileAccessMutex.lock();
-        ioctlError = ioctl(m_fileDescriptor, VIDIOC_ENUM_FMT, &format);
-        m_fileAccessMutex.unlock();
+    return FrameRef(buffer, framePixelFormat(), m_frameWidth, m_frameHeight, m_frameBytesPerLine);
+}
+
+
+unsigned int CaptureDevice::lockNewestFrames(FrameRef *frames, unsigned int n)
+{
+    unsigned int ret = 0;
+
+    for (const Buffer *buffer = m_outputRing->lockNewest(); buffer != 0 && ret < n; ) {
+        frames[ret++] = FrameRef(buffer, framePixelFormat(), m_frameWidth, m_frameHeight, m_frameBytesPerLine);
+        if (ret < n) buffer = m_outputRing->lockNewestOlderThan(frames[ret - 1].serial());
+    }
+
+    return ret;
+}
+
+
+unsigned int CaptureDevice::newerBuffersAvailable(const timespec &newerThan)
+{
+    return m_outputRing->newerBuffersAvailable(newerThan);
+}
+
+
+unsigned long long CaptureDevice::newestSerial() const
+{
+    return m_outputRing->latestSerial();
+}
+
+
+unsigned long long CaptureDevice::waitForNewerBuffers(unsigned long long newerThanSerial, long timeoutNanoseconds)
+{
+    return m_notifier.wait(newerThanSerial, timeoutNanoseconds);
+}
+
+
+void CaptureDevice::addNotificationFileDescriptor(int fileDescriptor)
+{
+    m_notifier.addFileDescriptor(fileDescriptor);
+}
+
+
+void CaptureDevice::removeNotificationFileDescriptor(int fileDescriptor)
+{
+    m_notifier.removeFileDescriptor(fileDescriptor);
+}
+
+
+unsigned int CaptureDevice::addToSynchronizer(FrameSynchronizer *synchronizer)
+{
+    assert(m_fileDescriptor != -1);
+
+    return synchronizer->addRing(m_outputRing, &m_notifier, framePixelFormat(), m_frameWidth, m_frameHeight,
+            m_frameBytesPerLine);
+}
+
+
+unsigned int CaptureDevice::addToRecorder(FrameRecorder *recorder, const string &fileName, bool compressed)
+{
+    assert(m_fileDescriptor != -1);
+
+    /* passthrough - compressed frames have no rows */
+    if (compressed == true && isDecoding() == true) {
+        return recorder->addRing(&m_ring, &m_compressedNotifier, m_pixelFormat, m_deviceWidth, m_deviceHeight, 0,
+                fileName);
+    }
+
+    return recorder->addRing(m_outputRing, &m_notifier, framePixelFormat(), m_frameWidth, m_frameHeight,
+            m_frameBytesPerLine, fileName);
+}
+
+
+void CaptureDevice::setPreview(unsigned int maximumWidth, unsigned int maximumHeight, double framesPerSecond)
+{
+    assert(m_fileDescriptor == -1);
+
+    m_previewFramesPerSecond = framesPerSecond;
+    if (framesPerSecond > 0.0) {
+        m_preview.setMaximumSize(maximumWidth, maximumHeight);
+        m_preview.setFramesPerSecond(framesPerSecond);
+    }
+}
 
-		if (ioctlError == 0) {
-			for (int a = 0; a < formatCount; ++a) {
-				if (format.pixelformat == pixelFormats[a].id) {
-                    cout << "  " << format.description
-                            << ((format.flags & V4L2_FMT_FLAG_COMPRESSED) ? " compressed" : " raw")
-                            << " \"" << pixelFormats[a].name << "\"" << endl;
-					break;
-				}
-			}
-		}
 
-        ++formatIndex;
-	}
+PreviewStream *CaptureDevice::preview()
+{
+    return m_preview.size().first > 0 ? &m_preview : 0;
+}
+
+
+void CaptureDevice::addToHistory(FrameHistory *history)
+{
+    assert(m_fileDescriptor != -1);
+
+    history->setRing(m_outputRing, &m_notifier, framePixelFormat(), m_frameWidth, m_frameHeight,
+            m_frameBytesPerLine);
+}
+
+
+CaptureDevice::FrameCounters CaptureDevice::frameCounters() const
+{
+    FrameCounters ret;
+    ret.captured = m_capturedFrameCount.load(memory_order_relaxed);
+    ret.dropped = m_droppedFrameCount.load(memory_order_relaxed);
+    ret.undecoded = m_decodeStream.droppedFrameCount();
+    ret.discarded = m_discardedFrameCount.load(memory_order_relaxed);
+    ret.overwritten = m_overwrittenFrameCount.load(memory_order_relaxed);
+    ret.addedBuffers = m_addedBufferCount.load(memory_order_relaxed);
+    return ret;
+}
+
+
+FrameTiming::Statistics CaptureDevice::frameTiming() const
+{
+    return m_timing.statistics();
+}
+
+
+bool CaptureDevice::startCapturing()
+{
+    assert(m_capturing == false);
+
+    if (isDecoding() == true) {
+        m_mjpegDecoder->attach(&m_decodeStream);
+    }
+
+    /* the time while not capturing is no interval between frames */
+    m_timing.skipInterval();
+
+    if (m_source != 0) {
+        m_lastSequence = -1;
+
+        /* it would never become readable */
+        if (m_source->start() == false) {
+            cerr << __PRETTY_FUNCTION__ << " cannot start \"" << m_source->name() << "\"" << endl;
+            m_source->stop();
+            if (isDecoding() == true) m_mjpegDecoder->detach(&m_decodeStream);
+            return false;
+        }
+    }
 
+    if (m_ioMethod != IoMethodRead) {
 
-    cout << "Supported Software Formats: " << endl;
+        /* hand all buffers, which are not needed for the readers, to the driver */
+        requeueSurplusBuffers();
 
-    /* ask for a pixel format enumeration */
-    ioctlError = 0;
-    formatIndex = 0;
+        /* the driver restarts counting */
+        m_lastSequence = -1;
 
-    while (ioctlError == 0) {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_STREAMON, &type) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " VIDIOC_STREAMON " << errno << " " << strerror(errno) << endl;
 
-        struct v4l2_fmtdesc format;
-        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        format.index = formatIndex;
+            /* give the queued buffers back to the ring */
+            streamOff();
+            if (isDecoding() == true) m_mjpegDecoder->detach(&m_decodeStream);
+            return false;
+        }
+    }
 
-        ioctlError = xv4l2_ioctl(m_fileDescriptor, VIDIOC_ENUM_FMT, &format);
+    if (m_captureReactor != 0) {
+        m_captureReactor->attach(this);
+    } else {
+        m_captureThread = new thread(bind(captureThread, this));
 
-        if (ioctlError == 0) {
-            for (int a = 0; a < formatCount; ++a) {
-                if (format.pixelformat == pixelFormats[a].id) {
-                    cout << "  " << format.description
-                            << ((format.flags & V4L2_FMT_FLAG_COMPRESSED) ? " compressed" : " raw")
-                            << " \"" << pixelFormats[a].name << "\"" << endl;
-                    break;
-                }
-            }
+        if (m_threadScheduling.isDefault() == false) {
+            m_effectiveThreadScheduling = m_threadScheduling.apply(m_captureThread->native_handle());
+            cout << m_fileName << ": capture thread " << m_effectiveThreadScheduling.toString() << endl;
+        } else {
+            m_effectiveThreadScheduling = ThreadScheduling::ofThread(m_captureThread->native_handle());
         }
+    }
 
-        ++formatIndex;
+    m_capturing = true;
+
+    if (preview() != 0 && m_preview.start() == false) {
+        cerr << "Cannot start the preview." << endl;
     }
+
+    return true;
 }
 
 
-deque<const CaptureDevice::Buffer*> CaptureDevice::lockFirstNBuffers(unsigned int n)
+void CaptureDevice::stopCapturing()
 {
-    std::deque<const Buffer*> ret;
+    if (m_capturing == true) {
 
-    m_timelySortedBuffersMutex.lock();
-    unsigned int a = 0;
-    for (auto it = m_timelySortedBuffers.begin(); a < n && it != m_timelySortedBuffers.end(); ++it, ++a) {
+        /* it holds a frame of the output ring */
+        m_preview.stop();
 
-        ret.push_back(*it);
-        ++(*it)->readerCount;
+        if (isCapturingPaused() == true) pauseCapturing(false);
 
-    }
-    m_timelySortedBuffersMutex.unlock();
+        if (m_captureReactor != 0) {
+            m_captureReactor->detach(this);
+        } else {
+            assert(m_captureThread->joinable() == true);
 
+            m_captureThreadCancellationFlag = true;
+            m_captureThread->join();
+            m_captureThreadCancellationFlag = false;
 
-    return ret;
-}
+            delete m_captureThread;
+            m_captureThread = 0;
+        }
 
+        m_capturing = false;
 
-void CaptureDevice::unlock(const deque<const Buffer*> &buffers)
-{
-    m_timelySortedBuffersMutex.lock();
-    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-        for (auto it2 = m_timelySortedBuffers.begin(); it2 != m_timelySortedBuffers.end(); ++it2) {
+        if (m_source != 0) m_source->stop();
 
-            if (*it == *it2) {
-                --((*it2)->readerCount);
-                assert((*it2)->readerCount >= 0);
-            }
+        /* the decoder must not hold any compressed buffer anymore */
+        if (isDecoding() == true) {
+            m_mjpegDecoder->detach(&m_decodeStream);
+        }
+
+        if (m_writeBuffer != 0) {
+            m_ring.discard(m_writeBuffer);
+            m_writeBuffer = 0;
+        }
+
+        if (m_ioMethod != IoMethodRead) {
+            streamOff();
         }
     }
-    m_timelySortedBuffersMutex.unlock();
 }
 
 
-unsigned int CaptureDevice::newerBuffersAvailable(const timespec &newerThan)
+bool CaptureDevice::isCapturing() const
 {
-    unsigned int ret = 0;
-    auto it = m_timelySortedBuffers.begin();
+    return m_capturing;
+}
+
+
+void CaptureDevice::pauseCapturing(bool pause)
+{
+    if (isCapturing() == false) return;
 
-    m_timelySortedBuffersMutex.lock();
+    if (pause == true) {
+        m_pauseGate.pause();
 
-    // cerr << (*it)->time.tv_sec - newerThan.tv_sec << " " << (*it)->time.tv_nsec - newerThan.tv_nsec << endl;
+        /* the reactor must not block on one device - it stops watching it instead */
+        if (m_captureReactor != 0) m_captureReactor->setWatching(this, false);
 
-    for (; it != m_timelySortedBuffers.end(); ++it) {
-        if (((*it)->time.tv_sec < newerThan.tv_sec) ||
-                (((*it)->time.tv_sec == newerThan.tv_sec) && ((*it)->time.tv_nsec <= newerThan.tv_nsec))
-                ) {
-            break;
-        }
-        ++ret;
+    } else {
+        if (isCapturingPaused() == false) return;
 
-    }
-    m_timelySortedBuffersMutex.unlock();
+        m_timing.skipInterval();
 
-    return ret;
+        if (m_captureReactor != 0) {
+            /* not watched, so nobody captures */
+            skipFramesTakenWhilePaused();
+            m_pauseGate.resume();
+            m_captureReactor->setWatching(this, true);
+        } else {
+            /* the capture thread calls skipFramesTakenWhilePaused() itself, if it parked */
+            m_pauseGate.resume();
+        }
+    }
 }
 
 
-pair<double, double> CaptureDevice::determineCapturePeriod(double secondsToIterate)
+bool CaptureDevice::isCapturingPaused() const
 {
-    pair<double, double> ret;
-
-    thread t(bind(determineCapturePeriodThread, secondsToIterate, this, &ret));
-    t.join();
-    
-    return ret;
+    return m_pauseGate.isPaused();
 }
 
 
-void CaptureDevice::startCapturing()
+PauseGate::Statistics CaptureDevice::resumeStatistics() const
 {
-    assert(m_captureThread == 0);
-    m_captureThread = new thread(bind(captureThread, this));
+    return m_pauseGate.statistics();
 }
 
 
-void CaptureDevice::stopCapturing()
+const vector<struct v4l2_fmtdesc> &CaptureDevice::formats()
 {
-    if (m_captureThread != 0) {
-        assert(m_captureThread->joinable() == true);
-
-        if (isCapturingPaused() == true) pauseCapturing(false);
+    assert(m_fileDescriptor != -1);
 
-        m_captureThreadCancellationFlag = true;
-        m_captureThread->join();
-        m_captureThreadCancellationFlag = false;
+    if (m_formatsCached == false) {
+        m_formats.clear();
 
-        delete m_captureThread;
-        m_captureThread = 0;
+        enumerateFormats(m_formats);
+        m_formatsCached = true;
     }
+
+    return m_formats;
 }
 
 
-bool CaptureDevice::isCapturing() const
+void CaptureDevice::enumerateFormats(vector<struct v4l2_fmtdesc> &ret)
 {
-    return m_captureThread != 0;
+    for (__u32 index = 0; ; ++index) {
+        struct v4l2_fmtdesc format;
+        memset(&format, 0, sizeof(v4l2_fmtdesc));
+        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        format.index = index;
+
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_ENUM_FMT, &format) != 0) break;
+
+        ret.push_back(format);
+    }
 }
 
 
-void CaptureDevice::pauseCapturing(bool pause)
+const pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > &CaptureDevice::controls()
 {
-    if (isCapturing() == false) return;
+    assert(m_fileDescriptor != -1);
 
-    if (pause == true ) {
-        m_pauseCapturingMutex.try_lock();
-        m_capturingPaused = true;
-    } else {
-        m_pauseCapturingMutex.unlock();
-        m_capturingPaused = false;
+    if (m_controlsCached == false) {
+        m_controls.first.clear();
+        m_controls.second.clear();
+
+        enumerateControls(m_controls);
+        m_controlsCached = true;
     }
+
+    return m_controls;
 }
 
 
-bool CaptureDevice::isCapturingPaused() const
+void CaptureDevice::enumerateControls(pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > &ret)
 {
-    return m_capturingPaused;
-}
+    struct v4l2_queryctrl ctl;
 
+    /* the driver hands out one control after the other, of all control classes */
+    ctl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+    while (queryControl(ctl) == true) {
+        ret.first.push_back(ctl);
 
-pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > CaptureDevice::controls()
-{
-    pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > ret;
+        if (ctl.type == V4L2_CTRL_TYPE_MENU) {
+            list<struct v4l2_querymenu> m = menus(ctl);
+            ret.second.insert(ret.second.end(),m.begin(),m.end());
+        }
 
-    struct v4l2_queryctrl ctl;
+        ctl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+    }
+
+    if (ret.first.empty() == false) return;
+
+    /* drivers, which do not know V4L2_CTRL_FLAG_NEXT_CTRL, have to be probed id by id */
 
     /* for each control ... */
     for (__u32 id = V4L2_CID_BASE; id < V4L2_CID_LASTP1; ++id) {
@@ -657,8 +1649,6 @@ pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > CaptureDevice::c
             break;
         }
     }
-
-    return ret;
 }
 
 
@@ -701,6 +1691,96 @@ bool CaptureDevice::setControl(const struct v4l2_control &ctl)
 }
 
 
+void CaptureDevice::queueControl(__u32 id, __s32 value)
+{
+    m_controlQueueMutex.lock();
+
+    auto it = m_queuedControls.begin();
+    while (it != m_queuedControls.end() && it->id != id) ++it;
+
+    if (it == m_queuedControls.end()) {
+        struct v4l2_ext_control control;
+        memset(&control, 0, sizeof(v4l2_ext_control));
+        control.id = id;
+        m_queuedControls.push_back(control);
+        it = m_queuedControls.end() - 1;
+    }
+    it->value = value;
+
+    m_controlsQueued.store(true, memory_order_release);
+    m_controlQueueMutex.unlock();
+
+    /* nobody captures, who could apply it */
+    if (isCapturing() == false || isCapturingPaused() == true) {
+        applyQueuedControls();
+    }
+}
+
+
+bool CaptureDevice::readControls(vector<struct v4l2_ext_control> &controls)
+{
+    if (controls.empty() == true) return true;
+
+    struct v4l2_ext_controls ctls;
+    memset(&ctls, 0, sizeof(v4l2_ext_controls));
+    /* 0 allows controls of different classes - drivers without the control framework refuse it */
+    ctls.ctrl_class = 0;
+    ctls.count = controls.size();
+    ctls.controls = &controls[0];
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_G_EXT_CTRLS, &ctls) == 0) return true;
+
+    /* one by one then */
+    bool ret = true;
+    for (auto it = controls.begin(); it != controls.end(); ++it) {
+        struct v4l2_control ctl;
+        ctl.id = it->id;
+        if (control(ctl) == true) {
+            it->value = ctl.value;
+        } else {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+
+void CaptureDevice::applyQueuedControls()
+{
+    if (m_controlsQueued.load(memory_order_acquire) == false) return;
+
+    /* paused, queueControl() applies on the caller's thread, while the capture thread may not have parked
+       yet - a batch must not be swapped out before an older one is applied, it would be overwritten */
+    lock_guard<mutex> applyLock(m_controlApplyMutex);
+
+    vector<struct v4l2_ext_control> batch;
+
+    m_controlQueueMutex.lock();
+    batch.swap(m_queuedControls);
+    m_controlsQueued.store(false, memory_order_relaxed);
+    m_controlQueueMutex.unlock();
+
+    if (batch.empty() == true) return;
+
+    struct v4l2_ext_controls ctls;
+    memset(&ctls, 0, sizeof(v4l2_ext_controls));
+    ctls.ctrl_class = 0;
+    ctls.count = batch.size();
+    ctls.controls = &batch[0];
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_S_EXT_CTRLS, &ctls) == 0) return;
+
+    /* one by one then - errors are reported by setControl() */
+    for (auto it = batch.begin(); it != batch.end(); ++it) {
+        struct v4l2_control ctl;
+        ctl.id = it->id;
+        ctl.value = it->value;
+        setControl(ctl);
+    }
+}
+
+
 bool CaptureDevice::queryControl(struct v4l2_queryctrl &ctl)
 {
     bool ret = false;
@@ -747,32 +1827,29 @@ list<v4l2_querymenu> CaptureDevice::menus(const struct v4l2_queryctrl &ctl)
 
 
 /* *** static functions ***************************************************** */
-void CaptureDevice::determineCapturePeriodThread(double secondsToIterate,
-        CaptureDevice *camera, std::pair<double,double> *ret)
+void CaptureDevice::captureThread(CaptureDevice *camera)
 {
     int fileDescriptor = camera->m_fileDescriptor;
-    unsigned int bufferSize = camera->m_bufferSize;
-    void *buffer = malloc(camera->m_bufferSize);
-    std::mutex &fileAccessMutex = camera->m_fileAccessMutex;
     fd_set filedescriptorset;
     struct timeval tv;
     int sel;
-    ssize_t readlen;
-    vector<struct timespec> times;
 
 
-    for (;;) {
-        times.resize(times.size()+1);
-        clock_gettime(CLOCK_MONOTONIC, &times.back());
+    while (camera->m_captureThreadCancellationFlag == false) {
+
+        /* parks here while paused - the stream stays on */
+        if (camera->m_pauseGate.checkpoint() == true) camera->skipFramesTakenWhilePaused();
 
-        if (difftime(times.back().tv_sec, times.front().tv_sec) > secondsToIterate) {
-            break;
+        if (camera->prepareCapture() == false) {
+            struct timespec sleepLength = { 0, 1000000 };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &sleepLength, 0);
+            continue;
         }
 
         FD_ZERO(&filedescriptorset);
         FD_SET(fileDescriptor, &filedescriptorset);
-        tv.tv_sec = 2;
-        tv.tv_usec = 0;
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
 
         /* watch the file handle for new readable data */
         sel = select(fileDescriptor + 1, &filedescriptorset, 0, 0, &tv);
@@ -780,130 +1857,348 @@ void CaptureDevice::determineCapturePeriodThread(double secondsToIterate,
         if (sel == -1 && errno != EINTR) {
             cerr << __PRETTY_FUNCTION__ << " Select error. " << errno << " " << strerror(errno) << endl;
             abort();
-        } else if (sel == 0) {
-            cerr << __PRETTY_FUNCTION__ << " Select timeout. " << errno << " " << strerror(errno) << endl;
-            abort();
+        } else if (sel > 0) {
+            camera->captureFrame();
         }
 
-        /* read from the device */
-        fileAccessMutex.lock();
-        readlen = v4l2_read(fileDescriptor, buffer, bufferSize);
-        fileAccessMutex.unlock();
+        /* between frames, also if none came */
+        camera->applyQueuedControls();
+    }
+}
+
+
+bool CaptureDevice::prepareCapture()
+{
+    if (m_ioMethod != IoMethodRead) {
+        requeueSurplusBuffers();
+
+        /* captureFrame() never leaves the driver without a buffer, but a failed VIDIOC_QBUF might */
+        return m_queuedBufferCount > 0;
 
-        if (readlen == -1) {
-            cerr << __PRETTY_FUNCTION__ << " Read error. " << errno << " " << strerror(errno) << endl;
+    } else {
+        /* captureFrame() locks the buffer once a frame is there - locking it now would take a frame
+           from the readers for BackpressureOverwrite, before a newer one exists */
+        return true;
+    }
+}
+
+
+void CaptureDevice::captureFrame()
+{
+    if (m_ioMethod != IoMethodRead) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(v4l2_buffer));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = memoryType(m_ioMethod);
+
+        if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_DQBUF, &buf) == -1) {
+            if (errno == EAGAIN) return;
+            cerr << __PRETTY_FUNCTION__ << " VIDIOC_DQBUF " << errno << " " << strerror(errno) << endl;
             abort();
         }
+        --m_queuedBufferCount;
+
+        Buffer *buffer = &m_ring.buffer(buf.index);
+
+        /* the driver's timestamp tells when the frame was taken, not when we got it */
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+            buffer->time.tv_sec = buf.timestamp.tv_sec;
+            buffer->time.tv_nsec = buf.timestamp.tv_usec * 1000;
+        } else {
+            /* unknown or different clock - not comparable with other devices */
+            clock_gettime(CLOCK_MONOTONIC, &(buffer->time));
+        }
+
+        if (m_staleBefore.tv_sec != 0) {
+            if (buffer->time.tv_sec < m_staleBefore.tv_sec ||
+                    (buffer->time.tv_sec == m_staleBefore.tv_sec && buffer->time.tv_nsec < m_staleBefore.tv_nsec)) {
+                /* taken while paused - the driver filled the queued buffers meanwhile */
+                if (queueBuffer(buffer) == false) m_ring.discard(buffer);
+                return;
+            }
+            m_staleBefore.tv_sec = 0;
+        }
+
+        if (m_lastSequence != -1) {
+            /* unsigned arithmetic handles the wrap around */
+            unsigned int gap = buf.sequence - (unsigned int) m_lastSequence;
+            if (gap > 1) m_droppedFrameCount.fetch_add(gap - 1, memory_order_relaxed);
+        }
+        /* before a discard, otherwise the next frame counts it as dropped, too */
+        m_lastSequence = buf.sequence;
+
+        if (m_queuedBufferCount == 0) {
+            /* the driver must always have a buffer, otherwise we would have to poll for readers
+               releasing one */
+            Buffer *spare = lockForCapturing();
+
+            if (spare == 0 || queueBuffer(spare) == false) {
+                if (spare != 0) m_ring.discard(spare);
+
+                /* readers hold all other buffers - throw the new frame away */
+                if (queueBuffer(buffer) == false) m_ring.discard(buffer);
+                m_discardedFrameCount.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+        }
+
+        buffer->sequence = buf.sequence;
+        buffer->bytesUsed = buf.bytesused;
+        m_timing.addFrame(buffer->time);
+
+        /* the driver's buffer becomes the newest element of the ring - no copy */
+        m_ring.publish(buffer);
+        m_capturedFrameCount.fetch_add(1, memory_order_relaxed);
+        handOut(buffer);
+
+        return;
+    }
+
+    if (m_writeBuffer == 0) {
+        /* if there is none, the frame is read into m_discardBuffer */
+        m_writeBuffer = lockForCapturing();
     }
-    free(buffer);
 
+    Buffer *buffer = m_writeBuffer;
+
+    if (m_source != 0) {
+        timespec time;
+        unsigned int sequence;
+
+        /* without a buffer the frame is skipped */
+        size_t length;
+        if (m_source->mapsFrames() == true) {
+            const unsigned char *data = 0;
+            length = m_source->mapFrame(buffer != 0 ? &data : 0, &time, &sequence);
+
+            /* nobody writes into the ring's buffers - the source's memory can be read only */
+            if (length > 0 && buffer != 0) {
+                buffer->buffer = (unsigned char*) data;
+                buffer->length = (unsigned int) length;
+            }
+        } else {
+            length = m_source->readFrame(buffer != 0 ? buffer->buffer : 0, buffer != 0 ? buffer->length : 0,
+                    &time, &sequence);
+        }
+
+        /* none due */
+        if (length == 0) return;
 
-    /* *** compute interval from timestamps *** */
-    vector<double> intervals;
-    for (auto a = times.begin(); a != (times.end()-1); ++a) {
-        auto b = a+1;
-        intervals.push_back(
-                (b->tv_sec + b->tv_nsec / 1000000000.0) -
-                (a->tv_sec + a->tv_nsec / 1000000000.0));
+        if (m_lastSequence != -1 && sequence - (unsigned int) m_lastSequence > 1) {
+            m_droppedFrameCount.fetch_add(sequence - (unsigned int) m_lastSequence - 1, memory_order_relaxed);
+        }
+        m_lastSequence = sequence;
+
+        if (buffer == 0) {
+            m_discardedFrameCount.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        m_writeBuffer = 0;
+
+        buffer->time = time;
+        buffer->sequence = sequence;
+        buffer->bytesUsed = (unsigned int) length;
+        m_timing.addFrame(buffer->time);
+
+        m_ring.publish(buffer);
+        m_capturedFrameCount.fetch_add(1, memory_order_relaxed);
+        handOut(buffer);
+        return;
     }
 
-    /* *** compute period *** */
-    double mean = 0.0;
-    for (auto a = intervals.begin(); a != intervals.end(); ++a) {
-        mean += *a;
+    /* read from the device into the buffer, without one the frame is thrown away */
+    m_fileAccessMutex.lock();
+    ssize_t readlen = v4l2_read(m_fileDescriptor, buffer != 0 ? buffer->buffer : m_discardBuffer, m_bufferSize);
+    m_fileAccessMutex.unlock();
+
+    if (readlen == -1) {
+        cerr << __PRETTY_FUNCTION__ << " Read error. " << errno << " " << strerror(errno);
+        if (errno != EAGAIN) {
+            cerr << endl;
+            /* ignore Resource temporarily not available errors and just try again */
+            abort();
+        }
+        cerr << ". ignored" << endl;
+
+        /* keep the buffer for the next try */
+        return;
     }
-    mean /= intervals.size();
 
-    /* *** compute standard deviation **/
-    double addedSquares = 0.0;
-    for (auto a = intervals.begin(); a != intervals.end(); ++a) {
-        addedSquares = ((*a - mean) * (*a - mean));
+    if (buffer == 0) {
+        m_discardedFrameCount.fetch_add(1, memory_order_relaxed);
+        return;
     }
-    double standardDeviation = sqrt(addedSquares / intervals.size());
 
-    ret->first = mean;
-    ret->second = standardDeviation;
+    m_writeBuffer = 0;
+
+    /* read() gives no timestamp - the end of the read is the best guess we have */
+    clock_gettime(CLOCK_MONOTONIC, &(buffer->time));
+    buffer->sequence = (unsigned int) m_capturedFrameCount.load(memory_order_relaxed);
+    buffer->bytesUsed = (unsigned int) readlen;
+    m_timing.addFrame(buffer->time);
+
+    /* make the newly read buffer the newest element - newest picture taken */
+    m_ring.publish(buffer);
+    m_capturedFrameCount.fetch_add(1, memory_order_relaxed);
+    handOut(buffer);
 }
 
 
-void CaptureDevice::captureThread(CaptureDevice *camera)
+void CaptureDevice::handOut(Buffer *buffer)
 {
-    int fileDescriptor = camera->m_fileDescriptor;
-    unsigned int bufferSize = camera->m_bufferSize;
-    std::deque<Buffer*> &sortedBuffers = camera->m_timelySortedBuffers;
-    std::mutex &sortedBuffersMutex =  camera->m_timelySortedBuffersMutex;
-    std::mutex &fileAccessMutex = camera->m_fileAccessMutex;
-    std::mutex &pauseCapturingMutex = camera->m_pauseCapturingMutex;
-    fd_set filedescriptorset;
-    struct timeval tv;
-    int sel;
-    ssize_t readlen;
+    if (isDecoding() == true) {
+        /* cannot fail - only the capturing thread writes into the ring. The decoder unlocks it.
+           The decoded frame is notified about */
+        FrameRing::tryLockForReading(buffer);
+        m_mjpegDecoder->decode(&m_decodeStream, buffer);
+        m_compressedNotifier.notify(buffer->serial);
+    } else if (m_regionRing.size() > 0) {
+        /* the captured frame is free for the driver again right away */
+        Buffer *region = copyRegion(buffer);
+        if (region != 0) m_notifier.notify(region->serial);
+    } else {
+        m_notifier.notify(buffer->serial);
+    }
+}
 
 
-    while (camera->m_captureThreadCancellationFlag == false) {
+CaptureDevice::Buffer *CaptureDevice::copyRegion(const Buffer *buffer)
+{
+    Buffer *ret = m_regionRing.lockForWriting();
+    if (ret == 0 && m_backpressurePolicy == BackpressureOverwrite) {
+        /* only the newest region can be left */
+        ret = m_regionRing.lockForWriting(true);
+        if (ret != 0) m_overwrittenFrameCount.fetch_add(1, memory_order_relaxed);
+    }
+    if (ret == 0) {
+        m_discardedFrameCount.fetch_add(1, memory_order_relaxed);
+        return 0;
+    }
 
-        pauseCapturingMutex.lock();
-        pauseCapturingMutex.unlock();
+    /* moved by setRegionOfInterest() any time */
+    unsigned long long position = m_regionPosition.load(memory_order_relaxed);
 
-        FD_ZERO(&filedescriptorset);
-        FD_SET(fileDescriptor, &filedescriptorset);
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000;
+    if (PixelConversion::copyRegion(m_pixelFormat, buffer->buffer, m_bytesPerLine, m_deviceHeight,
+            (unsigned int) (position >> 32), (unsigned int) position, m_frameWidth * m_regionFactor,
+            m_frameHeight * m_regionFactor, m_regionFactor, m_regionAverage.load(memory_order_relaxed),
+            ret->buffer, m_frameBytesPerLine) == false) {
+        m_regionRing.discard(ret);
+        return 0;
+    }
 
-        /* watch the file handle for new readable data */
-        fileAccessMutex.lock();
-        sel = select(fileDescriptor + 1, &filedescriptorset, 0, 0, &tv);
-        fileAccessMutex.unlock();
+    ret->time = buffer->time;
+    ret->sequence = buffer->sequence;
+    ret->bytesUsed = ret->length;
+    m_regionRing.publish(ret);
 
-        if (sel == -1 && errno != EINTR) {
-            cerr << __PRETTY_FUNCTION__ << " Select error. " << errno << " " << strerror(errno) << endl;
-            abort();
-        } else if (sel == 0) {
-            /* select timeout */
-            continue;
-        }
+    return ret;
+}
 
-        /* remove the last element if possible */
-        sortedBuffersMutex.lock();
 
-        if (sortedBuffers.back()->readerCount > 0) {
-            cerr << "no writeable buffer present. trying hard" << endl;
-            continue;
-        }
-        Buffer *buffer = sortedBuffers.back();
-        sortedBuffers.pop_back();
+void CaptureDevice::skipFramesTakenWhilePaused()
+{
+    if (m_ioMethod != IoMethodRead) {
+        clock_gettime(CLOCK_MONOTONIC, &m_staleBefore);
+    }
+    m_lastSequence = -1;
+}
 
-        sortedBuffersMutex.unlock();
+
+bool CaptureDevice::isDecoding() const
+{
+    return isJpeg(m_pixelFormat) == true && m_mjpegDecoder != 0;
+}
 
 
-        /* read from the device into the buffer */
-        clock_gettime(CLOCK_MONOTONIC, &(buffer->time));
-        fileAccessMutex.lock();
-        readlen = v4l2_read(fileDescriptor, buffer->buffer, bufferSize);
-        fileAccessMutex.unlock();
+/** hands the oldest buffers of the ring back to the driver, as long as more than m_bufferCount
+    buffers are out of the driver and nobody is reading them */
+void CaptureDevice::requeueSurplusBuffers()
+{
+    while (m_ring.size() - m_reserveBuffers.size() - m_queuedBufferCount > m_bufferCount) {
+        Buffer *buffer = m_ring.lockForWriting();
+        if (buffer == 0) break;
 
-        if (readlen == -1) {
-            cerr << __PRETTY_FUNCTION__ << " Read error. " << errno << " " << strerror(errno);
-            if (errno != EAGAIN) {
-                cerr << endl;
-                /* ignore Resource temporarily not available errors and just try again */
-                abort();
-            }
-            cerr << ". ignored" << endl;
+        if (queueBuffer(buffer) == false) {
+            m_ring.discard(buffer);
+            break;
         }
+    }
+}
+
+
+bool CaptureDevice::queueBuffer(Buffer *buffer)
+{
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(v4l2_buffer));
+
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = memoryType(m_ioMethod);
+    buf.index = buffer->index;
+    if (m_ioMethod == IoMethodUserPtr) {
+        buf.m.userptr = (unsigned long) buffer->buffer;
+        buf.length = buffer->length;
+    }
+
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_QBUF, &buf) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " VIDIOC_QBUF " << errno << " " << strerror(errno) << endl;
+        return false;
+    }
+    ++m_queuedBufferCount;
+
+    return true;
+}
+
+
+void CaptureDevice::streamOff()
+{
+    /* dequeues all buffers implicitly */
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xv4l2_ioctl(m_fileDescriptor, VIDIOC_STREAMOFF, &type) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " VIDIOC_STREAMOFF " << errno << " " << strerror(errno) << endl;
+    }
+
+    for (unsigned int a = 0; a < m_ring.size(); ++a) {
+        Buffer *buffer = &m_ring.buffer(a);
+        if (buffer->readerCount != -1) continue;
+        /* parked buffers stay parked */
+        if (find(m_reserveBuffers.begin(), m_reserveBuffers.end(), buffer) != m_reserveBuffers.end()) continue;
+        m_ring.discard(buffer);
+    }
+    m_queuedBufferCount = 0;
+}
+
 
+unsigned int CaptureDevice::reserveBufferCount() const
+{
+    return m_backpressurePolicy == BackpressureGrow ? m_growLimit : 0;
+}
 
-        /* insert the newly read buffer as first element - newest picture taken */
-        sortedBuffersMutex.lock();
-        sortedBuffers.push_front(buffer);
-        sortedBuffersMutex.unlock();
 
-        /*cerr << "wrote ";
-        for (auto it = sortedBuffers.begin(); it != sortedBuffers.end(); ++it) {
-            cerr << (*it)->time.tv_sec << " " << *it << ", ";
+CaptureDevice::Buffer *CaptureDevice::lockForCapturing()
+{
+    /* the oldest buffer, which is not read */
+    Buffer *ret = m_ring.lockForWriting();
+    if (ret != 0) return ret;
+
+    switch (m_backpressurePolicy) {
+    case BackpressureGrow:
+        if (m_reserveBuffers.empty() == false) {
+            ret = m_reserveBuffers.back();
+            m_reserveBuffers.pop_back();
+            m_addedBufferCount.fetch_add(1, memory_order_relaxed);
         }
-        cerr << endl;*/
+        break;
+    case BackpressureOverwrite:
+        /* only the newest frame can be left */
+        ret = m_ring.lockForWriting(true);
+        if (ret != 0) m_overwrittenFrameCount.fetch_add(1, memory_order_relaxed);
+        break;
+    default:
+        break;
     }
+
+    return ret;
 }
 
 
@@ -923,6 +2218,20 @@ int CaptureDevice::xv4l2_ioctl(int fileDescriptor, int request, void *arg)
 }
 
 
+__u32 CaptureDevice::nativePixelFormat()
+{
+    const vector<struct v4l2_fmtdesc> &all = formats();
+
+    for (auto it = all.begin(); it != all.end(); ++it) {
+        /* libv4l's conversions are not native */
+        if ((it->flags & V4L2_FMT_FLAG_EMULATED) != 0) continue;
+        if (PixelConversion::isSupported(it->pixelformat) == true) return it->pixelformat;
+    }
+
+    return 0;
+}
+
+
 string CaptureDevice::pixelFormatString(__u32 pixelFormat)
 {
     string ret;
@@ -933,3 +2242,42 @@ string CaptureDevice::pixelFormatString(__u32 pixelFormat)
     return  ret;
 }
 
+
+__u32 CaptureDevice::pixelFormatFromString(const string &fourcc)
+{
+    if (fourcc.size() != 4) return 0;
+    return v4l2_fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+}
+
+
+/* *** local *************************************************************** */
+bool isWholeFrame(const CaptureDevice::RegionOfInterest &region, unsigned int width, unsigned int height)
+{
+    return region.left == 0 && region.top == 0 && region.width == width && region.height == height &&
+            region.factor == 1;
+}
+
+
+bool isJpeg(__u32 pixelFormat)
+{
+    return pixelFormat == V4L2_PIX_FMT_MJPEG || pixelFormat == V4L2_PIX_FMT_JPEG;
+}
+
+
+unsigned int minimumBytesPerLine(__u32 pixelFormat, unsigned int width)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24: return width * 3;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY: return width * 2;
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG: return 0; /* no rows, the driver knows the maximum frame size */
+    default: return width; /* GREY, NV12 luma plane */
+    }
+}
+
+
+enum v4l2_memory memoryType(CaptureDevice::IoMethod ioMethod)
+{
+    return ioMethod == CaptureDevice::IoMethodUserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+}
@@ -21,16 +21,34 @@
 
 #include "prereqs.hpp"
 
+#include "framearena.hpp"
+#include "framenotifier.hpp"
+#include "frameref.hpp"
+#include "framering.hpp"
+#include "frametiming.hpp"
+#include "mjpegdecoder.hpp"
+#include "pausegate.hpp"
+#include "previewstream.hpp"
+#include "threadscheduling.hpp"
+
+#include <atomic>
 #include <ctime>
-#include <deque>
 #include <list>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <linux/videodev2.h>
 #include <sys/time.h>
 
+class CapabilityCache;
+class CaptureReactor;
+class CaptureSource;
+class FrameHistory;
+class FrameRecorder;
+class FrameSynchronizer;
+
 namespace std
 {
     class thread;
@@ -46,12 +64,58 @@ class CaptureDevice
 {
 public:
 
-    struct Buffer
+    typedef FrameRing::Buffer Buffer;
+
+    struct FrameCounters
+    {
+        /** frames published into the ring */
+        unsigned long long captured;
+        /** frames the driver dropped, derived from gaps in the sequence numbers - streaming i/o only */
+        unsigned long long dropped;
+        /** captured compressed frames, which were not decoded (decoder too busy or corrupt data) */
+        unsigned long long undecoded;
+        /** new frames thrown away, because readers held all buffers */
+        unsigned long long discarded;
+        /** unread frames replaced by newer ones, BackpressureOverwrite only */
+        unsigned long long overwritten;
+        /** buffers added to the ring, BackpressureGrow only */
+        unsigned long long addedBuffers;
+    };
+
+    /** what happens to a new frame, if readers (e.g. slow filters) hold all buffers of the ring */
+    enum BackpressurePolicy
     {
-        timespec time;
-        /** if 0 -> writeable, readable; if > 0 -> readable */
-        int readerCount;
-        unsigned char *buffer;
+        /** the new frame is thrown away, the readers keep the previous ones */
+        BackpressureDrop,
+        /** a buffer is added to the ring, up to growLimit(). Then like BackpressureDrop */
+        BackpressureGrow,
+        /** the oldest frame nobody has locked yet - the newest one - is replaced.
+            If readers hold that one as well, like BackpressureDrop */
+        BackpressureOverwrite
+    };
+
+    enum IoMethod
+    {
+        /** copy every frame via read() */
+        IoMethodRead,
+        /** streaming i/o, the driver's buffers are mmap'd and handed out directly */
+        IoMethodMmap,
+        /** streaming i/o into our own buffers (FrameArena, possibly huge pages), handed out directly */
+        IoMethodUserPtr
+    };
+
+    /** part of the frame to hand out, see setRegionOfInterest() */
+    struct RegionOfInterest
+    {
+        /** in pixels of the whole frame (captureSize()). A width or height of 0 means the whole frame */
+        unsigned int left;
+        unsigned int top;
+        unsigned int width;
+        unsigned int height;
+        /** 1, 2 or 4: the frames are that many times smaller in both directions */
+        unsigned int factor;
+        /** each pixel is the mean of factor x factor pixels (binning), else the top left one (decimation) */
+        bool average;
     };
 
 
@@ -65,10 +129,28 @@ public:
     /** set programatically (approx width*height*byteperpixel) */
     unsigned int bufferSize() const;
 
-    /** @note possibly changed during initialization by the device */
+    /** size of the whole frame
+        @note possibly changed during initialization by the device */
     void setCaptureSize(unsigned int width, unsigned int height);
     std::pair<unsigned int, unsigned int> captureSize() const;
 
+    /** hands out only the region of the frames, reduced by its factor. The ring buffers are sized to it.
+        The driver crops (and scales), if it can, otherwise the capture thread copies the region out of each
+        frame. Default: the whole frame, factor 1
+        @note while initialized, only the position and 'average' can change - also while capturing, from the next
+            frame on. Size and factor take effect at the next init()
+        @returns false, if the size or factor differ while initialized, or if the driver crops and cannot move
+            its crop rectangle now */
+    bool setRegionOfInterest(const RegionOfInterest &region);
+    /** @returns the requested region before, the one in effect after init() - fitted into the frame and aligned
+        to the format, e.g. to even columns for YUYV */
+    RegionOfInterest regionOfInterest() const;
+    /** @returns true, if the driver crops to the region. Valid after init() */
+    bool isCroppingInHardware() const;
+    /** size of the frames handed out by lockNewestFrame(), i.e. of the region reduced by its factor
+        @note valid after init() */
+    std::pair<unsigned int, unsigned int> frameSize() const;
+
     void setFileName(const std::string&);
     const std::string &fileName() const;
 
@@ -76,6 +158,75 @@ public:
     void setBufferCount(unsigned int);
     unsigned int bufferCount() const;
 
+    /** pixel format to request from the device (V4L2_PIX_FMT_*). Default: V4L2_PIX_FMT_RGB24
+        0 picks the first format the hardware delivers natively, which PixelConversion supports.
+        V4L2_PIX_FMT_MJPEG and V4L2_PIX_FMT_JPEG need an MjpegDecoder.
+        @note formats the hardware does not deliver are converted by libv4l on the capture thread.
+            Native formats are handed out unconverted, see PixelConversion */
+    void setPixelFormat(__u32 pixelFormat);
+    /** @returns the requested format before, the negotiated format after init() */
+    __u32 pixelFormat() const;
+    /** @returns the format of the frames handed out by lockNewestFrame(). Equals pixelFormat(),
+        except for compressed formats, which are decoded to V4L2_PIX_FMT_RGB24 */
+    __u32 framePixelFormat() const;
+    /** length of one row in the frames handed out by lockNewestFrame() in bytes (of the luma plane for NV12)
+        @note valid after init() */
+    unsigned int bytesPerLine() const;
+
+    /** decodes the frames of devices capturing (M)JPEG. The compressed frames stay in the ring,
+        lockNewestFrame() hands out the decoded ones. Default: 0
+        @pre not initialized */
+    void setMjpegDecoder(MjpegDecoder *decoder);
+    MjpegDecoder *mjpegDecoder() const;
+
+    /** preferred i/o method. Default: IoMethodMmap
+        @note falls back to IoMethodMmap during initialization, if the device (or libv4l's format conversion)
+            does not support user pointers, and to IoMethodRead, if it does not support streaming */
+    void setIoMethod(IoMethod);
+    IoMethod ioMethod() const;
+
+    /** Default: BackpressureDrop
+        @note either way the capture thread never waits for readers
+        @pre not initialized */
+    void setBackpressurePolicy(BackpressurePolicy policy);
+    BackpressurePolicy backpressurePolicy() const;
+    /** buffers BackpressureGrow may add to the ring. They are allocated by init(), not while capturing,
+        and stay in the ring once added. Default: 4
+        @pre not initialized */
+    void setGrowLimit(unsigned int bufferCount);
+    unsigned int growLimit() const;
+
+    /** captures from the source instead of the V4L2 device fileName(), which then is just a name.
+        The source's frames go through the same ring, decoder and readers. Default: 0
+        @note such a device has no formats and controls, the i/o method is IoMethodRead
+        @pre not initialized */
+    void setCaptureSource(CaptureSource *source);
+    CaptureSource *captureSource() const;
+
+    /** if set, init() takes formats and controls from the cache instead of enumerating them, as long as
+        the device reports the same driver, card, bus info and version. Default: 0 - always enumerate
+        @pre not initialized */
+    void setCapabilityCache(CapabilityCache *cache);
+    CapabilityCache *capabilityCache() const;
+    /** @returns true, if formats() and controls() came from the capability cache during init() */
+    bool capabilitiesFromCache() const;
+
+    /** if set, the reactor's threads capture for this device instead of a dedicated thread.
+        Default: 0 - a thread per device
+        @pre not capturing */
+    void setCaptureReactor(CaptureReactor *reactor);
+    CaptureReactor *captureReactor() const;
+
+    /** policy, priority and cpus of the capture thread, applied by startCapturing(). Default: unchanged
+        @note not used with a reactor, see CaptureReactor::setThreadScheduling() */
+    void setThreadScheduling(const ThreadScheduling &scheduling);
+    const ThreadScheduling &threadScheduling() const;
+    /** @returns what the capture thread got, possibly less than requested. Valid while capturing without reactor */
+    const ThreadScheduling &effectiveThreadScheduling() const;
+
+    /** @returns the device file's descriptor, -1 if not initialized */
+    int fileDescriptor() const;
+
     /**
      * @pre captureSize() has to be set
      * @pre fileName() has to be set
@@ -88,30 +239,84 @@ public:
     void finish();
 
 
-    /** n has to be less than  'buffersCount' */
-    std::deque<const Buffer*> lockFirstNBuffers(unsigned int n);
-    void unlock(const std::deque<const Buffer*> &buffers);
+    /** @returns the newest frame, unlocked when the last reference goes away. Null if there is none
+        @note lock-free, never blocks the capture thread, does not allocate */
+    FrameRef lockNewestFrame();
+    /** locks up to n of the newest frames, newest first. n has to be less than 'buffersCount'
+        @returns the number of frames stored in 'frames' - can be fewer than n, if the producer is faster than us
+        @note lock-free, never blocks the capture thread, does not allocate */
+    unsigned int lockNewestFrames(FrameRef *frames, unsigned int n);
     /** @returns number of newer buffers
         @note
         When actually locking the buffer this number might differ due to threading.
         It can be larger, or it can be n-1, when previously n */
     unsigned int newerBuffersAvailable(const timespec &newerThan);
 
-    /** @returns average period for capturing an image and the standard deviation
-        @note blocks for several seconds */
-    std::pair<double, double> determineCapturePeriod(double secondsToIterate = 5.0);
-
-    void startCapturing();
+    /** @returns the serial of the newest buffer (Buffer::serial). 0 if nothing has been captured yet */
+    unsigned long long newestSerial() const;
+    /** blocks until a buffer newer than the given serial has been captured or the timeout expired
+        @returns the serial of the newest buffer */
+    unsigned long long waitForNewerBuffers(unsigned long long newerThanSerial, long timeoutNanoseconds);
+    /** the descriptor (an eventfd, see FrameNotifier::createFileDescriptor()) becomes readable each
+        time a new buffer has been captured.
+        @note register the same descriptor at several devices to wait for all of them at once */
+    void addNotificationFileDescriptor(int fileDescriptor);
+    void removeNotificationFileDescriptor(int fileDescriptor);
+
+    /** matches the device's frames with the ones of other devices
+        @pre initialized. It stays so as long as the synchronizer exists - delete the synchronizer and release
+        its tuples before finish(), which frees the frames
+        @returns the index of the device's frames in the synchronizer's tuples */
+    unsigned int addToSynchronizer(FrameSynchronizer *synchronizer);
+    /** records the device's frames to the file
+        @param compressed (M)JPEG frames are recorded as the device delivers them, with the driver's timestamps -
+            neither decoded nor encoded again. Else the decoded ones. No effect on other formats
+        @pre initialized. It stays so as long as the recorder exists
+        @returns the index of the device's statistics in the recorder */
+    unsigned int addToRecorder(FrameRecorder *recorder, const std::string &fileName, bool compressed = true);
+    /** keeps the device's last frames - decoded ones for MJPG - in the history
+        @pre initialized. It stays so as long as the history runs */
+    void addToHistory(FrameHistory *history);
+
+    /** a second stream of the frames, downscaled to RGB888 at display rate for showing them - the frames
+        above stay untouched for processing. Runs while capturing, see PreviewStream
+        @param framesPerSecond 0 disables it (default)
+        @note give the device a buffer more (setBufferCount()) for the frame being downscaled
+        @pre not initialized */
+    void setPreview(unsigned int maximumWidth, unsigned int maximumHeight, double framesPerSecond);
+    /** @returns 0, if disabled or not initialized */
+    PreviewStream *preview();
+
+    /** running counters since init(). Can be called any time */
+    FrameCounters frameCounters() const;
+
+    /** statistics of the intervals between the captured frames since init(), based on their timestamps.
+        Can be called any time, also while capturing
+        @note pauses and restarts of capturing are left out */
+    FrameTiming::Statistics frameTiming() const;
+
+    /** @returns false, if the device does not start streaming */
+    bool startCapturing();
     void stopCapturing();
     bool isCapturing() const;
 
+    /** pausing leaves the stream on - resuming does not pay a restart. Frames the driver captured meanwhile
+        are thrown away, the first one handed out is taken after resuming. Does not block
+        @note the capture thread parks at its next frame or within 100ms, the reactor stops watching right away */
     void pauseCapturing(bool pause);
     bool isCapturingPaused() const;
+    /** from resuming until the capture thread runs again. No resumes are counted with a reactor, it watches
+        the device again within pauseCapturing() */
+    PauseGate::Statistics resumeStatistics() const;
 
-    /** @returns all controls and control menu items, which the capture device provides
+    /** @returns all controls and control menu items, which the capture device provides - of all control classes
+        @note enumerated on the first call after init(), cached afterwards
         @see http://www.linuxtv.org/downloads/video4linux/API/V4L2_API/spec-single/v4l2.html#V4L2-QUERYCTRL
         @see http://www.linuxtv.org/downloads/video4linux/API/V4L2_API/spec-single/v4l2.html#V4L2-QUERYMENU */
-    std::pair<std::list<struct v4l2_queryctrl>, std::list<struct v4l2_querymenu> > controls();
+    const std::pair<std::list<struct v4l2_queryctrl>, std::list<struct v4l2_querymenu> > &controls();
+    /** @returns all formats - as libv4l offers them, the ones it converts to flagged V4L2_FMT_FLAG_EMULATED
+        @note enumerated on the first call after init(), cached afterwards */
+    const std::vector<struct v4l2_fmtdesc> &formats();
 
     /** @returns true if the query succeeded - more sophisticated error checking to come
         @see http://www.linuxtv.org/downloads/video4linux/API/V4L2_API/spec-single/v4l2.html#V4L2-CONTROL */
@@ -119,6 +324,21 @@ public:
     /** @returns true if the call succeeded - more sophisticated error checking to come */
     bool setControl(const struct v4l2_control&);
 
+    /** queues a new control value. The capturing thread applies all queued values between two frames with one
+        VIDIOC_S_EXT_CTRLS. A value replaces the one of the same control, which was not applied yet
+        @note never blocks while capturing. Otherwise (or paused) the values are applied right away, after a batch
+        the capture thread may still be applying */
+    void queueControl(__u32 id, __s32 value);
+    /** reads the values of the given controls (set their ids) with one VIDIOC_G_EXT_CTRLS
+        @returns false, if any value could not be read */
+    bool readControls(std::vector<struct v4l2_ext_control> &controls);
+
+
+    /** @returns the four character code of the format, e.g. "YUYV" */
+    static std::string pixelFormatString(__u32 pixelFormat);
+    /** @returns the format for a four character code. 0 if the string is not four characters long */
+    static __u32 pixelFormatFromString(const std::string &fourcc);
+
 
     void printDeviceInfo();
     void printControls();
@@ -127,27 +347,138 @@ public:
 private:
 
     bool queryControl(struct v4l2_queryctrl&);
+    void enumerateControls(std::pair<std::list<struct v4l2_queryctrl>, std::list<struct v4l2_querymenu> >&);
+    void enumerateFormats(std::vector<struct v4l2_fmtdesc>&);
+    /** applies the values of queueControl() - cheap if there are none */
+    void applyQueuedControls();
     std::list<struct v4l2_querymenu> menus(const struct v4l2_queryctrl&);
 
     static void captureThread(CaptureDevice *camera);
-    static void determineCapturePeriodThread(double, CaptureDevice*,
-            std::pair<double,double>*);
 
     int xv4l2_ioctl(int fileDescriptor, int request, void *arg);
 
-    static std::string pixelFormatString(__u32 pixelFormat);
+    /** init() for a CaptureSource */
+    bool initSource();
+    /** the part of init() after the frame size is known - read buffers, decoder, reserve
+        @note calls finish() on failure */
+    bool initRings();
+    bool initReadBuffers();
+    bool initMmapBuffers();
+    bool initUserPtrBuffers();
+    bool initDecodedBuffers();
+    /** the ring the region is copied into, unless the driver crops and scales */
+    bool initRegionBuffers();
+    /** asks the driver to crop (and scale) to m_regionOfInterest. Restores the whole frame, if it cannot
+        @param format the negotiated one of the whole frame, the cropped one on return */
+    bool initHardwareCrop(const struct v4l2_cropcap &cropcap, struct v4l2_format *format);
+    /** @returns the region in the driver's crop coordinates */
+    struct v4l2_rect cropRectangle(const struct v4l2_cropcap &cropcap, const RegionOfInterest &region) const;
+    /** @returns the region fitted into the whole frame and aligned to the format */
+    RegionOfInterest fittedRegion(const RegionOfInterest &region) const;
+    /** copies the region of the captured frame into the region ring and publishes it there
+        @returns the published buffer, 0 if readers hold all of them */
+    Buffer *copyRegion(const Buffer *buffer);
+    void freeBuffers();
+    bool queueBuffer(Buffer *buffer);
+    void requeueSurplusBuffers();
+    /** stops the driver streaming, which dequeues all buffers, and frees the ones not read */
+    void streamOff();
+    /** @returns the number of buffers to allocate for BackpressureGrow */
+    unsigned int reserveBufferCount() const;
+    /** @returns a buffer to capture into locked for writing, applying the backpressure policy.
+        0 if readers hold all buffers, the new frame has to be thrown away */
+    Buffer *lockForCapturing();
+
+    /** @returns true, if there is a buffer to capture into. Always for read i/o, captureFrame() locks it */
+    bool prepareCapture();
+    /** dequeues/reads one frame and publishes it. Does not block
+        @pre prepareCapture() returned true, the device file is readable */
+    void captureFrame();
+    /** notifies about a newly published buffer, or hands it to the decoder first */
+    void handOut(Buffer *buffer);
+    /** after a pause: frames taken before now are stale, the sequence gap is no loss
+        @pre nothing captures for the device right now */
+    void skipFramesTakenWhilePaused();
+    /** @returns true if the device delivers (M)JPEG, which is decoded */
+    bool isDecoding() const;
+
+    /** @returns the first natively supported format, which PixelConversion can handle. 0 if there is none */
+    __u32 nativePixelFormat();
+
+    friend class CaptureReactor;
 
 
     unsigned int m_captureHeight;
     unsigned int m_captureWidth;
     std::string m_fileName;
     unsigned int m_bufferCount;
+    IoMethod m_ioMethod;
+    __u32 m_pixelFormat;
+    BackpressurePolicy m_backpressurePolicy;
+    unsigned int m_growLimit;
 
     int m_fileDescriptor;
     unsigned int m_bufferSize;
-    std::list<Buffer> m_buffers;
-    std::deque<Buffer*> m_timelySortedBuffers;
-    std::mutex m_timelySortedBuffersMutex;
+    unsigned int m_bytesPerLine;
+    /** for streaming i/o it holds all driver buffers, the ones queued in the driver are locked for writing */
+    FrameRing m_ring;
+    /** memory of m_ring's buffers for IoMethodRead and IoMethodUserPtr */
+    FrameArena m_arena;
+    /** number of buffers currently queued in the driver, streaming i/o only */
+    unsigned int m_queuedBufferCount;
+    FrameNotifier m_notifier;
+    /** about the frames of m_ring, if they are decoded - m_notifier is about the decoded ones */
+    FrameNotifier m_compressedNotifier;
+    /** buffer locked by captureFrame() for read(), kept if no frame came. IoMethodRead only */
+    Buffer *m_writeBuffer;
+    /** frames, which are thrown away, are read into this. IoMethodRead only */
+    unsigned char *m_discardBuffer;
+    /** buffers of m_ring not in use yet, locked for writing. BackpressureGrow only */
+    std::vector<Buffer*> m_reserveBuffers;
+
+    MjpegDecoder *m_mjpegDecoder;
+    MjpegDecoder::Stream m_decodeStream;
+
+    PreviewStream m_preview;
+    double m_previewFramesPerSecond;
+    /** decoded frames, if isDecoding() */
+    FrameRing m_decodedRing;
+    FrameArena m_decodedArena;
+    /** the ring handed to the readers: m_ring, m_decodedRing or m_regionRing */
+    FrameRing *m_outputRing;
+
+    RegionOfInterest m_regionOfInterest;
+    bool m_croppingInHardware;
+    struct v4l2_cropcap m_cropcap;
+    /** of the frames the device delivers: the whole frame, or the region, if the driver crops */
+    unsigned int m_deviceWidth;
+    unsigned int m_deviceHeight;
+    /** of the frames handed out */
+    unsigned int m_frameWidth;
+    unsigned int m_frameHeight;
+    unsigned int m_frameBytesPerLine;
+    /** regions copied by the capture thread, if the driver does not crop and scale */
+    FrameRing m_regionRing;
+    FrameArena m_regionArena;
+    /** the capture thread reduces by - 1, if the driver crops to the region and only factor is left */
+    unsigned int m_regionFactor;
+    /** left << 32 | top of the copied region - moved without stopping the capture thread */
+    std::atomic<unsigned long long> m_regionPosition;
+    std::atomic<bool> m_regionAverage;
+
+    /** sequence number of the last dequeued buffer, -1 if none since STREAMON */
+    long long m_lastSequence;
+    std::atomic<unsigned long long> m_capturedFrameCount;
+    std::atomic<unsigned long long> m_droppedFrameCount;
+    std::atomic<unsigned long long> m_discardedFrameCount;
+    std::atomic<unsigned long long> m_overwrittenFrameCount;
+    std::atomic<unsigned long long> m_addedBufferCount;
+    FrameTiming m_timing;
+
+    CaptureReactor *m_captureReactor;
+    ThreadScheduling m_threadScheduling;
+    ThreadScheduling m_effectiveThreadScheduling;
+    bool m_capturing;
 
     struct timespec m_timerResolution;
     struct timespec m_timerStart;
@@ -157,8 +488,25 @@ private:
     bool m_captureThreadCancellationFlag;
 
     std::mutex m_fileAccessMutex;
-    std::mutex m_pauseCapturingMutex;
-    bool m_capturingPaused;
+    PauseGate m_pauseGate;
+    /** frames taken before are thrown away. 0 if none are */
+    timespec m_staleBefore;
+
+    CaptureSource *m_source;
+    CapabilityCache *m_capabilityCache;
+    bool m_capabilitiesFromCache;
+    bool m_controlsCached;
+    std::pair<std::list<struct v4l2_queryctrl>, std::list<struct v4l2_querymenu> > m_controls;
+    bool m_formatsCached;
+    std::vector<struct v4l2_fmtdesc> m_formats;
+
+    std::mutex m_controlQueueMutex;
+    /** held while a batch is swapped out and applied, so batches are applied in order.
+        queueControl() does not take it, so it does not wait for the ioctl */
+    std::mutex m_controlApplyMutex;
+    /** one value per control, the newest */
+    std::vector<struct v4l2_ext_control> m_queuedControls;
+    std::atomic<bool> m_controlsQueued;
 };
 
 
@@ -18,6 +18,9 @@
 
 #include "capturedevicestab.hpp"
 
+#include "framesynchronizer.hpp"
+#include "pixelconversion.hpp"
+
 #include <QPainter>
 #include <QPaintEvent>
 #include <QCheckBox>
@@ -32,12 +35,17 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <linux/videodev2.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -107,6 +115,8 @@ CaptureDevicesTab::~CaptureDevicesTab()
     }
 
     for (auto it = m_captureDevices.begin(); it != m_captureDevices.end(); ++it) {
+        it->currentImage = QImage();
+        it->currentFrame.release();
         delete it->currentImageMutex;
     }
 }
@@ -148,8 +158,11 @@ void CaptureDevicesTab::startStopAllDevicesButtonClicked(bool checked)
     if (checked == true ) {
 
         for (auto it = m_captureDevices.begin(); it != m_captureDevices.end(); ++it) {
-            if (it->device->isCapturing() == false) it->device->startCapturing();
-            else it->device->pauseCapturing(false);
+            if (it->device->isCapturing() == true) {
+                it->device->pauseCapturing(false);
+            } else if (it->device->startCapturing() == false) {
+                cerr << "Cannot start capturing from \"" << it->device->fileName() << "\"" << endl;
+            }
         }
 
         if (isPainting() == false) startPaintThread();
@@ -162,7 +175,8 @@ void CaptureDevicesTab::startStopAllDevicesButtonClicked(bool checked)
         pausePaintThread(true);
 
         for (auto it = m_captureDevices.begin(); it != m_captureDevices.end(); ++it) {
-            assert(it->device->isCapturing() == true);
+            /* did not start */
+            if (it->device->isCapturing() == false) continue;
             it->device->pauseCapturing(true);
         }
 
@@ -177,78 +191,72 @@ void CaptureDevicesTab::updateAllDeviceControlsButtonClicked(bool checked)
     m_updateAllDeviceControlsButton->setEnabled(false);
 
 
-    /* disable each capture device */
-    list<bool> wasPaused;
-    for (auto it = m_captureDevices.begin(); it != m_captureDevices.end(); ++it) {
-        if (it->device->isCapturingPaused() == true) {
-            wasPaused.push_back(true);
-        } else {
-            wasPaused.push_back(false);
-            it->device->pauseCapturing(true);
-        }
-    }
+    /* collect the controls per device, to read them in one go without pausing it */
+    map<CaptureDevice*, vector<struct v4l2_ext_control> > values;
+    map<CaptureDevice*, vector<QObject*> > widgets;
 
-
-    /* for each controls do update */
     for (auto itControls = m_senderWidgetToControl.begin(); itControls != m_senderWidgetToControl.end(); ++itControls) {
 
         /* leave out disabled controls */
         if (qobject_cast<QWidget*>(itControls->first)->isEnabled() == false) continue;
 
-        struct v4l2_control currentValue;
-        currentValue.id = itControls->second.id;
-        if (itControls->second.device->control(currentValue) == true) {
-            /* currentValue->value = xxx */
-        } else {
-            cerr << __PRETTY_FUNCTION__ << "error getting control value. Using default." << endl;
-            currentValue.value = itControls->second.default_value;
+        /* no state or no widget */
+        if (itControls->second.type != V4L2_CTRL_TYPE_INTEGER && itControls->second.type != V4L2_CTRL_TYPE_BOOLEAN &&
+                itControls->second.type != V4L2_CTRL_TYPE_MENU) continue;
+
+        struct v4l2_ext_control value;
+        memset(&value, 0, sizeof(v4l2_ext_control));
+        value.id = itControls->second.id;
+        /* kept, if it cannot be read */
+        value.value = itControls->second.default_value;
+
+        values[itControls->second.device].push_back(value);
+        widgets[itControls->second.device].push_back(itControls->first);
+    }
+
+
+    for (auto itDevice = values.begin(); itDevice != values.end(); ++itDevice) {
+
+        if (itDevice->first->readControls(itDevice->second) == false) {
+            cerr << __PRETTY_FUNCTION__ << "error getting control values. Using defaults." << endl;
         }
-        
-        switch (itControls->second.type) {
-        case V4L2_CTRL_TYPE_INTEGER: {
-            QSlider *widget = qobject_cast<QSlider*>(itControls->first);
-            assert(widget != 0);
-            widget->setValue(currentValue.value);
-            break; }
-        case V4L2_CTRL_TYPE_BOOLEAN: {
-            QCheckBox *widget = qobject_cast<QCheckBox*>(itControls->first);
-            assert(widget != 0);
-            widget->setCheckState(currentValue.value == 0 ? Qt::Unchecked : Qt::Checked);
-            break; }
-        case V4L2_CTRL_TYPE_MENU: { /* never tested this - ronny 090820 */
-            QComboBox *widget = qobject_cast<QComboBox*>(itControls->first);
-            assert(widget != 0);
-            /* select the current item */
-            int a;
-            for (a = 0; a < widget->count(); ++a) {
-                if (widget->itemData(a).toInt() == currentValue.value) {
-                    widget->setCurrentIndex(a);
-                    break;
+
+        vector<QObject*> &deviceWidgets = widgets[itDevice->first];
+
+        for (unsigned int a = 0; a < deviceWidgets.size(); ++a) {
+            __s32 currentValue = itDevice->second[a].value;
+
+            switch (m_senderWidgetToControl[deviceWidgets[a]].type) {
+            case V4L2_CTRL_TYPE_INTEGER: {
+                QSlider *widget = qobject_cast<QSlider*>(deviceWidgets[a]);
+                assert(widget != 0);
+                widget->setValue(currentValue);
+                break; }
+            case V4L2_CTRL_TYPE_BOOLEAN: {
+                QCheckBox *widget = qobject_cast<QCheckBox*>(deviceWidgets[a]);
+                assert(widget != 0);
+                widget->setCheckState(currentValue == 0 ? Qt::Unchecked : Qt::Checked);
+                break; }
+            case V4L2_CTRL_TYPE_MENU: { /* never tested this - ronny 090820 */
+                QComboBox *widget = qobject_cast<QComboBox*>(deviceWidgets[a]);
+                assert(widget != 0);
+                /* select the current item */
+                int b;
+                for (b = 0; b < widget->count(); ++b) {
+                    if (widget->itemData(b).toInt() == currentValue) {
+                        widget->setCurrentIndex(b);
+                        break;
+                    }
                 }
+                assert(b < widget->count());
+                break; }
+            default:
+                /* filtered out above */
+                break;
             }
-            assert(a < widget->count());
-            break; }
-        case V4L2_CTRL_TYPE_BUTTON:
-            /* a button has no state -> do nothing*/
-            break;
-        case V4L2_CTRL_TYPE_INTEGER64:
-            break;
-        case V4L2_CTRL_TYPE_CTRL_CLASS:
-            break;
-        default:
-            assert(0);
-            break;
         }
     }
 
-
-    /* reenable each capture device */
-    auto it2 = wasPaused.begin();
-    for (auto it = m_captureDevices.begin(); it != m_captureDevices.end(); ++it, ++it2) {
-        if ((*it2) == false) it->device->pauseCapturing(false);
-        else it->device->pauseCapturing(true);
-    }
-
     m_updateAllDeviceControlsButton->setEnabled(true);
 }
 
@@ -258,20 +266,10 @@ void CaptureDevicesTab::sliderControlValueChanged(int value)
     if (m_senderWidgetToControl.find(sender()) == 
             m_senderWidgetToControl.end()) return;
 
-    m_senderWidgetToControl[sender()].device->pauseCapturing(true);
-
-    QWidget *senderWidget = qobject_cast<QWidget*>(sender());
-    assert (senderWidget != 0);
-    senderWidget->setEnabled(false);
-
-    v4l2_control control;
-    control.id = m_senderWidgetToControl[sender()].id;
-    control.value = value;
-    m_senderWidgetToControl[sender()].device->setControl(control);
-
-    m_senderWidgetToControl[sender()].device->pauseCapturing(false);
-
-    senderWidget->setEnabled(true);
+    /* applied between two frames by the capturing thread. Values of a dragged slider, which come faster, replace
+       each other */
+    const ControlProperties &properties = m_senderWidgetToControl[sender()];
+    properties.device->queueControl(properties.id, value);
 }
 
 
@@ -280,22 +278,10 @@ void CaptureDevicesTab::checkBoxControlStateChanged(int state)
     if (m_senderWidgetToControl.find(sender()) == 
             m_senderWidgetToControl.end()) return;
 
-    m_senderWidgetToControl[sender()].device->pauseCapturing(true);
-
     assert(state == Qt::Unchecked || state == Qt::Checked);
 
-    QWidget *senderWidget = qobject_cast<QWidget*>(sender());
-    assert (senderWidget != 0);
-    senderWidget->setEnabled(false);
-
-    v4l2_control control;
-    control.id = m_senderWidgetToControl[sender()].id;
-    control.value = state == Qt::Unchecked ? 0 : 1;
-    m_senderWidgetToControl[sender()].device->setControl(control);
-
-    m_senderWidgetToControl[sender()].device->pauseCapturing(false);
-
-    senderWidget->setEnabled(true);
+    const ControlProperties &properties = m_senderWidgetToControl[sender()];
+    properties.device->queueControl(properties.id, state == Qt::Unchecked ? 0 : 1);
 }
 
 
@@ -304,21 +290,8 @@ void CaptureDevicesTab::comboBoxControlIndexChanged (int index)
     if (m_senderWidgetToControl.find(sender()) == 
             m_senderWidgetToControl.end()) return;
 
-    m_senderWidgetToControl[sender()].device->pauseCapturing(true);
-
-    QWidget *senderWidget = qobject_cast<QWidget*>(sender());
-    assert (senderWidget != 0);
-    senderWidget->setEnabled(false);
-
-    v4l2_control control;
-    control.id = m_senderWidgetToControl[sender()].id;
-    control.value = qobject_cast<QComboBox*>(sender())->itemData(index).toInt();
-
-    m_senderWidgetToControl[sender()].device->setControl(control);
-
-    m_senderWidgetToControl[sender()].device->pauseCapturing(false);
-
-    senderWidget->setEnabled(true);
+    const ControlProperties &properties = m_senderWidgetToControl[sender()];
+    properties.device->queueControl(properties.id, qobject_cast<QComboBox*>(sender())->itemData(index).toInt());
 }
 
 
@@ -367,16 +340,16 @@ bool CaptureDevicesTab::isPainting() const
 void CaptureDevicesTab::pausePaintThread(bool pause)
 {
     if (pause == true) {
-        m_pausePaintingMutex.try_lock();
+        m_paintPauseGate.pause();
     } else {
-        m_pausePaintingMutex.unlock();
+        m_paintPauseGate.resume();
     }
 }
 
 
 void CaptureDevicesTab::createCaptureDeviceControlWidgets(CaptureDevice *device, QWidget *widgetWhereToAddControlsTo)
 {
-    const pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > cameraControls = device->controls();
+    const pair<list<struct v4l2_queryctrl>, list<struct v4l2_querymenu> > &cameraControls = device->controls();
     const list<struct v4l2_queryctrl> &controls = cameraControls.first;
     const list<struct v4l2_querymenu> &menuItems = cameraControls.second;
 
@@ -395,7 +368,8 @@ void CaptureDevicesTab::createCaptureDeviceControlWidgets(CaptureDevice *device,
             controlLabel = new QLabel(controlName.c_str(), widgetWhereToAddControlsTo);
             QSlider *widget = new QSlider(Qt::Horizontal, widgetWhereToAddControlsTo);
             connect(widget, SIGNAL(valueChanged(int)), this, SLOT(sliderControlValueChanged(int)));
-            widget->setTracking(false);
+            /* values are queued and coalesced, so following the slider is cheap */
+            widget->setTracking(true);
             widget->setSingleStep(1);
             widget->setMinimum(it->minimum);
             widget->setMaximum(it->maximum);
@@ -440,7 +414,10 @@ void CaptureDevicesTab::createCaptureDeviceControlWidgets(CaptureDevice *device,
             controlWidget = qobject_cast<QWidget*>(new QLabel("V4L2_CTRL_TYPE_CTRL_CLASS", widgetWhereToAddControlsTo));
             break;
         default:
-            assert(0);
+            /* strings, bitmasks, integer menus of the extended control classes */
+            controlLabel = new QLabel(controlName.c_str(), widgetWhereToAddControlsTo);
+            controlWidget = qobject_cast<QWidget*>(new QLabel(QString("type %1 - not supported").arg(it->type),
+                    widgetWhereToAddControlsTo));
             break;
         }
 
@@ -466,14 +443,36 @@ void CaptureDevicesTab::createCaptureDeviceControlWidgets(CaptureDevice *device,
 
 void CaptureDevicesTab::paintThread(CaptureDevicesTab *window)
 {
-    std::mutex &pausePaintingMutex = window->m_pausePaintingMutex;
+    PauseGate &pauseGate = window->m_paintPauseGate;
     bool &m_paintThreadCancellationFlag = window->m_paintThreadCancellationFlag;
 
-    /* init list of last image times */
-    list<timespec> lastImageTimes;
+    /* init list of last image serials */
+    list<unsigned long long> lastImageSerials;
     for (auto it = window->m_captureDevices.begin(); it != window->m_captureDevices.end(); ++it) {
-        lastImageTimes.push_back(timespec());
-        lastImageTimes.back() = {numeric_limits<time_t>::min(), 0};
+        lastImageSerials.push_back(0);
+    }
+
+    /* one descriptor for all devices - it becomes readable as soon as any of them captured a frame */
+    int notificationFileDescriptor = FrameNotifier::createFileDescriptor();
+    if (notificationFileDescriptor != -1) {
+        for (auto it = window->m_captureDevices.begin(); it != window->m_captureDevices.end(); ++it) {
+            /* the preview, if the device has one - its frames are already small and RGB */
+            if (it->device->preview() != 0) {
+                it->device->preview()->addNotificationFileDescriptor(notificationFileDescriptor);
+            } else {
+                it->device->addNotificationFileDescriptor(notificationFileDescriptor);
+            }
+        }
+    }
+
+    /* how far apart the cameras take their frames */
+    FrameSynchronizer *synchronizer = 0;
+    FrameSynchronizer::FrameTuple tuple;
+    if (window->m_captureDevices.size() > 1) {
+        synchronizer = new FrameSynchronizer();
+        for (auto it = window->m_captureDevices.begin(); it != window->m_captureDevices.end(); ++it) {
+            it->device->addToSynchronizer(synchronizer);
+        }
     }
 
 
@@ -482,61 +481,117 @@ void CaptureDevicesTab::paintThread(CaptureDevicesTab *window)
         bool updateGUI = false;
 
         /* pausing mechanism */
-        pausePaintingMutex.lock();
-        pausePaintingMutex.unlock();
+        pauseGate.checkpoint();
+
+        /* sleep until a new frame arrives - the timeout is just for noticing the cancellation */
+        FrameNotifier::waitForFileDescriptor(notificationFileDescriptor, 100);
 
-        auto itImageTimes = lastImageTimes.begin();
+        auto itImageSerials = lastImageSerials.begin();
         for (auto it = window->m_captureDevices.begin();
                 it != window->m_captureDevices.end()
-                ; ++it, ++itImageTimes) {
+                ; ++it, ++itImageSerials) {
         
-            if (it->device->newerBuffersAvailable(*itImageTimes) > 0) {
+            PreviewStream *preview = it->device->preview();
+            unsigned long long newestSerial = preview != 0 ? preview->newestSerial() : it->device->newestSerial();
 
-                updateGUI = true;
+            if (newestSerial > *itImageSerials) {
 
-                deque<const CaptureDevice::Buffer*> buffers;
-                const CaptureDevice::Buffer *buffer = buffers[0];
+                FrameRef frame = preview != 0 ? preview->lockNewestFrame() : it->device->lockNewestFrame();
+                if (frame.isNull() == true) continue;
 
-                buffers = it->device->lockFirstNBuffers(1);
-                buffer = buffers[0];
+                updateGUI = true;
 
-                *itImageTimes = buffer->time;
+                *itImageSerials = frame.serial();
 
                 it->infoLabelContents["time"] = anythingToString(
-                        (itImageTimes->tv_sec + itImageTimes->tv_nsec / 1000000000.0));
-
-                it->currentImageMutex->lock();
-                it->currentImage = QImage(buffer->buffer, it->device->captureSize().first,
-                        it->device->captureSize().second, QImage::Format_RGB888);
-                it->currentImageMutex->unlock();
-                
-                it->device->unlock(buffers);
+                        (frame.time().tv_sec + frame.time().tv_nsec / 1000000000.0));
+
+                CaptureDevice::FrameCounters counters = it->device->frameCounters();
+                it->infoLabelContents["frames"] = anythingToString(counters.captured);
+                it->infoLabelContents["dropped"] = anythingToString(counters.dropped);
+                if (it->device->mjpegDecoder() != 0) {
+                    it->infoLabelContents["undecoded"] = anythingToString(counters.undecoded);
+                }
+                it->infoLabelContents["discarded"] = anythingToString(counters.discarded);
+                if (it->device->backpressurePolicy() == CaptureDevice::BackpressureOverwrite) {
+                    it->infoLabelContents["overwritten"] = anythingToString(counters.overwritten);
+                } else if (it->device->backpressurePolicy() == CaptureDevice::BackpressureGrow) {
+                    it->infoLabelContents["added buffers"] = anythingToString(counters.addedBuffers);
+                }
+
+                FrameTiming::Statistics timing = it->device->frameTiming();
+                it->infoLabelContents["fps"] = anythingToString(timing.framesPerSecond);
+                it->infoLabelContents["interval [ms]"] = anythingToString(timing.meanInterval * 1000.0) + " +- " +
+                        anythingToString(timing.standardDeviation * 1000.0);
+
+                if (preview != 0) {
+                    PreviewStream::Statistics previewStatistics = preview->statistics();
+                    it->infoLabelContents["preview [ms]"] = anythingToString(previewStatistics.meanMilliseconds) +
+                            " (max " + anythingToString(previewStatistics.maximumMilliseconds) + ")";
+                }
+
+                PauseGate::Statistics resumes = it->device->resumeStatistics();
+                if (resumes.resumeCount > 0) {
+                    it->infoLabelContents["resume latency [ms]"] = anythingToString(resumes.lastResumeLatency * 1000.0) +
+                            " (max " + anythingToString(resumes.maximumResumeLatency * 1000.0) + ")";
+                }
+
+                if (frame.pixelFormat() == V4L2_PIX_FMT_RGB24) {
+                    /* no copy - the image refers to the frame, which stays locked until the next one is shown */
+                    it->currentImageMutex->lock();
+                    it->currentImage = QImage(frame.data(), frame.width(), frame.height(), frame.bytesPerLine(),
+                            QImage::Format_RGB888);
+                    it->currentFrame = move(frame);
+                    it->currentImageMutex->unlock();
+                } else {
+                    /* native formats get converted here, not on the capture thread */
+                    QImage image(frame.width(), frame.height(), QImage::Format_RGB888);
+                    PixelConversion::convertToRgb888(frame.pixelFormat(), frame.data(), frame.bytesPerLine(),
+                            frame.width(), frame.height(), image.bits(), image.bytesPerLine());
+                    frame.release();
+
+                    it->currentImageMutex->lock();
+                    it->currentImage = image;
+                    it->currentFrame.release();
+                    it->currentImageMutex->unlock();
+                }
             }
 
-            /*
-             does not work with N capture devices TODO
+        }
 
-             if (window->m_camera1InfoLabelContents.find("time") !=window->m_camera1InfoLabelContents.end() &&
-                    window->m_camera2InfoLabelContents.find("time") !=window->m_camera2InfoLabelContents.end()) {
-                double t1 = atof(window->m_camera1InfoLabelContents["time"].c_str());
-                double t2 = atof(window->m_camera2InfoLabelContents["time"].c_str());
+        if (synchronizer != 0 && synchronizer->waitForTuple(&tuple, 0) == true) {
+            FrameSynchronizer::Statistics statistics = synchronizer->statistics();
 
-                window->m_camera1InfoLabelContents["deviation"] = window->m_camera2InfoLabelContents["deviation"]
-                        = anythingToString(fabs(t1-t2));
-            }*/
+            unsigned int index = 0;
+            for (auto it = window->m_captureDevices.begin(); it != window->m_captureDevices.end(); ++it, ++index) {
+                it->infoLabelContents["skew [ms]"] = anythingToString(tuple.skew * 1000.0);
+                it->infoLabelContents["unmatched"] = anythingToString(statistics.droppedFrames[index]);
+            }
+
+            /* only the timestamps were of interest */
+            tuple.frames.clear();
+            updateGUI = true;
         }
 
 
         if (updateGUI == true) {
-
             window->update();
+        }
+    }
 
-        } else {
-
-            struct timespec sleepLength = { 0, 1000 };
-            clock_nanosleep(CLOCK_MONOTONIC, 0, &sleepLength, 0);
+    /* both refer to the devices' rings, which go with CaptureDevice::finish() */
+    tuple.frames.clear();
+    delete synchronizer;
 
-        } 
+    if (notificationFileDescriptor != -1) {
+        for (auto it = window->m_captureDevices.begin(); it != window->m_captureDevices.end(); ++it) {
+            if (it->device->preview() != 0) {
+                it->device->preview()->removeNotificationFileDescriptor(notificationFileDescriptor);
+            } else {
+                it->device->removeNotificationFileDescriptor(notificationFileDescriptor);
+            }
+        }
+        close(notificationFileDescriptor);
     }
 }
 
@@ -45,6 +45,8 @@ class CaptureDevicesTab : public QWidget
 {
     Q_OBJECT
 public:
+    /** @note the paint thread locks the devices' frames and synchronizes them - destroy the tab before the
+        devices are finished */
     CaptureDevicesTab(QWidget *parent, const std::set<CaptureDevice*> &captureDevices);
     ~CaptureDevicesTab();
 
@@ -91,6 +93,8 @@ private:
         QLabel *imageLabel;
 
         QImage currentImage;
+        /** the frame currentImage refers to, if it was not converted */
+        FrameRef currentFrame;
         std::mutex *currentImageMutex;
     };
 
@@ -111,7 +115,7 @@ private:
 
     std::thread *m_paintThread;
     bool m_paintThreadCancellationFlag;
-    std::mutex m_pausePaintingMutex;
+    PauseGate m_paintPauseGate;
 
 };
 
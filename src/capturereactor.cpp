@@ -0,0 +1,330 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "capturereactor.hpp"
+
+#include "capturedevice.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/** maximum number of events handled per epoll_wait() */
+static const int s_maxEvents = 16;
+
+
+CaptureReactor::CaptureReactor(unsigned int threadCount) :
+        m_threadCount(threadCount),
+        m_cancellationFlag(false)
+{
+    assert(threadCount > 0);
+}
+
+
+CaptureReactor::~CaptureReactor()
+{
+    stop();
+}
+
+
+unsigned int CaptureReactor::threadCount() const
+{
+    return m_threadCount;
+}
+
+
+void CaptureReactor::setThreadScheduling(const ThreadScheduling &scheduling)
+{
+    assert(isRunning() == false);
+    m_threadScheduling = scheduling;
+}
+
+
+const ThreadScheduling &CaptureReactor::threadScheduling() const
+{
+    return m_threadScheduling;
+}
+
+
+const ThreadScheduling &CaptureReactor::effectiveThreadScheduling(unsigned int thread) const
+{
+    assert(thread < m_threads.size());
+    return m_threads[thread]->scheduling;
+}
+
+
+bool CaptureReactor::start()
+{
+    assert(isRunning() == false);
+
+    m_cancellationFlag = false;
+
+    for (unsigned int a = 0; a < m_threadCount; ++a) {
+        ReactorThread *t = new ReactorThread();
+        t->thread = 0;
+        t->load = 0;
+
+        t->epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+        t->wakeUpFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_threads.push_back(t);
+
+        if (t->epollFileDescriptor == -1 || t->wakeUpFileDescriptor == -1) {
+            cerr << __PRETTY_FUNCTION__ << " Cannot create descriptors. " << errno << " " << strerror(errno) << endl;
+            stop(); return false;
+        }
+
+        /* data.ptr == 0 marks the wake up descriptor */
+        struct epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN;
+        event.data.ptr = 0;
+        if (epoll_ctl(t->epollFileDescriptor, EPOLL_CTL_ADD, t->wakeUpFileDescriptor, &event) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " epoll_ctl " << errno << " " << strerror(errno) << endl;
+            stop(); return false;
+        }
+    }
+
+    for (unsigned int a = 0; a < m_threads.size(); ++a) {
+        ReactorThread *t = m_threads[a];
+        t->thread = new thread(bind(reactorThread, this, t));
+
+        if (m_threadScheduling.isDefault() == false) {
+            t->scheduling = m_threadScheduling.apply(t->thread->native_handle());
+            cout << "reactor thread " << a << ": " << t->scheduling.toString() << endl;
+        } else {
+            t->scheduling = ThreadScheduling::ofThread(t->thread->native_handle());
+        }
+    }
+
+    return true;
+}
+
+
+void CaptureReactor::stop()
+{
+    m_cancellationFlag = true;
+
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        ReactorThread *t = *it;
+
+        if (t->thread != 0) {
+            uint64_t one = 1;
+            if (write(t->wakeUpFileDescriptor, &one, sizeof(uint64_t)) == -1) { /* it wakes up on its own */ }
+
+            t->thread->join();
+            delete t->thread;
+        }
+
+        assert(t->devices.empty() == true);
+
+        if (t->epollFileDescriptor != -1) close(t->epollFileDescriptor);
+        if (t->wakeUpFileDescriptor != -1) close(t->wakeUpFileDescriptor);
+        delete t;
+    }
+    m_threads.clear();
+}
+
+
+bool CaptureReactor::isRunning() const
+{
+    return m_threads.empty() == false;
+}
+
+
+void CaptureReactor::attach(CaptureDevice *device)
+{
+    assert(isRunning() == true);
+    assert(device->fileDescriptor() != -1);
+
+    m_attachMutex.lock();
+
+    /* choose the thread with the least load */
+    ReactorThread *t = 0;
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        (*it)->mutex.lock();
+        if (t == 0 || (*it)->load < t->load) t = *it;
+        (*it)->mutex.unlock();
+    }
+
+    t->mutex.lock();
+
+    assert(t->devices.find(device) == t->devices.end());
+    t->devices.insert(device);
+    t->load += device->bufferSize();
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN;
+    event.data.ptr = device;
+    if (epoll_ctl(t->epollFileDescriptor, EPOLL_CTL_ADD, device->fileDescriptor(), &event) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " epoll_ctl " << errno << " " << strerror(errno) << endl;
+        abort();
+    }
+
+    t->mutex.unlock();
+
+    m_attachMutex.unlock();
+}
+
+
+void CaptureReactor::detach(CaptureDevice *device)
+{
+    m_attachMutex.lock();
+
+    ReactorThread *t = findThread(device);
+    assert(t != 0);
+
+    /* waits for the thread to finish dispatching */
+    t->mutex.lock();
+
+    if (epoll_ctl(t->epollFileDescriptor, EPOLL_CTL_DEL, device->fileDescriptor(), 0) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " epoll_ctl " << errno << " " << strerror(errno) << endl;
+    }
+
+    t->devices.erase(device);
+    t->starvedDevices.erase(device);
+    t->pausedDevices.erase(device);
+    t->load -= device->bufferSize();
+
+    t->mutex.unlock();
+
+    m_attachMutex.unlock();
+}
+
+
+void CaptureReactor::setWatching(CaptureDevice *device, bool watching)
+{
+    m_attachMutex.lock();
+
+    ReactorThread *t = findThread(device);
+
+    if (t != 0) {
+        t->mutex.lock();
+
+        if (watching == false) {
+            t->pausedDevices.insert(device);
+            watch(t, device, false);
+        } else {
+            t->pausedDevices.erase(device);
+            if (t->starvedDevices.find(device) == t->starvedDevices.end()) watch(t, device, true);
+        }
+
+        t->mutex.unlock();
+    }
+
+    m_attachMutex.unlock();
+}
+
+
+CaptureReactor::ReactorThread *CaptureReactor::findThread(CaptureDevice *device)
+{
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        (*it)->mutex.lock();
+        bool found = (*it)->devices.find(device) != (*it)->devices.end();
+        (*it)->mutex.unlock();
+        if (found == true) return *it;
+    }
+    return 0;
+}
+
+
+/** @pre thread->mutex is held */
+bool CaptureReactor::watch(ReactorThread *thread, CaptureDevice *device, bool watch)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = watch == true ? (uint32_t) EPOLLIN : 0;
+    event.data.ptr = device;
+
+    if (epoll_ctl(thread->epollFileDescriptor, EPOLL_CTL_MOD, device->fileDescriptor(), &event) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " epoll_ctl " << errno << " " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+
+/* *** static functions ***************************************************** */
+void CaptureReactor::reactorThread(CaptureReactor *reactor, ReactorThread *thread)
+{
+    struct epoll_event events[s_maxEvents];
+
+    while (reactor->m_cancellationFlag == false) {
+
+        thread->mutex.lock();
+        int timeout = thread->starvedDevices.empty() == true ? 100 : 1;
+        thread->mutex.unlock();
+
+        int eventCount = epoll_wait(thread->epollFileDescriptor, events, s_maxEvents, timeout);
+
+        if (eventCount == -1 && errno != EINTR) {
+            cerr << __PRETTY_FUNCTION__ << " epoll_wait " << errno << " " << strerror(errno) << endl;
+            abort();
+        }
+
+        thread->mutex.lock();
+
+        /* devices, which got a buffer to write into again */
+        for (auto it = thread->starvedDevices.begin(); it != thread->starvedDevices.end();) {
+            if ((*it)->prepareCapture() == true) {
+                if (thread->pausedDevices.find(*it) == thread->pausedDevices.end()) watch(thread, *it, true);
+                thread->starvedDevices.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+
+        for (int a = 0; a < eventCount; ++a) {
+            CaptureDevice *device = (CaptureDevice*) events[a].data.ptr;
+
+            /* wake up descriptor */
+            if (device == 0) continue;
+
+            /* detached after epoll_wait() returned */
+            if (thread->devices.find(device) == thread->devices.end()) continue;
+
+            if (device->prepareCapture() == false) {
+                /* stop watching it until readers released a buffer - otherwise we would spin */
+                watch(thread, device, false);
+                thread->starvedDevices.insert(device);
+                continue;
+            }
+
+            device->captureFrame();
+        }
+
+        /* between frames - also of devices without any lately */
+        for (auto it = thread->devices.begin(); it != thread->devices.end(); ++it) {
+            (*it)->applyQueuedControls();
+        }
+
+        thread->mutex.unlock();
+    }
+}
@@ -0,0 +1,115 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CAPTURE_REACTOR_HPP
+#define CAPTURE_REACTOR_HPP
+
+#include "prereqs.hpp"
+
+#include "threadscheduling.hpp"
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+class CaptureDevice;
+
+namespace std
+{
+    class thread;
+};
+
+
+/**
+ * captures for many devices with few threads
+ *
+ * Each reactor thread watches the descriptors of its devices with one epoll set.
+ * A device is assigned to the thread with the least load (sum of the attached devices' frame sizes)
+ * when it starts capturing.
+ *
+ * @see CaptureDevice::setCaptureReactor()
+ */
+class CaptureReactor
+{
+public:
+
+    CaptureReactor(unsigned int threadCount = 1);
+    CaptureReactor(const CaptureReactor&) = delete;
+    CaptureReactor(CaptureReactor&&) = delete;
+    ~CaptureReactor();
+    CaptureReactor &operator=(const CaptureReactor&) = delete;
+    CaptureReactor &operator=(CaptureReactor&&) = delete;
+
+    unsigned int threadCount() const;
+
+    /** policy, priority and cpus of all reactor threads, applied by start(). Default: unchanged
+        @pre not running */
+    void setThreadScheduling(const ThreadScheduling &scheduling);
+    const ThreadScheduling &threadScheduling() const;
+    /** @returns what the thread got, possibly less than requested
+        @pre running, thread < threadCount() */
+    const ThreadScheduling &effectiveThreadScheduling(unsigned int thread) const;
+
+    /** @returns true on success */
+    bool start();
+    void stop();
+    bool isRunning() const;
+
+    /** @note called by CaptureDevice::startCapturing() */
+    void attach(CaptureDevice *device);
+    /** after returning, the device is not touched by the reactor anymore
+        @note called by CaptureDevice::stopCapturing() */
+    void detach(CaptureDevice *device);
+    /** stop/resume watching the device's descriptor, e.g. while it is paused */
+    void setWatching(CaptureDevice *device, bool watch);
+
+private:
+
+    struct ReactorThread
+    {
+        int epollFileDescriptor;
+        /** eventfd for waking up the thread on cancellation */
+        int wakeUpFileDescriptor;
+        std::thread *thread;
+        ThreadScheduling scheduling;
+
+        /** held while dispatching events, guards everything below */
+        std::mutex mutex;
+        std::set<CaptureDevice*> devices;
+        /** devices without a buffer to capture into, retried regularly */
+        std::set<CaptureDevice*> starvedDevices;
+        std::set<CaptureDevice*> pausedDevices;
+        unsigned long long load;
+    };
+
+    static void reactorThread(CaptureReactor *reactor, ReactorThread *thread);
+
+    ReactorThread *findThread(CaptureDevice *device);
+    static bool watch(ReactorThread *thread, CaptureDevice *device, bool watch);
+
+    unsigned int m_threadCount;
+    ThreadScheduling m_threadScheduling;
+    std::vector<ReactorThread*> m_threads;
+    bool m_cancellationFlag;
+
+    /** serializes attaching and detaching */
+    std::mutex m_attachMutex;
+};
+
+
+#endif /* CAPTURE_REACTOR_HPP */
@@ -0,0 +1,87 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CAPTURE_SOURCE_HPP
+#define CAPTURE_SOURCE_HPP
+
+#include "prereqs.hpp"
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+
+#include <linux/types.h>
+
+
+/**
+ * delivers frames to a CaptureDevice instead of a V4L2 device
+ *
+ * The device captures from it like from a device with read i/o: its capture thread (or reactor) waits until
+ * fileDescriptor() becomes readable and lets readFrame() write the frame into a buffer of the ring.
+ * Everything behind - ring, decoder, readers - does not notice the difference.
+ * Sources, which hold their frames in memory anyway, hand them out with mapFrame() instead - the ring's buffers
+ * then point into the source's memory and nothing is copied at all.
+ *
+ * @see CaptureDevice::setCaptureSource()
+ */
+class CaptureSource
+{
+protected:
+    CaptureSource();
+public:
+    virtual ~CaptureSource();
+    CaptureSource(const CaptureSource&) = delete;
+    CaptureSource(CaptureSource&&) = delete;
+    CaptureSource &operator=(const CaptureSource&) = delete;
+    CaptureSource &operator=(CaptureSource&&) = delete;
+
+    /** e.g. for the device info */
+    virtual std::string name() const = 0;
+
+    /** negotiates the format, the source may change any of the values
+        @param pixelFormat 0 lets the source choose
+        @param bytesPerLine the preferred row length, at least the minimum for the format
+        @returns the size of a frame in bytes, 0 on failure */
+    virtual size_t open(unsigned int *width, unsigned int *height, __u32 *pixelFormat, unsigned int *bytesPerLine) = 0;
+    virtual void close() = 0;
+
+    /** becomes readable (select/epoll), whenever a frame is due. -1 if not open */
+    virtual int fileDescriptor() const = 0;
+
+    /** the sequence numbers start over
+        @returns false, if the descriptor cannot be made to become readable. Call stop() then */
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+    /** writes the frame, which is due, if any. Does not block
+        @param data 0 skips the frame
+        @param sequence counts from start() on. Gaps are frames the caller was too slow for
+        @returns the size of the frame, 0 if none is due */
+    virtual size_t readFrame(unsigned char *data, size_t length, timespec *time, unsigned int *sequence) = 0;
+
+    /** if true, the device takes the frames with mapFrame(). Default: false */
+    virtual bool mapsFrames() const;
+    /** like readFrame(), but points 'data' to the frame in the source's memory instead of copying it.
+        The frame stays there until close(), it must not be written to
+        @param data 0 skips the frame
+        @pre mapsFrames() */
+    virtual size_t mapFrame(const unsigned char **data, timespec *time, unsigned int *sequence);
+};
+
+
+#endif /* CAPTURE_SOURCE_HPP */
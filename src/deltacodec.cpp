@@ -0,0 +1,153 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "deltacodec.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+
+static unsigned char *writeRun(unsigned char *out, const unsigned char *end, size_t words, bool zero);
+static const unsigned char *readRun(const unsigned char *in, const unsigned char *end, size_t *words, bool *zero);
+static uint64_t load(const unsigned char *p);
+static void store(unsigned char *p, uint64_t value);
+
+
+size_t DeltaCodec::encode(const unsigned char *frame, const unsigned char *reference, size_t length,
+        unsigned char *out, size_t capacity)
+{
+    const size_t wordCount = length / 8;
+    const size_t tailLength = length % 8;
+    unsigned char *o = out;
+    unsigned char *end = out + capacity;
+
+    size_t w = 0;
+    while (w < wordCount) {
+        /* unchanged words */
+        size_t start = w;
+        while (w < wordCount && load(frame + w * 8) == load(reference + w * 8)) ++w;
+
+        if (w > start) {
+            o = writeRun(o, end, w - start, true);
+            if (o == 0) return 0;
+            if (w == wordCount) break;
+        }
+
+        /* changed words, stored as difference */
+        start = w;
+        while (w < wordCount && load(frame + w * 8) != load(reference + w * 8)) ++w;
+
+        o = writeRun(o, end, w - start, false);
+        if (o == 0 || (size_t) (end - o) < (w - start) * 8) return 0;
+
+        for (size_t a = start; a < w; ++a, o += 8) {
+            store(o, load(frame + a * 8) ^ load(reference + a * 8));
+        }
+    }
+
+    if ((size_t) (end - o) < tailLength) return 0;
+    for (size_t a = wordCount * 8; a < length; ++a) {
+        *o++ = frame[a] ^ reference[a];
+    }
+
+    return o - out;
+}
+
+
+bool DeltaCodec::decode(const unsigned char *in, size_t inLength, unsigned char *frame, size_t length)
+{
+    const size_t wordCount = length / 8;
+    const size_t tailLength = length % 8;
+    const unsigned char *i = in;
+    const unsigned char *end = in + inLength;
+
+    size_t w = 0;
+    while (w < wordCount) {
+        size_t words;
+        bool zero;
+        i = readRun(i, end, &words, &zero);
+        if (i == 0 || words == 0 || words > wordCount - w) return false;
+
+        if (zero == false) {
+            if ((size_t) (end - i) < words * 8) return false;
+
+            for (size_t a = w; a < w + words; ++a, i += 8) {
+                store(frame + a * 8, load(frame + a * 8) ^ load(i));
+            }
+        }
+        w += words;
+    }
+
+    if ((size_t) (end - i) != tailLength) return false;
+    for (size_t a = wordCount * 8; a < length; ++a) {
+        frame[a] ^= *i++;
+    }
+
+    return true;
+}
+
+
+/* *** local *************************************************************** */
+unsigned char *writeRun(unsigned char *out, const unsigned char *end, size_t words, bool zero)
+{
+    size_t value = (words << 1) | (zero == true ? 1 : 0);
+
+    do {
+        if (out == end) return 0;
+        *out++ = (value & 0x7f) | (value >= 0x80 ? 0x80 : 0);
+        value >>= 7;
+    } while (value != 0);
+
+    return out;
+}
+
+
+const unsigned char *readRun(const unsigned char *in, const unsigned char *end, size_t *words, bool *zero)
+{
+    size_t value = 0;
+    unsigned int shift = 0;
+
+    for (;;) {
+        if (in == end || shift >= 8 * sizeof(size_t)) return 0;
+        unsigned char byte = *in++;
+        value |= (size_t) (byte & 0x7f) << shift;
+        shift += 7;
+        if ((byte & 0x80) == 0) break;
+    }
+
+    *words = value >> 1;
+    *zero = (value & 1) != 0;
+    return in;
+}
+
+
+/* unaligned access, compiles to a plain load/store */
+uint64_t load(const unsigned char *p)
+{
+    uint64_t ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+
+void store(unsigned char *p, uint64_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
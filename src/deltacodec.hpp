@@ -0,0 +1,51 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef DELTA_CODEC_HPP
+#define DELTA_CODEC_HPP
+
+#include "prereqs.hpp"
+
+#include <cstddef>
+
+
+/**
+ * lossless inter-frame codec for uncompressed frames of a mostly static scene
+ *
+ * The frame is XORed with a reference frame (usually the previous one) in 64 bit words. Runs of zero words -
+ * unchanged pixels - are stored as a count, runs of changed words are stored as they are. Runs are stored as
+ * varints: (words << 1) | isZeroRun. The length % 8 trailing bytes follow as XOR difference.
+ *
+ * It runs at memory speed on one core, but only gains where pixels do not change bit for bit, so sensor noise
+ * defeats it - encode() fails instead of growing the frame then, store it as it is.
+ */
+class DeltaCodec
+{
+public:
+
+    /** @param reference frame of the same length
+        @returns the encoded length. 0, if it does not fit into 'capacity' */
+    static size_t encode(const unsigned char *frame, const unsigned char *reference, size_t length,
+            unsigned char *out, size_t capacity);
+    /** @param frame holds the reference on entry and the decoded frame on return
+        @returns false, if the encoded data is corrupt or does not match the length */
+    static bool decode(const unsigned char *in, size_t inLength, unsigned char *frame, size_t length);
+};
+
+
+#endif /* DELTA_CODEC_HPP */
@@ -0,0 +1,186 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framearena.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static const size_t s_hugePageSize = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t value, size_t multiple);
+
+
+FrameArena::FrameArena() :
+        m_mapping(0),
+        m_mappingLength(0),
+        m_frameCount(0),
+        m_frameSize(0),
+        m_frameStride(0),
+        m_pageSize(PageSizeNormal)
+{
+}
+
+
+FrameArena::~FrameArena()
+{
+    release();
+}
+
+
+bool FrameArena::allocate(unsigned int frameCount, size_t frameSize)
+{
+    release();
+
+    if (frameCount == 0 || frameSize == 0) return true;
+
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t frameStride = roundUp(frameSize, pageSize);
+    size_t length = frameStride * frameCount;
+
+    /* prefaulted - the capture thread should not take page faults */
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+    if (length >= s_hugePageSize) {
+        /* explicit huge pages - only works, if the administrator reserved some */
+        size_t hugeLength = roundUp(length, s_hugePageSize);
+        void *mapping = mmap(0, hugeLength, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+
+        if (mapping != MAP_FAILED) {
+            m_mapping = (unsigned char*) mapping;
+            m_mappingLength = hugeLength;
+            m_pageSize = PageSizeHuge;
+        }
+    }
+
+    if (m_mapping == 0 && length >= s_hugePageSize) {
+        /* transparent huge pages need huge page aligned memory, so over-allocate and trim.
+           Populating is postponed until after madvise(), otherwise it would be done with normal pages */
+        void *mapping = mmap(0, length + s_hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0);
+
+        if (mapping != MAP_FAILED) {
+            unsigned char *begin = (unsigned char*) mapping;
+            unsigned char *aligned = (unsigned char*) roundUp((uintptr_t) begin, s_hugePageSize);
+            unsigned char *end = begin + length + s_hugePageSize;
+
+            if (aligned > begin) munmap(begin, aligned - begin);
+            if (end > aligned + length) munmap(aligned + length, end - (aligned + length));
+
+            m_mapping = aligned;
+            m_mappingLength = length;
+            m_pageSize = madvise(aligned, length, MADV_HUGEPAGE) == 0 ? PageSizeTransparentHuge : PageSizeNormal;
+
+            for (size_t a = 0; a < length; a += pageSize) m_mapping[a] = 0;
+        }
+    }
+
+    if (m_mapping == 0) {
+        void *mapping = mmap(0, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        if (mapping == MAP_FAILED) {
+            cerr << __PRETTY_FUNCTION__ << " Cannot map " << length << " bytes. " << errno << " "
+                    << strerror(errno) << endl;
+            return false;
+        }
+
+        m_mapping = (unsigned char*) mapping;
+        m_mappingLength = length;
+        m_pageSize = PageSizeNormal;
+    }
+
+    m_frameCount = frameCount;
+    m_frameSize = frameSize;
+    m_frameStride = frameStride;
+
+    return true;
+}
+
+
+void FrameArena::release()
+{
+    if (m_mapping != 0) {
+        if (munmap(m_mapping, m_mappingLength) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " munmap " << errno << " " << strerror(errno) << endl;
+        }
+    }
+
+    m_mapping = 0;
+    m_mappingLength = 0;
+    m_frameCount = 0;
+    m_frameSize = 0;
+    m_frameStride = 0;
+    m_pageSize = PageSizeNormal;
+}
+
+
+unsigned int FrameArena::frameCount() const
+{
+    return m_frameCount;
+}
+
+
+size_t FrameArena::frameSize() const
+{
+    return m_frameSize;
+}
+
+
+unsigned char *FrameArena::frame(unsigned int index) const
+{
+    assert(index < m_frameCount);
+    return m_mapping + index * m_frameStride;
+}
+
+
+FrameArena::PageSize FrameArena::pageSize() const
+{
+    return m_pageSize;
+}
+
+
+const char *FrameArena::pageSizeString(PageSize pageSize)
+{
+    switch (pageSize) {
+    case PageSizeHuge: return "huge pages";
+    case PageSizeTransparentHuge: return "transparent huge pages";
+    default: return "normal pages";
+    }
+}
+
+
+unsigned int FrameArena::alignedRowLength(unsigned int rowLength)
+{
+    return (unsigned int) roundUp(rowLength, CacheLineSize);
+}
+
+
+/* *** local *************************************************************** */
+size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
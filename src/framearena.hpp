@@ -0,0 +1,88 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_ARENA_HPP
+#define FRAME_ARENA_HPP
+
+#include "prereqs.hpp"
+
+#include <cstddef>
+
+
+/**
+ * one contiguous, prefaulted mapping holding the frames of a ring
+ *
+ * Frames start at page boundaries (which also suits O_DIRECT and USERPTR streaming).
+ * Arenas of at least one huge page are backed by explicit huge pages if some are reserved
+ * (/proc/sys/vm/nr_hugepages), otherwise by transparent huge pages if the kernel allows.
+ */
+class FrameArena
+{
+public:
+
+    enum PageSize
+    {
+        PageSizeNormal,
+        PageSizeTransparentHuge,
+        PageSizeHuge
+    };
+
+    enum
+    {
+        /** rows should be padded to multiples of this */
+        CacheLineSize = 64
+    };
+
+
+    FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena(FrameArena&&) = delete;
+    ~FrameArena();
+    FrameArena &operator=(const FrameArena&) = delete;
+    FrameArena &operator=(FrameArena&&) = delete;
+
+    /** releases the previous frames
+        @returns false, if out of memory */
+    bool allocate(unsigned int frameCount, size_t frameSize);
+    void release();
+
+    unsigned int frameCount() const;
+    /** the requested frame size */
+    size_t frameSize() const;
+    /** @pre index < frameCount() */
+    unsigned char *frame(unsigned int index) const;
+
+    /** page size backing the arena. Transparent huge pages are a hint, the kernel may not comply */
+    PageSize pageSize() const;
+    static const char *pageSizeString(PageSize pageSize);
+
+    /** @returns the row length rounded up to a multiple of CacheLineSize */
+    static unsigned int alignedRowLength(unsigned int rowLength);
+
+private:
+
+    unsigned char *m_mapping;
+    size_t m_mappingLength;
+    unsigned int m_frameCount;
+    size_t m_frameSize;
+    size_t m_frameStride;
+    PageSize m_pageSize;
+};
+
+
+#endif /* FRAME_ARENA_HPP */
@@ -0,0 +1,259 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framecontainer.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static size_t roundUp(size_t value, size_t multiple);
+
+
+FrameContainer::FrameContainer() :
+        m_fileDescriptor(-1),
+        m_mapping(0),
+        m_mappingLength(0),
+        m_index(0),
+        m_frameCount(0),
+        m_hadIndex(false)
+{
+}
+
+
+FrameContainer::~FrameContainer()
+{
+    close();
+}
+
+
+bool FrameContainer::open(const string &fileName)
+{
+    close();
+
+    m_fileName = fileName;
+
+    m_fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+    if (m_fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " cannot open \"" << fileName << "\" " << errno << " " << strerror(errno)
+                << endl;
+        close(); return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fileDescriptor, &st) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " fstat " << errno << " " << strerror(errno) << endl;
+        close(); return false;
+    }
+
+    if ((size_t) st.st_size < (size_t) BlockSize) {
+        cerr << "\"" << fileName << "\" is no frame file." << endl;
+        close(); return false;
+    }
+
+    void *mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, m_fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        cerr << __PRETTY_FUNCTION__ << " mmap " << errno << " " << strerror(errno) << endl;
+        close(); return false;
+    }
+    m_mapping = (const unsigned char*) mapping;
+    m_mappingLength = st.st_size;
+
+    /* mostly read front to back */
+    madvise(mapping, m_mappingLength, MADV_SEQUENTIAL);
+
+    const FileHeader *header = (const FileHeader*) m_mapping;
+    if (memcmp(header->magic, "VCRAW1", 7) != 0 || header->blockSize != BlockSize) {
+        cerr << "\"" << fileName << "\" is no frame file." << endl;
+        close(); return false;
+    }
+
+    m_hadIndex = readIndex();
+    if (m_hadIndex == false) rebuildIndex();
+
+    return true;
+}
+
+
+void FrameContainer::close()
+{
+    if (m_mapping != 0) munmap((void*) m_mapping, m_mappingLength);
+    m_mapping = 0;
+    m_mappingLength = 0;
+
+    if (m_fileDescriptor != -1) ::close(m_fileDescriptor);
+    m_fileDescriptor = -1;
+
+    m_index = 0;
+    m_frameCount = 0;
+    m_hadIndex = false;
+    m_rebuiltIndex.clear();
+}
+
+
+bool FrameContainer::isOpen() const
+{
+    return m_mapping != 0;
+}
+
+
+const string &FrameContainer::fileName() const
+{
+    return m_fileName;
+}
+
+
+bool FrameContainer::hadIndex() const
+{
+    return m_hadIndex;
+}
+
+
+unsigned int FrameContainer::frameCount() const
+{
+    return m_frameCount;
+}
+
+
+const FrameContainer::IndexEntry &FrameContainer::entry(unsigned int index) const
+{
+    assert(index < m_frameCount);
+    return m_index[index];
+}
+
+
+const unsigned char *FrameContainer::data(unsigned int index) const
+{
+    assert(index < m_frameCount);
+    return m_mapping + m_index[index].offset;
+}
+
+
+bool FrameContainer::readFileHeader(const string &fileName, FileHeader *header)
+{
+    int fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+    if (fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " cannot open \"" << fileName << "\" " << errno << " " << strerror(errno)
+                << endl;
+        return false;
+    }
+
+    bool ret = pread(fileDescriptor, header, sizeof(FileHeader), 0) == (ssize_t) sizeof(FileHeader) &&
+            memcmp(header->magic, "VCRAW1", 7) == 0 && header->blockSize == BlockSize;
+    ::close(fileDescriptor);
+
+    if (ret == false) cerr << "\"" << fileName << "\" is no frame file." << endl;
+    return ret;
+}
+
+
+size_t FrameContainer::indexLength(unsigned long long frameCount)
+{
+    return roundUp(frameCount * sizeof(IndexEntry), BlockSize) + BlockSize;
+}
+
+
+void FrameContainer::writeIndex(const IndexEntry *entries, unsigned long long count, unsigned long long indexOffset,
+        unsigned char *index)
+{
+    size_t length = indexLength(count);
+    memset(index, 0, length);
+    memcpy(index, entries, count * sizeof(IndexEntry));
+
+    Trailer *trailer = (Trailer*) (index + length - sizeof(Trailer));
+    trailer->indexOffset = indexOffset;
+    trailer->frameCount = count;
+    memcpy(trailer->magic, "VCINDEX1", sizeof(trailer->magic));
+}
+
+
+bool FrameContainer::readIndex()
+{
+    if (m_mappingLength < 2 * (size_t) BlockSize || m_mappingLength % BlockSize != 0) return false;
+
+    const Trailer *trailer = (const Trailer*) (m_mapping + m_mappingLength - sizeof(Trailer));
+    if (memcmp(trailer->magic, "VCINDEX1", sizeof(trailer->magic)) != 0) return false;
+
+    /* the index has to end the file */
+    if (trailer->indexOffset % BlockSize != 0 ||
+            trailer->indexOffset + indexLength(trailer->frameCount) != m_mappingLength) {
+        return false;
+    }
+
+    const IndexEntry *index = (const IndexEntry*) (m_mapping + trailer->indexOffset);
+    for (unsigned long long a = 0; a < trailer->frameCount; ++a) {
+        if (index[a].offset + index[a].bytesUsed > trailer->indexOffset) return false;
+    }
+
+    m_index = index;
+    m_frameCount = (unsigned int) trailer->frameCount;
+    return true;
+}
+
+
+void FrameContainer::rebuildIndex()
+{
+    m_rebuiltIndex.clear();
+
+    size_t offset = BlockSize;
+    while (offset + BlockSize <= m_mappingLength) {
+        const ChunkHeader *chunk = (const ChunkHeader*) (m_mapping + offset);
+
+        /* preallocated space or a torn write */
+        if (memcmp(chunk->magic, "VCFR", sizeof(chunk->magic)) != 0 || chunk->chunkLength < BlockSize ||
+                chunk->chunkLength % BlockSize != 0 || offset + chunk->chunkLength > m_mappingLength ||
+                BlockSize + (size_t) chunk->bytesUsed > chunk->chunkLength) {
+            break;
+        }
+
+        IndexEntry entry;
+        entry.offset = offset + BlockSize;
+        entry.seconds = chunk->seconds;
+        entry.nanoseconds = chunk->nanoseconds;
+        entry.sequence = chunk->sequence;
+        entry.pixelFormat = chunk->pixelFormat;
+        entry.width = chunk->width;
+        entry.height = chunk->height;
+        entry.bytesPerLine = chunk->bytesPerLine;
+        entry.bytesUsed = chunk->bytesUsed;
+        m_rebuiltIndex.push_back(entry);
+
+        offset += chunk->chunkLength;
+    }
+
+    cerr << "\"" << m_fileName << "\" has no index, found " << m_rebuiltIndex.size() << " frames." << endl;
+
+    m_index = m_rebuiltIndex.empty() == true ? 0 : &m_rebuiltIndex[0];
+    m_frameCount = m_rebuiltIndex.size();
+}
+
+
+/* *** local *************************************************************** */
+size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
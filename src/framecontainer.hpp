@@ -0,0 +1,165 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_CONTAINER_HPP
+#define FRAME_CONTAINER_HPP
+
+#include "prereqs.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <linux/types.h>
+
+
+/**
+ * read access to a recorded frame file, mapped into memory
+ *
+ * The file is a sequence of chunks, everything in blocks of BlockSize bytes, so it can be written with O_DIRECT:
+ *   one block with the FileHeader,
+ *   per frame a chunk: one block with the ChunkHeader, followed by the frame data padded to a multiple of BlockSize,
+ *   the index: an IndexEntry per frame, padded, followed by one block ending with the Trailer.
+ *
+ * Opening reads the trailing index - the frames are found in O(1) and handed out without copying.
+ * Files without index (the recording did not end properly) are indexed by walking the chunks.
+ *
+ * @see FrameRecorder
+ */
+class FrameContainer
+{
+public:
+
+    enum
+    {
+        /** alignment and granularity of the file's parts. Suits O_DIRECT with 512 byte and 4k sectors */
+        BlockSize = 4096
+    };
+
+    struct FileHeader
+    {
+        /** "VCRAW1" */
+        char magic[8];
+        __u32 blockSize;
+        /** format of the first frame. V4L2_PIX_FMT_* */
+        __u32 pixelFormat;
+        __u32 width;
+        __u32 height;
+        __u32 bytesPerLine;
+    };
+
+    struct ChunkHeader
+    {
+        /** "VCFR" */
+        char magic[4];
+        __u32 sequence;
+        /** CLOCK_MONOTONIC, when the frame was taken */
+        __s64 seconds;
+        __s64 nanoseconds;
+        /** V4L2_PIX_FMT_* */
+        __u32 pixelFormat;
+        __u32 width;
+        __u32 height;
+        __u32 bytesPerLine;
+        /** size of the frame data, which follows the header block */
+        __u32 bytesUsed;
+        /** of the header block and the padded frame data - the next chunk starts after it */
+        __u32 chunkLength;
+    };
+
+    struct IndexEntry
+    {
+        /** of the frame data in the file */
+        __u64 offset;
+        __s64 seconds;
+        __s64 nanoseconds;
+        __u32 sequence;
+        __u32 pixelFormat;
+        __u32 width;
+        __u32 height;
+        __u32 bytesPerLine;
+        __u32 bytesUsed;
+    };
+
+    struct Trailer
+    {
+        /** of the first IndexEntry */
+        __u64 indexOffset;
+        __u64 frameCount;
+        /** "VCINDEX1" */
+        char magic[8];
+    };
+
+
+    FrameContainer();
+    FrameContainer(const FrameContainer&) = delete;
+    FrameContainer(FrameContainer&&) = delete;
+    ~FrameContainer();
+    FrameContainer &operator=(const FrameContainer&) = delete;
+    FrameContainer &operator=(FrameContainer&&) = delete;
+
+    /** maps the file and reads its index
+        @returns false, if it is no frame file */
+    bool open(const std::string &fileName);
+    /** unmaps the file - the data of its frames goes away */
+    void close();
+    bool isOpen() const;
+
+    const std::string &fileName() const;
+    /** false, if the index was rebuilt from the chunks */
+    bool hadIndex() const;
+
+    unsigned int frameCount() const;
+    /** O(1)
+        @pre index < frameCount() */
+    const IndexEntry &entry(unsigned int index) const;
+    /** @returns the frame data in the mapping, followed by the padding to the next block. O(1)
+        @pre index < frameCount() */
+    const unsigned char *data(unsigned int index) const;
+
+    /** reads the header only, e.g. to learn the format before replaying a file
+        @returns false, if it is no frame file */
+    static bool readFileHeader(const std::string &fileName, FileHeader *header);
+
+    /** the index of a file with frameCount frames. Padded, the Trailer ends it */
+    static size_t indexLength(unsigned long long frameCount);
+    /** writes an index for the entries to 'index' - indexLength(count) bytes - found at 'indexOffset' in the file */
+    static void writeIndex(const IndexEntry *entries, unsigned long long count, unsigned long long indexOffset,
+            unsigned char *index);
+
+private:
+
+    /** @returns false, if the file has no valid trailing index */
+    bool readIndex();
+    /** walks the chunks up to the first incomplete one */
+    void rebuildIndex();
+
+    std::string m_fileName;
+    int m_fileDescriptor;
+    const unsigned char *m_mapping;
+    size_t m_mappingLength;
+
+    /** points into the mapping, or to m_rebuiltIndex */
+    const IndexEntry *m_index;
+    unsigned int m_frameCount;
+    bool m_hadIndex;
+    std::vector<IndexEntry> m_rebuiltIndex;
+};
+
+
+#endif /* FRAME_CONTAINER_HPP */
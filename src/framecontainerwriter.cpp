@@ -0,0 +1,281 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framecontainerwriter.hpp"
+
+#include "frameref.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static size_t roundUp(size_t value, size_t multiple);
+
+
+FrameContainerWriter::FrameContainerWriter() :
+        m_preallocation(256 * 1024 * 1024),
+        m_fileDescriptor(-1),
+        m_directIo(false),
+        m_fileLength(0),
+        m_allocatedLength(0),
+        m_headerBlock(0),
+        m_bounceBuffer(0),
+        m_bounceBufferLength(0)
+{
+}
+
+
+FrameContainerWriter::~FrameContainerWriter()
+{
+    close();
+
+    free(m_headerBlock);
+    free(m_bounceBuffer);
+}
+
+
+void FrameContainerWriter::setPreallocation(size_t bytes)
+{
+    m_preallocation = bytes;
+}
+size_t FrameContainerWriter::preallocation() const
+{
+    return m_preallocation;
+}
+
+
+bool FrameContainerWriter::open(const string &fileName, __u32 pixelFormat, unsigned int width, unsigned int height,
+        unsigned int bytesPerLine)
+{
+    assert(isOpen() == false);
+
+    m_fileName = fileName;
+
+    if (m_headerBlock == 0 &&
+            posix_memalign((void**) &m_headerBlock, FrameContainer::BlockSize, FrameContainer::BlockSize) != 0) {
+        cerr << __PRETTY_FUNCTION__ << " posix_memalign failed" << endl;
+        m_headerBlock = 0;
+        return false;
+    }
+
+    m_fileDescriptor = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    m_directIo = m_fileDescriptor != -1;
+
+    if (m_fileDescriptor == -1 && errno == EINVAL) {
+        /* the file system does not do O_DIRECT */
+        m_fileDescriptor = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (m_fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " cannot open \"" << fileName << "\" " << errno << " " << strerror(errno)
+                << endl;
+        return false;
+    }
+
+    m_fileLength = 0;
+    m_allocatedLength = 0;
+    m_index.clear();
+
+    memset(m_headerBlock, 0, FrameContainer::BlockSize);
+    FrameContainer::FileHeader *header = (FrameContainer::FileHeader*) m_headerBlock;
+    strncpy(header->magic, "VCRAW1", sizeof(header->magic));
+    header->blockSize = FrameContainer::BlockSize;
+    header->pixelFormat = pixelFormat;
+    header->width = width;
+    header->height = height;
+    header->bytesPerLine = bytesPerLine;
+
+    if (pwrite(m_fileDescriptor, m_headerBlock, FrameContainer::BlockSize, 0) != FrameContainer::BlockSize) {
+        cerr << __PRETTY_FUNCTION__ << " cannot write \"" << fileName << "\" " << errno << " " << strerror(errno)
+                << endl;
+        close(false);
+        return false;
+    }
+    m_fileLength = FrameContainer::BlockSize;
+
+    return true;
+}
+
+
+void FrameContainerWriter::close(bool writeIndex)
+{
+    if (m_fileDescriptor == -1) return;
+
+    if (writeIndex == true) {
+        size_t length = FrameContainer::indexLength(m_index.size());
+        unsigned char *index = 0;
+
+        if (posix_memalign((void**) &index, FrameContainer::BlockSize, length) == 0) {
+            FrameContainer::writeIndex(m_index.empty() == true ? 0 : &m_index[0], m_index.size(), m_fileLength, index);
+
+            if (pwrite(m_fileDescriptor, index, length, m_fileLength) == (ssize_t) length) {
+                m_fileLength += length;
+            } else {
+                cerr << __PRETTY_FUNCTION__ << " cannot write the index of \"" << m_fileName << "\" " << errno << " "
+                        << strerror(errno) << endl;
+            }
+            free(index);
+        }
+    }
+    m_index.clear();
+
+    /* give back the space reserved ahead */
+    if (m_allocatedLength != m_fileLength && ftruncate(m_fileDescriptor, m_fileLength) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " ftruncate " << errno << " " << strerror(errno) << endl;
+    }
+
+    ::close(m_fileDescriptor);
+    m_fileDescriptor = -1;
+}
+
+
+bool FrameContainerWriter::isOpen() const
+{
+    return m_fileDescriptor != -1;
+}
+
+
+const string &FrameContainerWriter::fileName() const
+{
+    return m_fileName;
+}
+
+
+bool FrameContainerWriter::isDirectIo() const
+{
+    return m_directIo;
+}
+
+
+unsigned long long FrameContainerWriter::fileLength() const
+{
+    return m_fileLength;
+}
+
+
+bool FrameContainerWriter::write(const unsigned char *data, unsigned int bytesUsed, size_t readableLength,
+        const timespec &time, unsigned int sequence, __u32 pixelFormat, unsigned int width, unsigned int height,
+        unsigned int bytesPerLine)
+{
+    if (m_fileDescriptor == -1) return false;
+
+    size_t dataLength = roundUp(bytesUsed, FrameContainer::BlockSize);
+    size_t chunkLength = FrameContainer::BlockSize + dataLength;
+
+    /* reserve the space ahead, so the writes do not allocate blocks one by one */
+    if (m_fileLength + (off_t) chunkLength > m_allocatedLength) {
+        off_t length = max((off_t) roundUp(m_preallocation, FrameContainer::BlockSize), (off_t) chunkLength);
+        if (fallocate(m_fileDescriptor, 0, m_fileLength, length) == 0) {
+            m_allocatedLength = m_fileLength + length;
+        } else if (errno == EOPNOTSUPP) {
+            /* the file system cannot, grow as written */
+            m_allocatedLength = m_fileLength + chunkLength;
+        } else {
+            cerr << __PRETTY_FUNCTION__ << " fallocate \"" << m_fileName << "\" " << errno << " " << strerror(errno)
+                    << endl;
+            close(false);
+            return false;
+        }
+    }
+
+    memset(m_headerBlock, 0, sizeof(FrameContainer::ChunkHeader));
+    FrameContainer::ChunkHeader *header = (FrameContainer::ChunkHeader*) m_headerBlock;
+    memcpy(header->magic, "VCFR", sizeof(header->magic));
+    header->sequence = sequence;
+    header->seconds = time.tv_sec;
+    header->nanoseconds = time.tv_nsec;
+    header->pixelFormat = pixelFormat;
+    header->width = width;
+    header->height = height;
+    header->bytesPerLine = bytesPerLine;
+    header->bytesUsed = bytesUsed;
+    header->chunkLength = chunkLength;
+
+    /* O_DIRECT needs aligned memory */
+    if ((uintptr_t) data % FrameContainer::BlockSize != 0 || dataLength > readableLength) {
+        if (m_bounceBufferLength < dataLength) {
+            free(m_bounceBuffer);
+            if (posix_memalign((void**) &m_bounceBuffer, FrameContainer::BlockSize, dataLength) != 0) {
+                cerr << __PRETTY_FUNCTION__ << " posix_memalign failed" << endl;
+                m_bounceBuffer = 0;
+                m_bounceBufferLength = 0;
+                close(false);
+                return false;
+            }
+            m_bounceBufferLength = dataLength;
+        }
+        memcpy(m_bounceBuffer, data, bytesUsed);
+        data = m_bounceBuffer;
+    }
+
+    struct iovec vectors[2];
+    vectors[0].iov_base = m_headerBlock;
+    vectors[0].iov_len = FrameContainer::BlockSize;
+    vectors[1].iov_base = (void*) data;
+    vectors[1].iov_len = dataLength;
+
+    if (pwritev(m_fileDescriptor, vectors, 2, m_fileLength) != (ssize_t) chunkLength) {
+        cerr << __PRETTY_FUNCTION__ << " pwritev \"" << m_fileName << "\" " << errno << " " << strerror(errno) << endl;
+        close(false);
+        return false;
+    }
+
+    FrameContainer::IndexEntry entry;
+    entry.offset = m_fileLength + FrameContainer::BlockSize;
+    entry.seconds = header->seconds;
+    entry.nanoseconds = header->nanoseconds;
+    entry.sequence = header->sequence;
+    entry.pixelFormat = header->pixelFormat;
+    entry.width = header->width;
+    entry.height = header->height;
+    entry.bytesPerLine = header->bytesPerLine;
+    entry.bytesUsed = header->bytesUsed;
+    m_index.push_back(entry);
+
+    m_fileLength += chunkLength;
+
+    return true;
+}
+
+
+bool FrameContainerWriter::write(const FrameRef &frame)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    return write(frame.data(), frame.bytesUsed(), roundUp(frame.buffer()->length, pageSize), frame.time(),
+            frame.sequence(), frame.pixelFormat(), frame.width(), frame.height(), frame.bytesPerLine());
+}
+
+
+/* *** local *************************************************************** */
+size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
@@ -0,0 +1,103 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_CONTAINER_WRITER_HPP
+#define FRAME_CONTAINER_WRITER_HPP
+
+#include "prereqs.hpp"
+
+#include "framecontainer.hpp"
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <linux/types.h>
+
+class FrameRef;
+
+
+/**
+ * writes a FrameContainer file front to back, with O_DIRECT where the file system supports it (not tmpfs)
+ *
+ * The frame data is written straight out of the caller's memory, if it is aligned to FrameContainer::BlockSize and
+ * the padding up to the next block can be read from behind it, otherwise through a bounce buffer.
+ * Disk space is reserved ahead in steps of preallocation(). close() appends the index.
+ *
+ * @note not thread safe - one writing thread
+ */
+class FrameContainerWriter
+{
+public:
+
+    FrameContainerWriter();
+    FrameContainerWriter(const FrameContainerWriter&) = delete;
+    FrameContainerWriter(FrameContainerWriter&&) = delete;
+    ~FrameContainerWriter();
+    FrameContainerWriter &operator=(const FrameContainerWriter&) = delete;
+    FrameContainerWriter &operator=(FrameContainerWriter&&) = delete;
+
+    /** Default: 256 MiB */
+    void setPreallocation(size_t bytes);
+    size_t preallocation() const;
+
+    /** replaces the file
+        @param pixelFormat etc. go into the file header, each frame has its own format nevertheless */
+    bool open(const std::string &fileName, __u32 pixelFormat, unsigned int width, unsigned int height,
+            unsigned int bytesPerLine);
+    /** @param writeIndex false leaves the file without index - FrameContainer rebuilds it */
+    void close(bool writeIndex = true);
+    bool isOpen() const;
+
+    const std::string &fileName() const;
+    bool isDirectIo() const;
+    /** bytes written so far */
+    unsigned long long fileLength() const;
+
+    /** appends a frame
+        @param readableLength bytes, which can be read from 'data' on - at least bytesUsed
+        @returns false, if the write failed. The file is closed then, without index */
+    bool write(const unsigned char *data, unsigned int bytesUsed, size_t readableLength, const timespec &time,
+            unsigned int sequence, __u32 pixelFormat, unsigned int width, unsigned int height,
+            unsigned int bytesPerLine);
+    /** a frame of a ring. Ring buffers start at page boundaries and span whole pages (FrameArena, driver mappings,
+        mapped files), they are written without copying */
+    bool write(const FrameRef &frame);
+
+private:
+
+    size_t m_preallocation;
+
+    std::string m_fileName;
+    int m_fileDescriptor;
+    bool m_directIo;
+    /** end of the written data and of the reserved space */
+    off_t m_fileLength;
+    off_t m_allocatedLength;
+    std::vector<FrameContainer::IndexEntry> m_index;
+
+    /** one block */
+    unsigned char *m_headerBlock;
+    /** frame data not aligned for O_DIRECT is copied here */
+    unsigned char *m_bounceBuffer;
+    size_t m_bounceBufferLength;
+};
+
+
+#endif /* FRAME_CONTAINER_WRITER_HPP */
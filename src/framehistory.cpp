@@ -0,0 +1,511 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framehistory.hpp"
+
+#include "deltacodec.hpp"
+#include "framecontainer.hpp"
+#include "framecontainerwriter.hpp"
+#include "framenotifier.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+
+
+static size_t roundUp(size_t value, size_t multiple);
+static double secondsBetween(const timespec &start, const timespec &end);
+
+
+FrameHistory::FrameHistory() :
+        m_ring(0),
+        m_notifier(0),
+        m_pixelFormat(0),
+        m_width(0),
+        m_height(0),
+        m_bytesPerLine(0),
+        m_budget(256 * 1024 * 1024),
+        m_codec(CodecNone),
+        m_keyFrameInterval(30),
+        m_notificationFileDescriptor(-1),
+        m_collectThread(0),
+        m_cancellationFlag(false),
+        m_lastSerial(0),
+        m_nextId(0),
+        m_framesSinceKey(0),
+        m_referenceLength(0),
+        m_storedBytes(0),
+        m_rawBytes(0),
+        m_droppedFrames(0),
+        m_flushThread(0),
+        m_flushing(false),
+        m_pinnedFrom(ULLONG_MAX),
+        m_flushedFrames(0),
+        m_flushFailed(false)
+{
+}
+
+
+FrameHistory::~FrameHistory()
+{
+    stop();
+}
+
+
+void FrameHistory::setRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+        unsigned int height, unsigned int bytesPerLine)
+{
+    assert(isRunning() == false);
+
+    m_ring = ring;
+    m_notifier = notifier;
+    m_pixelFormat = pixelFormat;
+    m_width = width;
+    m_height = height;
+    m_bytesPerLine = bytesPerLine;
+}
+
+
+void FrameHistory::setBudget(size_t bytes)
+{
+    assert(isRunning() == false);
+    m_budget = bytes;
+}
+size_t FrameHistory::budget() const
+{
+    return m_budget;
+}
+
+
+void FrameHistory::setCodec(Codec codec)
+{
+    assert(isRunning() == false);
+    m_codec = codec;
+}
+FrameHistory::Codec FrameHistory::codec() const
+{
+    return m_codec;
+}
+
+
+const char *FrameHistory::codecString(Codec codec)
+{
+    switch (codec) {
+    case CodecNone: return "none";
+    case CodecDelta: return "delta";
+    default: assert(false); return "";
+    }
+}
+
+
+FrameHistory::Codec FrameHistory::codecFromString(const string &codec, bool *ok)
+{
+    if (ok != 0) *ok = true;
+
+    if (codec == "none") return CodecNone;
+    else if (codec == "delta") return CodecDelta;
+
+    if (ok != 0) *ok = false;
+    return CodecNone;
+}
+
+
+void FrameHistory::setKeyFrameInterval(unsigned int frames)
+{
+    assert(isRunning() == false);
+    assert(frames > 0);
+    m_keyFrameInterval = frames;
+}
+unsigned int FrameHistory::keyFrameInterval() const
+{
+    return m_keyFrameInterval;
+}
+
+
+bool FrameHistory::start()
+{
+    assert(isRunning() == false);
+    assert(m_ring != 0);
+
+    if (m_arena.allocate(1, m_budget) == false) {
+        cerr << __PRETTY_FUNCTION__ << " cannot allocate " << m_budget / (1024 * 1024) << " MiB" << endl;
+        return false;
+    }
+
+    m_notificationFileDescriptor = FrameNotifier::createFileDescriptor();
+    if (m_notificationFileDescriptor == -1) {
+        m_arena.release();
+        return false;
+    }
+
+    m_nextId = 0;
+    m_framesSinceKey = 0;
+    m_referenceLength = 0;
+    m_buffers.reserve(m_ring->size());
+
+    m_entries.clear();
+    m_storedBytes = 0;
+    m_rawBytes = 0;
+    m_droppedFrames = 0;
+    m_pinnedFrom = ULLONG_MAX;
+
+    /* what has been captured before is not kept */
+    m_lastSerial = m_ring->latestSerial();
+    m_notifier->addFileDescriptor(m_notificationFileDescriptor);
+
+    m_cancellationFlag = false;
+    m_collectThread = new thread(bind(collectThread, this));
+
+    return true;
+}
+
+
+void FrameHistory::stop()
+{
+    /* it reads the arena */
+    if (m_flushThread != 0) {
+        m_flushThread->join();
+        delete m_flushThread;
+        m_flushThread = 0;
+    }
+
+    if (m_collectThread != 0) {
+        m_cancellationFlag = true;
+        m_collectThread->join();
+        delete m_collectThread;
+        m_collectThread = 0;
+    }
+
+    if (m_notificationFileDescriptor != -1) {
+        m_notifier->removeFileDescriptor(m_notificationFileDescriptor);
+        close(m_notificationFileDescriptor);
+        m_notificationFileDescriptor = -1;
+    }
+
+    m_mutex.lock();
+    m_entries.clear();
+    m_storedBytes = 0;
+    m_rawBytes = 0;
+    m_mutex.unlock();
+
+    m_arena.release();
+}
+
+
+bool FrameHistory::isRunning() const
+{
+    return m_collectThread != 0;
+}
+
+
+bool FrameHistory::trigger(const string &fileName, double seconds)
+{
+    if (isRunning() == false || m_flushing.load() == true) return false;
+
+    /* the previous one has finished */
+    if (m_flushThread != 0) {
+        m_flushThread->join();
+        delete m_flushThread;
+        m_flushThread = 0;
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    if (m_entries.empty() == true) return false;
+
+    /* from the key frame the first wanted frame depends on */
+    size_t first = 0;
+    if (seconds > 0.0) {
+        first = m_entries.size() - 1;
+        while (first > 0 && secondsBetween(m_entries[first - 1].time, m_entries.back().time) <= seconds) --first;
+        while (m_entries[first].key == false) --first;
+    }
+
+    m_flushEntries.assign(m_entries.begin() + first, m_entries.end());
+    m_pinnedFrom = m_flushEntries.front().id;
+    m_flushFileName = fileName;
+    m_flushedFrames = 0;
+    m_flushFailed = false;
+
+    m_flushing = true;
+    m_flushThread = new thread(bind(flushThread, this));
+
+    return true;
+}
+
+
+bool FrameHistory::isFlushing() const
+{
+    return m_flushing.load();
+}
+
+
+FrameHistory::Statistics FrameHistory::statistics() const
+{
+    Statistics ret;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    ret.frames = m_entries.size();
+    ret.seconds = m_entries.empty() == true ? 0.0 : secondsBetween(m_entries.front().time, m_entries.back().time);
+    ret.storedBytes = m_storedBytes;
+    ret.rawBytes = m_rawBytes;
+    ret.droppedFrames = m_droppedFrames;
+    ret.flushing = m_flushing.load();
+    ret.flushFileName = m_flushFileName;
+    ret.flushedFrames = m_flushedFrames;
+    ret.flushFailed = m_flushFailed;
+
+    return ret;
+}
+
+
+void FrameHistory::collectThread(FrameHistory *history)
+{
+    while (history->m_cancellationFlag.load() == false) {
+        /* the timeout only checks the cancellation flag */
+        FrameNotifier::waitForFileDescriptor(history->m_notificationFileDescriptor, 100);
+        history->collect();
+    }
+}
+
+
+void FrameHistory::flushThread(FrameHistory *history)
+{
+    vector<Entry> entries;
+    string fileName;
+
+    history->m_mutex.lock();
+    entries.swap(history->m_flushEntries);
+    fileName = history->m_flushFileName;
+    history->m_mutex.unlock();
+
+    /* the frames are decoded into one page aligned buffer, which is written without copying */
+    size_t frameLength = 0;
+    size_t fileLength = FrameContainer::BlockSize;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        frameLength = max(frameLength, roundUp(it->bytesUsed, FrameContainer::BlockSize));
+        fileLength += FrameContainer::BlockSize + roundUp(it->bytesUsed, FrameContainer::BlockSize);
+    }
+
+    unsigned char *frame = 0;
+    bool ok = posix_memalign((void**) &frame, FrameContainer::BlockSize, frameLength) == 0;
+    if (ok == false) frame = 0;
+
+    FrameContainerWriter writer;
+    writer.setPreallocation(fileLength);
+    if (ok == true) {
+        ok = writer.open(fileName, history->m_pixelFormat, history->m_width, history->m_height,
+                history->m_bytesPerLine);
+    }
+
+    for (auto it = entries.begin(); it != entries.end() && ok == true; ++it) {
+        const unsigned char *data = history->m_arena.frame(0) + it->offset;
+
+        if (it->key == true) {
+            memcpy(frame, data, it->bytesUsed);
+        } else if (DeltaCodec::decode(data, it->length, frame, it->bytesUsed) == false) {
+            cerr << __PRETTY_FUNCTION__ << " corrupt frame " << it->sequence << endl;
+            ok = false;
+            break;
+        }
+
+        ok = writer.write(frame, it->bytesUsed, roundUp(it->bytesUsed, FrameContainer::BlockSize), it->time,
+                it->sequence, it->pixelFormat, it->width, it->height, it->bytesPerLine);
+
+        /* written, it can be dropped. The next delta is decoded from 'frame' */
+        lock_guard<mutex> lock(history->m_mutex);
+        history->m_pinnedFrom = it->id + 1;
+        if (ok == true) ++history->m_flushedFrames;
+    }
+
+    writer.close();
+    free(frame);
+
+    lock_guard<mutex> lock(history->m_mutex);
+    history->m_pinnedFrom = ULLONG_MAX;
+    history->m_flushFailed = ok == false;
+    history->m_flushing = false;
+}
+
+
+void FrameHistory::collect()
+{
+    unsigned long long newestSerial = m_ring->latestSerial();
+    if (newestSerial <= m_lastSerial) return;
+
+    /* usually one frame, more if this thread fell behind */
+    m_buffers.clear();
+    const FrameRing::Buffer *buffer = m_ring->lockNewest();
+
+    while (buffer != 0) {
+        if (buffer->serial.load(memory_order_relaxed) <= m_lastSerial) {
+            FrameRing::unlock(buffer);
+            break;
+        }
+
+        m_buffers.push_back(buffer);
+        if (m_buffers.size() == m_buffers.capacity()) break;
+        buffer = m_ring->lockNewestOlderThan(buffer->serial.load(memory_order_relaxed));
+    }
+
+    /* published meanwhile */
+    if (m_buffers.empty() == false) {
+        newestSerial = max(newestSerial, m_buffers.front()->serial.load(memory_order_relaxed));
+    }
+
+    unsigned long long dropped = newestSerial - m_lastSerial - m_buffers.size();
+    m_lastSerial = newestSerial;
+
+    /* oldest first */
+    for (auto it = m_buffers.rbegin(); it != m_buffers.rend(); ++it) {
+        if (store(*it) == false) ++dropped;
+        FrameRing::unlock(*it);
+    }
+    m_buffers.clear();
+
+    if (dropped > 0) {
+        lock_guard<mutex> lock(m_mutex);
+        m_droppedFrames += dropped;
+    }
+}
+
+
+bool FrameHistory::store(const FrameRing::Buffer *buffer)
+{
+    unsigned int bytesUsed = buffer->bytesUsed;
+
+    bool key = m_codec == CodecNone || m_referenceLength != bytesUsed || m_framesSinceKey + 1 >= m_keyFrameInterval;
+
+    /* room for the frame as it is, in case it does not get smaller */
+    long long offset = reserve(bytesUsed);
+    if (offset == -1) {
+        /* the next frame cannot be a delta to this one */
+        m_referenceLength = 0;
+        return false;
+    }
+
+    /* the previous frames were dropped for this one */
+    if (m_entries.empty() == true) key = true;
+
+    unsigned char *data = m_arena.frame(0) + offset;
+    size_t length = 0;
+
+    if (key == false) {
+        length = DeltaCodec::encode(buffer->buffer, &m_reference[0], bytesUsed, data, bytesUsed);
+        if (length == 0) key = true;
+    }
+    if (key == true) {
+        memcpy(data, buffer->buffer, bytesUsed);
+        length = bytesUsed;
+    }
+
+    if (m_codec == CodecDelta) {
+        if (m_reference.size() < bytesUsed) m_reference.resize(bytesUsed);
+        memcpy(&m_reference[0], buffer->buffer, bytesUsed);
+        m_referenceLength = bytesUsed;
+        m_framesSinceKey = key == true ? 0 : m_framesSinceKey + 1;
+    }
+
+    Entry entry;
+    entry.id = m_nextId++;
+    entry.offset = offset;
+    entry.length = length;
+    entry.key = key;
+    entry.time = buffer->time;
+    entry.sequence = buffer->sequence;
+    entry.pixelFormat = m_pixelFormat;
+    entry.width = m_width;
+    entry.height = m_height;
+    entry.bytesPerLine = m_bytesPerLine;
+    entry.bytesUsed = bytesUsed;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_entries.push_back(entry);
+    m_storedBytes += length;
+    m_rawBytes += bytesUsed;
+
+    return true;
+}
+
+
+long long FrameHistory::reserve(size_t length)
+{
+    size_t capacity = m_arena.frameSize();
+    if (length > capacity) return -1;
+
+    for (;;) {
+        if (m_entries.empty() == true) return 0;
+
+        const Entry &front = m_entries.front();
+        const Entry &back = m_entries.back();
+        /* entries start at cache lines */
+        size_t end = roundUp(back.offset + back.length, FrameArena::CacheLineSize);
+
+        if (back.offset >= front.offset) {
+            /* not wrapped around: behind the newest entry, else in front of the oldest */
+            if (end + length <= capacity) return end;
+            if (length <= front.offset) return 0;
+        } else if (end + length <= front.offset) {
+            return end;
+        }
+
+        if (dropOldestGroup() == false) return -1;
+    }
+}
+
+
+bool FrameHistory::dropOldestGroup()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    size_t count = 1;
+    while (count < m_entries.size() && m_entries[count].key == false) ++count;
+
+    if (m_entries[count - 1].id >= m_pinnedFrom) return false;
+
+    for (size_t a = 0; a < count; ++a) {
+        m_storedBytes -= m_entries.front().length;
+        m_rawBytes -= m_entries.front().bytesUsed;
+        m_entries.pop_front();
+    }
+
+    return true;
+}
+
+
+/* *** local *************************************************************** */
+size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+double secondsBetween(const timespec &start, const timespec &end)
+{
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
@@ -0,0 +1,213 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_HISTORY_HPP
+#define FRAME_HISTORY_HPP
+
+#include "prereqs.hpp"
+
+#include "framearena.hpp"
+#include "framering.hpp"
+
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <linux/types.h>
+
+class FrameNotifier;
+
+namespace std
+{
+    class thread;
+};
+
+
+/**
+ * keeps the frames of a ring for the last seconds - as many as fit into a memory budget - and writes them
+ * to a FrameContainer file on trigger(), e.g. when something interesting happened
+ *
+ * A collecting thread copies each new frame out of the ring into one prefaulted arena, used as a circular
+ * store, and drops the oldest frames to make room. With CodecDelta a frame is stored as the difference to
+ * its predecessor (see DeltaCodec), every keyFrameInterval()th frame and every frame which does not get
+ * smaller is stored as it is. Frames are dropped a key frame and its deltas at a time.
+ *
+ * trigger() writes the history from a separate thread, collecting goes on meanwhile. Frames not yet written
+ * are not dropped - if the store runs full during a long write, the new frames are not kept.
+ *
+ * @note the capture threads are not involved. The ring's buffers are locked only while they are copied
+ */
+class FrameHistory
+{
+public:
+
+    enum Codec
+    {
+        CodecNone,
+        CodecDelta
+    };
+
+    struct Statistics
+    {
+        unsigned long long frames;
+        /** between the oldest and the newest frame */
+        double seconds;
+        /** memory used by the frames */
+        unsigned long long storedBytes;
+        /** the frames would need uncompressed */
+        unsigned long long rawBytes;
+        /** not kept, because the collecting thread fell behind or the store was full while writing */
+        unsigned long long droppedFrames;
+
+        bool flushing;
+        /** of the last trigger() */
+        std::string flushFileName;
+        unsigned long long flushedFrames;
+        bool flushFailed;
+    };
+
+
+    FrameHistory();
+    FrameHistory(const FrameHistory&) = delete;
+    FrameHistory(FrameHistory&&) = delete;
+    ~FrameHistory();
+    FrameHistory &operator=(const FrameHistory&) = delete;
+    FrameHistory &operator=(FrameHistory&&) = delete;
+
+    /** @pre not running. Ring and notifier outlive the history
+        @see CaptureDevice::addToHistory() */
+    void setRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+            unsigned int height, unsigned int bytesPerLine);
+
+    /** memory for the frames. Default: 256 MiB
+        @pre not running */
+    void setBudget(size_t bytes);
+    size_t budget() const;
+
+    /** Default: CodecNone
+        @pre not running */
+    void setCodec(Codec codec);
+    Codec codec() const;
+    static const char *codecString(Codec codec);
+    /** @param ok set to false, if the string is none of "none" and "delta" */
+    static Codec codecFromString(const std::string &codec, bool *ok = 0);
+
+    /** a frame stored as it is every this many frames. Default: 30
+        @pre not running */
+    void setKeyFrameInterval(unsigned int frames);
+    unsigned int keyFrameInterval() const;
+
+    /** allocates the budget and keeps the frames published from now on
+        @returns false, if out of memory */
+    bool start();
+    /** waits for a running flush and releases the memory */
+    void stop();
+    bool isRunning() const;
+
+    /** writes the frames of the last 'seconds' - all if 0 - to the file, which is replaced. Returns at once
+        @returns false, if not running, if there is nothing to write or if the previous flush has not finished */
+    bool trigger(const std::string &fileName, double seconds = 0.0);
+    bool isFlushing() const;
+
+    /** can be called any time */
+    Statistics statistics() const;
+
+private:
+
+    struct Entry
+    {
+        /** running number, identifies the entry while flushing */
+        unsigned long long id;
+        /** in the arena */
+        size_t offset;
+        size_t length;
+        /** stored as it is, else as difference to the previous entry */
+        bool key;
+
+        timespec time;
+        unsigned int sequence;
+        __u32 pixelFormat;
+        unsigned int width;
+        unsigned int height;
+        unsigned int bytesPerLine;
+        unsigned int bytesUsed;
+    };
+
+    static void collectThread(FrameHistory *history);
+    static void flushThread(FrameHistory *history);
+
+    /** stores the ring's frames newer than m_lastSerial */
+    void collect();
+    /** @returns false, if the frame is not kept */
+    bool store(const FrameRing::Buffer *buffer);
+    /** @returns the offset of 'length' free bytes, drops the oldest frames for them. -1 if they are pinned */
+    long long reserve(size_t length);
+    /** drops the oldest key frame and its deltas
+        @returns false, if they are pinned */
+    bool dropOldestGroup();
+
+    FrameRing *m_ring;
+    FrameNotifier *m_notifier;
+    __u32 m_pixelFormat;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_bytesPerLine;
+
+    size_t m_budget;
+    Codec m_codec;
+    unsigned int m_keyFrameInterval;
+
+    FrameArena m_arena;
+    int m_notificationFileDescriptor;
+    std::thread *m_collectThread;
+    std::atomic<bool> m_cancellationFlag;
+
+    /* collecting thread only */
+    unsigned long long m_lastSerial;
+    unsigned long long m_nextId;
+    unsigned int m_framesSinceKey;
+    /** the previous frame, the deltas are computed against */
+    std::vector<unsigned char> m_reference;
+    unsigned int m_referenceLength;
+    /** the frames being stored */
+    std::vector<const FrameRing::Buffer*> m_buffers;
+
+    /** guards the entries, the pinning and the statistics. Only the collecting thread changes the entries, it
+        reads them without lock. The stored frames are not guarded, the collecting thread writes only where no
+        entry is */
+    mutable std::mutex m_mutex;
+    std::deque<Entry> m_entries;
+    unsigned long long m_storedBytes;
+    unsigned long long m_rawBytes;
+    unsigned long long m_droppedFrames;
+
+    std::thread *m_flushThread;
+    std::atomic<bool> m_flushing;
+    /** entries from this id on are not dropped - they are yet to be written. Guarded by m_mutex, as the rest */
+    unsigned long long m_pinnedFrom;
+    std::vector<Entry> m_flushEntries;
+    std::string m_flushFileName;
+    unsigned long long m_flushedFrames;
+    bool m_flushFailed;
+};
+
+
+#endif /* FRAME_HISTORY_HPP */
@@ -0,0 +1,138 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framenotifier.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+FrameNotifier::FrameNotifier() :
+        m_serial(0)
+{
+}
+
+
+FrameNotifier::~FrameNotifier()
+{
+    assert(m_fileDescriptors.empty() == true);
+}
+
+
+void FrameNotifier::notify(unsigned long long serial)
+{
+    m_mutex.lock();
+
+    m_serial = serial;
+
+    for (auto it = m_fileDescriptors.begin(); it != m_fileDescriptors.end(); ++it) {
+        uint64_t one = 1;
+        /* EAGAIN means the counter is about to overflow - the consumer is notified anyways */
+        if (write(*it, &one, sizeof(uint64_t)) == -1 && errno != EAGAIN) {
+            cerr << __PRETTY_FUNCTION__ << " Cannot notify. " << errno << " " << strerror(errno) << endl;
+        }
+    }
+
+    m_mutex.unlock();
+
+    m_condition.notify_all();
+}
+
+
+unsigned long long FrameNotifier::wait(unsigned long long newerThanSerial, long timeoutNanoseconds)
+{
+    unique_lock<mutex> lock(m_mutex);
+
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+            chrono::nanoseconds(timeoutNanoseconds);
+
+    while (m_serial <= newerThanSerial) {
+        if (m_condition.wait_until(lock, deadline) == cv_status::timeout) break;
+    }
+
+    return m_serial;
+}
+
+
+void FrameNotifier::addFileDescriptor(int fileDescriptor)
+{
+    assert(fileDescriptor != -1);
+
+    m_mutex.lock();
+    assert(find(m_fileDescriptors.begin(), m_fileDescriptors.end(), fileDescriptor) == m_fileDescriptors.end());
+    m_fileDescriptors.push_back(fileDescriptor);
+    m_mutex.unlock();
+}
+
+
+void FrameNotifier::removeFileDescriptor(int fileDescriptor)
+{
+    m_mutex.lock();
+    auto it = find(m_fileDescriptors.begin(), m_fileDescriptors.end(), fileDescriptor);
+    if (it != m_fileDescriptors.end()) m_fileDescriptors.erase(it);
+    m_mutex.unlock();
+}
+
+
+int FrameNotifier::createFileDescriptor()
+{
+    int fileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " Cannot create eventfd. " << errno << " " << strerror(errno) << endl;
+    }
+
+    return fileDescriptor;
+}
+
+
+bool FrameNotifier::waitForFileDescriptor(int fileDescriptor, int timeoutMilliseconds)
+{
+    struct pollfd pfd;
+    pfd.fd = fileDescriptor;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ret = poll(&pfd, 1, timeoutMilliseconds);
+
+    if (ret == -1 && errno != EINTR) {
+        cerr << __PRETTY_FUNCTION__ << " Poll error. " << errno << " " << strerror(errno) << endl;
+        return false;
+    } else if (ret <= 0) {
+        return false;
+    }
+
+    /* reset the counter */
+    uint64_t count;
+    if (read(fileDescriptor, &count, sizeof(uint64_t)) == -1 && errno != EAGAIN) {
+        cerr << __PRETTY_FUNCTION__ << " Read error. " << errno << " " << strerror(errno) << endl;
+    }
+
+    return true;
+}
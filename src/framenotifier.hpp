@@ -0,0 +1,73 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_NOTIFIER_HPP
+#define FRAME_NOTIFIER_HPP
+
+#include "prereqs.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+
+/**
+ * wakes up consumers, when a producer publishes a new frame
+ *
+ * Consumers either block on the condition variable via wait(), or register an eventfd
+ * which becomes readable on each new frame. The latter is meant for waiting on several
+ * producers at once: register the same descriptor everywhere and poll() it.
+ */
+class FrameNotifier
+{
+public:
+
+    FrameNotifier();
+    FrameNotifier(const FrameNotifier&) = delete;
+    FrameNotifier(FrameNotifier&&) = delete;
+    ~FrameNotifier();
+    FrameNotifier &operator=(const FrameNotifier&) = delete;
+    FrameNotifier &operator=(FrameNotifier&&) = delete;
+
+    /** called by the producer after publishing the frame with the given serial */
+    void notify(unsigned long long serial);
+
+    /** blocks until a serial newer than the given one has been notified or the timeout expired
+        @returns the newest notified serial */
+    unsigned long long wait(unsigned long long newerThanSerial, long timeoutNanoseconds);
+
+    void addFileDescriptor(int fileDescriptor);
+    void removeFileDescriptor(int fileDescriptor);
+
+
+    /** @returns a new non-blocking eventfd suitable for addFileDescriptor(). -1 on failure */
+    static int createFileDescriptor();
+    /** polls the descriptor and resets it
+        @returns true if there was a notification, false on timeout */
+    static bool waitForFileDescriptor(int fileDescriptor, int timeoutMilliseconds);
+
+private:
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    unsigned long long m_serial;
+    std::vector<int> m_fileDescriptors;
+};
+
+
+#endif /* FRAME_NOTIFIER_HPP */
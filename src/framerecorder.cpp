@@ -0,0 +1,371 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framerecorder.hpp"
+
+#include "framecontainerwriter.hpp"
+#include "framenotifier.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static double secondsSince(const timespec &start);
+
+
+FrameRecorder::FrameRecorder() :
+        m_queueLength(4),
+        m_preallocation(256 * 1024 * 1024),
+        m_notificationFileDescriptor(-1),
+        m_collectThread(0),
+        m_writeThread(0),
+        m_cancellationFlag(false),
+        m_draining(false)
+{
+}
+
+
+FrameRecorder::~FrameRecorder()
+{
+    stop();
+
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        delete it->writer;
+    }
+}
+
+
+unsigned int FrameRecorder::addRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat,
+        unsigned int width, unsigned int height, unsigned int bytesPerLine, const string &fileName)
+{
+    assert(isRecording() == false);
+
+    m_streams.push_back(Stream());
+    Stream &stream = m_streams.back();
+
+    stream.ring = ring;
+    stream.notifier = notifier;
+    stream.pixelFormat = pixelFormat;
+    stream.width = width;
+    stream.height = height;
+    stream.bytesPerLine = bytesPerLine;
+    stream.fileName = fileName;
+    stream.writer = new FrameContainerWriter;
+    stream.lastSerial = 0;
+    stream.queuedFrameCount = 0;
+
+    stream.statistics.fileName = fileName;
+    stream.statistics.recordedFrames = 0;
+    stream.statistics.droppedFrames = 0;
+    stream.statistics.bytesWritten = 0;
+    stream.statistics.maximumWriteLatency = 0.0;
+    stream.statistics.directIo = false;
+    stream.statistics.failed = false;
+
+    return m_streams.size() - 1;
+}
+
+
+unsigned int FrameRecorder::streamCount() const
+{
+    return m_streams.size();
+}
+
+
+void FrameRecorder::setQueueLength(unsigned int frames)
+{
+    assert(isRecording() == false);
+    assert(frames > 0);
+    m_queueLength = frames;
+}
+unsigned int FrameRecorder::queueLength() const
+{
+    return m_queueLength;
+}
+
+
+void FrameRecorder::setPreallocation(size_t bytes)
+{
+    assert(isRecording() == false);
+    m_preallocation = bytes;
+}
+size_t FrameRecorder::preallocation() const
+{
+    return m_preallocation;
+}
+
+
+bool FrameRecorder::start()
+{
+    assert(isRecording() == false);
+    assert(m_streams.empty() == false);
+
+    unsigned int openedCount = 0;
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        if (openFile(&*it) == true) ++openedCount;
+    }
+
+    if (openedCount == 0) {
+        stop();
+        return false;
+    }
+
+    m_notificationFileDescriptor = FrameNotifier::createFileDescriptor();
+    if (m_notificationFileDescriptor == -1) {
+        stop();
+        return false;
+    }
+
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        /* what has been captured before is not recorded */
+        it->lastSerial = it->ring->latestSerial();
+        it->notifier->addFileDescriptor(m_notificationFileDescriptor);
+    }
+
+    m_cancellationFlag = false;
+    m_draining = false;
+
+    m_writeThread = new thread(bind(writeThread, this));
+    m_collectThread = new thread(bind(collectThread, this));
+
+    return true;
+}
+
+
+void FrameRecorder::stop()
+{
+    /* no new frames */
+    if (m_collectThread != 0) {
+        m_cancellationFlag = true;
+        m_collectThread->join();
+        delete m_collectThread;
+        m_collectThread = 0;
+    }
+
+    /* but the queued ones are written */
+    if (m_writeThread != 0) {
+        m_mutex.lock();
+        m_draining = true;
+        m_mutex.unlock();
+        m_jobAvailable.notify_all();
+
+        m_writeThread->join();
+        delete m_writeThread;
+        m_writeThread = 0;
+    }
+
+    if (m_notificationFileDescriptor != -1) {
+        for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+            it->notifier->removeFileDescriptor(m_notificationFileDescriptor);
+        }
+        close(m_notificationFileDescriptor);
+        m_notificationFileDescriptor = -1;
+    }
+
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        it->writer->close();
+    }
+}
+
+
+bool FrameRecorder::isRecording() const
+{
+    return m_writeThread != 0;
+}
+
+
+vector<FrameRecorder::Statistics> FrameRecorder::statistics() const
+{
+    vector<Statistics> ret;
+
+    lock_guard<mutex> lock(m_statisticsMutex);
+
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        ret.push_back(it->statistics);
+    }
+
+    return ret;
+}
+
+
+void FrameRecorder::collectThread(FrameRecorder *recorder)
+{
+    /* no allocations while recording */
+    vector<FrameRef> frames;
+    frames.reserve(recorder->m_queueLength);
+
+    while (recorder->m_cancellationFlag.load() == false) {
+        /* a notification of any stream - the timeout only checks the cancellation flag */
+        FrameNotifier::waitForFileDescriptor(recorder->m_notificationFileDescriptor, 100);
+
+        for (unsigned int a = 0; a < recorder->m_streams.size(); ++a) {
+            recorder->collect(a, &frames);
+        }
+    }
+}
+
+
+void FrameRecorder::writeThread(FrameRecorder *recorder)
+{
+    for (;;) {
+        unique_lock<mutex> lock(recorder->m_mutex);
+        while (recorder->m_jobs.empty() == true && recorder->m_draining == false) {
+            recorder->m_jobAvailable.wait(lock);
+        }
+        if (recorder->m_jobs.empty() == true) break;
+
+        Job job = move(recorder->m_jobs.front());
+        recorder->m_jobs.pop_front();
+        lock.unlock();
+
+        Stream *stream = &recorder->m_streams[job.stream];
+
+        timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        bool written = recorder->write(stream, job.frame);
+        double latency = secondsSince(start);
+
+        /* the ring gets its buffer back before the queue gets room */
+        job.frame.release();
+
+        recorder->m_mutex.lock();
+        --stream->queuedFrameCount;
+        recorder->m_mutex.unlock();
+
+        lock_guard<mutex> statisticsLock(recorder->m_statisticsMutex);
+        if (written == true) {
+            ++stream->statistics.recordedFrames;
+            stream->statistics.maximumWriteLatency = max(stream->statistics.maximumWriteLatency, latency);
+        } else {
+            ++stream->statistics.droppedFrames;
+        }
+    }
+}
+
+
+bool FrameRecorder::openFile(Stream *stream)
+{
+    stream->writer->setPreallocation(m_preallocation);
+    bool opened = stream->writer->open(stream->fileName, stream->pixelFormat, stream->width, stream->height,
+            stream->bytesPerLine);
+
+    lock_guard<mutex> lock(m_statisticsMutex);
+    stream->statistics.recordedFrames = 0;
+    stream->statistics.droppedFrames = 0;
+    stream->statistics.bytesWritten = stream->writer->fileLength();
+    stream->statistics.maximumWriteLatency = 0.0;
+    stream->statistics.directIo = stream->writer->isDirectIo();
+    stream->statistics.failed = opened == false;
+
+    return opened;
+}
+
+
+void FrameRecorder::collect(unsigned int streamIndex, vector<FrameRef> *frames)
+{
+    Stream *stream = &m_streams[streamIndex];
+
+    unsigned long long newestSerial = stream->ring->latestSerial();
+    if (newestSerial <= stream->lastSerial) return;
+
+    m_mutex.lock();
+    unsigned int room = m_queueLength - stream->queuedFrameCount;
+    m_mutex.unlock();
+
+    bool failed;
+    {
+        lock_guard<mutex> lock(m_statisticsMutex);
+        failed = stream->statistics.failed;
+    }
+
+    /* the newest frames, as long as they fit */
+    frames->clear();
+    const FrameRing::Buffer *buffer = failed == false && room > 0 ? stream->ring->lockNewest() : 0;
+
+    while (buffer != 0) {
+        if (buffer->serial.load(memory_order_relaxed) <= stream->lastSerial) {
+            FrameRing::unlock(buffer);
+            break;
+        }
+
+        frames->push_back(FrameRef(buffer, stream->pixelFormat, stream->width, stream->height,
+                stream->bytesPerLine));
+
+        if (frames->size() == room) break;
+        buffer = stream->ring->lockNewestOlderThan(frames->back().serial());
+    }
+
+    /* published meanwhile */
+    if (frames->empty() == false) newestSerial = max(newestSerial, frames->front().serial());
+
+    unsigned long long dropped = newestSerial - stream->lastSerial - frames->size();
+    stream->lastSerial = newestSerial;
+
+    if (dropped > 0) {
+        lock_guard<mutex> lock(m_statisticsMutex);
+        stream->statistics.droppedFrames += dropped;
+    }
+
+    if (frames->empty() == true) return;
+
+    /* oldest first */
+    m_mutex.lock();
+    for (auto it = frames->rbegin(); it != frames->rend(); ++it) {
+        Job job;
+        job.stream = streamIndex;
+        job.frame = move(*it);
+        m_jobs.push_back(move(job));
+    }
+    stream->queuedFrameCount += frames->size();
+    m_mutex.unlock();
+    m_jobAvailable.notify_one();
+
+    frames->clear();
+}
+
+
+bool FrameRecorder::write(Stream *stream, const FrameRef &frame)
+{
+    if (stream->writer->isOpen() == false) return false;
+
+    /* the writer closes the file, if the write fails */
+    bool written = stream->writer->write(frame);
+
+    lock_guard<mutex> lock(m_statisticsMutex);
+    stream->statistics.bytesWritten = stream->writer->fileLength();
+    if (written == false) stream->statistics.failed = true;
+
+    return written;
+}
+
+
+/* *** local *************************************************************** */
+double secondsSince(const timespec &start)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
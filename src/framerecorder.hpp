@@ -0,0 +1,171 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_RECORDER_HPP
+#define FRAME_RECORDER_HPP
+
+#include "prereqs.hpp"
+
+#include "frameref.hpp"
+#include "framering.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <linux/types.h>
+
+class FrameContainerWriter;
+class FrameNotifier;
+
+namespace std
+{
+    class thread;
+};
+
+
+/**
+ * records the frames of one or more rings - e.g. all cameras of a rig - to FrameContainer files, one per ring
+ *
+ * A collecting thread takes the new frames of all rings by reference as they are notified, a writing thread
+ * writes them straight out of the rings' buffers with O_DIRECT into preallocated files. Neither copies
+ * a frame, the capture threads are not involved at all. Up to queueLength() frames per ring wait for the
+ * disk - if it stalls longer, the following frames are not taken and counted as dropped.
+ *
+ * The frames are written as chunks as they come, the index is appended by stop(). Compressed frames (MJPG, see
+ * CaptureDevice::addToRecorder()) take as many blocks as they need, the index keeps their lengths.
+ *
+ * @note the frames waiting for the disk are locked. The device needs queueLength() buffers more, or its capture
+ *    drops frames instead of the recorder (see CaptureDevice::setBufferCount())
+ * @note where O_DIRECT is not supported (e.g. tmpfs) the files are written through the page cache
+ */
+class FrameRecorder
+{
+public:
+
+    struct Statistics
+    {
+        std::string fileName;
+        unsigned long long recordedFrames;
+        /** frames published while the queue was full, or after a write failed */
+        unsigned long long droppedFrames;
+        unsigned long long bytesWritten;
+        /** of a single frame, in seconds */
+        double maximumWriteLatency;
+        bool directIo;
+        /** the file could not be opened or written, nothing more is recorded */
+        bool failed;
+    };
+
+
+    FrameRecorder();
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder(FrameRecorder&&) = delete;
+    ~FrameRecorder();
+    FrameRecorder &operator=(const FrameRecorder&) = delete;
+    FrameRecorder &operator=(FrameRecorder&&) = delete;
+
+    /** records the ring's frames to the file, which is replaced
+        @returns the index of the ring in statistics()
+        @pre not recording. Ring and notifier outlive the recorder
+        @see CaptureDevice::addToRecorder() */
+    unsigned int addRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+            unsigned int height, unsigned int bytesPerLine, const std::string &fileName);
+    unsigned int streamCount() const;
+
+    /** frames per ring waiting to be written. Default: 4
+        @pre not recording */
+    void setQueueLength(unsigned int frames);
+    unsigned int queueLength() const;
+
+    /** disk space is reserved in steps of this many bytes ahead of the writes. Default: 256 MiB
+        @pre not recording */
+    void setPreallocation(size_t bytes);
+    size_t preallocation() const;
+
+    /** opens the files and records the frames published from now on
+        @returns false, if no file could be opened */
+    bool start();
+    /** writes the queued frames and closes the files */
+    void stop();
+    bool isRecording() const;
+
+    /** per ring, can be called any time */
+    std::vector<Statistics> statistics() const;
+
+private:
+
+    struct Stream
+    {
+        FrameRing *ring;
+        FrameNotifier *notifier;
+        __u32 pixelFormat;
+        unsigned int width;
+        unsigned int height;
+        unsigned int bytesPerLine;
+        std::string fileName;
+
+        FrameContainerWriter *writer;
+
+        /** serial of the newest frame taken or dropped. Collecting thread only */
+        unsigned long long lastSerial;
+        /** taken and not yet written. Guarded by m_mutex */
+        unsigned int queuedFrameCount;
+
+        /** guarded by m_statisticsMutex */
+        Statistics statistics;
+    };
+
+    struct Job
+    {
+        unsigned int stream;
+        FrameRef frame;
+    };
+
+    static void collectThread(FrameRecorder *recorder);
+    static void writeThread(FrameRecorder *recorder);
+
+    bool openFile(Stream *stream);
+    /** takes the stream's frames newer than lastSerial while there is room in the queue, counts the others */
+    void collect(unsigned int streamIndex, std::vector<FrameRef> *frames);
+    /** @returns false, if the write failed */
+    bool write(Stream *stream, const FrameRef &frame);
+
+    std::vector<Stream> m_streams;
+    unsigned int m_queueLength;
+    size_t m_preallocation;
+    int m_notificationFileDescriptor;
+
+    std::thread *m_collectThread;
+    std::thread *m_writeThread;
+    std::atomic<bool> m_cancellationFlag;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    std::deque<Job> m_jobs;
+    /** set by stop() after the collecting thread has finished - the writing thread empties the queue and ends */
+    bool m_draining;
+
+    mutable std::mutex m_statisticsMutex;
+};
+
+
+#endif /* FRAME_RECORDER_HPP */
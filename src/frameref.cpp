@@ -0,0 +1,176 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "frameref.hpp"
+
+#include <cassert>
+
+using namespace std;
+
+
+FrameRef::FrameRef() :
+        m_buffer(0),
+        m_pixelFormat(0),
+        m_width(0),
+        m_height(0),
+        m_bytesPerLine(0),
+        m_serial(0)
+{
+}
+
+
+FrameRef::FrameRef(const FrameRing::Buffer *buffer, __u32 pixelFormat, unsigned int width,
+        unsigned int height, unsigned int bytesPerLine) :
+        m_buffer(buffer),
+        m_pixelFormat(pixelFormat),
+        m_width(width),
+        m_height(height),
+        m_bytesPerLine(bytesPerLine),
+        m_serial(buffer->serial.load(memory_order_relaxed))
+{
+    assert(buffer->readerCount.load(memory_order_relaxed) > 0);
+}
+
+
+FrameRef::FrameRef(FrameRef &&other) :
+        m_buffer(other.m_buffer),
+        m_pixelFormat(other.m_pixelFormat),
+        m_width(other.m_width),
+        m_height(other.m_height),
+        m_bytesPerLine(other.m_bytesPerLine),
+        m_serial(other.m_serial)
+{
+    other.m_buffer = 0;
+}
+
+
+FrameRef::~FrameRef()
+{
+    release();
+}
+
+
+FrameRef &FrameRef::operator=(FrameRef &&other)
+{
+    if (this != &other) {
+        release();
+
+        m_buffer = other.m_buffer;
+        m_pixelFormat = other.m_pixelFormat;
+        m_width = other.m_width;
+        m_height = other.m_height;
+        m_bytesPerLine = other.m_bytesPerLine;
+        m_serial = other.m_serial;
+
+        other.m_buffer = 0;
+    }
+
+    return *this;
+}
+
+
+FrameRef FrameRef::share() const
+{
+    assert(m_buffer != 0);
+
+    /* cannot fail - we hold a read lock, so the producer cannot take the buffer */
+    bool locked = FrameRing::tryLockForReading(m_buffer);
+    assert(locked == true);
+    (void) locked;
+
+    return FrameRef(m_buffer, m_pixelFormat, m_width, m_height, m_bytesPerLine);
+}
+
+
+void FrameRef::release()
+{
+    if (m_buffer != 0) {
+        FrameRing::unlock(m_buffer);
+        m_buffer = 0;
+    }
+}
+
+
+bool FrameRef::isNull() const
+{
+    return m_buffer == 0;
+}
+
+
+const unsigned char *FrameRef::data() const
+{
+    assert(m_buffer != 0);
+    return m_buffer->buffer;
+}
+
+
+unsigned int FrameRef::bytesUsed() const
+{
+    assert(m_buffer != 0);
+    return m_buffer->bytesUsed;
+}
+
+
+__u32 FrameRef::pixelFormat() const
+{
+    return m_pixelFormat;
+}
+
+
+unsigned int FrameRef::width() const
+{
+    return m_width;
+}
+
+
+unsigned int FrameRef::height() const
+{
+    return m_height;
+}
+
+
+unsigned int FrameRef::bytesPerLine() const
+{
+    return m_bytesPerLine;
+}
+
+
+const timespec &FrameRef::time() const
+{
+    assert(m_buffer != 0);
+    return m_buffer->time;
+}
+
+
+unsigned int FrameRef::sequence() const
+{
+    assert(m_buffer != 0);
+    return m_buffer->sequence;
+}
+
+
+unsigned long long FrameRef::serial() const
+{
+    return m_serial;
+}
+
+
+const FrameRing::Buffer *FrameRef::buffer() const
+{
+    return m_buffer;
+}
@@ -0,0 +1,92 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_REF_HPP
+#define FRAME_REF_HPP
+
+#include "prereqs.hpp"
+
+#include "framering.hpp"
+
+#include <ctime>
+
+#include <linux/videodev2.h>
+
+
+/**
+ * a frame of a FrameRing locked for reading, unlocked when the last reference goes away
+ *
+ * The reference count is the buffer's reader count - no allocation, no copy of the pixels.
+ * References can be moved to (or shared with) other threads freely.
+ *
+ * @note while referenced, the producer cannot write into the buffer. Keep references short,
+ *    or make sure the ring has buffers to spare (see CaptureDevice::BackpressurePolicy)
+ */
+class FrameRef
+{
+public:
+
+    /** a null reference */
+    FrameRef();
+    /** takes over a read lock of the buffer
+        @param bytesPerLine length of one row (of the luma plane for NV12) */
+    FrameRef(const FrameRing::Buffer *buffer, __u32 pixelFormat, unsigned int width, unsigned int height,
+            unsigned int bytesPerLine);
+    FrameRef(const FrameRef&) = delete;
+    FrameRef(FrameRef &&other);
+    ~FrameRef();
+    FrameRef &operator=(const FrameRef&) = delete;
+    FrameRef &operator=(FrameRef &&other);
+
+    /** @returns another reference to the same frame. O(1)
+        @pre not null */
+    FrameRef share() const;
+    /** unlocks the frame, if this was the last reference. Afterwards the reference is null */
+    void release();
+    bool isNull() const;
+
+    /** @pre not null - for all of the following */
+    const unsigned char *data() const;
+    /** size of the frame data. Varies for compressed formats */
+    unsigned int bytesUsed() const;
+    /** V4L2_PIX_FMT_* */
+    __u32 pixelFormat() const;
+    unsigned int width() const;
+    unsigned int height() const;
+    unsigned int bytesPerLine() const;
+    /** CLOCK_MONOTONIC, when the frame was taken */
+    const timespec &time() const;
+    unsigned int sequence() const;
+    /** see FrameRing::Buffer::serial */
+    unsigned long long serial() const;
+
+    const FrameRing::Buffer *buffer() const;
+
+private:
+
+    const FrameRing::Buffer *m_buffer;
+    __u32 m_pixelFormat;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_bytesPerLine;
+    /** the buffer's serial cannot change while it is locked - cached, as it is atomic */
+    unsigned long long m_serial;
+};
+
+
+#endif /* FRAME_REF_HPP */
@@ -0,0 +1,214 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framering.hpp"
+
+#include <cassert>
+#include <limits>
+
+using namespace std;
+
+
+FrameRing::FrameRing() :
+        m_buffers(0),
+        m_count(0),
+        m_nextSerial(1),
+        m_latestSerial(0)
+{
+}
+
+
+FrameRing::~FrameRing()
+{
+    delete[] m_buffers;
+}
+
+
+void FrameRing::resize(unsigned int count)
+{
+    delete[] m_buffers;
+    m_buffers = 0;
+    m_count = count;
+
+    if (count > 0) {
+        m_buffers = new Buffer[count];
+    }
+
+    for (unsigned int a = 0; a < count; ++a) {
+        m_buffers[a].time = {numeric_limits<time_t>::min(), 0};
+        m_buffers[a].readerCount.store(0);
+        m_buffers[a].serial.store(0);
+        m_buffers[a].buffer = 0;
+        m_buffers[a].index = a;
+        m_buffers[a].length = 0;
+        m_buffers[a].bytesUsed = 0;
+        m_buffers[a].sequence = 0;
+    }
+
+    m_nextSerial = 1;
+    m_latestSerial.store(0);
+}
+
+
+unsigned int FrameRing::size() const
+{
+    return m_count;
+}
+
+
+FrameRing::Buffer &FrameRing::buffer(unsigned int index)
+{
+    assert(index < m_count);
+    return m_buffers[index];
+}
+
+
+FrameRing::Buffer *FrameRing::lockForWriting(bool mayTakeNewest)
+{
+    unsigned long long latest = m_latestSerial.load(memory_order_relaxed);
+
+    for (;;) {
+        /* find the oldest free buffer - usually without taking away the newest frame from the readers */
+        Buffer *oldest = 0;
+        for (unsigned int a = 0; a < m_count; ++a) {
+            Buffer &b = m_buffers[a];
+            unsigned long long serial = b.serial.load(memory_order_relaxed);
+
+            if (b.readerCount.load(memory_order_relaxed) != 0) continue;
+            if (serial != 0 && serial == latest && mayTakeNewest == false) continue;
+            if (oldest == 0 || serial < oldest->serial.load(memory_order_relaxed)) oldest = &b;
+        }
+
+        if (oldest == 0) return 0;
+
+        /* acquire: whatever the last reader did with the buffer happened before we write into it */
+        int expected = 0;
+        if (oldest->readerCount.compare_exchange_strong(expected, -1, memory_order_acquire,
+                memory_order_relaxed) == true) {
+            return oldest;
+        }
+        /* a reader came first, look again */
+    }
+}
+
+
+void FrameRing::publish(Buffer *buffer)
+{
+    assert(buffer->readerCount.load(memory_order_relaxed) == -1);
+
+    unsigned long long serial = m_nextSerial++;
+    buffer->serial.store(serial, memory_order_relaxed);
+    buffer->readerCount.store(0, memory_order_release);
+    m_latestSerial.store(serial, memory_order_release);
+}
+
+
+void FrameRing::discard(Buffer *buffer)
+{
+    assert(buffer->readerCount.load(memory_order_relaxed) == -1);
+
+    buffer->serial.store(0, memory_order_relaxed);
+    buffer->readerCount.store(0, memory_order_release);
+}
+
+
+const FrameRing::Buffer *FrameRing::lockNewest()
+{
+    return lockNewestOlderThan(numeric_limits<unsigned long long>::max());
+}
+
+
+const FrameRing::Buffer *FrameRing::lockNewestOlderThan(unsigned long long serial)
+{
+    /* candidates get older with every pass, so this terminates */
+    unsigned long long bound = serial;
+
+    for (;;) {
+        Buffer *newest = 0;
+        unsigned long long newestSerial = 0;
+        for (unsigned int a = 0; a < m_count; ++a) {
+            unsigned long long s = m_buffers[a].serial.load(memory_order_relaxed);
+            if (s != 0 && s < bound && s > newestSerial) {
+                newest = &m_buffers[a];
+                newestSerial = s;
+            }
+        }
+
+        if (newest == 0) return 0;
+
+        if (tryLockForReading(newest) == true) {
+            /* the producer might have rewritten it in the meantime - still fine if it holds
+               a valid frame of the requested age */
+            unsigned long long s = newest->serial.load(memory_order_relaxed);
+            if (s != 0 && s < serial) return newest;
+            unlock(newest);
+        }
+
+        /* being written (or queued in the driver) - take the next older one */
+        bound = newestSerial;
+    }
+}
+
+
+void FrameRing::unlock(const Buffer *buffer)
+{
+    int previous = buffer->readerCount.fetch_sub(1, memory_order_release);
+    assert(previous > 0);
+    (void) previous;
+}
+
+
+unsigned int FrameRing::newerBuffersAvailable(const timespec &newerThan)
+{
+    unsigned int ret = 0;
+
+    for (unsigned int a = 0; a < m_count; ++a) {
+        const Buffer &b = m_buffers[a];
+
+        if (tryLockForReading(&b) == false) continue;
+
+        if (b.serial.load(memory_order_relaxed) != 0 &&
+                ((b.time.tv_sec > newerThan.tv_sec) ||
+                ((b.time.tv_sec == newerThan.tv_sec) && (b.time.tv_nsec > newerThan.tv_nsec)))
+                ) {
+            ++ret;
+        }
+
+        unlock(&b);
+    }
+
+    return ret;
+}
+
+
+unsigned long long FrameRing::latestSerial() const
+{
+    return m_latestSerial.load(memory_order_acquire);
+}
+
+
+bool FrameRing::tryLockForReading(const Buffer *buffer)
+{
+    int readers = buffer->readerCount.load(memory_order_relaxed);
+    do {
+        if (readers < 0) return false;
+    } while (buffer->readerCount.compare_exchange_weak(readers, readers + 1, memory_order_acquire,
+            memory_order_relaxed) == false);
+
+    return true;
+}
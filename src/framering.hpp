@@ -0,0 +1,125 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+#include "prereqs.hpp"
+
+#include <atomic>
+#include <ctime>
+
+
+/**
+ * lock-free ring of frame buffers with one producer and any number of consumers
+ *
+ * Each buffer carries an atomic reader count, which doubles as write lock:
+ * -1 means the producer (or the driver) is writing into it, 0 means it is free and
+ * > 0 means that many readers hold it. Locking and unlocking are a single CAS/decrement,
+ * nobody ever blocks.
+ *
+ * The order of the frames is given by a running serial number, which is assigned
+ * on publication.
+ *
+ * @note memory for the buffers is provided from outside - the ring only manages
+ *    the state of them
+ */
+class FrameRing
+{
+public:
+
+    struct Buffer
+    {
+        timespec time;
+        /** if -1 -> being written; if 0 -> writeable, readable; if > 0 -> readable */
+        mutable std::atomic<int> readerCount;
+        /** running number of the publication. 0 if nothing valid has been published into the buffer */
+        std::atomic<unsigned long long> serial;
+        unsigned char *buffer;
+        /** index of the buffer in the ring (equals the driver buffer index for mmap'd buffers) */
+        unsigned int index;
+        /** size of the allocation/mapping behind 'buffer' */
+        unsigned int length;
+        /** size of the frame data in 'buffer'. Varies for compressed formats */
+        unsigned int bytesUsed;
+        /** frame number assigned by the driver (streaming i/o) or by the producer */
+        unsigned int sequence;
+    };
+
+
+    FrameRing();
+    FrameRing(const FrameRing&) = delete;
+    FrameRing(FrameRing&&) = delete;
+    ~FrameRing();
+    FrameRing &operator=(const FrameRing&) = delete;
+    FrameRing &operator=(FrameRing&&) = delete;
+
+    /** (re)creates 'count' empty buffers without memory attached
+        @pre nobody uses the ring */
+    void resize(unsigned int count);
+    unsigned int size() const;
+    /** @note for setting up the buffers only, not thread safe */
+    Buffer &buffer(unsigned int index);
+
+
+    /* *** producer side - one thread at a time *** */
+
+    /** @returns the oldest buffer, which nobody reads and which is not the newest one, locked for writing.
+        0, if there is none
+        @param mayTakeNewest also consider the newest frame - readers, which did not lock it yet, lose it
+        @note several threads may lock buffers for writing at the same time, but only one may publish */
+    Buffer *lockForWriting(bool mayTakeNewest = false);
+    /** makes a buffer locked for writing the newest one and unlocks it */
+    void publish(Buffer *buffer);
+    /** unlocks a buffer locked for writing without publishing it. Its content is considered invalid */
+    void discard(Buffer *buffer);
+
+
+    /* *** consumer side - any thread *** */
+
+    /** @returns the newest published buffer locked for reading. 0 if there is none
+        @note does not allocate. See FrameRef for unlocking automatically */
+    const Buffer *lockNewest();
+    /** @returns the newest published buffer with a serial below the given one, locked for reading.
+        0 if there is none
+        @note lock the n newest frames with lockNewest() and n-1 calls of this - newer frames
+            published in the meantime are skipped, not handed out out of order */
+    const Buffer *lockNewestOlderThan(unsigned long long serial);
+    /** locks a single buffer for reading
+        @returns false, if it is being written */
+    static bool tryLockForReading(const Buffer *buffer);
+    /** O(1) */
+    static void unlock(const Buffer *buffer);
+
+    /** @returns number of published buffers newer than the given time */
+    unsigned int newerBuffersAvailable(const timespec &newerThan);
+    /** @returns the serial of the newest published buffer. 0 if there is none */
+    unsigned long long latestSerial() const;
+
+private:
+
+    Buffer *m_buffers;
+    unsigned int m_count;
+
+    /** only touched by the producer */
+    unsigned long long m_nextSerial;
+    std::atomic<unsigned long long> m_latestSerial;
+};
+
+
+#endif /* FRAME_RING_HPP */
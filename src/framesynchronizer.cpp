@@ -0,0 +1,241 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "framesynchronizer.hpp"
+
+#include "framenotifier.hpp"
+
+#include <cassert>
+#include <limits>
+
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static long long nanoseconds(const timespec &time);
+
+
+FrameSynchronizer::FrameSynchronizer() :
+        m_toleranceNanoseconds(5000000),
+        m_notificationFileDescriptor(FrameNotifier::createFileDescriptor()),
+        m_tupleCount(0),
+        m_skewSum(0.0),
+        m_maximumSkew(0.0)
+{
+}
+
+
+FrameSynchronizer::~FrameSynchronizer()
+{
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        it->notifier->removeFileDescriptor(m_notificationFileDescriptor);
+    }
+
+    if (m_notificationFileDescriptor != -1) close(m_notificationFileDescriptor);
+}
+
+
+unsigned int FrameSynchronizer::addRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat,
+        unsigned int width, unsigned int height, unsigned int bytesPerLine)
+{
+    m_streams.push_back(Stream());
+    Stream &stream = m_streams.back();
+
+    stream.ring = ring;
+    stream.notifier = notifier;
+    stream.pixelFormat = pixelFormat;
+    stream.width = width;
+    stream.height = height;
+    stream.bytesPerLine = bytesPerLine;
+    stream.lastSerial = 0;
+    stream.droppedFrames = 0;
+    stream.candidateCount = 0;
+    stream.chosenCandidate = 0;
+
+    if (m_notificationFileDescriptor != -1) notifier->addFileDescriptor(m_notificationFileDescriptor);
+
+    return m_streams.size() - 1;
+}
+
+
+unsigned int FrameSynchronizer::streamCount() const
+{
+    return m_streams.size();
+}
+
+
+void FrameSynchronizer::setTolerance(double seconds)
+{
+    m_toleranceNanoseconds = (long long) (seconds * 1000000000.0);
+}
+double FrameSynchronizer::tolerance() const
+{
+    return m_toleranceNanoseconds / 1000000000.0;
+}
+
+
+bool FrameSynchronizer::waitForTuple(FrameTuple *tuple, int timeoutMilliseconds)
+{
+    assert(m_streams.empty() == false);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        if (match(tuple) == true) return true;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int remaining = timeoutMilliseconds - (int) ((nanoseconds(now) - nanoseconds(start)) / 1000000);
+        if (remaining <= 0) return false;
+
+        /* a notification of any stream might complete a tuple */
+        FrameNotifier::waitForFileDescriptor(m_notificationFileDescriptor, remaining);
+    }
+}
+
+
+FrameSynchronizer::Statistics FrameSynchronizer::statistics() const
+{
+    Statistics ret;
+
+    lock_guard<mutex> lock(m_statisticsMutex);
+
+    ret.tupleCount = m_tupleCount;
+    ret.meanSkew = m_tupleCount > 0 ? m_skewSum / m_tupleCount : 0.0;
+    ret.maximumSkew = m_maximumSkew;
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        ret.droppedFrames.push_back(it->droppedFrames);
+    }
+
+    return ret;
+}
+
+
+void FrameSynchronizer::resetStatistics()
+{
+    lock_guard<mutex> lock(m_statisticsMutex);
+
+    m_tupleCount = 0;
+    m_skewSum = 0.0;
+    m_maximumSkew = 0.0;
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        it->droppedFrames = 0;
+    }
+}
+
+
+bool FrameSynchronizer::match(FrameTuple *tuple)
+{
+    bool ret = true;
+
+    for (auto it = m_streams.begin(); it != m_streams.end() && ret == true; ++it) {
+        lockCandidates(&(*it));
+        ret = it->candidateCount > 0;
+    }
+
+    if (ret == true) {
+        /* the newest frame of the stream lagging behind most */
+        long long reference = numeric_limits<long long>::max();
+        for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+            long long time = nanoseconds(it->candidates[0].time());
+            if (time < reference) reference = time;
+        }
+
+        long long oldest = numeric_limits<long long>::max();
+        long long newest = numeric_limits<long long>::min();
+
+        for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+            long long closestDistance = numeric_limits<long long>::max();
+
+            for (unsigned int a = 0; a < it->candidateCount; ++a) {
+                long long time = nanoseconds(it->candidates[a].time());
+                long long distance = time > reference ? time - reference : reference - time;
+                if (distance < closestDistance) {
+                    closestDistance = distance;
+                    it->chosenCandidate = a;
+                }
+            }
+
+            long long time = nanoseconds(it->candidates[it->chosenCandidate].time());
+            if (time < oldest) oldest = time;
+            if (time > newest) newest = time;
+        }
+
+        ret = newest - oldest <= m_toleranceNanoseconds;
+
+        if (ret == true) {
+            tuple->frames.resize(m_streams.size());
+            tuple->skew = (newest - oldest) / 1000000000.0;
+
+            lock_guard<mutex> lock(m_statisticsMutex);
+
+            for (unsigned int a = 0; a < m_streams.size(); ++a) {
+                Stream &stream = m_streams[a];
+                FrameRef &frame = stream.candidates[stream.chosenCandidate];
+
+                /* the serials of a ring have no gaps */
+                if (stream.lastSerial != 0) stream.droppedFrames += frame.serial() - stream.lastSerial - 1;
+                stream.lastSerial = frame.serial();
+
+                tuple->frames[a] = move(frame);
+            }
+
+            ++m_tupleCount;
+            m_skewSum += tuple->skew;
+            if (tuple->skew > m_maximumSkew) m_maximumSkew = tuple->skew;
+        }
+    }
+
+    /* the producers may have the others back */
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        for (unsigned int a = 0; a < it->candidateCount; ++a) it->candidates[a].release();
+        it->candidateCount = 0;
+    }
+
+    return ret;
+}
+
+
+void FrameSynchronizer::lockCandidates(Stream *stream)
+{
+    const FrameRing::Buffer *buffer = stream->ring->lockNewest();
+
+    while (buffer != 0) {
+        if (buffer->serial.load(memory_order_relaxed) <= stream->lastSerial) {
+            /* part of the previous tuple or older */
+            FrameRing::unlock(buffer);
+            break;
+        }
+
+        FrameRef &candidate = stream->candidates[stream->candidateCount++];
+        candidate = FrameRef(buffer, stream->pixelFormat, stream->width, stream->height, stream->bytesPerLine);
+
+        if (stream->candidateCount == CandidateCount) break;
+        buffer = stream->ring->lockNewestOlderThan(candidate.serial());
+    }
+}
+
+
+/* *** local *************************************************************** */
+long long nanoseconds(const timespec &time)
+{
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
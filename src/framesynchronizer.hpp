@@ -0,0 +1,138 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_SYNCHRONIZER_HPP
+#define FRAME_SYNCHRONIZER_HPP
+
+#include "prereqs.hpp"
+
+#include "frameref.hpp"
+#include "framering.hpp"
+
+#include <mutex>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+class FrameNotifier;
+
+
+/**
+ * matches the frames of several cameras (stereo, multi-view rigs) by their timestamps
+ *
+ * waitForTuple() hands out one frame per stream, each newer than the one of the previous tuple,
+ * whose timestamps lie within the tolerance. The frames are not copied, the tuple references them.
+ * Frames of a stream, which never become part of a tuple, are counted as dropped.
+ *
+ * Matching looks at the newest few frames of every stream: the reference is the newest frame of the
+ * stream lagging behind most, every other stream contributes its frame closest to it.
+ * That is O(streams) and does not allocate - fine for 8 and more cameras.
+ *
+ * @note the timestamps have to be comparable - driver timestamps from CLOCK_MONOTONIC or ours
+ * @note one consumer thread, statistics() can be called from any thread
+ */
+class FrameSynchronizer
+{
+public:
+
+    struct FrameTuple
+    {
+        /** in the order the streams were added */
+        std::vector<FrameRef> frames;
+        /** difference between the oldest and the newest frame in seconds */
+        double skew;
+    };
+
+    struct Statistics
+    {
+        unsigned long long tupleCount;
+        /** seconds */
+        double meanSkew;
+        double maximumSkew;
+        /** per stream: frames, which did not become part of a tuple, since the first tuple.
+            The drop rate is droppedFrames / (droppedFrames + tupleCount) */
+        std::vector<unsigned long long> droppedFrames;
+    };
+
+
+    FrameSynchronizer();
+    FrameSynchronizer(const FrameSynchronizer&) = delete;
+    FrameSynchronizer(FrameSynchronizer&&) = delete;
+    ~FrameSynchronizer();
+    FrameSynchronizer &operator=(const FrameSynchronizer&) = delete;
+    FrameSynchronizer &operator=(FrameSynchronizer&&) = delete;
+
+    /** @returns the index of the ring's frames in the tuples
+        @pre ring and notifier outlive the synchronizer and the tuples it handed out
+        @see CaptureDevice::addToSynchronizer() */
+    unsigned int addRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+            unsigned int height, unsigned int bytesPerLine);
+    unsigned int streamCount() const;
+
+    /** maximum difference between the timestamps of a tuple's frames. Default: 5ms */
+    void setTolerance(double seconds);
+    double tolerance() const;
+
+    /** waits until the streams have frames, which match, or the timeout expired
+        @param tuple receives the frames. Its previous frames are released. Reuse it to avoid allocations
+        @returns false on timeout */
+    bool waitForTuple(FrameTuple *tuple, int timeoutMilliseconds);
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+private:
+
+    /** frames of a stream looked at per match */
+    enum { CandidateCount = 4 };
+
+    struct Stream
+    {
+        FrameRing *ring;
+        FrameNotifier *notifier;
+        __u32 pixelFormat;
+        unsigned int width;
+        unsigned int height;
+        unsigned int bytesPerLine;
+
+        /** serial of the frame in the previous tuple. 0 if none */
+        unsigned long long lastSerial;
+        unsigned long long droppedFrames;
+
+        /** newest first, all newer than lastSerial */
+        FrameRef candidates[CandidateCount];
+        unsigned int candidateCount;
+        unsigned int chosenCandidate;
+    };
+
+    /** @returns true and fills 'tuple', if the current frames match */
+    bool match(FrameTuple *tuple);
+    void lockCandidates(Stream *stream);
+
+    std::vector<Stream> m_streams;
+    long long m_toleranceNanoseconds;
+    int m_notificationFileDescriptor;
+
+    mutable std::mutex m_statisticsMutex;
+    unsigned long long m_tupleCount;
+    double m_skewSum;
+    double m_maximumSkew;
+};
+
+
+#endif /* FRAME_SYNCHRONIZER_HPP */
@@ -0,0 +1,126 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "frametiming.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+
+/** upper bounds of the jitter histogram's bins in seconds, the last bin takes the rest */
+static const double s_jitterBinUpperBounds[FrameTiming::JitterBinCount - 1] =
+        {0.00001, 0.00003, 0.0001, 0.0003, 0.001, 0.003, 0.01, 0.03};
+
+/** weight of a new interval in the moving average behind framesPerSecond */
+static const double s_averageWeight = 1.0 / 16.0;
+
+
+FrameTiming::FrameTiming()
+{
+    reset();
+}
+
+
+void FrameTiming::addFrame(const timespec &time)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    ++m_frameCount;
+
+    if (m_hasPreviousTime == true) {
+        double interval = (time.tv_sec - m_previousTime.tv_sec) +
+                (time.tv_nsec - m_previousTime.tv_nsec) / 1000000000.0;
+
+        if (m_intervalCount > 0) {
+            double deviation = fabs(interval - m_mean);
+            unsigned int bin = 0;
+            while (bin < JitterBinCount - 1 && deviation > s_jitterBinUpperBounds[bin]) ++bin;
+            ++m_jitterHistogram[bin];
+        }
+
+        /* Welford */
+        ++m_intervalCount;
+        double delta = interval - m_mean;
+        m_mean += delta / m_intervalCount;
+        m_m2 += delta * (interval - m_mean);
+
+        if (interval < m_minimum) m_minimum = interval;
+        if (interval > m_maximum) m_maximum = interval;
+
+        m_averageInterval = m_intervalCount == 1 ? interval :
+                m_averageInterval + s_averageWeight * (interval - m_averageInterval);
+    }
+
+    m_previousTime = time;
+    m_hasPreviousTime = true;
+}
+
+
+void FrameTiming::reset()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    m_hasPreviousTime = false;
+    m_previousTime = {0, 0};
+    m_frameCount = 0;
+    m_intervalCount = 0;
+    m_mean = 0.0;
+    m_m2 = 0.0;
+    m_minimum = numeric_limits<double>::max();
+    m_maximum = 0.0;
+    m_averageInterval = 0.0;
+    memset(m_jitterHistogram, 0, sizeof(m_jitterHistogram));
+}
+
+
+void FrameTiming::skipInterval()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    m_hasPreviousTime = false;
+}
+
+
+FrameTiming::Statistics FrameTiming::statistics() const
+{
+    Statistics ret;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    ret.frameCount = m_frameCount;
+    ret.meanInterval = m_mean;
+    ret.standardDeviation = m_intervalCount > 0 ? sqrt(m_m2 / m_intervalCount) : 0.0;
+    ret.minimumInterval = m_intervalCount > 0 ? m_minimum : 0.0;
+    ret.maximumInterval = m_maximum;
+    ret.framesPerSecond = m_averageInterval > 0.0 ? 1.0 / m_averageInterval : 0.0;
+    memcpy(ret.jitterHistogram, m_jitterHistogram, sizeof(m_jitterHistogram));
+
+    return ret;
+}
+
+
+double FrameTiming::jitterBinUpperBound(unsigned int bin)
+{
+    assert(bin < JitterBinCount);
+
+    return bin < JitterBinCount - 1 ? s_jitterBinUpperBounds[bin] : numeric_limits<double>::infinity();
+}
@@ -0,0 +1,97 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FRAME_TIMING_HPP
+#define FRAME_TIMING_HPP
+
+#include "prereqs.hpp"
+
+#include <ctime>
+#include <mutex>
+
+
+/**
+ * running statistics of the intervals between frames
+ *
+ * Mean and variance are updated with Welford's algorithm - O(1) per frame, no history is kept.
+ * The producer adds frames, anybody may query the statistics at any time.
+ */
+class FrameTiming
+{
+public:
+
+    enum
+    {
+        /** see jitterBinUpperBound() */
+        JitterBinCount = 9
+    };
+
+    struct Statistics
+    {
+        /** frames added since reset() */
+        unsigned long long frameCount;
+        /** intervals in seconds. 0 without intervals */
+        double meanInterval;
+        double standardDeviation;
+        double minimumInterval;
+        double maximumInterval;
+        /** recent rate, an exponential moving average over roughly the last 16 intervals */
+        double framesPerSecond;
+        /** intervals by their absolute deviation from the mean of the intervals before them */
+        unsigned long long jitterHistogram[JitterBinCount];
+    };
+
+
+    FrameTiming();
+    FrameTiming(const FrameTiming&) = delete;
+    FrameTiming(FrameTiming&&) = delete;
+    FrameTiming &operator=(const FrameTiming&) = delete;
+    FrameTiming &operator=(FrameTiming&&) = delete;
+
+    /** @param time when the frame was taken, CLOCK_MONOTONIC */
+    void addFrame(const timespec &time);
+    void reset();
+    /** the next frame does not end an interval, e.g. after a pause */
+    void skipInterval();
+
+    Statistics statistics() const;
+
+    /** @returns the largest deviation in seconds, which falls into the bin. The last bin is unbounded */
+    static double jitterBinUpperBound(unsigned int bin);
+
+private:
+
+    /** held very briefly - by the producer per frame and by a reader per query */
+    mutable std::mutex m_mutex;
+
+    bool m_hasPreviousTime;
+    timespec m_previousTime;
+
+    unsigned long long m_frameCount;
+    unsigned long long m_intervalCount;
+    double m_mean;
+    /** sum of squared deviations from the mean */
+    double m_m2;
+    double m_minimum;
+    double m_maximum;
+    double m_averageInterval;
+    unsigned long long m_jitterHistogram[JitterBinCount];
+};
+
+
+#endif /* FRAME_TIMING_HPP */
@@ -19,29 +19,91 @@
 #include "prereqs.hpp"
 
 #include "basefilter.hpp"
+#include "capabilitycache.hpp"
 #include "capturedevice.hpp"
+#include "capturereactor.hpp"
+#include "framecontainer.hpp"
+#include "framehistory.hpp"
+#include "framerecorder.hpp"
 #include "mainwindow.hpp"
+#include "mjpegdecoder.hpp"
+#include "pixelconversion.hpp"
+#include "replaysource.hpp"
+#include "syntheticsource.hpp"
+#include "threadscheduling.hpp"
 
 #include <QApplication>
 
+#include <atomic>
 #include <cassert>
 #include <cerrno>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
 #include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <dirent.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <time.h>
 
 using namespace std;
 
 
+struct DeviceInitialization
+{
+    CaptureDevice *device;
+    std::string fileName;
+    bool initialized;
+    double milliseconds;
+};
+
+/** writes the histories on SIGUSR1 */
+struct HistoryTrigger
+{
+    std::vector<FrameHistory*> histories;
+    /** of the devices */
+    std::vector<std::string> names;
+    std::string directory;
+    double seconds;
+    std::atomic<bool> stop;
+};
+
+static void initDevice(DeviceInitialization *initialization);
+/** sched=<policy> and cpus=<list>
+    @returns false, if the option is neither */
+static bool parseSchedulingOption(const std::string &key, const std::string &value, ThreadScheduling *scheduling);
+static double millisecondsSince(const timespec &start);
+static void historyTriggerThread(HistoryTrigger *trigger);
+
+
 int main(int argc, char **args)
 {
     VT
 
+    timespec startupStart, phaseStart;
+    clock_gettime(CLOCK_MONOTONIC, &startupStart);
+    phaseStart = startupStart;
+    /* name, milliseconds */
+    list<pair<string, double> > startupPhases;
+
+    /* SIGUSR1 triggers the histories. It is taken by sigwait() in one thread only, all threads
+       started from here on inherit the mask */
+    sigset_t triggerSignals;
+    sigemptyset(&triggerSignals);
+    sigaddset(&triggerSignals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &triggerSignals, 0);
+
     QApplication app(argc, args);
 
 
@@ -59,6 +121,31 @@ int main(int argc, char **args)
     }
 
     set<CaptureDevice*> captureDevices;
+    /* in the order of the arguments */
+    vector<CaptureDevice*> newCaptureDevices;
+    /* the devices do not own them */
+    list<CaptureSource*> captureSources;
+    bool printDiagnostics = false;
+    string capabilityCacheDirectory = CapabilityCache::defaultDirectory();
+    CaptureReactor *captureReactor = 0;
+    FrameRecorder *frameRecorder = 0;
+    string recordingDirectory;
+    bool recordCompressed = true;
+    /* 0: no history */
+    size_t historyBudget = 0;
+    FrameHistory::Codec historyCodec = FrameHistory::CodecNone;
+    unsigned int historyKeyFrameInterval = 30;
+    HistoryTrigger historyTrigger;
+    historyTrigger.directory = ".";
+    historyTrigger.seconds = 0.0;
+    historyTrigger.stop = false;
+    thread *historyTriggerThreadHandle = 0;
+    /* 0 fps: no preview, the GUI shows the frames themselves */
+    unsigned int previewWidth = 640;
+    unsigned int previewHeight = 480;
+    double previewFramesPerSecond = 30.0;
+    MjpegDecoder *mjpegDecoder = 0;
+    unsigned int decoderThreadCount = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
 
     /* *** evaluate arguments start *** */
     auto it = argList.begin();
@@ -78,23 +165,301 @@ int main(int argc, char **args)
             newCaptureDevice->setFileName(deviceFile);
             newCaptureDevice->setCaptureSize(width, height);
 
-            bool initialized = newCaptureDevice->init();
-            assert(initialized);
+            /* synthetic[:<pattern>] generates frames instead of opening a device file */
+            SyntheticSource *syntheticSource = 0;
+            if (deviceFile.compare(0, 9, "synthetic") == 0 &&
+                    (deviceFile.size() == 9 || deviceFile[9] == ':')) {
+                syntheticSource = new SyntheticSource();
+
+                SyntheticSource::Pattern pattern;
+                if (deviceFile.size() > 10) {
+                    if (SyntheticSource::patternFromString(deviceFile.substr(10), &pattern) == true) {
+                        syntheticSource->setPattern(pattern);
+                    } else {
+                        cerr << "unknown pattern: \"" << deviceFile.substr(10) << "\"" << endl;
+                    }
+                }
+
+                newCaptureDevice->setCaptureSource(syntheticSource);
+                captureSources.push_back(syntheticSource);
+            }
 
-            newCaptureDevice->printDeviceInfo();
-            newCaptureDevice->printFormats();
-            newCaptureDevice->printControls();
-            cout << endl;
+            /* replay:<file> plays a recording */
+            ReplaySource *replaySource = 0;
+            if (deviceFile.compare(0, 7, "replay:") == 0) {
+                replaySource = new ReplaySource(deviceFile.substr(7));
+                newCaptureDevice->setCaptureSource(replaySource);
+                captureSources.push_back(replaySource);
+            }
+
+            /* optional settings: key=value */
+            while (next(it) != argList.end() && next(it)->find('=') != string::npos) {
+                string option = *(++it);
+                string key = option.substr(0, option.find('='));
+                string value = option.substr(option.find('=') + 1);
+
+                if (key == "format") {
+                    __u32 pixelFormat = value == "native" ? 0 : CaptureDevice::pixelFormatFromString(value);
+                    if (pixelFormat == V4L2_PIX_FMT_MJPEG) {
+                        /* one pool for all devices - created on demand, started later */
+                        if (mjpegDecoder == 0) mjpegDecoder = new MjpegDecoder(decoderThreadCount);
+                        newCaptureDevice->setMjpegDecoder(mjpegDecoder);
+                    } else if (value != "native" && PixelConversion::isSupported(pixelFormat) == false) {
+                        cerr << "unsupported pixel format: \"" << value << "\"" << endl;
+                        continue;
+                    }
+                    newCaptureDevice->setPixelFormat(pixelFormat);
+                } else if (key == "io") {
+                    if (value == "read") {
+                        newCaptureDevice->setIoMethod(CaptureDevice::IoMethodRead);
+                    } else if (value == "mmap") {
+                        newCaptureDevice->setIoMethod(CaptureDevice::IoMethodMmap);
+                    } else if (value == "userptr") {
+                        newCaptureDevice->setIoMethod(CaptureDevice::IoMethodUserPtr);
+                    } else {
+                        cerr << "unknown i/o method: \"" << value << "\"" << endl;
+                    }
+                } else if (key == "backpressure") {
+                    if (value == "drop") {
+                        newCaptureDevice->setBackpressurePolicy(CaptureDevice::BackpressureDrop);
+                    } else if (value == "overwrite") {
+                        newCaptureDevice->setBackpressurePolicy(CaptureDevice::BackpressureOverwrite);
+                    } else if (value.compare(0, 4, "grow") == 0) {
+                        newCaptureDevice->setBackpressurePolicy(CaptureDevice::BackpressureGrow);
+                        if (value.size() > 5 && value[4] == ':') {
+                            newCaptureDevice->setGrowLimit(atoi(value.c_str() + 5));
+                        }
+                    } else {
+                        cerr << "unknown backpressure policy: \"" << value << "\"" << endl;
+                    }
+                } else if (key == "roi") {
+                    CaptureDevice::RegionOfInterest region = newCaptureDevice->regionOfInterest();
+                    if (sscanf(value.c_str(), "%u,%u,%u,%u", &region.left, &region.top, &region.width,
+                            &region.height) == 4) {
+                        newCaptureDevice->setRegionOfInterest(region);
+                    } else {
+                        cerr << "invalid region: \"" << value << "\"" << endl;
+                    }
+                } else if (key == "bin" || key == "decimate") {
+                    CaptureDevice::RegionOfInterest region = newCaptureDevice->regionOfInterest();
+                    region.factor = atoi(value.c_str());
+                    region.average = key == "bin";
+                    if (region.factor == 1 || region.factor == 2 || region.factor == 4) {
+                        newCaptureDevice->setRegionOfInterest(region);
+                    } else {
+                        cerr << "invalid factor: \"" << value << "\"" << endl;
+                    }
+                } else if (key == "fps" && syntheticSource != 0) {
+                    syntheticSource->setFramesPerSecond(atof(value.c_str()));
+                } else if (key == "timing" && replaySource != 0) {
+                    ReplaySource::Timing timing;
+                    double framesPerSecond;
+                    if (ReplaySource::timingFromString(value, &timing, &framesPerSecond) == true) {
+                        replaySource->setTiming(timing, framesPerSecond);
+                    } else {
+                        cerr << "unknown timing: \"" << value << "\"" << endl;
+                    }
+                } else if (key == "loop" && replaySource != 0) {
+                    replaySource->setLooping(value == "yes" || value == "1");
+                } else if (key == "sched" || key == "cpus") {
+                    ThreadScheduling scheduling = newCaptureDevice->threadScheduling();
+                    if (parseSchedulingOption(key, value, &scheduling) == true) {
+                        newCaptureDevice->setThreadScheduling(scheduling);
+                    }
+                } else {
+                    cerr << "unknown device option: \"" << option << "\"" << endl;
+                }
+            }
+
+            /* recordings of MJPG devices hold the compressed frames */
+            FrameContainer::FileHeader header;
+            if (replaySource != 0 && FrameContainer::readFileHeader(replaySource->fileName(), &header) == true &&
+                    (header.pixelFormat == V4L2_PIX_FMT_MJPEG || header.pixelFormat == V4L2_PIX_FMT_JPEG)) {
+                if (mjpegDecoder == 0) mjpegDecoder = new MjpegDecoder(decoderThreadCount);
+                newCaptureDevice->setMjpegDecoder(mjpegDecoder);
+                newCaptureDevice->setPixelFormat(header.pixelFormat);
+            }
+
+            /* initialized after all arguments are read - in parallel */
+            newCaptureDevices.push_back(newCaptureDevice);
+
+        } else if (*it == "-r") {
+            int threadCount = atoi((++it)->c_str());
+            assert(threadCount > 0);
+            assert(captureReactor == 0);
+
+            captureReactor = new CaptureReactor(threadCount);
+
+            /* optional settings: key=value */
+            ThreadScheduling scheduling;
+            while (next(it) != argList.end() && next(it)->find('=') != string::npos) {
+                string option = *(++it);
+                string key = option.substr(0, option.find('='));
+                string value = option.substr(option.find('=') + 1);
 
-            assert(captureDevices.find(newCaptureDevice) == captureDevices.end());
-            captureDevices.insert(newCaptureDevice);
+                if (key == "sched" || key == "cpus") {
+                    parseSchedulingOption(key, value, &scheduling);
+                } else {
+                    cerr << "unknown reactor option: \"" << option << "\"" << endl;
+                }
+            }
+            captureReactor->setThreadScheduling(scheduling);
+
+        } else if (*it == "-o") {
+            recordingDirectory = *(++it);
+            assert(frameRecorder == 0);
+
+            frameRecorder = new FrameRecorder();
+
+            /* optional settings: key=value */
+            while (next(it) != argList.end() && next(it)->find('=') != string::npos) {
+                string option = *(++it);
+                string key = option.substr(0, option.find('='));
+                string value = option.substr(option.find('=') + 1);
+
+                if (key == "queue" && atoi(value.c_str()) > 0) {
+                    frameRecorder->setQueueLength(atoi(value.c_str()));
+                } else if (key == "prealloc") {
+                    frameRecorder->setPreallocation((size_t) atoi(value.c_str()) * 1024 * 1024);
+                } else if (key == "compressed") {
+                    recordCompressed = value == "yes" || value == "1";
+                } else {
+                    cerr << "unknown recording option: \"" << option << "\"" << endl;
+                }
+            }
+
+        } else if (*it == "-t") {
+            int megabytes = atoi((++it)->c_str());
+            assert(megabytes > 0);
+
+            historyBudget = (size_t) megabytes * 1024 * 1024;
+
+            /* optional settings: key=value */
+            while (next(it) != argList.end() && next(it)->find('=') != string::npos) {
+                string option = *(++it);
+                string key = option.substr(0, option.find('='));
+                string value = option.substr(option.find('=') + 1);
+
+                bool ok = true;
+                if (key == "codec") {
+                    historyCodec = FrameHistory::codecFromString(value, &ok);
+                } else if (key == "key" && atoi(value.c_str()) > 0) {
+                    historyKeyFrameInterval = atoi(value.c_str());
+                } else if (key == "dir") {
+                    historyTrigger.directory = value;
+                } else if (key == "seconds") {
+                    historyTrigger.seconds = atof(value.c_str());
+                } else {
+                    ok = false;
+                }
+
+                if (ok == false) cerr << "unknown history option: \"" << option << "\"" << endl;
+            }
+
+        } else if (*it == "-p") {
+            if (*(++it) == "none") {
+                previewFramesPerSecond = 0.0;
+                continue;
+            }
+
+            previewWidth = atoi(it->c_str());
+            previewHeight = atoi((++it)->c_str());
+            assert(previewWidth > 0);
+            assert(previewHeight > 0);
+
+            /* optional settings: key=value */
+            while (next(it) != argList.end() && next(it)->find('=') != string::npos) {
+                string option = *(++it);
+                string key = option.substr(0, option.find('='));
+                string value = option.substr(option.find('=') + 1);
+
+                if (key == "fps" && atof(value.c_str()) > 0.0) {
+                    previewFramesPerSecond = atof(value.c_str());
+                } else {
+                    cerr << "unknown preview option: \"" << option << "\"" << endl;
+                }
+            }
+
+        } else if (*it == "-j") {
+            int threadCount = atoi((++it)->c_str());
+            assert(threadCount > 0);
+            assert(mjpegDecoder == 0); /* has to precede the -d arguments */
+
+            decoderThreadCount = threadCount;
+
+        } else if (*it == "-c") {
+            capabilityCacheDirectory = *(++it);
+
+        } else if (*it == "-v") {
+            printDiagnostics = true;
 
         } else if (*it == "-h" || *it == "--help") {
             cout
                 << "videocapture [-d ...] [-d ...] [-d ...] ..." << endl
                 << endl
                 << "  arguments:" << endl
-                << "    -d <device file> <res width> <res height>   use this device" << endl
+                << "    -d <device file> <res width> <res height> [<option>=<value> ...]" << endl
+                << "                                                use this device. options:" << endl
+                << "                                                format=<fourcc>|native  capture in RGB3 (default)," << endl
+                << "                                                  YUYV, UYVY, NV12, GREY or the first of these" << endl
+                << "                                                  the hardware delivers natively. MJPG is decoded" << endl
+                << "                                                  by a pool of threads shared by all devices" << endl
+                << "                                                io=mmap|userptr|read  i/o method (default: mmap)." << endl
+                << "                                                  userptr streams into our own huge page backed" << endl
+                << "                                                  buffers, falls back to mmap" << endl
+                << "                                                backpressure=drop|overwrite|grow[:<n>]  if readers" << endl
+                << "                                                  hold all buffers: throw the new frame away" << endl
+                << "                                                  (default), replace the newest unread one or" << endl
+                << "                                                  add up to n (default 4) buffers" << endl
+                << "                                                sched=other|fifo:<prio>|rr:<prio>  scheduling of" << endl
+                << "                                                  the capture thread. Real time policies need" << endl
+                << "                                                  CAP_SYS_NICE or RLIMIT_RTPRIO, else other" << endl
+                << "                                                cpus=<list>  run the capture thread on these" << endl
+                << "                                                  cpus only, e.g. 2,4-5" << endl
+                << "                                                roi=<left>,<top>,<width>,<height>  hand out only" << endl
+                << "                                                  this part of the frames, cropped by the driver" << endl
+                << "                                                  if it can, else copied (not for decoded MJPG)" << endl
+                << "                                                bin=2|4, decimate=2|4  reduce the frames (or the" << endl
+                << "                                                  region) by averaging or by skipping pixels" << endl
+                << "                                                <device file> synthetic[:bars|gradient|" << endl
+                << "                                                  checkerboard] generates a moving pattern" << endl
+                << "                                                  instead. format=RGB3|YUYV|UYVY|NV12|GREY," << endl
+                << "                                                  fps=<n> frames per second (default 30," << endl
+                << "                                                  0: as fast as the frames are taken)" << endl
+                << "                                                <device file> replay:<file> plays a recording" << endl
+                << "                                                  (see -o) in its format instead." << endl
+                << "                                                  timing=original|fastest|<fps>, loop=yes|no" << endl
+                << "    -r <thread count> [<option>=<value> ...]    capture for all devices with <thread count>" << endl
+                << "                                                epoll threads instead of one thread per device." << endl
+                << "                                                options: sched=, cpus= as for -d" << endl
+                << "    -o <directory> [<option>=<value> ...]       record the frames of all devices to" << endl
+                << "                                                <directory>/<n>-<device>.raw. options:" << endl
+                << "                                                queue=<n>  frames per device waiting for the" << endl
+                << "                                                  disk (default 4), more are dropped" << endl
+                << "                                                prealloc=<MiB>  reserve disk space in steps of" << endl
+                << "                                                  this size (default 256)" << endl
+                << "                                                compressed=yes|no  record MJPG as delivered," << endl
+                << "                                                  not decoded (default yes). Replayed MJPG" << endl
+                << "                                                  recordings are decoded again" << endl
+                << "    -t <MiB> [<option>=<value> ...]             keep the last frames of each device, as many as" << endl
+                << "                                                fit into <MiB>, and write them to" << endl
+                << "                                                <dir>/<n>-<device>-history-<time>.raw on SIGUSR1." << endl
+                << "                                                options: codec=none|delta  store frames as the" << endl
+                << "                                                  difference to the previous one (default none)," << endl
+                << "                                                key=<n>  a whole frame every n (default 30)," << endl
+                << "                                                dir=<directory> (default .), seconds=<n>  write" << endl
+                << "                                                  only the last n seconds (default all)" << endl
+                << "    -p <width> <height> [fps=<n>]|none          show the devices downscaled to fit into" << endl
+                << "                                                <width>x<height> (default 640x480), at up to" << endl
+                << "                                                fps (default 30) frames per second. Downscaled" << endl
+                << "                                                by an idle priority thread per device, apart" << endl
+                << "                                                from the full frames. none shows those" << endl
+                << "    -j <thread count>                           decode MJPG with <thread count> threads" << endl
+                << "                                                (default: number of cores). Precedes -d" << endl
+                << "    -c <directory>|none                         cache the formats and controls of the devices" << endl
+                << "                                                in <directory> (default: ~/.cache/videocapture)" << endl
+                << "    -v                                          print the info, formats and controls of each" << endl
+                << "                                                device at startup" << endl
                 << "    -h, --help                                  show this message" << endl;
             return 0;
         } else {
@@ -103,6 +468,159 @@ int main(int argc, char **args)
     }
     /* *** evaluate arguments end *** */
 
+    startupPhases.push_back(make_pair(string("arguments"), millisecondsSince(phaseStart)));
+    clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+
+
+    /* *** initialize devices *** */
+    CapabilityCache *capabilityCache = 0;
+    if (capabilityCacheDirectory != "none") {
+        capabilityCache = new CapabilityCache(capabilityCacheDirectory);
+        for (auto it = newCaptureDevices.begin(); it != newCaptureDevices.end(); ++it) {
+            (*it)->setCapabilityCache(capabilityCache);
+        }
+    }
+
+    /* the frames waiting for the disk must not starve the capture */
+    if (frameRecorder != 0) {
+        for (auto it = newCaptureDevices.begin(); it != newCaptureDevices.end(); ++it) {
+            (*it)->setBufferCount((*it)->bufferCount() + frameRecorder->queueLength());
+        }
+    }
+
+    /* and the one copied into the history */
+    if (historyBudget > 0) {
+        for (auto it = newCaptureDevices.begin(); it != newCaptureDevices.end(); ++it) {
+            (*it)->setBufferCount((*it)->bufferCount() + 1);
+        }
+    }
+
+    /* and the one being downscaled for the preview */
+    if (previewFramesPerSecond > 0.0) {
+        for (auto it = newCaptureDevices.begin(); it != newCaptureDevices.end(); ++it) {
+            (*it)->setPreview(previewWidth, previewHeight, previewFramesPerSecond);
+            (*it)->setBufferCount((*it)->bufferCount() + 1);
+        }
+    }
+
+    /* opening, negotiating and allocating buffers mostly waits for the drivers - one thread per device */
+    vector<DeviceInitialization> initializations(newCaptureDevices.size());
+    list<thread*> initThreads;
+
+    for (unsigned int a = 0; a < newCaptureDevices.size(); ++a) {
+        initializations[a].device = newCaptureDevices[a];
+        initializations[a].fileName = newCaptureDevices[a]->fileName();
+        initializations[a].initialized = false;
+        initializations[a].milliseconds = 0.0;
+        initThreads.push_back(new thread(bind(initDevice, &initializations[a])));
+    }
+
+    for (auto it = initThreads.begin(); it != initThreads.end(); ++it) {
+        (*it)->join();
+        delete *it;
+    }
+
+    for (auto it = initializations.begin(); it != initializations.end(); ++it) {
+        if (it->initialized == false) {
+            cerr << "cannot initialize \"" << it->fileName << "\" - left out" << endl;
+            delete it->device;
+            continue;
+        }
+
+        assert(captureDevices.find(it->device) == captureDevices.end());
+        captureDevices.insert(it->device);
+    }
+
+    startupPhases.push_back(make_pair(string("device initialization"), millisecondsSince(phaseStart)));
+    for (auto it = initializations.begin(); it != initializations.end(); ++it) {
+        startupPhases.push_back(make_pair("  " + it->fileName, it->milliseconds));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+
+    if (printDiagnostics == true) {
+        for (auto it = initializations.begin(); it != initializations.end(); ++it) {
+            if (it->initialized == false) continue;
+
+            it->device->printDeviceInfo();
+            it->device->printFormats();
+            it->device->printControls();
+            cout << endl;
+        }
+
+        startupPhases.push_back(make_pair(string("diagnostics"), millisecondsSince(phaseStart)));
+        clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+    }
+    /* *** initialize devices end *** */
+
+
+    if (captureReactor != 0) {
+        bool started = captureReactor->start();
+        assert(started);
+
+        for (auto it = captureDevices.begin(); it != captureDevices.end(); ++it) {
+            (*it)->setCaptureReactor(captureReactor);
+        }
+    }
+
+    if (mjpegDecoder != 0) {
+        bool started = mjpegDecoder->start();
+        assert(started);
+    }
+
+    startupPhases.push_back(make_pair(string("reactor and decoder start"), millisecondsSince(phaseStart)));
+    clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+
+    if (frameRecorder != 0) {
+        /* in the order of the arguments */
+        for (unsigned int a = 0; a < initializations.size(); ++a) {
+            if (initializations[a].initialized == false) continue;
+
+            string name = initializations[a].fileName.substr(initializations[a].fileName.find_last_of('/') + 1);
+            ostringstream fileName;
+            fileName << recordingDirectory << "/" << a << "-" << name << ".raw";
+            initializations[a].device->addToRecorder(frameRecorder, fileName.str(), recordCompressed);
+        }
+
+        if (frameRecorder->streamCount() == 0 || frameRecorder->start() == false) {
+            cerr << "cannot record to \"" << recordingDirectory << "\"" << endl;
+            delete frameRecorder;
+            frameRecorder = 0;
+        }
+
+        startupPhases.push_back(make_pair(string("recorder start"), millisecondsSince(phaseStart)));
+        clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+    }
+
+    if (historyBudget > 0) {
+        for (unsigned int a = 0; a < initializations.size(); ++a) {
+            if (initializations[a].initialized == false) continue;
+
+            FrameHistory *history = new FrameHistory();
+            history->setBudget(historyBudget);
+            history->setCodec(historyCodec);
+            history->setKeyFrameInterval(historyKeyFrameInterval);
+            initializations[a].device->addToHistory(history);
+
+            if (history->start() == false) {
+                cerr << "cannot keep a history of \"" << initializations[a].fileName << "\"" << endl;
+                delete history;
+                continue;
+            }
+
+            ostringstream name;
+            name << a << "-" << initializations[a].fileName.substr(initializations[a].fileName.find_last_of('/') + 1);
+            historyTrigger.histories.push_back(history);
+            historyTrigger.names.push_back(name.str());
+        }
+
+        if (historyTrigger.histories.empty() == false) {
+            historyTriggerThreadHandle = new thread(bind(historyTriggerThread, &historyTrigger));
+        }
+
+        startupPhases.push_back(make_pair(string("history start"), millisecondsSince(phaseStart)));
+        clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+    }
+
     set<pair<CreateFilterFunction, DestroyFilterFunction> > filters;
     set<void*> filterLibraryHandles;
     /* *** load filters *** */
@@ -150,17 +668,90 @@ int main(int argc, char **args)
     }
     /* *** load filters end *** */
 
+    startupPhases.push_back(make_pair(string("filter loading"), millisecondsSince(phaseStart)));
+    clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+
+
+    /* on the heap: it holds frames of the devices, so it goes before they are finished */
+    MainWindow *mainWindow = new MainWindow(0, captureDevices, filters);
+    mainWindow->show();
 
-    MainWindow mainWindow(0, captureDevices, filters);
-    mainWindow.show();
+    startupPhases.push_back(make_pair(string("main window"), millisecondsSince(phaseStart)));
+    startupPhases.push_back(make_pair(string("total"), millisecondsSince(startupStart)));
+
+    cout << "Startup (ms):" << endl;
+    for (auto it = startupPhases.begin(); it != startupPhases.end(); ++it) {
+        cout << "  " << left << setw(30) << it->first << right << setw(10) << fixed << setprecision(1) << it->second
+                << endl;
+    }
 
     int ret = app.exec();
 
+    /* stops the paint thread and releases its frames - the rings go with finish() below */
+    delete mainWindow;
+
+    if (historyTriggerThreadHandle != 0) {
+        historyTrigger.stop = true;
+        pthread_kill(historyTriggerThreadHandle->native_handle(), SIGUSR1);
+        historyTriggerThreadHandle->join();
+        delete historyTriggerThreadHandle;
+    }
+
+    if (historyTrigger.histories.empty() == false) {
+        cout << "History:" << endl;
+        for (unsigned int a = 0; a < historyTrigger.histories.size(); ++a) {
+            FrameHistory *history = historyTrigger.histories[a];
+            /* waits for the last write */
+            history->stop();
+
+            FrameHistory::Statistics statistics = history->statistics();
+            cout << "  " << historyTrigger.names[a] << ": " << statistics.droppedFrames << " dropped";
+            if (statistics.flushFileName.empty() == false) {
+                cout << ", last written " << statistics.flushFileName << " (" << statistics.flushedFrames
+                        << " frames" << (statistics.flushFailed == true ? ", failed" : "") << ")";
+            }
+            cout << endl;
+
+            delete history;
+        }
+    }
+
+    if (frameRecorder != 0) {
+        frameRecorder->stop();
+
+        vector<FrameRecorder::Statistics> statistics = frameRecorder->statistics();
+        cout << "Recorded:" << endl;
+        for (auto it = statistics.begin(); it != statistics.end(); ++it) {
+            cout << "  " << it->fileName << ": " << it->recordedFrames << " frames, " << it->droppedFrames
+                    << " dropped, " << it->bytesWritten / (1024 * 1024) << " MiB, "
+                    << (it->directIo == true ? "direct" : "buffered") << " i/o, slowest write "
+                    << fixed << setprecision(1) << it->maximumWriteLatency * 1000.0 << " ms"
+                    << (it->failed == true ? ", failed" : "") << endl;
+        }
+
+        delete frameRecorder;
+    }
 
     for (auto it = captureDevices.begin(); it != captureDevices.end(); ++it) {
         (*it)->finish();
     }
 
+    if (captureReactor != 0) {
+        captureReactor->stop();
+        delete captureReactor;
+    }
+
+    for (auto it = captureSources.begin(); it != captureSources.end(); ++it) {
+        delete *it;
+    }
+
+    delete capabilityCache;
+
+    if (mjpegDecoder != 0) {
+        mjpegDecoder->stop();
+        delete mjpegDecoder;
+    }
+
     for (auto it = filterLibraryHandles.begin(); it != filterLibraryHandles.end(); ++it) {
         int dlcloseRet = dlclose(*it);
         assert(dlcloseRet == 0);
@@ -169,3 +760,82 @@ int main(int argc, char **args)
     return ret;
 }
 
+
+/* *** local *************************************************************** */
+void initDevice(DeviceInitialization *initialization)
+{
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    initialization->initialized = initialization->device->init();
+
+    initialization->milliseconds = millisecondsSince(start);
+}
+
+
+double millisecondsSince(const timespec &start)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+bool parseSchedulingOption(const string &key, const string &value, ThreadScheduling *scheduling)
+{
+    if (key == "sched") {
+        ThreadScheduling::Policy policy;
+        int priority;
+        if (ThreadScheduling::parsePolicy(value, &policy, &priority) == false) {
+            cerr << "unknown scheduling policy: \"" << value << "\"" << endl;
+            return false;
+        }
+        scheduling->setPolicy(policy, priority);
+        return true;
+
+    } else if (key == "cpus") {
+        set<unsigned int> cpus;
+        if (ThreadScheduling::parseCpus(value, &cpus) == false) {
+            cerr << "invalid cpu list: \"" << value << "\"" << endl;
+            return false;
+        }
+        scheduling->setCpus(cpus);
+        return true;
+    }
+
+    return false;
+}
+
+
+void historyTriggerThread(HistoryTrigger *trigger)
+{
+    sigset_t triggerSignals;
+    sigemptyset(&triggerSignals);
+    sigaddset(&triggerSignals, SIGUSR1);
+
+    for (;;) {
+        int signal;
+        if (sigwait(&triggerSignals, &signal) != 0) continue;
+        if (trigger->stop.load() == true) break;
+
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        for (unsigned int a = 0; a < trigger->histories.size(); ++a) {
+            FrameHistory *history = trigger->histories[a];
+
+            ostringstream fileName;
+            fileName << trigger->directory << "/" << trigger->names[a] << "-history-" << now.tv_sec << ".raw";
+
+            FrameHistory::Statistics statistics = history->statistics();
+            if (history->trigger(fileName.str(), trigger->seconds) == true) {
+                cout << "writing the history to " << fileName.str() << " (holding " << statistics.frames
+                        << " frames, " << fixed << setprecision(1) << statistics.seconds << " s in "
+                        << statistics.storedBytes / (1024 * 1024) << " MiB, "
+                        << statistics.rawBytes / (1024 * 1024) << " MiB uncompressed)" << endl;
+            } else {
+                cerr << "cannot write the history of " << trigger->names[a] << " - empty or still writing" << endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,367 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "mjpegdecoder.hpp"
+
+#include "framenotifier.hpp"
+
+#include <cassert>
+#include <csetjmp>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#include <jpeglib.h>
+
+using namespace std;
+
+
+/** frames, which may wait for a decoding thread, per thread. More are dropped */
+static const unsigned int s_maxQueuedFramesPerThread = 2;
+
+
+struct ErrorManager
+{
+    struct jpeg_error_mgr manager;
+    jmp_buf jumpBuffer;
+};
+
+static void errorExit(j_common_ptr info);
+static void outputMessage(j_common_ptr info);
+static bool decodeFrame(struct jpeg_decompress_struct *decompress, ErrorManager *errorManager,
+        const FrameRing::Buffer *compressed, FrameRing::Buffer *output, unsigned int width, unsigned int height,
+        unsigned int bytesPerLine);
+
+
+/* *** Stream ************************************************************** */
+MjpegDecoder::Stream::Stream() :
+        m_output(0),
+        m_width(0),
+        m_height(0),
+        m_bytesPerLine(0),
+        m_notifier(0),
+        m_nextTicket(0),
+        m_nextPublication(0),
+        m_decodedFrameCount(0),
+        m_droppedFrameCount(0)
+{
+}
+
+
+void MjpegDecoder::Stream::setOutput(FrameRing *ring, unsigned int width, unsigned int height,
+        unsigned int bytesPerLine)
+{
+    assert(bytesPerLine >= width * 3);
+
+    m_output = ring;
+    m_width = width;
+    m_height = height;
+    m_bytesPerLine = bytesPerLine;
+}
+
+
+void MjpegDecoder::Stream::setNotifier(FrameNotifier *notifier)
+{
+    m_notifier = notifier;
+}
+
+
+unsigned long long MjpegDecoder::Stream::decodedFrameCount() const
+{
+    return m_decodedFrameCount.load(memory_order_relaxed);
+}
+
+
+unsigned long long MjpegDecoder::Stream::droppedFrameCount() const
+{
+    return m_droppedFrameCount.load(memory_order_relaxed);
+}
+
+
+unsigned int MjpegDecoder::Stream::pendingFrameCount()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return (unsigned int) (m_nextTicket - m_nextPublication);
+}
+
+
+/* *** MjpegDecoder ******************************************************** */
+MjpegDecoder::MjpegDecoder(unsigned int threadCount) :
+        m_threadCount(threadCount),
+        m_cancellationFlag(false)
+{
+    assert(threadCount > 0);
+}
+
+
+MjpegDecoder::~MjpegDecoder()
+{
+    stop();
+}
+
+
+unsigned int MjpegDecoder::threadCount() const
+{
+    return m_threadCount;
+}
+
+
+bool MjpegDecoder::start()
+{
+    assert(isRunning() == false);
+
+    m_cancellationFlag = false;
+
+    for (unsigned int a = 0; a < m_threadCount; ++a) {
+        m_threads.push_back(new thread(bind(decodeThread, this)));
+    }
+
+    return true;
+}
+
+
+void MjpegDecoder::stop()
+{
+    m_mutex.lock();
+    m_cancellationFlag = true;
+    deque<Job> jobs;
+    jobs.swap(m_jobs);
+    m_mutex.unlock();
+    m_jobAvailable.notify_all();
+
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        (*it)->join();
+        delete *it;
+    }
+    m_threads.clear();
+
+    for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+        FrameRing::unlock(it->compressed);
+
+        lock_guard<mutex> lock(it->stream->m_mutex);
+        it->stream->m_finished[it->ticket] = 0;
+        publishInOrder(it->stream);
+    }
+}
+
+
+bool MjpegDecoder::isRunning() const
+{
+    return m_threads.empty() == false;
+}
+
+
+void MjpegDecoder::attach(Stream *stream)
+{
+    assert(stream->m_output != 0);
+
+    lock_guard<mutex> lock(stream->m_mutex);
+    assert(stream->m_nextTicket == stream->m_nextPublication);
+
+    stream->m_nextTicket = 0;
+    stream->m_nextPublication = 0;
+    stream->m_finished.clear();
+}
+
+
+void MjpegDecoder::detach(Stream *stream)
+{
+    /* take the stream's frames out of the queue */
+    deque<Job> jobs;
+    m_mutex.lock();
+    for (auto it = m_jobs.begin(); it != m_jobs.end(); ) {
+        if (it->stream == stream) {
+            jobs.push_back(*it);
+            it = m_jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_mutex.unlock();
+
+    unique_lock<mutex> lock(stream->m_mutex);
+
+    for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+        FrameRing::unlock(it->compressed);
+        stream->m_finished[it->ticket] = 0;
+    }
+    publishInOrder(stream);
+
+    /* wait for the frames being decoded right now */
+    while (stream->m_nextPublication != stream->m_nextTicket) {
+        stream->m_idle.wait(lock);
+    }
+}
+
+
+void MjpegDecoder::decode(Stream *stream, const FrameRing::Buffer *compressed)
+{
+    Job job;
+    job.stream = stream;
+    job.compressed = compressed;
+
+    stream->m_mutex.lock();
+    job.ticket = stream->m_nextTicket++;
+    stream->m_mutex.unlock();
+
+    m_mutex.lock();
+    if (m_cancellationFlag == true || m_jobs.size() >= s_maxQueuedFramesPerThread * m_threadCount) {
+        m_mutex.unlock();
+
+        /* too busy - drop it, but keep the order of the others */
+        FrameRing::unlock(compressed);
+        lock_guard<mutex> lock(stream->m_mutex);
+        stream->m_finished[job.ticket] = 0;
+        publishInOrder(stream);
+        return;
+    }
+    m_jobs.push_back(job);
+    m_mutex.unlock();
+
+    m_jobAvailable.notify_one();
+}
+
+
+void MjpegDecoder::decodeThread(MjpegDecoder *decoder)
+{
+    struct jpeg_decompress_struct decompress;
+    ErrorManager errorManager;
+
+    decompress.err = jpeg_std_error(&errorManager.manager);
+    errorManager.manager.error_exit = errorExit;
+    errorManager.manager.output_message = outputMessage;
+    jpeg_create_decompress(&decompress);
+
+    for (;;) {
+        unique_lock<mutex> lock(decoder->m_mutex);
+        while (decoder->m_jobs.empty() == true && decoder->m_cancellationFlag == false) {
+            decoder->m_jobAvailable.wait(lock);
+        }
+        if (decoder->m_cancellationFlag == true) break;
+
+        Job job = decoder->m_jobs.front();
+        decoder->m_jobs.pop_front();
+        lock.unlock();
+
+        Stream *stream = job.stream;
+
+        /* several threads lock buffers of the same ring, only publishing is serialized */
+        FrameRing::Buffer *output = stream->m_output->lockForWriting();
+
+        if (output != 0) {
+            if (decodeFrame(&decompress, &errorManager, job.compressed, output, stream->m_width,
+                    stream->m_height, stream->m_bytesPerLine) == true) {
+                output->time = job.compressed->time;
+                output->sequence = job.compressed->sequence;
+                output->bytesUsed = stream->m_bytesPerLine * stream->m_height;
+            } else {
+                stream->m_output->discard(output);
+                output = 0;
+            }
+        }
+
+        FrameRing::unlock(job.compressed);
+
+        stream->m_mutex.lock();
+        stream->m_finished[job.ticket] = output;
+        publishInOrder(stream);
+        stream->m_mutex.unlock();
+    }
+
+    jpeg_destroy_decompress(&decompress);
+}
+
+
+void MjpegDecoder::publishInOrder(Stream *stream)
+{
+    auto it = stream->m_finished.begin();
+
+    while (it != stream->m_finished.end() && it->first == stream->m_nextPublication) {
+        FrameRing::Buffer *buffer = it->second;
+
+        if (buffer != 0) {
+            stream->m_output->publish(buffer);
+            stream->m_decodedFrameCount.fetch_add(1, memory_order_relaxed);
+            if (stream->m_notifier != 0) stream->m_notifier->notify(buffer->serial);
+        } else {
+            stream->m_droppedFrameCount.fetch_add(1, memory_order_relaxed);
+        }
+
+        ++stream->m_nextPublication;
+        it = stream->m_finished.erase(it);
+    }
+
+    if (stream->m_nextPublication == stream->m_nextTicket) {
+        stream->m_idle.notify_all();
+    }
+}
+
+
+/* *** local *************************************************************** */
+void errorExit(j_common_ptr info)
+{
+    ErrorManager *errorManager = (ErrorManager*) info->err;
+    longjmp(errorManager->jumpBuffer, 1);
+}
+
+
+void outputMessage(j_common_ptr info)
+{
+    /* corrupt frames happen with usb cameras - they are counted, not printed */
+    (void) info;
+}
+
+
+/** @note no objects with destructors in here - errors longjmp out */
+bool decodeFrame(struct jpeg_decompress_struct *decompress, ErrorManager *errorManager,
+        const FrameRing::Buffer *compressed, FrameRing::Buffer *output, unsigned int width, unsigned int height,
+        unsigned int bytesPerLine)
+{
+    if (setjmp(errorManager->jumpBuffer) != 0) {
+        jpeg_abort_decompress(decompress);
+        return false;
+    }
+
+    jpeg_mem_src(decompress, (unsigned char*) compressed->buffer, compressed->bytesUsed);
+
+    if (jpeg_read_header(decompress, TRUE) != JPEG_HEADER_OK) {
+        jpeg_abort_decompress(decompress);
+        return false;
+    }
+
+    decompress->out_color_space = JCS_RGB;
+    jpeg_start_decompress(decompress);
+
+    if (decompress->output_width != width || decompress->output_height != height ||
+            decompress->output_components != 3 || output->length < bytesPerLine * height) {
+        jpeg_abort_decompress(decompress);
+        return false;
+    }
+
+    while (decompress->output_scanline < decompress->output_height) {
+        JSAMPROW rows[16];
+        unsigned int rowCount = 0;
+        for (; rowCount < 16 && decompress->output_scanline + rowCount < height; ++rowCount) {
+            rows[rowCount] = output->buffer + (decompress->output_scanline + rowCount) * bytesPerLine;
+        }
+        jpeg_read_scanlines(decompress, rows, rowCount);
+    }
+
+    jpeg_finish_decompress(decompress);
+    return true;
+}
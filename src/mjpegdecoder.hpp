@@ -0,0 +1,153 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MJPEG_DECODER_HPP
+#define MJPEG_DECODER_HPP
+
+#include "prereqs.hpp"
+
+#include "framering.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+
+class FrameNotifier;
+
+namespace std
+{
+    class thread;
+};
+
+
+/**
+ * pool of threads decoding (M)JPEG frames into RGB888, shared by any number of capture devices
+ *
+ * Every device owns a Stream: the decoded frames of it are published into the stream's output ring
+ * in the order they were handed to decode(), even though several threads decode them at the same time.
+ * A frame finished early waits (locked for writing) until all older frames are published.
+ *
+ * @note frames without huffman tables - as sent by most usb cameras - are fine, the decoder
+ *    falls back to the standard tables
+ */
+class MjpegDecoder
+{
+public:
+
+    class Stream
+    {
+    public:
+
+        Stream();
+        Stream(const Stream&) = delete;
+        Stream(Stream&&) = delete;
+        Stream &operator=(const Stream&) = delete;
+        Stream &operator=(Stream&&) = delete;
+
+        /** decoded frames go here, as RGB888 rows bytesPerLine apart. Its buffers have to hold
+            bytesPerLine*height bytes
+            @pre not attached */
+        void setOutput(FrameRing *ring, unsigned int width, unsigned int height, unsigned int bytesPerLine);
+        /** notified with the serial of each published frame. Default: 0 - nobody */
+        void setNotifier(FrameNotifier *notifier);
+
+        /** frames published into the output ring */
+        unsigned long long decodedFrameCount() const;
+        /** frames not decoded, because the decoder was too busy, no output buffer was free
+            or the data was corrupt */
+        unsigned long long droppedFrameCount() const;
+        /** frames handed to decode() and not yet published or dropped */
+        unsigned int pendingFrameCount();
+
+    private:
+
+        friend class MjpegDecoder;
+
+        FrameRing *m_output;
+        unsigned int m_width;
+        unsigned int m_height;
+        unsigned int m_bytesPerLine;
+        FrameNotifier *m_notifier;
+
+        std::mutex m_mutex;
+        std::condition_variable m_idle;
+        /** ticket of the next frame handed to decode() */
+        unsigned long long m_nextTicket;
+        /** ticket of the next frame to be published */
+        unsigned long long m_nextPublication;
+        /** decoded frames waiting for older ones. 0 means decoding failed */
+        std::map<unsigned long long, FrameRing::Buffer*> m_finished;
+
+        std::atomic<unsigned long long> m_decodedFrameCount;
+        std::atomic<unsigned long long> m_droppedFrameCount;
+    };
+
+
+    MjpegDecoder(unsigned int threadCount);
+    MjpegDecoder(const MjpegDecoder&) = delete;
+    MjpegDecoder(MjpegDecoder&&) = delete;
+    ~MjpegDecoder();
+    MjpegDecoder &operator=(const MjpegDecoder&) = delete;
+    MjpegDecoder &operator=(MjpegDecoder&&) = delete;
+
+    unsigned int threadCount() const;
+
+    bool start();
+    /** waits for the frames being decoded, drops the queued ones */
+    void stop();
+    bool isRunning() const;
+
+    void attach(Stream *stream);
+    /** drops the stream's queued frames and waits until the ones being decoded are published
+        @note afterwards no buffer of the stream is locked by the decoder anymore */
+    void detach(Stream *stream);
+
+    /** queues a compressed frame for decoding
+        @param compressed locked for reading by the caller. The decoder unlocks it, when done - also on failure
+        @note never blocks. If too many frames are queued already, the frame is dropped
+        @note to be called by one thread per stream */
+    void decode(Stream *stream, const FrameRing::Buffer *compressed);
+
+private:
+
+    struct Job
+    {
+        Stream *stream;
+        unsigned long long ticket;
+        const FrameRing::Buffer *compressed;
+    };
+
+    static void decodeThread(MjpegDecoder *decoder);
+    /** publishes the stream's finished frames in ticket order
+        @pre stream->m_mutex is locked */
+    static void publishInOrder(Stream *stream);
+
+    unsigned int m_threadCount;
+    std::list<std::thread*> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    std::deque<Job> m_jobs;
+    bool m_cancellationFlag;
+};
+
+
+#endif /* MJPEG_DECODER_HPP */
@@ -0,0 +1,125 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "pausegate.hpp"
+
+#include <chrono>
+
+using namespace std;
+
+
+PauseGate::PauseGate() :
+        m_state(StateRunning),
+        m_resumeCount(0),
+        m_lastResumeLatency(0.0),
+        m_resumeLatencySum(0.0),
+        m_maximumResumeLatency(0.0)
+{
+    m_resumeTime.tv_sec = 0;
+    m_resumeTime.tv_nsec = 0;
+}
+
+
+void PauseGate::pause()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    if (m_state.load(memory_order_relaxed) == StateRunning) {
+        m_state.store(StatePauseRequested, memory_order_release);
+    }
+}
+
+
+void PauseGate::resume()
+{
+    m_mutex.lock();
+
+    int state = m_state.load(memory_order_relaxed);
+    if (state == StateRunning) {
+        m_mutex.unlock();
+        return;
+    }
+
+    /* a worker, which did not park yet, just carries on */
+    clock_gettime(CLOCK_MONOTONIC, &m_resumeTime);
+    m_state.store(StateRunning, memory_order_release);
+    m_mutex.unlock();
+
+    if (state == StateParked) m_resumed.notify_all();
+}
+
+
+bool PauseGate::isPaused() const
+{
+    return m_state.load(memory_order_acquire) != StateRunning;
+}
+
+
+bool PauseGate::waitUntilParked(long timeoutNanoseconds)
+{
+    unique_lock<mutex> lock(m_mutex);
+
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::nanoseconds(timeoutNanoseconds);
+
+    while (m_state.load(memory_order_relaxed) == StatePauseRequested) {
+        if (m_parked.wait_until(lock, deadline) == cv_status::timeout) break;
+    }
+
+    return m_state.load(memory_order_relaxed) != StatePauseRequested;
+}
+
+
+bool PauseGate::checkpoint()
+{
+    /* the common case */
+    if (m_state.load(memory_order_acquire) == StateRunning) return false;
+
+    unique_lock<mutex> lock(m_mutex);
+    if (m_state.load(memory_order_relaxed) == StateRunning) return false;
+
+    m_state.store(StateParked, memory_order_relaxed);
+    m_parked.notify_all();
+
+    while (m_state.load(memory_order_relaxed) == StateParked) {
+        m_resumed.wait(lock);
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double latency = (now.tv_sec - m_resumeTime.tv_sec) + (now.tv_nsec - m_resumeTime.tv_nsec) / 1000000000.0;
+
+    ++m_resumeCount;
+    m_lastResumeLatency = latency;
+    m_resumeLatencySum += latency;
+    if (latency > m_maximumResumeLatency) m_maximumResumeLatency = latency;
+
+    return true;
+}
+
+
+PauseGate::Statistics PauseGate::statistics() const
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    Statistics ret;
+    ret.resumeCount = m_resumeCount;
+    ret.lastResumeLatency = m_lastResumeLatency;
+    ret.meanResumeLatency = m_resumeCount > 0 ? m_resumeLatencySum / m_resumeCount : 0.0;
+    ret.maximumResumeLatency = m_maximumResumeLatency;
+    return ret;
+}
@@ -0,0 +1,98 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PAUSE_GATE_HPP
+#define PAUSE_GATE_HPP
+
+#include "prereqs.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+
+
+/**
+ * lets one thread pause another one, which passes checkpoint() regularly, e.g. once per frame
+ *
+ * While running, checkpoint() is a single atomic load. A paused worker sleeps on a condition variable
+ * until resume() wakes it - nothing is polled, resuming takes one wake up. The time from resume() until
+ * the worker runs again is recorded.
+ */
+class PauseGate
+{
+public:
+
+    struct Statistics
+    {
+        unsigned long long resumeCount;
+        /** from resume() until the worker left checkpoint(), in seconds. 0 without resumes */
+        double lastResumeLatency;
+        double meanResumeLatency;
+        double maximumResumeLatency;
+    };
+
+
+    PauseGate();
+    PauseGate(const PauseGate&) = delete;
+    PauseGate(PauseGate&&) = delete;
+    PauseGate &operator=(const PauseGate&) = delete;
+    PauseGate &operator=(PauseGate&&) = delete;
+
+    /** the worker parks at its next checkpoint(). Does not wait for that, see waitUntilParked() */
+    void pause();
+    /** wakes the worker, if it is parked. Pausing again before it woke up is fine */
+    void resume();
+    /** @returns true between pause() and resume() */
+    bool isPaused() const;
+
+    /** @returns false on timeout - the worker did not reach a checkpoint() in time */
+    bool waitUntilParked(long timeoutNanoseconds);
+
+    /** to be called by the worker only. Blocks while paused
+        @returns true, if it was paused */
+    bool checkpoint();
+
+    Statistics statistics() const;
+
+private:
+
+    enum State
+    {
+        StateRunning,
+        StatePauseRequested,
+        StateParked
+    };
+
+    std::atomic<int> m_state;
+
+    mutable std::mutex m_mutex;
+    /** resume() -> worker */
+    std::condition_variable m_resumed;
+    /** worker -> waitUntilParked() */
+    std::condition_variable m_parked;
+
+    timespec m_resumeTime;
+    unsigned long long m_resumeCount;
+    double m_lastResumeLatency;
+    double m_resumeLatencySum;
+    double m_maximumResumeLatency;
+};
+
+
+#endif /* PAUSE_GATE_HPP */
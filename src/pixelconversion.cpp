@@ -0,0 +1,884 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "pixelconversion.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define HAVE_X86_SIMD
+    #include <immintrin.h>
+#endif
+
+using namespace std;
+
+
+/* All implementations compute with the same 6 bit fixed point coefficients
+ * (1.164, 1.596, 0.391, 0.813, 2.018 times 64), so their results are identical. */
+
+/** converts one row. 'yFirst' distinguishes YUYV (true) from UYVY (false) */
+typedef void (*Yuv422RowFunction)(const unsigned char *source, unsigned char *destination,
+        unsigned int width, bool yFirst);
+typedef void (*Nv12RowFunction)(const unsigned char *luma, const unsigned char *chroma,
+        unsigned char *destination, unsigned int width);
+typedef void (*Luma422RowFunction)(const unsigned char *source, unsigned char *destination,
+        unsigned int width, bool yFirst);
+/** each byte is the rounded mean of the bytes in its column of 'rows' rows, a power of 2 */
+typedef void (*AverageRowsFunction)(const unsigned char *source, unsigned int bytesPerLine, unsigned int rows,
+        unsigned char *destination, unsigned int length);
+/** halves RGB888 horizontally, each pixel the rounded mean of two. 'width' is the destination's, which may
+    be the source */
+typedef void (*HalveRgbRowFunction)(const unsigned char *source, unsigned char *destination, unsigned int width);
+
+struct RowFunctions
+{
+    Yuv422RowFunction yuv422;
+    Nv12RowFunction nv12;
+    Luma422RowFunction luma422;
+    AverageRowsFunction averageRows;
+    HalveRgbRowFunction halveRgb;
+    const char *name;
+};
+
+static const RowFunctions &rowFunctions();
+static bool s_forceScalar = false;
+
+
+/* *** scalar ************************************************************** */
+static inline unsigned char clamp(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : (unsigned char) value);
+}
+
+
+static inline void yuvToRgbScalar(int y, int u, int v, unsigned char *rgb)
+{
+    y = (y - 16) * 74;
+    u -= 128;
+    v -= 128;
+    rgb[0] = clamp((y + 102 * v + 32) >> 6);
+    rgb[1] = clamp((y - 25 * u - 52 * v + 32) >> 6);
+    rgb[2] = clamp((y + 129 * u + 32) >> 6);
+}
+
+
+static void yuv422RowScalar(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    int y0 = yFirst ? 0 : 1, u = yFirst ? 1 : 0, y1 = yFirst ? 2 : 3, v = yFirst ? 3 : 2;
+
+    for (unsigned int x = 0; x < width; x += 2, source += 4, destination += 6) {
+        yuvToRgbScalar(source[y0], source[u], source[v], destination);
+        if (x + 1 < width) yuvToRgbScalar(source[y1], source[u], source[v], destination + 3);
+    }
+}
+
+
+static void nv12RowScalar(const unsigned char *luma, const unsigned char *chroma, unsigned char *destination,
+        unsigned int width)
+{
+    for (unsigned int x = 0; x < width; ++x) {
+        yuvToRgbScalar(luma[x], chroma[x & ~1u], chroma[(x & ~1u) + 1], destination + 3 * x);
+    }
+}
+
+
+static void luma422RowScalar(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    source += yFirst ? 0 : 1;
+    for (unsigned int x = 0; x < width; ++x) {
+        destination[x] = source[2 * x];
+    }
+}
+
+
+static void greyRowScalar(const unsigned char *source, unsigned char *destination, unsigned int width)
+{
+    for (unsigned int x = 0; x < width; ++x, destination += 3) {
+        destination[0] = destination[1] = destination[2] = source[x];
+    }
+}
+
+
+static inline unsigned int shiftOf(unsigned int powerOf2)
+{
+    unsigned int ret = 0;
+    while ((1u << ret) < powerOf2) ++ret;
+    return ret;
+}
+
+
+static void averageRowsScalar(const unsigned char *source, unsigned int bytesPerLine, unsigned int rows,
+        unsigned char *destination, unsigned int length)
+{
+    unsigned int shift = shiftOf(rows);
+
+    for (unsigned int x = 0; x < length; ++x) {
+        unsigned int sum = rows >> 1;
+        for (unsigned int y = 0; y < rows; ++y) {
+            sum += source[y * bytesPerLine + x];
+        }
+        destination[x] = (unsigned char) (sum >> shift);
+    }
+}
+
+
+static void halveRgbRowScalar(const unsigned char *source, unsigned char *destination, unsigned int width)
+{
+    /* in place, too: a pixel is written after both of its source pixels are read */
+    for (unsigned int x = 0; x < width; ++x, source += 6, destination += 3) {
+        for (unsigned int c = 0; c < 3; ++c) {
+            destination[c] = (unsigned char) ((source[c] + source[c + 3] + 1) >> 1);
+        }
+    }
+}
+
+
+/** reduces one channel of interleaved samples, which are 'step' bytes apart: each of columns x rows
+    destination samples is the mean (rounded) or the first of factor x factor source samples */
+static void reduceChannel(const unsigned char *source, unsigned int sourceBytesPerLine, unsigned char *destination,
+        unsigned int destinationBytesPerLine, unsigned int columns, unsigned int rows, unsigned int step,
+        unsigned int factor, bool average)
+{
+    /* factor is a power of 2 */
+    unsigned int shift = factor == 4 ? 4 : 2;
+
+    for (unsigned int y = 0; y < rows; ++y) {
+        const unsigned char *in = source + y * factor * sourceBytesPerLine;
+        unsigned char *out = destination + y * destinationBytesPerLine;
+
+        if (average == false) {
+            for (unsigned int x = 0; x < columns; ++x) {
+                out[x * step] = in[x * factor * step];
+            }
+            continue;
+        }
+
+        if (factor == 2) {
+            const unsigned char *below = in + sourceBytesPerLine;
+            for (unsigned int x = 0; x < columns; ++x) {
+                unsigned int i = 2 * x * step;
+                out[x * step] = (unsigned char) ((in[i] + in[i + step] + below[i] + below[i + step] + 2) >> 2);
+            }
+            continue;
+        }
+
+        for (unsigned int x = 0; x < columns; ++x) {
+            unsigned int sum = 0;
+            for (unsigned int j = 0; j < factor; ++j) {
+                const unsigned char *row = in + j * sourceBytesPerLine + x * factor * step;
+                for (unsigned int i = 0; i < factor; ++i) {
+                    sum += row[i * step];
+                }
+            }
+            out[x * step] = (unsigned char) ((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+/* *** sse2 **************************************************************** */
+
+/** 8 pixels in 16 bit lanes */
+static inline void yuvToRgbSse2(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i round = _mm_set1_epi16(32);
+
+    y = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(74));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    r = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(102))), round);
+    g = _mm_adds_epi16(_mm_subs_epi16(_mm_subs_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(25))),
+            _mm_mullo_epi16(v, _mm_set1_epi16(52))), round);
+    b = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(129))), round);
+
+    r = _mm_srai_epi16(r, 6);
+    g = _mm_srai_epi16(g, 6);
+    b = _mm_srai_epi16(b, 6);
+}
+
+
+/** splits 8 pixels of YUYV/UYVY into 16 bit lanes, chroma duplicated for both pixels of a pair */
+static inline void unpack422Sse2(__m128i in, bool yFirst, __m128i &y, __m128i &u, __m128i &v)
+{
+    __m128i chroma;
+    if (yFirst == true) {
+        y = _mm_and_si128(in, _mm_set1_epi16(0x00ff));
+        chroma = _mm_srli_epi16(in, 8);
+    } else {
+        y = _mm_srli_epi16(in, 8);
+        chroma = _mm_and_si128(in, _mm_set1_epi16(0x00ff));
+    }
+    u = _mm_and_si128(chroma, _mm_set1_epi32(0x0000ffff));
+    u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+    v = _mm_srli_epi32(chroma, 16);
+    v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+}
+
+
+/** sse2 has no byte shuffle - interleaving 16 pixels is left to the scalar unit */
+static inline void storeRgbSse2(__m128i r, __m128i g, __m128i b, unsigned char *destination)
+{
+    unsigned char planes[3][16] __attribute__((aligned(16)));
+    _mm_store_si128((__m128i*) planes[0], r);
+    _mm_store_si128((__m128i*) planes[1], g);
+    _mm_store_si128((__m128i*) planes[2], b);
+
+    for (int a = 0; a < 16; ++a, destination += 3) {
+        destination[0] = planes[0][a];
+        destination[1] = planes[1][a];
+        destination[2] = planes[2][a];
+    }
+}
+
+
+static void yuv422RowSse2(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    unsigned int x = 0;
+
+    for (; x + 16 <= width; x += 16, source += 32, destination += 48) {
+        __m128i y, u, v, r0, g0, b0, r1, g1, b1;
+
+        unpack422Sse2(_mm_loadu_si128((const __m128i*) source), yFirst, y, u, v);
+        yuvToRgbSse2(y, u, v, r0, g0, b0);
+        unpack422Sse2(_mm_loadu_si128((const __m128i*) (source + 16)), yFirst, y, u, v);
+        yuvToRgbSse2(y, u, v, r1, g1, b1);
+
+        storeRgbSse2(_mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(b0, b1), destination);
+    }
+
+    yuv422RowScalar(source, destination, width - x, yFirst);
+}
+
+
+static void nv12RowSse2(const unsigned char *luma, const unsigned char *chroma, unsigned char *destination,
+        unsigned int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int x = 0;
+
+    for (; x + 16 <= width; x += 16, destination += 48) {
+        __m128i y = _mm_loadu_si128((const __m128i*) (luma + x));
+        __m128i uv = _mm_loadu_si128((const __m128i*) (chroma + x));
+        __m128i u = _mm_and_si128(uv, _mm_set1_epi16(0x00ff));
+        __m128i v = _mm_srli_epi16(uv, 8);
+        __m128i r0, g0, b0, r1, g1, b1;
+
+        yuvToRgbSse2(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v), r0, g0, b0);
+        yuvToRgbSse2(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v), r1, g1, b1);
+
+        storeRgbSse2(_mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(b0, b1), destination);
+    }
+
+    nv12RowScalar(luma + x, chroma + x, destination, width - x);
+}
+
+
+static void luma422RowSse2(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    unsigned int x = 0;
+
+    for (; x + 16 <= width; x += 16, source += 32, destination += 16) {
+        __m128i in0 = _mm_loadu_si128((const __m128i*) source);
+        __m128i in1 = _mm_loadu_si128((const __m128i*) (source + 16));
+        if (yFirst == true) {
+            in0 = _mm_and_si128(in0, _mm_set1_epi16(0x00ff));
+            in1 = _mm_and_si128(in1, _mm_set1_epi16(0x00ff));
+        } else {
+            in0 = _mm_srli_epi16(in0, 8);
+            in1 = _mm_srli_epi16(in1, 8);
+        }
+        _mm_storeu_si128((__m128i*) destination, _mm_packus_epi16(in0, in1));
+    }
+
+    luma422RowScalar(source, destination, width - x, yFirst);
+}
+
+
+static void averageRowsSse2(const unsigned char *source, unsigned int bytesPerLine, unsigned int rows,
+        unsigned char *destination, unsigned int length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16((short) (rows >> 1));
+    const __m128i shift = _mm_cvtsi32_si128(shiftOf(rows));
+    unsigned int x = 0;
+
+    /* 16 bit sums - up to 257 rows */
+    for (; x + 16 <= length; x += 16) {
+        __m128i low = round, high = round;
+        const unsigned char *in = source + x;
+
+        for (unsigned int y = 0; y < rows; ++y, in += bytesPerLine) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) in);
+            low = _mm_add_epi16(low, _mm_unpacklo_epi8(bytes, zero));
+            high = _mm_add_epi16(high, _mm_unpackhi_epi8(bytes, zero));
+        }
+
+        _mm_storeu_si128((__m128i*) (destination + x),
+                _mm_packus_epi16(_mm_srl_epi16(low, shift), _mm_srl_epi16(high, shift)));
+    }
+
+    averageRowsScalar(source + x, bytesPerLine, rows, destination + x, length - x);
+}
+
+
+/** averages the adjacent pairs of 'first', then those of 'second' */
+static inline __m128i averagePairsSse2(__m128i first, __m128i second)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+
+    first = _mm_avg_epu16(_mm_and_si128(first, low), _mm_srli_epi16(first, 8));
+    second = _mm_avg_epu16(_mm_and_si128(second, low), _mm_srli_epi16(second, 8));
+    return _mm_packus_epi16(first, second);
+}
+
+
+/* *** avx2 **************************************************************** */
+
+/** byte shuffles for interleaving three planes of 16 bytes into 48 bytes RGB: [output block][plane] */
+static const unsigned char s_interleaveMasks[3][3][16] __attribute__((aligned(16))) = {
+    {{0, 0x80, 0x80, 1, 0x80, 0x80, 2, 0x80, 0x80, 3, 0x80, 0x80, 4, 0x80, 0x80, 5},
+     {0x80, 0, 0x80, 0x80, 1, 0x80, 0x80, 2, 0x80, 0x80, 3, 0x80, 0x80, 4, 0x80, 0x80},
+     {0x80, 0x80, 0, 0x80, 0x80, 1, 0x80, 0x80, 2, 0x80, 0x80, 3, 0x80, 0x80, 4, 0x80}},
+    {{0x80, 0x80, 6, 0x80, 0x80, 7, 0x80, 0x80, 8, 0x80, 0x80, 9, 0x80, 0x80, 10, 0x80},
+     {5, 0x80, 0x80, 6, 0x80, 0x80, 7, 0x80, 0x80, 8, 0x80, 0x80, 9, 0x80, 0x80, 10},
+     {0x80, 5, 0x80, 0x80, 6, 0x80, 0x80, 7, 0x80, 0x80, 8, 0x80, 0x80, 9, 0x80, 0x80}},
+    {{0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80, 0x80},
+     {0x80, 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80},
+     {10, 0x80, 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15}}
+};
+
+
+/** byte shuffles for splitting 48 bytes RGB into three planes of 16 bytes: [input block][plane] */
+static const unsigned char s_deinterleaveMasks[3][3][16] __attribute__((aligned(16))) = {
+    {{0, 3, 6, 9, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {1, 4, 7, 10, 13, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {2, 5, 8, 11, 14, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80}},
+    {{0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 2, 5, 8, 11, 14, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 0, 3, 6, 9, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 1, 4, 7, 10, 13, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80}},
+    {{0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 1, 4, 7, 10, 13},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 2, 5, 8, 11, 14},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0, 3, 6, 9, 12, 15}}
+};
+
+
+__attribute__((target("avx2")))
+static inline void loadRgbAvx2(const unsigned char *source, __m128i &r, __m128i &g, __m128i &b)
+{
+    __m128i blocks[3], planes[3];
+    for (int block = 0; block < 3; ++block) {
+        blocks[block] = _mm_loadu_si128((const __m128i*) (source + 16 * block));
+    }
+
+    for (int plane = 0; plane < 3; ++plane) {
+        planes[plane] = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(blocks[0], _mm_load_si128((const __m128i*) s_deinterleaveMasks[0][plane])),
+                _mm_shuffle_epi8(blocks[1], _mm_load_si128((const __m128i*) s_deinterleaveMasks[1][plane]))),
+                _mm_shuffle_epi8(blocks[2], _mm_load_si128((const __m128i*) s_deinterleaveMasks[2][plane])));
+    }
+
+    r = planes[0];
+    g = planes[1];
+    b = planes[2];
+}
+
+
+__attribute__((target("avx2")))
+static inline void storeRgbAvx2(__m128i r, __m128i g, __m128i b, unsigned char *destination)
+{
+    for (int block = 0; block < 3; ++block) {
+        __m128i out = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(r, _mm_load_si128((const __m128i*) s_interleaveMasks[block][0])),
+                _mm_shuffle_epi8(g, _mm_load_si128((const __m128i*) s_interleaveMasks[block][1]))),
+                _mm_shuffle_epi8(b, _mm_load_si128((const __m128i*) s_interleaveMasks[block][2])));
+        _mm_storeu_si128((__m128i*) (destination + 16 * block), out);
+    }
+}
+
+
+/** 16 pixels in 16 bit lanes */
+__attribute__((target("avx2")))
+static inline void yuvToRgbAvx2(__m256i y, __m256i u, __m256i v, __m256i &r, __m256i &g, __m256i &b)
+{
+    const __m256i round = _mm256_set1_epi16(32);
+
+    y = _mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), _mm256_set1_epi16(74));
+    u = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+    v = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+    r = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(102))), round);
+    g = _mm256_adds_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(25))),
+            _mm256_mullo_epi16(v, _mm256_set1_epi16(52))), round);
+    b = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(129))), round);
+
+    r = _mm256_srai_epi16(r, 6);
+    g = _mm256_srai_epi16(g, 6);
+    b = _mm256_srai_epi16(b, 6);
+}
+
+
+/** packs two times 16 pixels of 16 bit lanes into 32 bytes in order and stores them as RGB */
+__attribute__((target("avx2")))
+static inline void packAndStoreRgbAvx2(__m256i r0, __m256i g0, __m256i b0, __m256i r1, __m256i g1, __m256i b1,
+        unsigned char *destination)
+{
+    /* packus works within 128 bit lanes - fix up the order afterwards */
+    __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xd8);
+    __m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xd8);
+    __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b0, b1), 0xd8);
+
+    storeRgbAvx2(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b), destination);
+    storeRgbAvx2(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1),
+            destination + 48);
+}
+
+
+__attribute__((target("avx2")))
+static inline void unpack422Avx2(__m256i in, bool yFirst, __m256i &y, __m256i &u, __m256i &v)
+{
+    __m256i chroma;
+    if (yFirst == true) {
+        y = _mm256_and_si256(in, _mm256_set1_epi16(0x00ff));
+        chroma = _mm256_srli_epi16(in, 8);
+    } else {
+        y = _mm256_srli_epi16(in, 8);
+        chroma = _mm256_and_si256(in, _mm256_set1_epi16(0x00ff));
+    }
+    u = _mm256_and_si256(chroma, _mm256_set1_epi32(0x0000ffff));
+    u = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+    v = _mm256_srli_epi32(chroma, 16);
+    v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+}
+
+
+__attribute__((target("avx2")))
+static void yuv422RowAvx2(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    unsigned int x = 0;
+
+    for (; x + 32 <= width; x += 32, source += 64, destination += 96) {
+        __m256i y, u, v, r0, g0, b0, r1, g1, b1;
+
+        unpack422Avx2(_mm256_loadu_si256((const __m256i*) source), yFirst, y, u, v);
+        yuvToRgbAvx2(y, u, v, r0, g0, b0);
+        unpack422Avx2(_mm256_loadu_si256((const __m256i*) (source + 32)), yFirst, y, u, v);
+        yuvToRgbAvx2(y, u, v, r1, g1, b1);
+
+        packAndStoreRgbAvx2(r0, g0, b0, r1, g1, b1, destination);
+    }
+
+    yuv422RowSse2(source, destination, width - x, yFirst);
+}
+
+
+/** duplicates 8 chroma samples of 8 UV pairs for 16 pixels */
+__attribute__((target("avx2")))
+static inline void unpackNv12ChromaAvx2(const unsigned char *chroma, __m256i &u, __m256i &v)
+{
+    __m128i uv = _mm_loadu_si128((const __m128i*) chroma);
+    __m128i u8 = _mm_and_si128(uv, _mm_set1_epi16(0x00ff));
+    __m128i v8 = _mm_srli_epi16(uv, 8);
+
+    u = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(u8, u8)), _mm_unpackhi_epi16(u8, u8), 1);
+    v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(v8, v8)), _mm_unpackhi_epi16(v8, v8), 1);
+}
+
+
+__attribute__((target("avx2")))
+static void nv12RowAvx2(const unsigned char *luma, const unsigned char *chroma, unsigned char *destination,
+        unsigned int width)
+{
+    unsigned int x = 0;
+
+    for (; x + 32 <= width; x += 32, destination += 96) {
+        __m256i u, v, r0, g0, b0, r1, g1, b1;
+
+        unpackNv12ChromaAvx2(chroma + x, u, v);
+        yuvToRgbAvx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (luma + x))), u, v, r0, g0, b0);
+        unpackNv12ChromaAvx2(chroma + x + 16, u, v);
+        yuvToRgbAvx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (luma + x + 16))), u, v, r1, g1, b1);
+
+        packAndStoreRgbAvx2(r0, g0, b0, r1, g1, b1, destination);
+    }
+
+    nv12RowSse2(luma + x, chroma + x, destination, width - x);
+}
+
+
+__attribute__((target("avx2")))
+static void luma422RowAvx2(const unsigned char *source, unsigned char *destination, unsigned int width,
+        bool yFirst)
+{
+    unsigned int x = 0;
+
+    for (; x + 32 <= width; x += 32, source += 64, destination += 32) {
+        __m256i in0 = _mm256_loadu_si256((const __m256i*) source);
+        __m256i in1 = _mm256_loadu_si256((const __m256i*) (source + 32));
+        if (yFirst == true) {
+            in0 = _mm256_and_si256(in0, _mm256_set1_epi16(0x00ff));
+            in1 = _mm256_and_si256(in1, _mm256_set1_epi16(0x00ff));
+        } else {
+            in0 = _mm256_srli_epi16(in0, 8);
+            in1 = _mm256_srli_epi16(in1, 8);
+        }
+        _mm256_storeu_si256((__m256i*) destination,
+                _mm256_permute4x64_epi64(_mm256_packus_epi16(in0, in1), 0xd8));
+    }
+
+    luma422RowSse2(source, destination, width - x, yFirst);
+}
+
+
+__attribute__((target("avx2")))
+static void averageRowsAvx2(const unsigned char *source, unsigned int bytesPerLine, unsigned int rows,
+        unsigned char *destination, unsigned int length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi16((short) (rows >> 1));
+    const __m128i shift = _mm_cvtsi32_si128(shiftOf(rows));
+    unsigned int x = 0;
+
+    /* unpacking and packing within the 128 bit lanes keeps the order */
+    for (; x + 32 <= length; x += 32) {
+        __m256i low = round, high = round;
+        const unsigned char *in = source + x;
+
+        for (unsigned int y = 0; y < rows; ++y, in += bytesPerLine) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*) in);
+            low = _mm256_add_epi16(low, _mm256_unpacklo_epi8(bytes, zero));
+            high = _mm256_add_epi16(high, _mm256_unpackhi_epi8(bytes, zero));
+        }
+
+        _mm256_storeu_si256((__m256i*) (destination + x),
+                _mm256_packus_epi16(_mm256_srl_epi16(low, shift), _mm256_srl_epi16(high, shift)));
+    }
+
+    averageRowsSse2(source + x, bytesPerLine, rows, destination + x, length - x);
+}
+
+
+__attribute__((target("avx2")))
+static void halveRgbRowAvx2(const unsigned char *source, unsigned char *destination, unsigned int width)
+{
+    unsigned int x = 0;
+
+    /* 32 pixels in, 16 out - all loaded before anything is stored, for working in place */
+    for (; x + 16 <= width; x += 16, source += 96, destination += 48) {
+        __m128i r0, g0, b0, r1, g1, b1;
+        loadRgbAvx2(source, r0, g0, b0);
+        loadRgbAvx2(source + 48, r1, g1, b1);
+
+        storeRgbAvx2(averagePairsSse2(r0, r1), averagePairsSse2(g0, g1), averagePairsSse2(b0, b1), destination);
+    }
+
+    halveRgbRowScalar(source, destination, width - x);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+/* *** PixelConversion ***************************************************** */
+bool PixelConversion::isSupported(__u32 pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+bool PixelConversion::convertToRgb888(__u32 pixelFormat, const unsigned char *source,
+        unsigned int sourceBytesPerLine, unsigned int width, unsigned int height,
+        unsigned char *destination, unsigned int destinationBytesPerLine)
+{
+    VT
+
+    const RowFunctions &functions = rowFunctions();
+
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24:
+        for (unsigned int y = 0; y < height; ++y) {
+            memcpy(destination + y * destinationBytesPerLine, source + y * sourceBytesPerLine, width * 3);
+        }
+        return true;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        for (unsigned int y = 0; y < height; ++y) {
+            functions.yuv422(source + y * sourceBytesPerLine, destination + y * destinationBytesPerLine, width,
+                    pixelFormat == V4L2_PIX_FMT_YUYV);
+        }
+        return true;
+    case V4L2_PIX_FMT_NV12: {
+        const unsigned char *chroma = source + height * sourceBytesPerLine;
+        for (unsigned int y = 0; y < height; ++y) {
+            functions.nv12(source + y * sourceBytesPerLine, chroma + (y / 2) * sourceBytesPerLine,
+                    destination + y * destinationBytesPerLine, width);
+        }
+        return true; }
+    case V4L2_PIX_FMT_GREY:
+        for (unsigned int y = 0; y < height; ++y) {
+            greyRowScalar(source + y * sourceBytesPerLine, destination + y * destinationBytesPerLine, width);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+const unsigned char *PixelConversion::lumaPlane(__u32 pixelFormat, const unsigned char *source)
+{
+    if (pixelFormat == V4L2_PIX_FMT_GREY || pixelFormat == V4L2_PIX_FMT_NV12) {
+        return source;
+    }
+    return 0;
+}
+
+
+bool PixelConversion::extractLuma(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+        unsigned int width, unsigned int height,
+        unsigned char *destination, unsigned int destinationBytesPerLine)
+{
+    VT
+
+    const RowFunctions &functions = rowFunctions();
+
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        for (unsigned int y = 0; y < height; ++y) {
+            functions.luma422(source + y * sourceBytesPerLine, destination + y * destinationBytesPerLine, width,
+                    pixelFormat == V4L2_PIX_FMT_YUYV);
+        }
+        return true;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY:
+        for (unsigned int y = 0; y < height; ++y) {
+            memcpy(destination + y * destinationBytesPerLine, source + y * sourceBytesPerLine, width);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+bool PixelConversion::copyRegion(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+        unsigned int sourceHeight, unsigned int left, unsigned int top, unsigned int width, unsigned int height,
+        unsigned int factor, bool average, unsigned char *destination, unsigned int destinationBytesPerLine)
+{
+    VT
+
+    assert(factor == 1 || factor == 2 || factor == 4);
+
+    unsigned int bytesPerPixel;
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24: bytesPerPixel = 3; break;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY: bytesPerPixel = 2; break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY: bytesPerPixel = 1; break;
+    default: return false;
+    }
+
+    const unsigned char *region = source + top * sourceBytesPerLine + left * bytesPerPixel;
+    unsigned int columns = width / factor;
+    unsigned int rows = height / factor;
+
+    /* a plain copy of the rows */
+    if (factor == 1) {
+        for (unsigned int y = 0; y < rows; ++y) {
+            memcpy(destination + y * destinationBytesPerLine, region + y * sourceBytesPerLine, width * bytesPerPixel);
+        }
+    }
+
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24:
+        if (factor == 1) break;
+        for (unsigned int c = 0; c < 3; ++c) {
+            reduceChannel(region + c, sourceBytesPerLine, destination + c, destinationBytesPerLine, columns, rows, 3,
+                    factor, average);
+        }
+        break;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY: {
+        if (factor == 1) break;
+        /* Y every 2nd byte, U and V every 4th */
+        unsigned int lumaOffset = pixelFormat == V4L2_PIX_FMT_YUYV ? 0 : 1;
+        unsigned int chromaOffset = pixelFormat == V4L2_PIX_FMT_YUYV ? 1 : 0;
+        reduceChannel(region + lumaOffset, sourceBytesPerLine, destination + lumaOffset, destinationBytesPerLine,
+                columns, rows, 2, factor, average);
+        for (unsigned int c = 0; c < 2; ++c) {
+            reduceChannel(region + chromaOffset + 2 * c, sourceBytesPerLine, destination + chromaOffset + 2 * c,
+                    destinationBytesPerLine, columns / 2, rows, 4, factor, average);
+        }
+        break; }
+    case V4L2_PIX_FMT_NV12: {
+        if (factor > 1) {
+            reduceChannel(region, sourceBytesPerLine, destination, destinationBytesPerLine, columns, rows, 1, factor,
+                    average);
+        }
+        /* interleaved UV at half the resolution in both directions */
+        const unsigned char *chroma = source + sourceHeight * sourceBytesPerLine + (top / 2) * sourceBytesPerLine +
+                left;
+        unsigned char *destinationChroma = destination + rows * destinationBytesPerLine;
+        if (factor == 1) {
+            for (unsigned int y = 0; y < rows / 2; ++y) {
+                memcpy(destinationChroma + y * destinationBytesPerLine, chroma + y * sourceBytesPerLine, width);
+            }
+            break;
+        }
+        for (unsigned int c = 0; c < 2; ++c) {
+            reduceChannel(chroma + c, sourceBytesPerLine, destinationChroma + c, destinationBytesPerLine,
+                    columns / 2, rows / 2, 2, factor, average);
+        }
+        break; }
+    case V4L2_PIX_FMT_GREY:
+        if (factor == 1) break;
+        reduceChannel(region, sourceBytesPerLine, destination, destinationBytesPerLine, columns, rows, 1, factor,
+                average);
+        break;
+    }
+
+    return true;
+}
+
+
+bool PixelConversion::downscaleToRgb888(__u32 pixelFormat, const unsigned char *source,
+        unsigned int sourceBytesPerLine, unsigned int width, unsigned int height, unsigned int factor,
+        unsigned char *destination, unsigned int destinationBytesPerLine)
+{
+    VT
+
+    assert(factor >= 1 && factor <= 16 && (factor & (factor - 1)) == 0);
+
+    if (isSupported(pixelFormat) == false) return false;
+    if (factor == 1) {
+        return convertToRgb888(pixelFormat, source, sourceBytesPerLine, width, height, destination,
+                destinationBytesPerLine);
+    }
+
+    const RowFunctions &functions = rowFunctions();
+    unsigned int columns = width / factor;
+    unsigned int rows = height / factor;
+    /* the source pixels of a row, which are averaged */
+    unsigned int used = columns * factor;
+
+    /* factor rows averaged into one - in the source format, the chroma of NV12 behind the luma - and converted */
+    vector<unsigned char> averaged(used * 2);
+    vector<unsigned char> rgb(used * 3);
+
+    for (unsigned int y = 0; y < rows; ++y) {
+        const unsigned char *in = source + y * factor * sourceBytesPerLine;
+
+        switch (pixelFormat) {
+        case V4L2_PIX_FMT_RGB24:
+            functions.averageRows(in, sourceBytesPerLine, factor, &rgb[0], used * 3);
+            break;
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+            functions.averageRows(in, sourceBytesPerLine, factor, &averaged[0], used * 2);
+            functions.yuv422(&averaged[0], &rgb[0], used, pixelFormat == V4L2_PIX_FMT_YUYV);
+            break;
+        case V4L2_PIX_FMT_NV12: {
+            /* a chroma row per two luma rows */
+            const unsigned char *chroma = source + height * sourceBytesPerLine + (y * factor / 2) * sourceBytesPerLine;
+            functions.averageRows(in, sourceBytesPerLine, factor, &averaged[0], used);
+            functions.averageRows(chroma, sourceBytesPerLine, factor / 2, &averaged[used], used);
+            functions.nv12(&averaged[0], &averaged[used], &rgb[0], used);
+            break; }
+        case V4L2_PIX_FMT_GREY:
+            functions.averageRows(in, sourceBytesPerLine, factor, &averaged[0], used);
+            greyRowScalar(&averaged[0], &rgb[0], used);
+            break;
+        }
+
+        /* then horizontally, halving at a time */
+        unsigned int rgbWidth = used;
+        for (; rgbWidth > 2 * columns; rgbWidth /= 2) {
+            functions.halveRgb(&rgb[0], &rgb[0], rgbWidth / 2);
+        }
+        functions.halveRgb(&rgb[0], destination + y * destinationBytesPerLine, columns);
+    }
+
+    return true;
+}
+
+
+void PixelConversion::regionGranularity(__u32 pixelFormat, unsigned int factor, unsigned int *horizontal,
+        unsigned int *vertical)
+{
+    /* whole macro pixels (YUYV, UYVY) and chroma samples (NV12) - in the reduced frame, too */
+    bool evenColumns = pixelFormat == V4L2_PIX_FMT_YUYV || pixelFormat == V4L2_PIX_FMT_UYVY ||
+            pixelFormat == V4L2_PIX_FMT_NV12;
+    bool evenRows = pixelFormat == V4L2_PIX_FMT_NV12;
+
+    *horizontal = evenColumns == true ? 2 * factor : factor;
+    *vertical = evenRows == true ? 2 * factor : factor;
+}
+
+
+const char *PixelConversion::implementation()
+{
+    return rowFunctions().name;
+}
+
+
+void PixelConversion::setForceScalar(bool force)
+{
+    s_forceScalar = force;
+}
+
+
+/* *** local *************************************************************** */
+const RowFunctions &rowFunctions()
+{
+    static const RowFunctions scalar = { yuv422RowScalar, nv12RowScalar, luma422RowScalar, averageRowsScalar,
+            halveRgbRowScalar, "scalar" };
+
+#ifdef HAVE_X86_SIMD
+    /* sse2 has no byte shuffle to split RGB into planes */
+    static const RowFunctions sse2 = { yuv422RowSse2, nv12RowSse2, luma422RowSse2, averageRowsSse2,
+            halveRgbRowScalar, "sse2" };
+    static const RowFunctions avx2 = { yuv422RowAvx2, nv12RowAvx2, luma422RowAvx2, averageRowsAvx2,
+            halveRgbRowAvx2, "avx2" };
+    /* determined once */
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+
+    if (s_forceScalar == true) return scalar;
+    return hasAvx2 == true ? avx2 : sse2;
+#else
+    return scalar;
+#endif
+}
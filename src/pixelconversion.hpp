@@ -0,0 +1,90 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PIXEL_CONVERSION_HPP
+#define PIXEL_CONVERSION_HPP
+
+#include "prereqs.hpp"
+
+#include <linux/videodev2.h>
+
+
+/**
+ * converts frames captured in the device's native format into RGB888
+ *
+ * The SSE2 or AVX2 implementation is chosen at runtime, depending on what the cpu supports.
+ * YUV is interpreted as ITU-R BT.601 with limited range.
+ *
+ * supported formats: V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12,
+ * V4L2_PIX_FMT_GREY
+ */
+class PixelConversion
+{
+public:
+
+    PixelConversion() = delete;
+
+    static bool isSupported(__u32 pixelFormat);
+
+    /** @returns false if the format is not supported */
+    static bool convertToRgb888(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+            unsigned int width, unsigned int height,
+            unsigned char *destination, unsigned int destinationBytesPerLine);
+
+    /** @returns the frame's 8 bit luma plane, if the format has one (GREY, NV12). 0 otherwise
+        @note rows are sourceBytesPerLine apart - no conversion needed at all */
+    static const unsigned char *lumaPlane(__u32 pixelFormat, const unsigned char *source);
+
+    /** extracts 8 bit luma (YUYV, UYVY) or copies the luma plane (GREY, NV12)
+        @returns false if the format is not supported */
+    static bool extractLuma(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+            unsigned int width, unsigned int height,
+            unsigned char *destination, unsigned int destinationBytesPerLine);
+
+    /** area-averages the frame down by 'factor' in both directions into RGB888: factor rows at a time in the
+        source format, then the converted row factor pixels at a time. Only 1 / factor of the rows is converted.
+        The destination is width / factor x height / factor, left over columns and rows are left out
+        @pre factor is a power of 2, at most 16
+        @returns false if the format is not supported */
+    static bool downscaleToRgb888(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+            unsigned int width, unsigned int height, unsigned int factor,
+            unsigned char *destination, unsigned int destinationBytesPerLine);
+
+    /** copies the region left, top, width x height of the frame, reduced by 'factor' in both directions - each
+        pixel is the mean of factor x factor pixels (binning) or the top left one of them (decimation).
+        The destination is width / factor x height / factor, the chroma plane of NV12 follows its luma rows
+        @param sourceHeight of the whole frame, locates the chroma plane of NV12
+        @pre the region lies within the frame and is aligned to regionGranularity(). factor is 1, 2 or 4
+        @returns false if the format is not supported */
+    static bool copyRegion(__u32 pixelFormat, const unsigned char *source, unsigned int sourceBytesPerLine,
+            unsigned int sourceHeight, unsigned int left, unsigned int top, unsigned int width, unsigned int height,
+            unsigned int factor, bool average, unsigned char *destination, unsigned int destinationBytesPerLine);
+    /** the columns and rows regions of copyRegion() start at and span are multiples of these - chroma
+        subsampled formats cannot be cut anywhere */
+    static void regionGranularity(__u32 pixelFormat, unsigned int factor, unsigned int *horizontal,
+            unsigned int *vertical);
+
+    /** @returns "avx2", "sse2" or "scalar" */
+    static const char *implementation();
+
+    /** forces the scalar implementation, for comparisons */
+    static void setForceScalar(bool force);
+};
+
+
+#endif /* PIXEL_CONVERSION_HPP */
@@ -0,0 +1,336 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "previewstream.hpp"
+
+#include "pixelconversion.hpp"
+#include "threadscheduling.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static void addNanoseconds(timespec *time, long nanoseconds);
+static double secondsBetween(const timespec &start, const timespec &end);
+
+
+PreviewStream::PreviewStream() :
+        m_maximumWidth(640),
+        m_maximumHeight(480),
+        m_framesPerSecond(30.0),
+        m_ring(0),
+        m_notifier(0),
+        m_pixelFormat(0),
+        m_width(0),
+        m_height(0),
+        m_bytesPerLine(0),
+        m_factor(1),
+        m_previewWidth(0),
+        m_previewHeight(0),
+        m_previewBytesPerLine(0),
+        m_notificationFileDescriptor(-1),
+        m_previewThread(0),
+        m_cancellationFlag(false),
+        m_lastSerial(0),
+        m_frames(0),
+        m_totalSeconds(0.0),
+        m_maximumSeconds(0.0)
+{
+}
+
+
+PreviewStream::~PreviewStream()
+{
+    stop();
+    clearRing();
+}
+
+
+void PreviewStream::setMaximumSize(unsigned int width, unsigned int height)
+{
+    assert(width > 0);
+    assert(height > 0);
+
+    m_maximumWidth = width;
+    m_maximumHeight = height;
+}
+pair<unsigned int, unsigned int> PreviewStream::maximumSize() const
+{
+    return make_pair(m_maximumWidth, m_maximumHeight);
+}
+
+
+void PreviewStream::setFramesPerSecond(double framesPerSecond)
+{
+    assert(isRunning() == false);
+    assert(framesPerSecond > 0.0);
+    m_framesPerSecond = framesPerSecond;
+}
+double PreviewStream::framesPerSecond() const
+{
+    return m_framesPerSecond;
+}
+
+
+bool PreviewStream::setRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+        unsigned int height, unsigned int bytesPerLine)
+{
+    assert(isRunning() == false);
+
+    clearRing();
+    if (PixelConversion::isSupported(pixelFormat) == false) return false;
+
+    m_ring = ring;
+    m_notifier = notifier;
+    m_pixelFormat = pixelFormat;
+    m_width = width;
+    m_height = height;
+    m_bytesPerLine = bytesPerLine;
+
+    /* the smallest power of 2, the preview fits with */
+    m_factor = 1;
+    while (m_factor < 16 && (width / m_factor > m_maximumWidth || height / m_factor > m_maximumHeight)) {
+        m_factor *= 2;
+    }
+    m_previewWidth = width / m_factor;
+    m_previewHeight = height / m_factor;
+    m_previewBytesPerLine = FrameArena::alignedRowLength(m_previewWidth * 3);
+
+    /* a frame per viewer, the newest and the one being written */
+    m_previewRing.resize(4);
+    if (m_previewArena.allocate(m_previewRing.size(), m_previewBytesPerLine * m_previewHeight) == false) {
+        m_previewRing.resize(0);
+        m_ring = 0;
+        return false;
+    }
+
+    for (unsigned int a = 0; a < m_previewRing.size(); ++a) {
+        FrameRing::Buffer &buffer = m_previewRing.buffer(a);
+
+        buffer.buffer = m_previewArena.frame(a);
+        buffer.length = m_previewBytesPerLine * m_previewHeight;
+    }
+
+    return true;
+}
+
+
+void PreviewStream::clearRing()
+{
+    assert(isRunning() == false);
+
+    /* a reader unlocking later would write to freed memory */
+    for (unsigned int a = 0; a < m_previewRing.size(); ++a) {
+        assert(m_previewRing.buffer(a).readerCount.load(memory_order_relaxed) == 0);
+    }
+
+    m_previewRing.resize(0);
+    m_previewArena.release();
+    m_ring = 0;
+    m_notifier = 0;
+    m_previewWidth = 0;
+    m_previewHeight = 0;
+}
+
+
+pair<unsigned int, unsigned int> PreviewStream::size() const
+{
+    return make_pair(m_previewWidth, m_previewHeight);
+}
+
+
+unsigned int PreviewStream::factor() const
+{
+    return m_factor;
+}
+
+
+bool PreviewStream::start()
+{
+    assert(isRunning() == false);
+    assert(m_ring != 0);
+
+    m_notificationFileDescriptor = FrameNotifier::createFileDescriptor();
+    if (m_notificationFileDescriptor == -1) return false;
+
+    m_statisticsMutex.lock();
+    m_frames = 0;
+    m_totalSeconds = 0.0;
+    m_maximumSeconds = 0.0;
+    m_statisticsMutex.unlock();
+
+    m_lastSerial = 0;
+    m_notifier->addFileDescriptor(m_notificationFileDescriptor);
+
+    m_cancellationFlag = false;
+    m_previewThread = new thread(bind(previewThread, this));
+
+    return true;
+}
+
+
+void PreviewStream::stop()
+{
+    if (m_previewThread != 0) {
+        m_cancellationFlag = true;
+        m_previewThread->join();
+        delete m_previewThread;
+        m_previewThread = 0;
+    }
+
+    if (m_notificationFileDescriptor != -1) {
+        m_notifier->removeFileDescriptor(m_notificationFileDescriptor);
+        close(m_notificationFileDescriptor);
+        m_notificationFileDescriptor = -1;
+    }
+}
+
+
+bool PreviewStream::isRunning() const
+{
+    return m_previewThread != 0;
+}
+
+
+FrameRef PreviewStream::lockNewestFrame()
+{
+    const FrameRing::Buffer *buffer = m_previewRing.lockNewest();
+    if (buffer == 0) return FrameRef();
+
+    return FrameRef(buffer, V4L2_PIX_FMT_RGB24, m_previewWidth, m_previewHeight, m_previewBytesPerLine);
+}
+
+
+unsigned long long PreviewStream::newestSerial() const
+{
+    return m_previewRing.latestSerial();
+}
+
+
+void PreviewStream::addNotificationFileDescriptor(int fileDescriptor)
+{
+    m_previewNotifier.addFileDescriptor(fileDescriptor);
+}
+
+
+void PreviewStream::removeNotificationFileDescriptor(int fileDescriptor)
+{
+    m_previewNotifier.removeFileDescriptor(fileDescriptor);
+}
+
+
+PreviewStream::Statistics PreviewStream::statistics() const
+{
+    Statistics ret;
+
+    lock_guard<mutex> lock(m_statisticsMutex);
+
+    ret.frames = m_frames;
+    ret.meanMilliseconds = m_frames > 0 ? m_totalSeconds / m_frames * 1000.0 : 0.0;
+    ret.maximumMilliseconds = m_maximumSeconds * 1000.0;
+
+    return ret;
+}
+
+
+void PreviewStream::previewThread(PreviewStream *preview)
+{
+    /* only the cpu time nobody else wants */
+    ThreadScheduling idle;
+    idle.setPolicy(ThreadScheduling::PolicyIdle);
+    idle.apply(pthread_self());
+
+    long interval = (long) (1000000000.0 / preview->m_framesPerSecond);
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (preview->m_cancellationFlag.load() == false) {
+        /* the timeout only checks the cancellation flag */
+        FrameNotifier::waitForFileDescriptor(preview->m_notificationFileDescriptor, 100);
+        if (preview->m_ring->latestSerial() <= preview->m_lastSerial) continue;
+
+        /* not more often than displayed - the frames captured meanwhile are skipped */
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+        preview->downscaleNewest();
+
+        /* a late frame does not make the next ones early */
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        addNanoseconds(&next, interval);
+        if (secondsBetween(now, next) < 0.0) next = now;
+    }
+}
+
+
+void PreviewStream::downscaleNewest()
+{
+    const FrameRing::Buffer *buffer = m_ring->lockNewest();
+    if (buffer == 0) return;
+    m_lastSerial = buffer->serial;
+
+    /* viewers hold a frame each at most - else the newest one, which nobody locked yet, is replaced */
+    FrameRing::Buffer *preview = m_previewRing.lockForWriting(true);
+    if (preview == 0) {
+        FrameRing::unlock(buffer);
+        return;
+    }
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    PixelConversion::downscaleToRgb888(m_pixelFormat, buffer->buffer, m_bytesPerLine, m_width, m_height, m_factor,
+            preview->buffer, m_previewBytesPerLine);
+    preview->time = buffer->time;
+    preview->sequence = buffer->sequence;
+    preview->bytesUsed = preview->length;
+    FrameRing::unlock(buffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    m_previewRing.publish(preview);
+    m_previewNotifier.notify(preview->serial);
+
+    double seconds = secondsBetween(start, end);
+    lock_guard<mutex> lock(m_statisticsMutex);
+    ++m_frames;
+    m_totalSeconds += seconds;
+    m_maximumSeconds = max(m_maximumSeconds, seconds);
+}
+
+
+/* *** local *************************************************************** */
+void addNanoseconds(timespec *time, long nanoseconds)
+{
+    time->tv_nsec += nanoseconds;
+    time->tv_sec += time->tv_nsec / 1000000000;
+    time->tv_nsec %= 1000000000;
+}
+
+
+double secondsBetween(const timespec &start, const timespec &end)
+{
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
@@ -0,0 +1,148 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PREVIEW_STREAM_HPP
+#define PREVIEW_STREAM_HPP
+
+#include "prereqs.hpp"
+
+#include "framearena.hpp"
+#include "framenotifier.hpp"
+#include "frameref.hpp"
+#include "framering.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+#include <linux/types.h>
+
+namespace std
+{
+    class thread;
+};
+
+
+/**
+ * a small RGB888 copy of a ring's frames at display rate - the second stream of a device, for showing it
+ *
+ * A thread of its own takes the newest frame of the ring at most framesPerSecond() times a second and
+ * area-averages it down by a power of 2 into a ring of its own (see PixelConversion::downscaleToRgb888()).
+ * The frame is reduced once for all viewers, which lock the preview frames like the device's.
+ *
+ * The thread runs with SCHED_IDLE - it only gets cpu time the capture and processing threads leave. It locks
+ * one frame of the ring for reading at a time, give the ring a buffer for it.
+ */
+class PreviewStream
+{
+public:
+
+    struct Statistics
+    {
+        unsigned long long frames;
+        /** spent downscaling one frame, mean and maximum */
+        double meanMilliseconds;
+        double maximumMilliseconds;
+    };
+
+
+    PreviewStream();
+    PreviewStream(const PreviewStream&) = delete;
+    PreviewStream(PreviewStream&&) = delete;
+    ~PreviewStream();
+    PreviewStream &operator=(const PreviewStream&) = delete;
+    PreviewStream &operator=(PreviewStream&&) = delete;
+
+    /** the preview fits into this. Default: 640x480
+        @note takes effect at the next setRing() */
+    void setMaximumSize(unsigned int width, unsigned int height);
+    std::pair<unsigned int, unsigned int> maximumSize() const;
+
+    /** Default: 30
+        @pre not running */
+    void setFramesPerSecond(double framesPerSecond);
+    double framesPerSecond() const;
+
+    /** allocates the preview frames for the ring's geometry. Ring and notifier outlive the preview
+        @pre not running
+        @returns false, if the format is not supported or out of memory */
+    bool setRing(FrameRing *ring, FrameNotifier *notifier, __u32 pixelFormat, unsigned int width,
+            unsigned int height, unsigned int bytesPerLine);
+    /** releases the preview frames
+        @pre not running, no preview frame locked */
+    void clearRing();
+
+    /** of the preview frames. 0x0 without ring */
+    std::pair<unsigned int, unsigned int> size() const;
+    /** the frames are reduced by */
+    unsigned int factor() const;
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+
+    /** the newest preview frame, RGB888. Null if none */
+    FrameRef lockNewestFrame();
+    unsigned long long newestSerial() const;
+    void addNotificationFileDescriptor(int fileDescriptor);
+    void removeNotificationFileDescriptor(int fileDescriptor);
+
+    /** can be called any time */
+    Statistics statistics() const;
+
+private:
+
+    static void previewThread(PreviewStream *preview);
+
+    /** downscales the ring's newest frame into the preview ring */
+    void downscaleNewest();
+
+    unsigned int m_maximumWidth;
+    unsigned int m_maximumHeight;
+    double m_framesPerSecond;
+
+    FrameRing *m_ring;
+    FrameNotifier *m_notifier;
+    __u32 m_pixelFormat;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_bytesPerLine;
+
+    unsigned int m_factor;
+    unsigned int m_previewWidth;
+    unsigned int m_previewHeight;
+    unsigned int m_previewBytesPerLine;
+    FrameRing m_previewRing;
+    FrameArena m_previewArena;
+    FrameNotifier m_previewNotifier;
+
+    int m_notificationFileDescriptor;
+    std::thread *m_previewThread;
+    std::atomic<bool> m_cancellationFlag;
+
+    /* preview thread only */
+    unsigned long long m_lastSerial;
+
+    mutable std::mutex m_statisticsMutex;
+    unsigned long long m_frames;
+    double m_totalSeconds;
+    double m_maximumSeconds;
+};
+
+
+#endif /* PREVIEW_STREAM_HPP */
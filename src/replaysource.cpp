@@ -0,0 +1,446 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "replaysource.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+static long long now();
+static string fourcc(__u32 pixelFormat);
+
+
+ReplaySource::ReplaySource(const string &fileName) :
+        m_fileName(fileName),
+        m_timing(TimingOriginal),
+        m_framesPerSecond(0.0),
+        m_looping(false),
+        m_pixelFormat(0),
+        m_width(0),
+        m_height(0),
+        m_bytesPerLine(0),
+        m_fileDescriptor(-1),
+        m_playing(false),
+        m_position(0),
+        m_nextSequence(0),
+        m_baseTime(0),
+        m_baseFrameTime(0),
+        m_seekRequest(-1)
+{
+}
+
+
+ReplaySource::~ReplaySource()
+{
+    close();
+}
+
+
+const string &ReplaySource::fileName() const
+{
+    return m_fileName;
+}
+
+
+void ReplaySource::setTiming(Timing timing, double framesPerSecond)
+{
+    assert(m_fileDescriptor == -1);
+    assert(timing != TimingFixedRate || framesPerSecond > 0.0);
+
+    m_timing = timing;
+    m_framesPerSecond = framesPerSecond;
+}
+
+
+ReplaySource::Timing ReplaySource::timing() const
+{
+    return m_timing;
+}
+
+
+double ReplaySource::framesPerSecond() const
+{
+    return m_framesPerSecond;
+}
+
+
+void ReplaySource::setLooping(bool looping)
+{
+    m_looping = looping;
+}
+
+
+bool ReplaySource::isLooping() const
+{
+    return m_looping;
+}
+
+
+unsigned int ReplaySource::frameCount() const
+{
+    assert(m_fileDescriptor != -1);
+    return m_container.frameCount();
+}
+
+
+void ReplaySource::seek(unsigned int frame)
+{
+    assert(m_fileDescriptor != -1);
+    assert(frame < m_container.frameCount());
+
+    m_seekRequest = frame;
+
+    /* due right away - the capturing thread takes the request with the next frame */
+    if (m_timing == TimingFastest) {
+        eventfd_write(m_fileDescriptor, 1);
+    } else {
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(itimerspec));
+        timer.it_value.tv_nsec = 1;
+        if (m_timing == TimingFixedRate) {
+            long long interval = (long long) (1000000000.0 / m_framesPerSecond);
+            timer.it_interval.tv_sec = interval / 1000000000;
+            timer.it_interval.tv_nsec = interval % 1000000000;
+        }
+        timerfd_settime(m_fileDescriptor, 0, &timer, 0);
+    }
+}
+
+
+string ReplaySource::name() const
+{
+    ostringstream ret;
+    ret << "replay " << m_fileName << ", " << m_container.frameCount() << " frames " << m_width << "x" << m_height
+            << " " << fourcc(m_pixelFormat) << " @ ";
+    switch (m_timing) {
+    case TimingFastest: ret << "max fps"; break;
+    case TimingFixedRate: ret << m_framesPerSecond << " fps"; break;
+    default: ret << "original timing"; break;
+    }
+    if (m_looping == true) ret << ", looping";
+    if (m_container.hadIndex() == false) ret << ", index rebuilt";
+    return ret.str();
+}
+
+
+size_t ReplaySource::open(unsigned int *width, unsigned int *height, __u32 *pixelFormat, unsigned int *bytesPerLine)
+{
+    assert(m_fileDescriptor == -1);
+
+    if (m_container.open(m_fileName) == false) return 0;
+
+    if (m_container.frameCount() == 0) {
+        cerr << "\"" << m_fileName << "\" has no frames." << endl;
+        m_container.close();
+        return 0;
+    }
+
+    const FrameContainer::IndexEntry &first = m_container.entry(0);
+    m_pixelFormat = first.pixelFormat;
+    m_width = first.width;
+    m_height = first.height;
+    m_bytesPerLine = first.bytesPerLine;
+
+    /* compressed frames vary */
+    size_t ret = 0;
+    for (unsigned int a = 0; a < m_container.frameCount(); a = nextPlayable(a + 1)) {
+        if (m_container.entry(a).bytesUsed > ret) ret = m_container.entry(a).bytesUsed;
+    }
+
+    if (m_timing == TimingFastest) {
+        /* stays readable until the end */
+        m_fileDescriptor = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    } else {
+        m_fileDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    if (m_fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " Cannot create descriptor. " << errno << " " << strerror(errno) << endl;
+        m_container.close();
+        return 0;
+    }
+
+    m_position = 0;
+    m_seekRequest = -1;
+
+    *width = m_width;
+    *height = m_height;
+    *pixelFormat = m_pixelFormat;
+    *bytesPerLine = m_bytesPerLine;
+
+    return ret;
+}
+
+
+void ReplaySource::close()
+{
+    if (m_fileDescriptor == -1) return;
+
+    ::close(m_fileDescriptor);
+    m_fileDescriptor = -1;
+    m_playing = false;
+
+    m_container.close();
+}
+
+
+int ReplaySource::fileDescriptor() const
+{
+    return m_fileDescriptor;
+}
+
+
+bool ReplaySource::start()
+{
+    assert(m_fileDescriptor != -1);
+
+    m_nextSequence = 0;
+    m_playing = true;
+
+    long long seekRequest = m_seekRequest.exchange(-1);
+    if (seekRequest != -1) m_position = (unsigned int) seekRequest;
+    m_position = nextPlayable(m_position);
+    if (m_position == m_container.frameCount() && m_looping == true) m_position = nextPlayable(0);
+
+    rebase();
+
+    if (m_timing == TimingFastest) {
+        if (eventfd_write(m_fileDescriptor, 1) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " eventfd_write " << errno << " " << strerror(errno) << endl;
+            return false;
+        }
+        return true;
+    }
+
+    return armTimer();
+}
+
+
+void ReplaySource::stop()
+{
+    m_playing = false;
+
+    if (m_timing != TimingFastest && m_fileDescriptor != -1) {
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(itimerspec));
+        timerfd_settime(m_fileDescriptor, 0, &timer, 0);
+    }
+}
+
+
+size_t ReplaySource::readFrame(unsigned char *data, size_t length, timespec *time, unsigned int *sequence)
+{
+    const unsigned char *frame = 0;
+    size_t ret = mapFrame(data != 0 ? &frame : 0, time, sequence);
+
+    if (ret > 0 && data != 0) {
+        assert(length >= ret);
+        memcpy(data, frame, ret);
+    }
+
+    return ret;
+}
+
+
+bool ReplaySource::mapsFrames() const
+{
+    return true;
+}
+
+
+size_t ReplaySource::mapFrame(const unsigned char **data, timespec *time, unsigned int *sequence)
+{
+    /* timer expirations since the last frame */
+    unsigned long long due = 1;
+
+    if (m_timing != TimingFastest && read(m_fileDescriptor, &due, sizeof(due)) != sizeof(due)) {
+        return 0;
+    }
+    if (m_playing == false) return 0;
+
+    long long seekRequest = m_seekRequest.exchange(-1);
+    if (seekRequest != -1) {
+        m_position = nextPlayable((unsigned int) seekRequest);
+        due = 1;
+        rebase();
+    }
+
+    unsigned int frameCount = m_container.frameCount();
+
+    if (m_position == frameCount && m_looping == true) {
+        m_position = nextPlayable(0);
+        rebase();
+    }
+
+    if (m_position == frameCount) {
+        /* the end - not readable anymore until a seek */
+        if (m_timing == TimingFastest) {
+            eventfd_t value;
+            eventfd_read(m_fileDescriptor, &value);
+        } else {
+            armTimer();
+        }
+        return 0;
+    }
+
+    /* like a camera: the frames, which became due while the consumer was busy, are gone */
+    unsigned int skipped = 0;
+    if (m_timing == TimingOriginal) {
+        long long currentTime = now();
+        for (unsigned int next = nextPlayable(m_position + 1); next < frameCount && dueTime(next) <= currentTime;
+                next = nextPlayable(next + 1)) {
+            m_position = next;
+            ++skipped;
+        }
+    } else if (m_timing == TimingFixedRate) {
+        for (unsigned int next = nextPlayable(m_position + 1); next < frameCount && skipped + 1 < due;
+                next = nextPlayable(next + 1)) {
+            m_position = next;
+            ++skipped;
+        }
+    }
+
+    m_nextSequence += skipped;
+    *sequence = m_nextSequence++;
+    clock_gettime(CLOCK_MONOTONIC, time);
+
+    size_t ret = m_container.entry(m_position).bytesUsed;
+    if (data != 0) *data = m_container.data(m_position);
+
+    m_position = nextPlayable(m_position + 1);
+    if (m_timing == TimingOriginal) armTimer();
+
+    return ret;
+}
+
+
+bool ReplaySource::timingFromString(const string &string, Timing *timing, double *framesPerSecond)
+{
+    if (string == "original") {
+        *timing = TimingOriginal;
+        *framesPerSecond = 0.0;
+    } else if (string == "fastest") {
+        *timing = TimingFastest;
+        *framesPerSecond = 0.0;
+    } else if (atof(string.c_str()) > 0.0) {
+        *timing = TimingFixedRate;
+        *framesPerSecond = atof(string.c_str());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+unsigned int ReplaySource::nextPlayable(unsigned int frame) const
+{
+    unsigned int frameCount = m_container.frameCount();
+
+    for (; frame < frameCount; ++frame) {
+        const FrameContainer::IndexEntry &entry = m_container.entry(frame);
+        if (entry.pixelFormat == m_pixelFormat && entry.width == m_width && entry.height == m_height &&
+                entry.bytesPerLine == m_bytesPerLine) {
+            break;
+        }
+    }
+
+    return frame;
+}
+
+
+void ReplaySource::rebase()
+{
+    m_baseTime = now();
+    if (m_position < m_container.frameCount()) {
+        const FrameContainer::IndexEntry &entry = m_container.entry(m_position);
+        m_baseFrameTime = entry.seconds * 1000000000LL + entry.nanoseconds;
+    }
+}
+
+
+bool ReplaySource::armTimer()
+{
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(itimerspec));
+
+    if (m_position < m_container.frameCount() || m_looping == true) {
+        if (m_timing == TimingFixedRate) {
+            long long interval = (long long) (1000000000.0 / m_framesPerSecond);
+            if (interval < 1) interval = 1;
+            timer.it_interval.tv_sec = interval / 1000000000;
+            timer.it_interval.tv_nsec = interval % 1000000000;
+            timer.it_value = timer.it_interval;
+        } else {
+            /* absolute. When looping, the first frame comes right after the last */
+            long long time = m_position < m_container.frameCount() ? dueTime(m_position) : now();
+            if (time <= 0) time = 1;
+            timer.it_value.tv_sec = time / 1000000000;
+            timer.it_value.tv_nsec = time % 1000000000;
+        }
+    }
+
+    if (timerfd_settime(m_fileDescriptor, m_timing == TimingOriginal ? TFD_TIMER_ABSTIME : 0, &timer, 0) == -1) {
+        cerr << __PRETTY_FUNCTION__ << " timerfd_settime " << errno << " " << strerror(errno) << endl;
+        return false;
+    }
+
+    /* a seek() while arming must not wait for the time set here */
+    if (m_seekRequest.load() != -1) {
+        memset(&timer, 0, sizeof(itimerspec));
+        timer.it_value.tv_nsec = 1;
+        timerfd_settime(m_fileDescriptor, 0, &timer, 0);
+    }
+
+    return true;
+}
+
+
+long long ReplaySource::dueTime(unsigned int frame) const
+{
+    const FrameContainer::IndexEntry &entry = m_container.entry(frame);
+    return m_baseTime + (entry.seconds * 1000000000LL + entry.nanoseconds - m_baseFrameTime);
+}
+
+
+/* *** local *************************************************************** */
+long long now()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+
+string fourcc(__u32 pixelFormat)
+{
+    string ret;
+    for (unsigned int a = 0; a < 4; ++a) ret.push_back((char) ((pixelFormat >> (8 * a)) & 0xff));
+    return ret;
+}
@@ -0,0 +1,133 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef REPLAY_SOURCE_HPP
+#define REPLAY_SOURCE_HPP
+
+#include "prereqs.hpp"
+
+#include "capturesource.hpp"
+#include "framecontainer.hpp"
+
+#include <atomic>
+#include <string>
+
+
+/**
+ * plays a recorded FrameContainer file back - recorded footage runs through the pipeline like a camera
+ *
+ * The file is mapped, the frames are handed out without copying (mapFrame()). Seeking is O(1).
+ * The frames get the time they are handed out at, like live ones.
+ *
+ * @note frames recorded in another format than the first one (e.g. after the region of interest changed)
+ *    are left out
+ */
+class ReplaySource : public CaptureSource
+{
+public:
+
+    enum Timing
+    {
+        /** the intervals of the recording. Like a camera, frames the consumer is too late for are skipped */
+        TimingOriginal,
+        /** every frame, as soon as the consumer takes it */
+        TimingFastest,
+        /** framesPerSecond(). Skips like TimingOriginal */
+        TimingFixedRate
+    };
+
+
+    ReplaySource(const std::string &fileName);
+    virtual ~ReplaySource();
+
+    const std::string &fileName() const;
+
+    /** Default: TimingOriginal
+        @param framesPerSecond for TimingFixedRate
+        @pre not open */
+    void setTiming(Timing timing, double framesPerSecond = 0.0);
+    Timing timing() const;
+    double framesPerSecond() const;
+
+    /** start over at the end. Default: false */
+    void setLooping(bool looping);
+    bool isLooping() const;
+
+    /** @pre open */
+    unsigned int frameCount() const;
+    /** the next frame is the given one. O(1), can be called any time, from any thread
+        @pre open, frame < frameCount() */
+    void seek(unsigned int frame);
+
+    virtual std::string name() const;
+    /** the format is the recording's, the parameters are only changed */
+    virtual size_t open(unsigned int *width, unsigned int *height, __u32 *pixelFormat, unsigned int *bytesPerLine);
+    virtual void close();
+    virtual int fileDescriptor() const;
+    /** plays from the beginning or the frame seeked to */
+    virtual bool start();
+    virtual void stop();
+    /** copies the frame - prefer mapFrame() */
+    virtual size_t readFrame(unsigned char *data, size_t length, timespec *time, unsigned int *sequence);
+    virtual bool mapsFrames() const;
+    virtual size_t mapFrame(const unsigned char **data, timespec *time, unsigned int *sequence);
+
+    /** "original", "fastest" or a number of frames per second
+        @returns false for anything else */
+    static bool timingFromString(const std::string &string, Timing *timing, double *framesPerSecond);
+
+private:
+
+    /** @returns the first frame from 'frame' on in the format played, frameCount() if there is none */
+    unsigned int nextPlayable(unsigned int frame) const;
+    /** frames from m_position on are due relative to now */
+    void rebase();
+    /** makes fileDescriptor() readable when m_position is due, or never at the end
+        @returns false, if the timer could not be set */
+    bool armTimer();
+    /** when the frame is due with TimingOriginal, nanoseconds of CLOCK_MONOTONIC */
+    long long dueTime(unsigned int frame) const;
+
+    std::string m_fileName;
+    Timing m_timing;
+    double m_framesPerSecond;
+    bool m_looping;
+
+    FrameContainer m_container;
+    __u32 m_pixelFormat;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_bytesPerLine;
+
+    /** timerfd, or an eventfd which stays readable for TimingFastest */
+    int m_fileDescriptor;
+    /** capturing thread only, from here on */
+    bool m_playing;
+    /** next frame to hand out */
+    unsigned int m_position;
+    unsigned int m_nextSequence;
+    /** for dueTime() */
+    long long m_baseTime;
+    long long m_baseFrameTime;
+
+    /** frame set by seek(), -1 if none */
+    std::atomic<long long> m_seekRequest;
+};
+
+
+#endif /* REPLAY_SOURCE_HPP */
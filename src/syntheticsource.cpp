@@ -0,0 +1,446 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "syntheticsource.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/** edge length of the checkerboard's squares and the sequence number's blocks */
+static const unsigned int s_squareSize = 32;
+static const unsigned int s_stampBlockSize = 4;
+
+
+static void patternColour(SyntheticSource::Pattern pattern, unsigned int rowType, unsigned int x, unsigned int period,
+        unsigned char *rgb);
+static void rgbToYuv(const unsigned char *rgb, unsigned char *y, unsigned char *u, unsigned char *v);
+static void writeGrey(unsigned char *pixels, __u32 pixelFormat, unsigned int pixelCount, bool white);
+static string fourcc(__u32 pixelFormat);
+
+
+SyntheticSource::SyntheticSource() :
+        m_framesPerSecond(30.0),
+        m_pattern(PatternBars),
+        m_speed(4),
+        m_width(0),
+        m_height(0),
+        m_pixelFormat(0),
+        m_bytesPerLine(0),
+        m_frameSize(0),
+        m_fileDescriptor(-1),
+        m_nextSequence(0),
+        m_period(0),
+        m_bytesPerPixel(0)
+{
+}
+
+
+SyntheticSource::~SyntheticSource()
+{
+    close();
+}
+
+
+void SyntheticSource::setFramesPerSecond(double framesPerSecond)
+{
+    assert(m_fileDescriptor == -1);
+    assert(framesPerSecond >= 0.0);
+    m_framesPerSecond = framesPerSecond;
+}
+
+
+double SyntheticSource::framesPerSecond() const
+{
+    return m_framesPerSecond;
+}
+
+
+void SyntheticSource::setPattern(Pattern pattern)
+{
+    assert(m_fileDescriptor == -1);
+    m_pattern = pattern;
+}
+
+
+SyntheticSource::Pattern SyntheticSource::pattern() const
+{
+    return m_pattern;
+}
+
+
+void SyntheticSource::setSpeed(unsigned int pixelsPerFrame)
+{
+    m_speed = pixelsPerFrame & ~1u;
+}
+
+
+unsigned int SyntheticSource::speed() const
+{
+    return m_speed;
+}
+
+
+string SyntheticSource::name() const
+{
+    ostringstream ret;
+    ret << "synthetic " << patternString(m_pattern) << " " << m_width << "x" << m_height << " " << fourcc(m_pixelFormat)
+            << " @ ";
+    if (m_framesPerSecond > 0.0) ret << m_framesPerSecond << " fps";
+    else ret << "max fps";
+    return ret.str();
+}
+
+
+size_t SyntheticSource::open(unsigned int *width, unsigned int *height, __u32 *pixelFormat, unsigned int *bytesPerLine)
+{
+    assert(m_fileDescriptor == -1);
+
+    switch (*pixelFormat) {
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_NV12:
+        break;
+    default:
+        /* also 0 - the "native" format of most usb cameras */
+        *pixelFormat = V4L2_PIX_FMT_YUYV;
+        break;
+    }
+
+    /* pixel pairs share their chroma */
+    if (*pixelFormat != V4L2_PIX_FMT_RGB24 && *pixelFormat != V4L2_PIX_FMT_GREY) *width = (*width + 1) & ~1u;
+    if (*pixelFormat == V4L2_PIX_FMT_NV12) *height = (*height + 1) & ~1u;
+    if (*width == 0 || *height == 0) return 0;
+
+    m_bytesPerPixel = *pixelFormat == V4L2_PIX_FMT_RGB24 ? 3 :
+            (*pixelFormat == V4L2_PIX_FMT_YUYV || *pixelFormat == V4L2_PIX_FMT_UYVY ? 2 : 1);
+    if (*bytesPerLine < *width * m_bytesPerPixel) *bytesPerLine = *width * m_bytesPerPixel;
+
+    m_width = *width;
+    m_height = *height;
+    m_pixelFormat = *pixelFormat;
+    m_bytesPerLine = *bytesPerLine;
+    m_frameSize = m_bytesPerLine * m_height;
+    if (m_pixelFormat == V4L2_PIX_FMT_NV12) m_frameSize += m_bytesPerLine * (m_height / 2);
+
+    if (m_framesPerSecond > 0.0) {
+        m_fileDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    } else {
+        /* stays readable - it is never read */
+        m_fileDescriptor = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    if (m_fileDescriptor == -1) {
+        cerr << __PRETTY_FUNCTION__ << " Cannot create descriptor. " << errno << " " << strerror(errno) << endl;
+        return 0;
+    }
+
+    renderRows();
+
+    return m_frameSize;
+}
+
+
+void SyntheticSource::close()
+{
+    if (m_fileDescriptor == -1) return;
+
+    ::close(m_fileDescriptor);
+    m_fileDescriptor = -1;
+
+    m_rows.clear();
+    m_chromaRows.clear();
+}
+
+
+int SyntheticSource::fileDescriptor() const
+{
+    return m_fileDescriptor;
+}
+
+
+bool SyntheticSource::start()
+{
+    assert(m_fileDescriptor != -1);
+
+    m_nextSequence = 0;
+
+    if (m_framesPerSecond > 0.0) {
+        long long interval = (long long) (1000000000.0 / m_framesPerSecond);
+        if (interval < 1) interval = 1;
+
+        struct itimerspec timer;
+        timer.it_interval.tv_sec = interval / 1000000000;
+        timer.it_interval.tv_nsec = interval % 1000000000;
+        timer.it_value = timer.it_interval;
+
+        if (timerfd_settime(m_fileDescriptor, 0, &timer, 0) == -1) {
+            cerr << __PRETTY_FUNCTION__ << " timerfd_settime " << errno << " " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void SyntheticSource::stop()
+{
+    if (m_framesPerSecond > 0.0 && m_fileDescriptor != -1) {
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(itimerspec));
+        timerfd_settime(m_fileDescriptor, 0, &timer, 0);
+    }
+}
+
+
+size_t SyntheticSource::readFrame(unsigned char *data, size_t length, timespec *time, unsigned int *sequence)
+{
+    /* timer expirations since the last read - all but the newest frame were missed */
+    unsigned long long due = 1;
+
+    if (m_framesPerSecond > 0.0 && read(m_fileDescriptor, &due, sizeof(due)) != sizeof(due)) {
+        return 0;
+    }
+
+    m_nextSequence += (unsigned int) due;
+    *sequence = m_nextSequence - 1;
+    clock_gettime(CLOCK_MONOTONIC, time);
+
+    if (data != 0) {
+        assert(length >= m_frameSize);
+        render(data, *sequence);
+    }
+
+    return m_frameSize;
+}
+
+
+bool SyntheticSource::patternFromString(const string &string, Pattern *pattern)
+{
+    if (string == "bars") {
+        *pattern = PatternBars;
+    } else if (string == "gradient") {
+        *pattern = PatternGradient;
+    } else if (string == "checkerboard") {
+        *pattern = PatternCheckerboard;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+const char *SyntheticSource::patternString(Pattern pattern)
+{
+    switch (pattern) {
+    case PatternGradient: return "gradient";
+    case PatternCheckerboard: return "checkerboard";
+    default: return "bars";
+    }
+}
+
+
+void SyntheticSource::renderRows()
+{
+    m_period = m_pattern == PatternCheckerboard ? 2 * s_squareSize : m_width;
+    unsigned int rowTypeCount = m_pattern == PatternCheckerboard ? 2 : 1;
+    unsigned int pixelCount = m_width + m_period;
+
+    m_rows.assign(rowTypeCount, vector<unsigned char>(pixelCount * m_bytesPerPixel));
+    if (m_pixelFormat == V4L2_PIX_FMT_NV12) m_chromaRows.assign(rowTypeCount, vector<unsigned char>(pixelCount));
+
+    for (unsigned int t = 0; t < rowTypeCount; ++t) {
+        unsigned char *row = &m_rows[t][0];
+
+        /* in pairs, they share chroma */
+        for (unsigned int x = 0; x + 1 < pixelCount; x += 2) {
+            unsigned char rgb[6], y[2], u[2], v[2];
+            patternColour(m_pattern, t, x % m_period, m_period, rgb);
+            patternColour(m_pattern, t, (x + 1) % m_period, m_period, rgb + 3);
+            rgbToYuv(rgb, &y[0], &u[0], &v[0]);
+            rgbToYuv(rgb + 3, &y[1], &u[1], &v[1]);
+            unsigned char uMean = (unsigned char) ((u[0] + u[1] + 1) / 2);
+            unsigned char vMean = (unsigned char) ((v[0] + v[1] + 1) / 2);
+
+            switch (m_pixelFormat) {
+            case V4L2_PIX_FMT_RGB24:
+                memcpy(row + x * 3, rgb, 6);
+                break;
+            case V4L2_PIX_FMT_YUYV:
+                row[x * 2 + 0] = y[0];
+                row[x * 2 + 1] = uMean;
+                row[x * 2 + 2] = y[1];
+                row[x * 2 + 3] = vMean;
+                break;
+            case V4L2_PIX_FMT_UYVY:
+                row[x * 2 + 0] = uMean;
+                row[x * 2 + 1] = y[0];
+                row[x * 2 + 2] = vMean;
+                row[x * 2 + 3] = y[1];
+                break;
+            case V4L2_PIX_FMT_NV12:
+                m_chromaRows[t][x + 0] = uMean;
+                m_chromaRows[t][x + 1] = vMean;
+                /* fall through */
+            default:
+                row[x + 0] = y[0];
+                row[x + 1] = y[1];
+                break;
+            }
+        }
+    }
+}
+
+
+void SyntheticSource::rowOf(unsigned int y, unsigned int shift, unsigned int *rowType, unsigned int *offset) const
+{
+    switch (m_pattern) {
+    case PatternGradient:
+        *rowType = 0;
+        *offset = ((shift + y) % m_period) & ~1u;
+        break;
+    case PatternCheckerboard:
+        *rowType = ((y + shift / 2) / s_squareSize) % 2;
+        *offset = (shift % m_period) & ~1u;
+        break;
+    default:
+        *rowType = 0;
+        *offset = (shift % m_period) & ~1u;
+        break;
+    }
+}
+
+
+void SyntheticSource::render(unsigned char *data, unsigned int sequence) const
+{
+    unsigned int shift = sequence * m_speed;
+    unsigned int rowLength = m_width * m_bytesPerPixel;
+
+    for (unsigned int y = 0; y < m_height; ++y) {
+        unsigned int rowType, offset;
+        rowOf(y, shift, &rowType, &offset);
+        memcpy(data + y * m_bytesPerLine, &m_rows[rowType][offset * m_bytesPerPixel], rowLength);
+    }
+
+    if (m_pixelFormat == V4L2_PIX_FMT_NV12) {
+        unsigned char *chroma = data + m_bytesPerLine * m_height;
+        for (unsigned int y = 0; y < m_height / 2; ++y) {
+            unsigned int rowType, offset;
+            rowOf(y * 2, shift, &rowType, &offset);
+            memcpy(chroma + y * m_bytesPerLine, &m_chromaRows[rowType][offset], m_width);
+        }
+    }
+
+    /* the sequence number */
+    if (m_width >= 32 * s_stampBlockSize && m_height >= s_stampBlockSize) {
+        for (unsigned int y = 0; y < s_stampBlockSize; ++y) {
+            for (unsigned int bit = 0; bit < 32; ++bit) {
+                writeGrey(data + y * m_bytesPerLine + bit * s_stampBlockSize * m_bytesPerPixel, m_pixelFormat,
+                        s_stampBlockSize, ((sequence >> (31 - bit)) & 1) != 0);
+            }
+        }
+    }
+}
+
+
+/* *** local *************************************************************** */
+void patternColour(SyntheticSource::Pattern pattern, unsigned int rowType, unsigned int x, unsigned int period,
+        unsigned char *rgb)
+{
+    /* white, yellow, cyan, green, magenta, red, blue, black */
+    static const unsigned char bars[8][3] = {
+            { 235, 235, 235 }, { 235, 235, 16 }, { 16, 235, 235 }, { 16, 235, 16 },
+            { 235, 16, 235 }, { 235, 16, 16 }, { 16, 16, 235 }, { 16, 16, 16 } };
+
+    switch (pattern) {
+    case SyntheticSource::PatternGradient:
+        rgb[0] = (unsigned char) (x * 256 / period);
+        rgb[1] = (unsigned char) ((x * 512 / period) & 0xff);
+        rgb[2] = (unsigned char) (255 - rgb[0]);
+        break;
+    case SyntheticSource::PatternCheckerboard: {
+        bool light = ((x / s_squareSize) + rowType) % 2 == 0;
+        rgb[0] = light ? 220 : 20;
+        rgb[1] = light ? 220 : 40;
+        rgb[2] = light ? 220 : 120;
+        break; }
+    default:
+        memcpy(rgb, bars[x * 8 / period], 3);
+        break;
+    }
+}
+
+
+/** BT.601, limited range - what PixelConversion expects */
+void rgbToYuv(const unsigned char *rgb, unsigned char *y, unsigned char *u, unsigned char *v)
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+    *y = (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    *u = (unsigned char) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    *v = (unsigned char) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+
+/** @param pixelCount even for YUYV and UYVY */
+void writeGrey(unsigned char *pixels, __u32 pixelFormat, unsigned int pixelCount, bool white)
+{
+    unsigned char luma = white ? 235 : 16;
+
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_RGB24:
+        memset(pixels, white ? 255 : 0, pixelCount * 3);
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        for (unsigned int a = 0; a < pixelCount; ++a) {
+            pixels[a * 2 + 0] = luma;
+            pixels[a * 2 + 1] = 128;
+        }
+        break;
+    case V4L2_PIX_FMT_UYVY:
+        for (unsigned int a = 0; a < pixelCount; ++a) {
+            pixels[a * 2 + 0] = 128;
+            pixels[a * 2 + 1] = luma;
+        }
+        break;
+    default:
+        /* GREY, NV12 luma */
+        memset(pixels, luma, pixelCount);
+        break;
+    }
+}
+
+
+string fourcc(__u32 pixelFormat)
+{
+    string ret;
+    for (unsigned int a = 0; a < 4; ++a) ret.push_back((char) ((pixelFormat >> (8 * a)) & 0xff));
+    return ret;
+}
@@ -0,0 +1,114 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include "prereqs.hpp"
+
+#include "capturesource.hpp"
+
+#include <string>
+#include <vector>
+
+
+/**
+ * generates moving test patterns at a fixed rate - a camera for machines without one
+ *
+ * Formats: V4L2_PIX_FMT_RGB24, YUYV, UYVY, GREY and NV12. The rows of the pattern are rendered once by open(),
+ * a frame is one memcpy per row, which easily makes thousands of frames per second.
+ * The top left corner holds the frame's sequence number: 32 blocks of 4x4 pixels, white for 1, most
+ * significant bit first.
+ */
+class SyntheticSource : public CaptureSource
+{
+public:
+
+    enum Pattern
+    {
+        /** vertical colour bars moving to the left */
+        PatternBars,
+        /** diagonal colour gradient */
+        PatternGradient,
+        /** checkerboard moving diagonally */
+        PatternCheckerboard
+    };
+
+
+    SyntheticSource();
+    virtual ~SyntheticSource();
+
+    /** Default: 30. 0 delivers a frame whenever the consumer is ready
+        @pre not open */
+    void setFramesPerSecond(double framesPerSecond);
+    double framesPerSecond() const;
+
+    /** Default: PatternBars
+        @pre not open */
+    void setPattern(Pattern pattern);
+    Pattern pattern() const;
+
+    /** horizontal movement per frame in pixels, rounded down to even. Default: 4 */
+    void setSpeed(unsigned int pixelsPerFrame);
+    unsigned int speed() const;
+
+    virtual std::string name() const;
+    virtual size_t open(unsigned int *width, unsigned int *height, __u32 *pixelFormat, unsigned int *bytesPerLine);
+    virtual void close();
+    virtual int fileDescriptor() const;
+    virtual bool start();
+    virtual void stop();
+    virtual size_t readFrame(unsigned char *data, size_t length, timespec *time, unsigned int *sequence);
+
+    /** "bars", "gradient" or "checkerboard"
+        @returns false for anything else */
+    static bool patternFromString(const std::string &string, Pattern *pattern);
+    static const char *patternString(Pattern pattern);
+
+private:
+
+    void renderRows();
+    /** @returns the row of m_rows to copy row y of the frame from, and the pixel to start at */
+    void rowOf(unsigned int y, unsigned int shift, unsigned int *rowType, unsigned int *offset) const;
+    void render(unsigned char *data, unsigned int sequence) const;
+
+    double m_framesPerSecond;
+    Pattern m_pattern;
+    unsigned int m_speed;
+
+    unsigned int m_width;
+    unsigned int m_height;
+    __u32 m_pixelFormat;
+    unsigned int m_bytesPerLine;
+    size_t m_frameSize;
+
+    /** timerfd, or an eventfd which stays readable, if unthrottled */
+    int m_fileDescriptor;
+    unsigned int m_nextSequence;
+
+    /** the pattern repeats every m_period pixels horizontally */
+    unsigned int m_period;
+    unsigned int m_bytesPerPixel;
+    /** m_width + m_period pixels each, in m_pixelFormat (its luma plane for NV12) */
+    std::vector<std::vector<unsigned char> > m_rows;
+    /** interleaved U and V for every two pixels of m_rows. NV12 only */
+    std::vector<std::vector<unsigned char> > m_chromaRows;
+};
+
+
+#endif /* SYNTHETIC_SOURCE_HPP */
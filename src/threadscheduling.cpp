@@ -0,0 +1,270 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "threadscheduling.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <sched.h>
+
+using namespace std;
+
+
+static int systemPolicy(ThreadScheduling::Policy policy);
+
+
+ThreadScheduling::ThreadScheduling() :
+        m_policy(PolicyOther),
+        m_priority(0)
+{
+}
+
+
+void ThreadScheduling::setPolicy(Policy policy, int priority)
+{
+    m_policy = policy;
+    m_priority = policy == PolicyOther || policy == PolicyIdle ? 0 : priority;
+}
+
+
+ThreadScheduling::Policy ThreadScheduling::policy() const
+{
+    return m_policy;
+}
+
+
+int ThreadScheduling::priority() const
+{
+    return m_priority;
+}
+
+
+void ThreadScheduling::setCpus(const set<unsigned int> &cpus)
+{
+    m_cpus = cpus;
+}
+
+
+const set<unsigned int> &ThreadScheduling::cpus() const
+{
+    return m_cpus;
+}
+
+
+bool ThreadScheduling::isDefault() const
+{
+    return m_policy == PolicyOther && m_cpus.empty() == true;
+}
+
+
+ThreadScheduling ThreadScheduling::apply(pthread_t thread) const
+{
+    if (m_cpus.empty() == false) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (auto it = m_cpus.begin(); it != m_cpus.end(); ++it) {
+            if (*it < CPU_SETSIZE && CPU_ISSET(*it, &allowed)) {
+                CPU_SET(*it, &cpus);
+            } else {
+                cerr << __PRETTY_FUNCTION__ << " cpu " << *it << " is not available - left out" << endl;
+            }
+        }
+
+        if (CPU_COUNT(&cpus) == 0) {
+            cerr << __PRETTY_FUNCTION__ << " none of the cpus is available - affinity unchanged" << endl;
+        } else {
+            int error = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus);
+            if (error != 0) {
+                cerr << __PRETTY_FUNCTION__ << " pthread_setaffinity_np " << error << " " << strerror(error) << endl;
+            }
+        }
+    }
+
+    if (m_policy != PolicyOther) {
+        int policy = systemPolicy(m_policy);
+
+        struct sched_param parameters;
+        memset(&parameters, 0, sizeof(sched_param));
+        parameters.sched_priority = m_priority;
+        if (parameters.sched_priority < sched_get_priority_min(policy)) {
+            parameters.sched_priority = sched_get_priority_min(policy);
+        }
+        if (parameters.sched_priority > sched_get_priority_max(policy)) {
+            parameters.sched_priority = sched_get_priority_max(policy);
+        }
+
+        int error = pthread_setschedparam(thread, policy, &parameters);
+        if (error == EPERM) {
+            cerr << "No permission for real time scheduling (" << toString()
+                    << "), needs CAP_SYS_NICE or RLIMIT_RTPRIO. Staying with SCHED_OTHER." << endl;
+        } else if (error != 0) {
+            cerr << __PRETTY_FUNCTION__ << " pthread_setschedparam " << error << " " << strerror(error) << endl;
+        }
+    }
+
+    return ofThread(thread);
+}
+
+
+string ThreadScheduling::toString() const
+{
+    ostringstream ret;
+
+    switch (m_policy) {
+    case PolicyFifo:
+        ret << "fifo:" << m_priority;
+        break;
+    case PolicyRoundRobin:
+        ret << "rr:" << m_priority;
+        break;
+    case PolicyIdle:
+        ret << "idle";
+        break;
+    default:
+        ret << "other";
+        break;
+    }
+
+    if (m_cpus.empty() == true) {
+        ret << " on any cpu";
+        return ret.str();
+    }
+
+    ret << " on cpus ";
+
+    /* ranges of consecutive cpus */
+    for (auto it = m_cpus.begin(); it != m_cpus.end(); ) {
+        unsigned int first = *it;
+        unsigned int last = first;
+        for (++it; it != m_cpus.end() && *it == last + 1; ++it) last = *it;
+
+        if (first != *m_cpus.begin()) ret << ",";
+        ret << first;
+        if (last != first) ret << "-" << last;
+    }
+
+    return ret.str();
+}
+
+
+ThreadScheduling ThreadScheduling::ofThread(pthread_t thread)
+{
+    ThreadScheduling ret;
+
+    int policy;
+    struct sched_param parameters;
+    if (pthread_getschedparam(thread, &policy, &parameters) == 0) {
+        if (policy == SCHED_FIFO) {
+            ret.setPolicy(PolicyFifo, parameters.sched_priority);
+        } else if (policy == SCHED_RR) {
+            ret.setPolicy(PolicyRoundRobin, parameters.sched_priority);
+        } else if (policy == SCHED_IDLE) {
+            ret.setPolicy(PolicyIdle);
+        }
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpus) == 0) {
+        set<unsigned int> cpuSet;
+        for (unsigned int a = 0; a < CPU_SETSIZE; ++a) {
+            if (CPU_ISSET(a, &cpus)) cpuSet.insert(a);
+        }
+        ret.setCpus(cpuSet);
+    }
+
+    return ret;
+}
+
+
+bool ThreadScheduling::parsePolicy(const string &string, Policy *policy, int *priority)
+{
+    if (string == "other") {
+        *policy = PolicyOther;
+        *priority = 0;
+        return true;
+    }
+
+    std::string::size_type colon = string.find(':');
+    if (colon == std::string::npos || colon + 1 == string.size()) return false;
+
+    std::string name = string.substr(0, colon);
+    if (name == "fifo") {
+        *policy = PolicyFifo;
+    } else if (name == "rr") {
+        *policy = PolicyRoundRobin;
+    } else {
+        return false;
+    }
+
+    char *end;
+    *priority = (int) strtol(string.c_str() + colon + 1, &end, 10);
+    return *end == '\0';
+}
+
+
+bool ThreadScheduling::parseCpus(const string &string, set<unsigned int> *cpus)
+{
+    istringstream stream(string);
+    std::string item;
+
+    while (getline(stream, item, ',')) {
+        /* strtoul would take "-1" and leading blanks */
+        if (isdigit((unsigned char) item.c_str()[0]) == 0) return false;
+
+        char *end;
+        unsigned long first = strtoul(item.c_str(), &end, 10);
+        unsigned long last = first;
+
+        if (*end == '-') {
+            const char *lastString = end + 1;
+            if (isdigit((unsigned char) lastString[0]) == 0) return false;
+            last = strtoul(lastString, &end, 10);
+        }
+        if (*end != '\0' || last < first || last >= CPU_SETSIZE) return false;
+
+        for (unsigned long a = first; a <= last; ++a) cpus->insert((unsigned int) a);
+    }
+
+    return cpus->empty() == false;
+}
+
+
+/* *** local *************************************************************** */
+int systemPolicy(ThreadScheduling::Policy policy)
+{
+    switch (policy) {
+    case ThreadScheduling::PolicyFifo:
+        return SCHED_FIFO;
+    case ThreadScheduling::PolicyRoundRobin:
+        return SCHED_RR;
+    case ThreadScheduling::PolicyIdle:
+        return SCHED_IDLE;
+    default:
+        return SCHED_OTHER;
+    }
+}
@@ -0,0 +1,92 @@
+/* videocapture is a tool with no special purpose
+ *
+ * Copyright (C) 2009 Ronny Brendel <ronnybrendel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef THREAD_SCHEDULING_HPP
+#define THREAD_SCHEDULING_HPP
+
+#include "prereqs.hpp"
+
+#include <set>
+#include <string>
+
+#include <pthread.h>
+
+
+/**
+ * scheduling policy, priority and cpu affinity of a thread
+ *
+ * Real time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO (e.g. "@video - rtprio 50" in
+ * /etc/security/limits.conf). Without, apply() leaves the thread with SCHED_OTHER.
+ */
+class ThreadScheduling
+{
+public:
+
+    enum Policy
+    {
+        /** SCHED_OTHER, the default */
+        PolicyOther,
+        PolicyFifo,
+        PolicyRoundRobin,
+        /** SCHED_IDLE, runs only on otherwise idle cpus. Needs no permission */
+        PolicyIdle
+    };
+
+
+    /** PolicyOther on any cpu - changes nothing */
+    ThreadScheduling();
+
+    /** @param priority 1 (lowest) to 99 for the real time policies, ignored for PolicyOther and PolicyIdle */
+    void setPolicy(Policy policy, int priority = 0);
+    Policy policy() const;
+    int priority() const;
+
+    /** empty means any */
+    void setCpus(const std::set<unsigned int> &cpus);
+    const std::set<unsigned int> &cpus() const;
+
+    /** @returns true if it changes nothing */
+    bool isDefault() const;
+
+    /** cpus outside the process' affinity are left out, a real time policy is dropped without permission.
+        Either is reported on stderr
+        @returns the thread's settings afterwards */
+    ThreadScheduling apply(pthread_t thread) const;
+
+    /** e.g. "fifo:50 on cpus 2,4-5" */
+    std::string toString() const;
+
+    /** the settings a thread runs with */
+    static ThreadScheduling ofThread(pthread_t thread);
+
+    /** "other", "fifo:<priority>" or "rr:<priority>"
+        @returns false, if the string is none of them */
+    static bool parsePolicy(const std::string &string, Policy *policy, int *priority);
+    /** comma separated cpus and ranges, e.g. "0,2-3"
+        @returns false on syntax errors and cpus beyond CPU_SETSIZE */
+    static bool parseCpus(const std::string &string, std::set<unsigned int> *cpus);
+
+private:
+
+    Policy m_policy;
+    int m_priority;
+    std::set<unsigned int> m_cpus;
+};
+
+
+#endif /* THREAD_SCHEDULING_HPP */
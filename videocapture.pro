@@ -38,7 +38,7 @@ DEFINES +=
 INCLUDEPATH += ./src
 
 DEPENDPATH +=
-LIBS += -lrt
+LIBS += -lrt -ljpeg
 
 
 MOC_DIR = tmp/
@@ -48,22 +48,65 @@ OBJECTS_DIR = tmp/
 
 
 HEADERS += ./src/basefilter.hpp \
+           ./src/capabilitycache.hpp \
            ./src/capturedevice.hpp \
            ./src/capturedevicesTab.hpp \
+           ./src/capturereactor.hpp \
+           ./src/capturesource.hpp \
+           ./src/deltacodec.hpp \
            ./src/filtereditorTab.hpp \
+           ./src/framearena.hpp \
+           ./src/framecontainer.hpp \
+           ./src/framecontainerwriter.hpp \
+           ./src/framehistory.hpp \
+           ./src/framenotifier.hpp \
+           ./src/framerecorder.hpp \
+           ./src/frameref.hpp \
+           ./src/framering.hpp \
+           ./src/framesynchronizer.hpp \
+           ./src/frametiming.hpp \
            ./src/mainwindow.hpp \
+           ./src/mjpegdecoder.hpp \
+           ./src/pausegate.hpp \
+           ./src/pixelconversion.hpp \
+           ./src/previewstream.hpp \
+           ./src/replaysource.hpp \
+           ./src/syntheticsource.hpp \
+           ./src/threadscheduling.hpp \
            ./src/viewstab.hpp
 
 SOURCES += ./src/basefilter.cpp \
+           ./src/capabilitycache.cpp \
            ./src/capturedevice.cpp \
            ./src/capturedevicesTab.cpp \
+           ./src/capturereactor.cpp \
+           ./src/capturesource.cpp \
+           ./src/deltacodec.cpp \
            ./src/filtereditortab.cpp \
+           ./src/framearena.cpp \
+           ./src/framecontainer.cpp \
+           ./src/framecontainerwriter.cpp \
+           ./src/framehistory.cpp \
+           ./src/framenotifier.cpp \
+           ./src/framerecorder.cpp \
+           ./src/frameref.cpp \
+           ./src/framering.cpp \
+           ./src/framesynchronizer.cpp \
+           ./src/frametiming.cpp \
            ./src/main.cpp \
            ./src/mainwindow.cpp \
+           ./src/mjpegdecoder.cpp \
+           ./src/pausegate.cpp \
+           ./src/pixelconversion.cpp \
+           ./src/previewstream.cpp \
+           ./src/replaysource.cpp \
+           ./src/syntheticsource.cpp \
+           ./src/threadscheduling.cpp \
            ./src/viewstab.cpp
 
 
 include(filters.pri)
+include(benchmarks.pri)
 
 #include(enable-vampirtrace.pri)
 